@@ -0,0 +1,143 @@
+// ChildMessage.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/ChildMessage.h"
+
+#include <framework/system/LogicError.h>
+using namespace framework::system;
+
+using namespace boost::system;
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // parent and children are the same build on the same host, so
+        // integers are in host byte order
+
+        struct ChildMessageHeader
+        {
+            boost::uint32_t size;
+            boost::uint16_t type;
+            boost::uint16_t reserved;
+            boost::uint32_t id;
+        };
+
+        ChildMessage::ChildMessage(
+            boost::uint16_t type,
+            boost::uint32_t id)
+            : type(type)
+            , id(id)
+            , pos_(0)
+            , failed_(false)
+        {
+        }
+
+        void ChildMessage::encode(
+            boost::asio::streambuf & buf) const
+        {
+            assert(body.size() <= max_size);
+            ChildMessageHeader header;
+            header.size = (boost::uint32_t)body.size();
+            header.type = type;
+            header.reserved = 0;
+            header.id = id;
+            char * p = boost::asio::buffer_cast<char *>(buf.prepare(header_size + body.size()));
+            memcpy(p, &header, header_size);
+            if (!body.empty())
+                memcpy(p + header_size, body.data(), body.size());
+            buf.commit(header_size + body.size());
+        }
+
+        bool ChildMessage::decode(
+            boost::asio::streambuf & buf,
+            error_code & ec)
+        {
+            if (buf.size() < header_size)
+                return false;
+            char const * p = boost::asio::buffer_cast<char const *>(buf.data());
+            ChildMessageHeader header;
+            memcpy(&header, p, header_size);
+            if (header.size > max_size) {
+                ec = logic_error::failed_some;
+                return false;
+            }
+            if (buf.size() < header_size + header.size)
+                return false;
+            type = header.type;
+            id = header.id;
+            body.assign(p + header_size, header.size);
+            pos_ = 0;
+            failed_ = false;
+            buf.consume(header_size + header.size);
+            return true;
+        }
+
+        ChildMessage & ChildMessage::operator<<(
+            boost::uint32_t v)
+        {
+            body.append((char const *)&v, sizeof(v));
+            return *this;
+        }
+
+        ChildMessage & ChildMessage::operator<<(
+            std::string const & s)
+        {
+            *this << (boost::uint32_t)s.size();
+            body.append(s);
+            return *this;
+        }
+
+        // only system errors keep their value across processes, others
+        // arrive as logic_error::failed_some
+        ChildMessage & ChildMessage::operator<<(
+            error_code const & ec)
+        {
+            boost::uint32_t kind = !ec ? 0 : (ec.category() == system_category() ? 1 : 2);
+            return *this << kind << (boost::uint32_t)ec.value();
+        }
+
+        ChildMessage & ChildMessage::operator>>(
+            boost::uint32_t & v)
+        {
+            if (failed_ || body.size() - pos_ < sizeof(v)) {
+                failed_ = true;
+                return *this;
+            }
+            memcpy(&v, body.data() + pos_, sizeof(v));
+            pos_ += sizeof(v);
+            return *this;
+        }
+
+        ChildMessage & ChildMessage::operator>>(
+            std::string & s)
+        {
+            boost::uint32_t size = 0;
+            *this >> size;
+            if (failed_ || body.size() - pos_ < size) {
+                failed_ = true;
+                return *this;
+            }
+            s.assign(body, pos_, size);
+            pos_ += size;
+            return *this;
+        }
+
+        ChildMessage & ChildMessage::operator>>(
+            error_code & ec)
+        {
+            boost::uint32_t kind = 0;
+            boost::uint32_t value = 0;
+            *this >> kind >> value;
+            if (failed_ || kind == 0)
+                ec.clear();
+            else if (kind == 1)
+                ec.assign((int)value, system_category());
+            else
+                ec = logic_error::failed_some;
+            return *this;
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -0,0 +1,84 @@
+// ChildMessage.h
+
+#ifndef _JUST_LIVE_WORKER_CHILD_MESSAGE_H_
+#define _JUST_LIVE_WORKER_CHILD_MESSAGE_H_
+
+#include <boost/asio/streambuf.hpp>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Framed binary message between LiveModuleProxy and its children.
+        // A frame is a fixed header (size, type, id) followed by size bytes
+        // of fields, so frames can be taken out of a byte stream however it
+        // is split by reads, and many can be in flight on one connection.
+        // Fields are written with << and read back with >> in same order.
+        struct ChildMessage
+        {
+            enum TypeEnum
+            {
+                ready = 1,  // child -> parent: ec, LiveModule started or failed
+                start,      // parent -> child: tcp_port, udp_port, url, status slot
+                started,    // child -> parent: ec, url
+                stop,       // parent -> child: stop the channel
+                heartbeat,  // parent -> child, echoed back: send time
+                exit,       // parent -> child: stop all channels and exit
+            };
+
+            static size_t const header_size = 12;
+
+            static size_t const max_size = 64 * 1024;
+
+            ChildMessage(
+                boost::uint16_t type = 0,
+                boost::uint32_t id = 0);
+
+            // append the frame to buf
+            void encode(
+                boost::asio::streambuf & buf) const;
+
+            // take a frame from the front of buf, false if not complete yet;
+            // ec is set if the frame is malformed
+            bool decode(
+                boost::asio::streambuf & buf,
+                boost::system::error_code & ec);
+
+            ChildMessage & operator<<(
+                boost::uint32_t v);
+
+            ChildMessage & operator<<(
+                std::string const & s);
+
+            ChildMessage & operator<<(
+                boost::system::error_code const & ec);
+
+            ChildMessage & operator>>(
+                boost::uint32_t & v);
+
+            ChildMessage & operator>>(
+                std::string & s);
+
+            ChildMessage & operator>>(
+                boost::system::error_code & ec);
+
+            // false once a field read past end of frame
+            operator bool() const
+            {
+                return !failed_;
+            }
+
+            boost::uint16_t type;
+            boost::uint32_t id; // channel id, 0 for messages of whole child
+            std::string body;
+
+        private:
+            size_t pos_;
+            bool failed_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_CHILD_MESSAGE_H_
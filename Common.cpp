@@ -1,3 +1,3 @@
-// Common.cpp
-
-#include "just/live_worker/Common.h"
+// Common.cpp
+
+#include "just/live_worker/Common.h"
@@ -1,3 +1,3 @@
-// Common.h
-
-#include <just/common/Common.h>
+// Common.h
+
+#include <just/common/Common.h>
@@ -0,0 +1,214 @@
+// CpuPlacement.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveModuleProxy.h"
+#include "just/live_worker/CpuPlacement.h"
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+#include <framework/string/Format.h>
+#include <framework/system/LogicError.h>
+using namespace framework::string;
+using namespace framework::system;
+
+using namespace boost::system;
+
+#include <algorithm>
+#include <fstream>
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h> // for strtol
+#include <pthread.h>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        CpuPlacement::CpuPlacement()
+            : policy_("none")
+            , next_(0)
+        {
+        }
+
+        bool CpuPlacement::init(
+            std::string const & policy,
+            std::string const & reactor_cpus,
+            int numa_node,
+            error_code & ec)
+        {
+            policy_ = policy;
+            if (!parse_cpu_list(reactor_cpus, reactor_cpus_)) {
+                ec = logic_error::invalid_argument;
+                return false;
+            }
+            if (policy_ != "none" && policy_ != "round_robin" && policy_ != "load") {
+                ec = logic_error::invalid_argument;
+                return false;
+            }
+            // with policy none too: children not pinned are kept off the
+            // reactor cpus, not left with affinity of the thread forking them
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (::sched_getaffinity(0, sizeof(set), &set) < 0) {
+                ec.assign(errno, system_category());
+                return false;
+            }
+            std::vector<int> node_cpus;
+            if (numa_node >= 0) {
+                std::ifstream ifs(("/sys/devices/system/node/node" + format(numa_node) + "/cpulist").c_str());
+                std::string list;
+                if (!std::getline(ifs, list) || !parse_cpu_list(list, node_cpus)) {
+                    ec = logic_error::invalid_argument;
+                    return false;
+                }
+            }
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (!CPU_ISSET(cpu, &set))
+                    continue;
+                if (std::find(reactor_cpus_.begin(), reactor_cpus_.end(), cpu) != reactor_cpus_.end())
+                    continue;
+                if (numa_node >= 0 && std::find(node_cpus.begin(), node_cpus.end(), cpu) == node_cpus.end())
+                    continue;
+                cpus_.push_back(cpu);
+            }
+            if (cpus_.empty() && policy_ != "none") {
+                ec = logic_error::invalid_argument;
+                return false;
+            }
+            children_.resize(cpus_.size(), 0);
+            loads_.resize(cpus_.size(), 0);
+            return true;
+        }
+
+        int CpuPlacement::alloc()
+        {
+            if (!enabled())
+                return -1;
+            size_t index = 0;
+            if (policy_ == "round_robin") {
+                index = next_++ % cpus_.size();
+            } else {
+                for (size_t i = 1; i < cpus_.size(); ++i) {
+                    if (loads_[i] < loads_[index]
+                        || (loads_[i] == loads_[index] && children_[i] < children_[index]))
+                        index = i;
+                }
+            }
+            ++children_[index];
+            return cpus_[index];
+        }
+
+        void CpuPlacement::free(
+            int cpu)
+        {
+            size_t index = index_of(cpu);
+            if (index < cpus_.size() && children_[index] > 0)
+                --children_[index];
+        }
+
+        void CpuPlacement::clear_load()
+        {
+            std::fill(loads_.begin(), loads_.end(), 0);
+        }
+
+        void CpuPlacement::add_load(
+            int cpu,
+            boost::uint32_t load)
+        {
+            size_t index = index_of(cpu);
+            if (index < cpus_.size())
+                loads_[index] += load;
+        }
+
+        boost::uint32_t CpuPlacement::load(
+            int cpu) const
+        {
+            size_t index = index_of(cpu);
+            return index < cpus_.size() ? loads_[index] : 0;
+        }
+
+        std::string CpuPlacement::status() const
+        {
+            std::string str;
+            for (size_t i = 0; i < cpus_.size(); ++i) {
+                if (i)
+                    str += ",";
+                str += format(cpus_[i]) + ":" + format(children_[i]) + ":" + format(loads_[i]);
+            }
+            return str;
+        }
+
+        void CpuPlacement::pin_reactor() const
+        {
+            if (reactor_cpus_.empty())
+                return;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (size_t i = 0; i < reactor_cpus_.size(); ++i)
+                CPU_SET(reactor_cpus_[i], &set);
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        }
+
+        bool CpuPlacement::pin_children() const
+        {
+            if (cpus_.empty())
+                return false;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (size_t i = 0; i < cpus_.size(); ++i)
+                CPU_SET(cpus_[i], &set);
+            return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+        }
+
+        bool CpuPlacement::pin_thread(
+            int cpu)
+        {
+            if (cpu < 0 || cpu >= CPU_SETSIZE)
+                return false;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+        }
+
+        bool CpuPlacement::parse_cpu_list(
+            std::string const & str,
+            std::vector<int> & cpus)
+        {
+            cpus.clear();
+            char const * p = str.c_str();
+            while (*p && *p != '\n') {
+                char * end = NULL;
+                long first = strtol(p, &end, 10);
+                if (end == p || first < 0 || first >= CPU_SETSIZE)
+                    return false;
+                long last = first;
+                p = end;
+                if (*p == '-') {
+                    last = strtol(++p, &end, 10);
+                    if (end == p || last < first || last >= CPU_SETSIZE)
+                        return false;
+                    p = end;
+                }
+                for (long cpu = first; cpu <= last; ++cpu)
+                    cpus.push_back((int)cpu);
+                if (*p == ',')
+                    ++p;
+                else if (*p && *p != '\n')
+                    return false;
+            }
+            return true;
+        }
+
+        size_t CpuPlacement::index_of(
+            int cpu) const
+        {
+            return std::find(cpus_.begin(), cpus_.end(), cpu) - cpus_.begin();
+        }
+
+    } // namespace live_worker
+} // namespace just
+
+#endif
@@ -0,0 +1,87 @@
+// CpuPlacement.h
+
+#ifndef _JUST_LIVE_WORKER_CPU_PLACEMENT_H_
+#define _JUST_LIVE_WORKER_CPU_PLACEMENT_H_
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Cpus for channel children. Cpus in reactor_cpus are kept for io
+        // threads of parent, children get the others (of numa_node only if
+        // it is not -1), one cpu for each child by policy:
+        //   none         not pinned to one, any of the cpus for children
+        //   round_robin  next cpu in turn
+        //   load         cpu with least measured load, then fewest children
+        // Load is cpu time of children in per mille of one cpu, fed by owner.
+        class CpuPlacement
+        {
+        public:
+            CpuPlacement();
+
+        public:
+            bool init(
+                std::string const & policy,
+                std::string const & reactor_cpus,
+                int numa_node,
+                boost::system::error_code & ec);
+
+            // children are pinned one cpu each
+            bool enabled() const
+            {
+                return policy_ != "none" && !cpus_.empty();
+            }
+
+            // cpu for a new child, -1 if children are not pinned
+            int alloc();
+
+            void free(
+                int cpu);
+
+            void clear_load();
+
+            void add_load(
+                int cpu,
+                boost::uint32_t load);
+
+            boost::uint32_t load(
+                int cpu) const;
+
+            // "cpu:children:load" of each cpu, comma separated
+            std::string status() const;
+
+            // pin calling thread to reactor cpus, if any
+            void pin_reactor() const;
+
+            // pin calling thread to all cpus for children, for a child with
+            // no cpu of its own; false if there is no such set
+            bool pin_children() const;
+
+        public:
+            // pin calling thread, threads created by it later inherit
+            static bool pin_thread(
+                int cpu);
+
+            // "0-3,8,10-11" as in /sys/devices/system/node/nodeN/cpulist
+            static bool parse_cpu_list(
+                std::string const & str,
+                std::vector<int> & cpus);
+
+        private:
+            size_t index_of(
+                int cpu) const;
+
+        private:
+            std::string policy_;
+            std::vector<int> cpus_;     // for children
+            std::vector<int> reactor_cpus_;
+            std::vector<size_t> children_;  // by index in cpus_
+            std::vector<boost::uint32_t> loads_;
+            size_t next_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_CPU_PLACEMENT_H_
@@ -1,14 +1,14 @@
-// Define.h
-
-#ifndef _JUST_LIVE_WORKER_DEFINE_H_
-#define _JUST_LIVE_WORKER_DEFINE_H_
-
-#include "just/common/VersionDefine.h" // for VERSION
-
-#define NAME live_worker
-
-#define BEGIN_NAME_SPACE namespace just { namespace live_worker {
-
-#define END_NAME_SPACE }}
-
-#endif // _JUST_LIVE_WORKER_DEFINE_H_
+// Define.h
+
+#ifndef _JUST_LIVE_WORKER_DEFINE_H_
+#define _JUST_LIVE_WORKER_DEFINE_H_
+
+#include "just/common/VersionDefine.h" // for VERSION
+
+#define NAME live_worker
+
+#define BEGIN_NAME_SPACE namespace just { namespace live_worker {
+
+#define END_NAME_SPACE }}
+
+#endif // _JUST_LIVE_WORKER_DEFINE_H_
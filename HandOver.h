@@ -0,0 +1,79 @@
+// HandOver.h
+
+#ifndef _JUST_LIVE_WORKER_HAND_OVER_H_
+#define _JUST_LIVE_WORKER_HAND_OVER_H_
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Channels of one shard passed to a new process on hot upgrade, see
+        // LiveUpgrade. Only children whose channels are all working are
+        // passed, other children stay with old process and go with it.
+        struct HandOver
+        {
+            struct Channel
+            {
+                Channel()
+                    : id(0)
+                    , slot(0)
+                    , tcp_port(0)
+                    , udp_port(0)
+                    , nref(0)
+                    , handle(NULL)
+                {
+                }
+
+                boost::uint32_t id;         // known by child
+                boost::uint32_t slot;       // in status table of child
+                boost::uint32_t tcp_port;
+                boost::uint32_t udp_port;
+                boost::uint32_t nref;       // viewers left in old process
+                std::string rid;
+                std::string url;
+                std::string url2;           // given to clients
+                void * handle;              // of LiveModuleProxy, not passed
+            };
+
+            struct Child
+            {
+                Child()
+                    : pid(0)
+                    , fd(-1)
+                    , table(0)
+                {
+                }
+
+                boost::uint32_t pid;
+                int fd;                     // parent end of socketpair
+                boost::uint32_t table;      // index in tables
+                std::vector<Channel> channels;
+            };
+
+            struct Table
+            {
+                Table()
+                    : fd(-1)
+                    , size(0)
+                {
+                }
+
+                int fd;
+                boost::uint32_t size;
+            };
+
+            HandOver()
+                : next_id(0)
+            {
+            }
+
+            boost::uint32_t next_id;
+            std::vector<Table> tables;      // status tables children write to
+            std::vector<Child> children;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_HAND_OVER_H_
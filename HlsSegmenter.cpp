@@ -0,0 +1,131 @@
+// HlsSegmenter.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/HlsSegmenter.h"
+
+#include <sstream>
+#include <iomanip>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // a stream without random access points is not kept for ever
+        static size_t const max_segment_size = 32 * 1024 * 1024;
+
+        HlsSegmenter::HlsSegmenter(
+            boost::uint32_t duration,
+            size_t window)
+            : duration_(duration)
+            , window_(window < 3 ? 3 : window)
+            , current_offset_(0)
+            , current_time_(0)
+            , sequence_(0)
+            , memory_(0)
+            , current_memory_(0)
+        {
+        }
+
+        // a point may be before offset, its packet begun in last write
+        void HlsSegmenter::write(
+            char const * data,
+            size_t size,
+            boost::uint64_t offset,
+            std::vector<boost::uint64_t> const & points,
+            boost::uint64_t now)
+        {
+            if (current_) {
+                current_->data.insert(current_->data.end(), data, data + size);
+                if (current_->data.size() > max_segment_size)
+                    current_.reset();
+            }
+            for (size_t i = 0; i < points.size(); ++i) {
+                if (current_) {
+                    if (now - current_time_ >= duration_)
+                        cut(points[i], now);
+                } else if (points[i] >= offset) {
+                    current_.reset(new HlsSegment);
+                    current_offset_ = points[i];
+                    current_time_ = now;
+                    current_->data.assign(data + (size_t)(points[i] - offset), data + size);
+                }
+            }
+        }
+
+        void HlsSegmenter::cut(
+            boost::uint64_t offset,
+            boost::uint64_t now)
+        {
+            size_t pos = (size_t)(offset - current_offset_);
+            boost::shared_ptr<HlsSegment> next(new HlsSegment);
+            next->data.assign(current_->data.begin() + pos, current_->data.end());
+            current_->data.resize(pos);
+            current_->sequence = sequence_++;
+            current_->duration = (boost::uint32_t)(now - current_time_);
+            cut_.push_back(current_);
+            current_ = next;
+            current_offset_ = offset;
+            current_time_ = now;
+        }
+
+        // runs in writer thread, current_ is not written meanwhile
+        void HlsSegmenter::commit(
+            boost::uint64_t limit)
+        {
+            for (size_t i = 0; i < cut_.size(); ++i) {
+                segments_.push_back(cut_[i]);
+                memory_ += cut_[i]->data.size();
+            }
+            cut_.clear();
+            current_memory_ = current_ ? current_->data.size() : 0;
+            while (!segments_.empty() 
+                && (segments_.size() > window_ || memory_ + current_memory_ > limit)) {
+                memory_ -= segments_.front()->data.size();
+                segments_.pop_front();
+            }
+            // the next one starts at a random access point
+            if (memory_ + current_memory_ > limit) {
+                current_.reset();
+                current_memory_ = 0;
+            }
+        }
+
+        void HlsSegmenter::playlist(
+            std::string const & uri,
+            std::string & m3u8) const
+        {
+            // no EXTINF rounded may be above it
+            boost::uint32_t target = 1;
+            for (size_t i = 0; i < segments_.size(); ++i) {
+                boost::uint32_t seconds = (segments_[i]->duration + 999) / 1000;
+                if (seconds > target)
+                    target = seconds;
+            }
+            std::ostringstream oss;
+            oss << "#EXTM3U\n"
+                << "#EXT-X-VERSION:3\n"
+                << "#EXT-X-TARGETDURATION:" << target << "\n"
+                << "#EXT-X-MEDIA-SEQUENCE:" << (segments_.empty() ? 0 : segments_.front()->sequence) << "\n";
+            for (size_t i = 0; i < segments_.size(); ++i) {
+                HlsSegment const & segment = *segments_[i];
+                oss << "#EXTINF:" << segment.duration / 1000 << "."
+                    << std::setw(3) << std::setfill('0') << segment.duration % 1000 << ",\n"
+                    << uri << segment.sequence << ".ts\n";
+            }
+            m3u8 = oss.str();
+        }
+
+        boost::shared_ptr<HlsSegment const> HlsSegmenter::segment(
+            boost::uint64_t sequence) const
+        {
+            if (segments_.empty() || sequence < segments_.front()->sequence)
+                return boost::shared_ptr<HlsSegment const>();
+            boost::uint64_t index = sequence - segments_.front()->sequence;
+            if (index >= segments_.size())
+                return boost::shared_ptr<HlsSegment const>();
+            return segments_[(size_t)index];
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -0,0 +1,97 @@
+// HlsSegmenter.h
+
+#ifndef _JUST_LIVE_WORKER_HLS_SEGMENTER_H_
+#define _JUST_LIVE_WORKER_HLS_SEGMENTER_H_
+
+#include <boost/shared_ptr.hpp>
+
+#include <deque>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // A segment is never changed once cut, it is written to any number
+        // of clients as it is
+        struct HlsSegment
+        {
+            boost::uint64_t sequence;
+            boost::uint32_t duration;   // msec
+            std::vector<char> data;
+        };
+
+        // Cuts the ts stream of a channel into HLS segments at its random
+        // access points, a segment at least duration msec long, and keeps
+        // the last window of them for the playlist. Durations are of
+        // arrival, the stream is live.
+        // One writer thread; commit and the readers under a lock of the
+        // owner, write without it.
+        class HlsSegmenter
+        {
+        public:
+            HlsSegmenter(
+                boost::uint32_t duration,
+                size_t window);
+
+        public:
+            // bytes of stream from offset, with the random access points
+            // found up to their end, arrived at now (msec)
+            void write(
+                char const * data,
+                size_t size,
+                boost::uint64_t offset,
+                std::vector<boost::uint64_t> const & points,
+                boost::uint64_t now);
+
+            // publishes the segments cut by write, drops those out of window,
+            // then the oldest and at last the one being cut while more than
+            // limit bytes are kept
+            void commit(
+                boost::uint64_t limit);
+
+        public:
+            bool empty() const
+            {
+                return segments_.empty();
+            }
+
+            // bytes of segments published and being cut, as of commit
+            boost::uint64_t memory() const
+            {
+                return memory_ + current_memory_;
+            }
+
+            // sliding playlist, segment n at uri followed by "n.ts"
+            void playlist(
+                std::string const & uri,
+                std::string & m3u8) const;
+
+            // NULL if it is not in window
+            boost::shared_ptr<HlsSegment const> segment(
+                boost::uint64_t sequence) const;
+
+        private:
+            void cut(
+                boost::uint64_t offset,
+                boost::uint64_t now);
+
+        private:
+            boost::uint32_t duration_;
+            size_t window_;
+            // of writer
+            boost::shared_ptr<HlsSegment> current_;
+            boost::uint64_t current_offset_;    // of first byte of current_
+            boost::uint64_t current_time_;
+            boost::uint64_t sequence_;          // of next segment
+            std::vector<boost::shared_ptr<HlsSegment const> > cut_;
+            // under lock
+            std::deque<boost::shared_ptr<HlsSegment const> > segments_;
+            boost::uint64_t memory_;
+            boost::uint64_t current_memory_;    // of current_ and cut_
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_HLS_SEGMENTER_H_
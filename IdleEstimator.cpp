@@ -0,0 +1,75 @@
+// IdleEstimator.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/IdleEstimator.h"
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        IdleEstimator::IdleEstimator(
+            size_t history_size)
+            : history_size_(history_size ? history_size : 1)
+        {
+        }
+
+        void IdleEstimator::on_release(
+            std::string const & rid,
+            boost::uint64_t now)
+        {
+            touch(rid).release = now ? now : 1;
+        }
+
+        void IdleEstimator::on_request(
+            std::string const & rid,
+            boost::uint64_t now)
+        {
+            entries_t::iterator iter = entries_.find(rid);
+            if (iter == entries_.end() || iter->second.release == 0)
+                return;
+            Entry & entry = touch(rid);
+            boost::uint64_t gap = now > entry.release ? now - entry.release : 0;
+            entry.release = 0;
+            if (entry.mean == 0) {
+                entry.mean = gap;
+                entry.dev = gap / 2;
+            } else {
+                boost::uint64_t diff = gap > entry.mean ? gap - entry.mean : entry.mean - gap;
+                entry.dev = (entry.dev * 3 + diff) / 4;
+                entry.mean = (entry.mean * 7 + gap) / 8;
+            }
+            if (entry.mean == 0)
+                entry.mean = 1;
+        }
+
+        boost::uint64_t IdleEstimator::estimate(
+            std::string const & rid) const
+        {
+            entries_t::const_iterator iter = entries_.find(rid);
+            if (iter == entries_.end() || iter->second.mean == 0)
+                return 0;
+            return iter->second.mean + iter->second.dev * 2;
+        }
+
+        IdleEstimator::Entry & IdleEstimator::touch(
+            std::string const & rid)
+        {
+            std::pair<entries_t::iterator, bool> result =
+                entries_.insert(std::make_pair(rid, Entry()));
+            Entry & entry = result.first->second;
+            if (result.second) {
+                lru_.push_front(rid);
+                if (entries_.size() > history_size_) {
+                    entries_.erase(lru_.back());
+                    lru_.pop_back();
+                }
+            } else {
+                lru_.splice(lru_.begin(), lru_, entry.lru);
+            }
+            entry.lru = lru_.begin();
+            return entry;
+        }
+
+    } // namespace live_worker
+} // namespace just
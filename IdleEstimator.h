@@ -0,0 +1,69 @@
+// IdleEstimator.h
+
+#ifndef _JUST_LIVE_WORKER_IDLE_ESTIMATOR_H_
+#define _JUST_LIVE_WORKER_IDLE_ESTIMATOR_H_
+
+#include <boost/unordered_map.hpp>
+
+#include <list>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Estimates per rid the time from channel release to the next
+        // request, with smoothed mean and deviation (like TCP RTT).
+        class IdleEstimator
+        {
+        public:
+            IdleEstimator(
+                size_t history_size);
+
+        public:
+            // the last client of rid is gone, at time now (msec)
+            void on_release(
+                std::string const & rid,
+                boost::uint64_t now);
+
+            // rid is requested at time now (msec)
+            void on_request(
+                std::string const & rid,
+                boost::uint64_t now);
+
+            // expected msec until rid is requested again, with margin;
+            // 0 if no sample of rid
+            boost::uint64_t estimate(
+                std::string const & rid) const;
+
+        private:
+            struct Entry
+            {
+                Entry()
+                    : release(0)
+                    , mean(0)
+                    , dev(0)
+                {
+                }
+
+                boost::uint64_t release; // 0 if not released
+                boost::uint64_t mean;
+                boost::uint64_t dev;
+                std::list<std::string>::iterator lru;
+            };
+
+            typedef boost::unordered_map<std::string, Entry> entries_t;
+
+            Entry & touch(
+                std::string const & rid);
+
+        private:
+            size_t history_size_;
+            entries_t entries_;
+            std::list<std::string> lru_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_IDLE_ESTIMATOR_H_
@@ -0,0 +1,491 @@
+// KeepPolicy.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/KeepPolicy.h"
+
+#include <framework/logger/Logger.h>
+#include <framework/logger/StreamRecord.h>
+
+#include <boost/unordered_map.hpp>
+
+#include <list>
+#include <set>
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.KeepPolicy", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // evict the channel released longest ago
+        class LruKeepPolicy
+            : public KeepPolicy
+        {
+        public:
+            LruKeepPolicy(
+                size_t history_size)
+                : KeepPolicy(history_size)
+            {
+            }
+
+        public:
+            virtual void on_request(
+                std::string const & rid)
+            {
+            }
+
+            virtual void on_idle(
+                std::string const & rid)
+            {
+                idle_.push_front(rid);
+                index_[rid] = idle_.begin();
+            }
+
+            virtual void on_busy(
+                std::string const & rid)
+            {
+                remove(rid);
+            }
+
+            virtual void on_drop(
+                std::string const & rid)
+            {
+                remove(rid);
+            }
+
+            virtual std::string const & victim() const
+            {
+                assert(!idle_.empty());
+                return idle_.back();
+            }
+
+        private:
+            void remove(
+                std::string const & rid)
+            {
+                index_t::iterator iter = index_.find(rid);
+                if (iter != index_.end()) {
+                    idle_.erase(iter->second);
+                    index_.erase(iter);
+                }
+            }
+
+        private:
+            typedef boost::unordered_map<
+                std::string, std::list<std::string>::iterator> index_t;
+
+            std::list<std::string> idle_; // most recently released first
+            index_t index_;
+        };
+
+        // LFU with dynamic aging: score = age + count, where age is the
+        // score of the last dropped idle channel, so that old popular
+        // channels do not stay forever
+        class LfuKeepPolicy
+            : public KeepPolicy
+        {
+        public:
+            LfuKeepPolicy(
+                size_t history_size)
+                : KeepPolicy(history_size)
+                , age_(0)
+            {
+            }
+
+        public:
+            virtual void on_request(
+                std::string const & rid)
+            {
+                Entry & entry = touch(rid);
+                if (entry.idle)
+                    idle_.erase(std::make_pair(entry.score, rid));
+                ++entry.count;
+                entry.score = age_ + entry.count;
+                if (entry.idle)
+                    idle_.insert(std::make_pair(entry.score, rid));
+                shrink();
+            }
+
+            virtual void on_idle(
+                std::string const & rid)
+            {
+                Entry & entry = touch(rid);
+                entry.idle = true;
+                idle_.insert(std::make_pair(entry.score, rid));
+            }
+
+            virtual void on_busy(
+                std::string const & rid)
+            {
+                history_t::iterator iter = history_.find(rid);
+                if (iter != history_.end() && iter->second.idle) {
+                    idle_.erase(std::make_pair(iter->second.score, rid));
+                    iter->second.idle = false;
+                }
+            }
+
+            virtual void on_drop(
+                std::string const & rid)
+            {
+                history_t::iterator iter = history_.find(rid);
+                if (iter != history_.end() && iter->second.idle) {
+                    idle_.erase(std::make_pair(iter->second.score, rid));
+                    iter->second.idle = false;
+                    if (iter->second.score > age_)
+                        age_ = iter->second.score;
+                }
+            }
+
+            virtual std::string const & victim() const
+            {
+                assert(!idle_.empty());
+                return idle_.begin()->second;
+            }
+
+        private:
+            struct Entry
+            {
+                Entry()
+                    : count(0)
+                    , score(0)
+                    , idle(false)
+                {
+                }
+
+                boost::uint64_t count;
+                boost::uint64_t score;
+                bool idle;
+                std::list<std::string>::iterator lru;
+            };
+
+            typedef boost::unordered_map<std::string, Entry> history_t;
+
+            Entry & touch(
+                std::string const & rid)
+            {
+                std::pair<history_t::iterator, bool> result =
+                    history_.insert(std::make_pair(rid, Entry()));
+                Entry & entry = result.first->second;
+                if (result.second) {
+                    lru_.push_front(rid);
+                } else {
+                    lru_.splice(lru_.begin(), lru_, entry.lru);
+                }
+                entry.lru = lru_.begin();
+                return entry;
+            }
+
+            // forget rids not requested for a long time, idle ones are kept
+            // and passed over toward the head
+            void shrink()
+            {
+                std::list<std::string>::iterator lru = lru_.end();
+                while (history_.size() > history_size_ && lru != lru_.begin()) {
+                    --lru;
+                    history_t::iterator iter = history_.find(*lru);
+                    if (iter->second.idle)
+                        continue;
+                    history_.erase(iter);
+                    lru = lru_.erase(lru);
+                }
+            }
+
+        private:
+            boost::uint64_t age_;
+            history_t history_;
+            std::list<std::string> lru_; // most recently requested first
+            std::set<std::pair<boost::uint64_t, std::string> > idle_;
+        };
+
+        // 2Q: a channel requested only once is "cold", one requested again
+        // while warm, or soon after being dropped (found in the ghost
+        // queue), is "hot". Cold idle channels are evicted first (FIFO),
+        // then hot ones (LRU).
+        class TwoQueueKeepPolicy
+            : public KeepPolicy
+        {
+        public:
+            TwoQueueKeepPolicy(
+                size_t history_size)
+                : KeepPolicy(history_size)
+            {
+            }
+
+        public:
+            virtual void on_request(
+                std::string const & rid)
+            {
+                std::pair<entries_t::iterator, bool> result =
+                    entries_.insert(std::make_pair(rid, Entry()));
+                Entry & entry = result.first->second;
+                if (result.second) {
+                    ghost_index_t::iterator iter = ghost_index_.find(rid);
+                    if (iter != ghost_index_.end()) {
+                        entry.hot = true;
+                        ghost_.erase(iter->second);
+                        ghost_index_.erase(iter);
+                    }
+                } else {
+                    entry.hot = true;
+                }
+            }
+
+            virtual void on_idle(
+                std::string const & rid)
+            {
+                entries_t::iterator iter = entries_.find(rid);
+                assert(iter != entries_.end());
+                Entry & entry = iter->second;
+                std::list<std::string> & queue = entry.hot ? hot_ : cold_;
+                queue.push_front(rid);
+                entry.idle = true;
+                entry.iter = queue.begin();
+            }
+
+            virtual void on_busy(
+                std::string const & rid)
+            {
+                entries_t::iterator iter = entries_.find(rid);
+                if (iter != entries_.end())
+                    unlink(iter->second);
+            }
+
+            virtual void on_drop(
+                std::string const & rid)
+            {
+                entries_t::iterator iter = entries_.find(rid);
+                if (iter == entries_.end())
+                    return;
+                unlink(iter->second);
+                if (!iter->second.hot) {
+                    ghost_.push_front(rid);
+                    ghost_index_[rid] = ghost_.begin();
+                    if (ghost_.size() > history_size_) {
+                        ghost_index_.erase(ghost_.back());
+                        ghost_.pop_back();
+                    }
+                }
+                entries_.erase(iter);
+            }
+
+            virtual std::string const & victim() const
+            {
+                if (!cold_.empty())
+                    return cold_.back();
+                assert(!hot_.empty());
+                return hot_.back();
+            }
+
+        private:
+            struct Entry
+            {
+                Entry()
+                    : hot(false)
+                    , idle(false)
+                {
+                }
+
+                bool hot;
+                bool idle;
+                std::list<std::string>::iterator iter;
+            };
+
+            void unlink(
+                Entry & entry)
+            {
+                if (entry.idle) {
+                    (entry.hot ? hot_ : cold_).erase(entry.iter);
+                    entry.idle = false;
+                }
+            }
+
+        private:
+            typedef boost::unordered_map<std::string, Entry> entries_t;
+            typedef boost::unordered_map<
+                std::string, std::list<std::string>::iterator> ghost_index_t;
+
+            entries_t entries_; // rids with a channel
+            std::list<std::string> cold_;
+            std::list<std::string> hot_;
+            std::list<std::string> ghost_; // recently dropped cold rids
+            ghost_index_t ghost_index_;
+        };
+
+        // ARC: like 2Q, rids requested once (t1) and again (t2), with a
+        // ghost list for each of recently dropped rids. A request of a
+        // ghost moves the target size of t1 toward the list it was found
+        // in; idle channels of t1 are evicted first while t1 is above its
+        // target, otherwise those of t2. Size of a list counts its busy
+        // channels too, only idle ones can be evicted.
+        class ArcKeepPolicy
+            : public KeepPolicy
+        {
+        public:
+            ArcKeepPolicy(
+                size_t history_size)
+                : KeepPolicy(history_size)
+                , target_(0)
+                , t1_size_(0)
+            {
+            }
+
+        public:
+            virtual void on_request(
+                std::string const & rid)
+            {
+                std::pair<entries_t::iterator, bool> result =
+                    entries_.insert(std::make_pair(rid, Entry()));
+                Entry & entry = result.first->second;
+                if (!result.second) {
+                    if (!entry.frequent) {
+                        bool idle = entry.idle;
+                        unlink(entry);
+                        entry.frequent = true;
+                        --t1_size_;
+                        if (idle)
+                            link(rid, entry);
+                    }
+                    return;
+                }
+                ghost_index_t::iterator iter = ghost_index_.find(rid);
+                if (iter == ghost_index_.end()) {
+                    ++t1_size_;
+                    return;
+                }
+                size_t b1 = b1_.size();
+                size_t b2 = b2_.size();
+                if (iter->second.frequent) {
+                    size_t delta = b1 > b2 ? b1 / b2 : 1;
+                    target_ = target_ > delta ? target_ - delta : 0;
+                    b2_.erase(iter->second.iter);
+                } else {
+                    size_t delta = b2 > b1 ? b2 / b1 : 1;
+                    target_ += delta;
+                    if (target_ > entries_.size())
+                        target_ = entries_.size();
+                    b1_.erase(iter->second.iter);
+                }
+                ghost_index_.erase(iter);
+                entry.frequent = true;
+            }
+
+            virtual void on_idle(
+                std::string const & rid)
+            {
+                entries_t::iterator iter = entries_.find(rid);
+                assert(iter != entries_.end());
+                link(rid, iter->second);
+            }
+
+            virtual void on_busy(
+                std::string const & rid)
+            {
+                entries_t::iterator iter = entries_.find(rid);
+                if (iter != entries_.end())
+                    unlink(iter->second);
+            }
+
+            virtual void on_drop(
+                std::string const & rid)
+            {
+                entries_t::iterator iter = entries_.find(rid);
+                if (iter == entries_.end())
+                    return;
+                Entry & entry = iter->second;
+                unlink(entry);
+                if (!entry.frequent)
+                    --t1_size_;
+                std::list<std::string> & ghost = entry.frequent ? b2_ : b1_;
+                ghost.push_front(rid);
+                Ghost & ghost2 = ghost_index_[rid];
+                ghost2.frequent = entry.frequent;
+                ghost2.iter = ghost.begin();
+                entries_.erase(iter);
+                while (ghost_index_.size() > history_size_) {
+                    std::list<std::string> & ghost3 = b1_.size() > b2_.size() ? b1_ : b2_;
+                    ghost_index_.erase(ghost3.back());
+                    ghost3.pop_back();
+                }
+            }
+
+            virtual std::string const & victim() const
+            {
+                if (!t1_.empty() && (t1_size_ > target_ || t2_.empty()))
+                    return t1_.back();
+                assert(!t2_.empty());
+                return t2_.back();
+            }
+
+        private:
+            struct Entry
+            {
+                Entry()
+                    : frequent(false)
+                    , idle(false)
+                {
+                }
+
+                bool frequent;  // in t2
+                bool idle;
+                std::list<std::string>::iterator iter;
+            };
+
+            struct Ghost
+            {
+                bool frequent;  // in b2
+                std::list<std::string>::iterator iter;
+            };
+
+            void link(
+                std::string const & rid,
+                Entry & entry)
+            {
+                std::list<std::string> & queue = entry.frequent ? t2_ : t1_;
+                queue.push_front(rid);
+                entry.idle = true;
+                entry.iter = queue.begin();
+            }
+
+            void unlink(
+                Entry & entry)
+            {
+                if (entry.idle) {
+                    (entry.frequent ? t2_ : t1_).erase(entry.iter);
+                    entry.idle = false;
+                }
+            }
+
+        private:
+            typedef boost::unordered_map<std::string, Entry> entries_t;
+            typedef boost::unordered_map<std::string, Ghost> ghost_index_t;
+
+            size_t target_;     // of t1 size
+            size_t t1_size_;    // rids with a channel requested once
+            entries_t entries_; // rids with a channel
+            std::list<std::string> t1_; // idle, most recently released first
+            std::list<std::string> t2_;
+            std::list<std::string> b1_; // recently dropped, most recent first
+            std::list<std::string> b2_;
+            ghost_index_t ghost_index_;
+        };
+
+        KeepPolicy * KeepPolicy::create(
+            std::string const & name,
+            size_t history_size)
+        {
+            if (name == "lfu") {
+                return new LfuKeepPolicy(history_size);
+            } else if (name == "2q") {
+                return new TwoQueueKeepPolicy(history_size);
+            } else if (name == "arc") {
+                return new ArcKeepPolicy(history_size);
+            } else {
+                if (name != "lru")
+                    LOG_WARN("[create] unknown keep policy " << name << ", use lru");
+                return new LruKeepPolicy(history_size);
+            }
+        }
+
+    } // namespace live_worker
+} // namespace just
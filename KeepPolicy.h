@@ -0,0 +1,58 @@
+// KeepPolicy.h
+
+#ifndef _JUST_LIVE_WORKER_KEEP_POLICY_H_
+#define _JUST_LIVE_WORKER_KEEP_POLICY_H_
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Decides which idle channel to evict when the warm pool is full.
+        // LiveManager reports the life of each channel by rid, the policy
+        // may keep request history of a rid across channel lifetimes.
+        class KeepPolicy
+        {
+        public:
+            // "lru", "lfu" (lfu with dynamic aging), "2q", "arc"
+            static KeepPolicy * create(
+                std::string const & name,
+                size_t history_size);
+
+            virtual ~KeepPolicy() {}
+
+        public:
+            // a client request is attached to the channel of rid
+            virtual void on_request(
+                std::string const & rid) = 0;
+
+            // the channel of rid has no client now
+            virtual void on_idle(
+                std::string const & rid) = 0;
+
+            // the idle channel of rid is requested again
+            virtual void on_busy(
+                std::string const & rid) = 0;
+
+            // the channel of rid is stopped, idle or not
+            virtual void on_drop(
+                std::string const & rid) = 0;
+
+            // the idle channel to evict, there must be at least one idle channel
+            virtual std::string const & victim() const = 0;
+
+        protected:
+            KeepPolicy(
+                size_t history_size)
+                : history_size_(history_size)
+            {
+            }
+
+        protected:
+            size_t history_size_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_KEEP_POLICY_H_
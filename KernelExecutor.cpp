@@ -0,0 +1,90 @@
+// KernelExecutor.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/KernelExecutor.h"
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        boost::mutex KernelExecutor::mutex_;
+        size_t KernelExecutor::users_ = 0;
+        KernelExecutor * KernelExecutor::inst_ = NULL;
+
+        KernelExecutor & KernelExecutor::acquire()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (users_++ == 0) {
+                inst_ = new KernelExecutor;
+            }
+            return *inst_;
+        }
+
+        void KernelExecutor::release()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            assert(users_ > 0);
+            if (--users_ == 0) {
+                delete inst_;
+                inst_ = NULL;
+            }
+        }
+
+        KernelExecutor::KernelExecutor()
+            : work_(new boost::asio::io_service::work(io_svc_))
+        {
+            thread_ = new boost::thread(boost::bind(&KernelExecutor::run, this));
+        }
+
+        KernelExecutor::~KernelExecutor()
+        {
+            // finish queued calls, then exit
+            delete work_;
+            thread_->join();
+            delete thread_;
+        }
+
+        struct call_waiter
+        {
+            call_waiter()
+                : done(false)
+            {
+            }
+
+            void operator()(
+                boost::function<void (void)> const & func)
+            {
+                func();
+                boost::mutex::scoped_lock lock(mutex);
+                done = true;
+                cond.notify_one();
+            }
+
+            boost::mutex mutex;
+            boost::condition_variable cond;
+            bool done;
+        };
+
+        void KernelExecutor::call(
+            boost::function<void (void)> const & func)
+        {
+            call_waiter waiter;
+            io_svc_.post(boost::bind<void>(boost::ref(waiter), func));
+            boost::mutex::scoped_lock lock(waiter.mutex);
+            while (!waiter.done)
+                waiter.cond.wait(lock);
+        }
+
+        void KernelExecutor::run()
+        {
+            io_svc_.run();
+        }
+
+    } // namespace live_worker
+} // namespace just
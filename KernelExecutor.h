@@ -0,0 +1,63 @@
+// KernelExecutor.h
+
+#ifndef _JUST_LIVE_WORKER_KERNEL_EXECUTOR_H_
+#define _JUST_LIVE_WORKER_KERNEL_EXECUTOR_H_
+
+#include <boost/asio/io_service.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace boost
+{
+    class thread;
+}
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // One thread per process that makes all calls into the live kernel,
+        // in order, so that slow kernel calls do not block io threads.
+        class KernelExecutor
+        {
+        public:
+            // start thread with first user, stop with last user
+            static KernelExecutor & acquire();
+
+            static void release();
+
+        public:
+            template <typename Handler>
+            void post(
+                Handler const & handler)
+            {
+                io_svc_.post(handler);
+            }
+
+            // run in kernel thread and wait, not from kernel thread
+            void call(
+                boost::function<void (void)> const & func);
+
+        private:
+            KernelExecutor();
+
+            ~KernelExecutor();
+
+            void run();
+
+        private:
+            boost::asio::io_service io_svc_;
+            boost::asio::io_service::work * work_;
+            boost::thread * thread_;
+
+        private:
+            static boost::mutex mutex_;
+            static size_t users_;
+            static KernelExecutor * inst_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_KERNEL_EXECUTOR_H_
@@ -1,420 +1,1023 @@
-// LiveManager.cpp
-
-#include "just/live_worker/Common.h"
-#include "just/live_worker/LiveManager.h"
-#include "just/live_worker/LiveModuleProxy.h"
-
-#include <live/Name.h>
-
-#include <util/protocol/pptv/Base64.h>
-using namespace util::protocol;
-
-#include <framework/system/LogicError.h>
-#include <framework/string/Format.h>
-#include <framework/string/Slice.h>
-#include <framework/string/Parse.h>
-#include <framework/logger/Logger.h>
-#include <framework/logger/StreamRecord.h>
-#include <framework/logger/Section.h>
-using namespace framework::string;
-using namespace framework::system;
-using namespace framework::timer;
-
-#include <boost/bind.hpp>
-#include <boost/asio/io_service.hpp>
-using namespace boost::system;
-
-FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveManager", framework::logger::Debug)
-
-static const char JUST_LIVE_KEY[] = "trinity";
-
-namespace just
-{
-    namespace live_worker
-    {
-
-        struct LiveManager::Channel
-        {
-            Channel() 
-                : nref(0)
-                , expire(0)
-                , handle(NULL)
-                , status(started)
-            {
-            }
-
-            enum StatusEnum
-            {
-                started, 
-                working, 
-                cancel, 
-                stopped, 
-            };
-
-            std::string url;
-            std::string rid;
-
-            boost::uint16_t tcp_port;
-            boost::uint16_t udp_port;
-
-            boost::uint32_t nref;
-            boost::uint32_t expire;
-            LiveModuleProxy::ChannelHandle handle;
-            StatusEnum status;
-            boost::system::error_code ec;
-            std::string url2;
-            std::vector<LiveManager::call_back_func> call_backs;
-        };
-
-        struct find_channel_not_active
-        {
-            bool operator()(LiveManager::Channel * channel) {
-                return (channel->nref == 0 
-                    || channel->status == LiveManager::Channel::cancel 
-                    || channel->status == LiveManager::Channel::stopped); 
+// LiveManager.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveManager.h"
+#include "just/live_worker/LiveModuleProxy.h"
+#include "just/live_worker/KeepPolicy.h"
+#include "just/live_worker/IdleEstimator.h"
+#include "just/live_worker/HandOver.h"
+
+#include <live/Name.h>
+
+#include <framework/system/LogicError.h>
+#include <framework/string/Format.h>
+#include <framework/string/Parse.h>
+#include <framework/logger/Logger.h>
+#include <framework/logger/StreamRecord.h>
+#include <framework/logger/Section.h>
+using namespace framework::string;
+using namespace framework::system;
+using namespace framework::timer;
+
+#include <boost/bind.hpp>
+#include <boost/asio/io_service.hpp>
+using namespace boost::system;
+
+#include <ctime>
+#include <unistd.h> // for getpid
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveManager", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        struct LiveManager::Waiter
+        {
+            Waiter()
+                : seq(0)
+                , channel(NULL)
+                , prev(NULL)
+                , next(NULL)
+            {
             }
+
+            LiveManager::call_back_func call_back;
+            boost::uint32_t seq;
+            Channel * channel; // NULL if not in waiter list of a channel
+            Waiter * prev;
+            Waiter * next;
         };
-
-        struct find_channel_stopped
+
+        struct LiveManager::Channel
         {
-            bool operator()(LiveManager::Channel * channel) {
-                return (channel->status == LiveManager::Channel::cancel 
-                    || channel->status == LiveManager::Channel::stopped); 
+            Channel() 
+                : tcp_port(0)
+                , udp_port(0)
+                , nref(0)
+                , expire(0)
+                , crash_time(0)
+                , prewarmed(false)
+                , handle(NULL)
+                , status(started)
+                , first_waiter(NULL)
+                , last_waiter(NULL)
+            {
             }
+
+            enum StatusEnum
+            {
+                started, 
+                working, 
+                cancel, 
+                stopped, 
+                restarting, // crashed, waiting in restart queue, no handle
+            };
+
+            std::string url;
+            std::string rid;
+
+            boost::uint16_t tcp_port;
+            boost::uint16_t udp_port;
+
+            boost::uint32_t nref;
+            boost::uint64_t expire; // tick in expire queue, 0 if not idle
+            std::multimap<boost::uint64_t, Channel *>::iterator expire_iter;
+            boost::uint64_t crash_time; // msec, 0 if not recovering from crash
+            std::multimap<boost::uint64_t, Channel *>::iterator restart_iter;
+            bool prewarmed; // started from warm snapshot, not requested yet
+            LiveModuleProxy::ChannelHandle handle;
+            StatusEnum status;
+            boost::system::error_code ec;
+            std::string url2;
+
+            Waiter * first_waiter;
+            Waiter * last_waiter;
         };
 
-        //ڹƵ
-        struct find_channel_working
+        LiveManager::LiveManager(
+            util::daemon::Daemon & daemon)
+            : util::daemon::ModuleBase<LiveManager>(daemon, "LiveManager")
+            , live_module_(util::daemon::use_module<LiveModuleProxy>(daemon))
+            , free_waiters_(NULL)
+            , idle_count_(0)
+            , keep_policy_name_("lru")
+            , keep_history_(4096)
+            , keep_policy_(NULL)
+            , idle_estimator_(NULL)
+            , warm_snapshot_(NULL)
+            , rate_half_life_(600000)
+            , prewarm_batch_(2)
+            , idle_ttl_(10000)
+            , idle_ttl_min_(1000)
+            , idle_ttl_max_(60000)
+            , fail_backoff_min_(1000)
+            , fail_backoff_max_(60000)
+            , rand_((boost::uint32_t)::time(NULL) ^ ((boost::uint32_t)::getpid() << 16))
+            , restart_max_(3)
+            , restart_window_(60000)
+            , restart_backoff_(1000)
+            , restart_backoff_max_(30000)
+            , expire_resolution_(1000)
+            , check_interval_(1000)
+            , dump_interval_(0)
+            , start_time_(clock_timer::traits_type::now())
+            , armed_tick_(0)
+            , check_time_(0)
+            , dump_time_(0)
+            , timer_(io_svc())
+            , check_timer_(io_svc())
         {
-            bool operator()(LiveManager::Channel * channel) {
-                return ((channel->status == LiveManager::Channel::working 
-                    || channel->status == LiveManager::Channel::started) && (channel->nref > 0));
+            std::string strParallel("1");
+            int iParallel = 0;
+            daemon.config().register_module("LiveProxy")
+                << CONFIG_PARAM_NAME_NOACC("max_parallel", strParallel);
+
+            LOG_DEBUG("[max_parallel] " << strParallel.c_str());
+
+            framework::string::parse2(strParallel,iParallel);
+
+            max_parallel_ = iParallel;
+
+            size_t url_cache_size = 256;
+
+            config().register_module("LiveManager")
+                << CONFIG_PARAM_NAME_RDWR("idle_ttl", idle_ttl_)
+                << CONFIG_PARAM_NAME_RDWR("idle_ttl_min", idle_ttl_min_)
+                << CONFIG_PARAM_NAME_RDWR("idle_ttl_max", idle_ttl_max_)
+                << CONFIG_PARAM_NAME_RDWR("fail_backoff_min", fail_backoff_min_)
+                << CONFIG_PARAM_NAME_RDWR("fail_backoff_max", fail_backoff_max_)
+                << CONFIG_PARAM_NAME_RDWR("restart_max", restart_max_)
+                << CONFIG_PARAM_NAME_RDWR("restart_window", restart_window_)
+                << CONFIG_PARAM_NAME_RDWR("restart_backoff", restart_backoff_)
+                << CONFIG_PARAM_NAME_RDWR("restart_backoff_max", restart_backoff_max_)
+                << CONFIG_PARAM_NAME_RDONLY("expire_resolution", expire_resolution_)
+                << CONFIG_PARAM_NAME_RDWR("check_interval", check_interval_)
+                << CONFIG_PARAM_NAME_RDWR("dump_interval", dump_interval_)
+                << CONFIG_PARAM_NAME_RDONLY("keep_policy", keep_policy_name_)
+                << CONFIG_PARAM_NAME_RDONLY("keep_history", keep_history_)
+                << CONFIG_PARAM_NAME_RDONLY("url_cache_size", url_cache_size)
+                << CONFIG_PARAM_NAME_RDONLY("rate_half_life", rate_half_life_)
+                << CONFIG_PARAM_NAME_RDWR("prewarm_batch", prewarm_batch_)
+                << CONFIG_PARAM_NAME_RDONLY("hit", stat_.hit)
+                << CONFIG_PARAM_NAME_RDONLY("miss", stat_.miss)
+                << CONFIG_PARAM_NAME_RDONLY("evict", stat_.evict)
+                << CONFIG_PARAM_NAME_RDONLY("idle_hit", stat_.idle_hit)
+                << CONFIG_PARAM_NAME_RDONLY("idle_expire", stat_.idle_expire)
+                << CONFIG_PARAM_NAME_RDONLY("last_idle_ttl", stat_.idle_ttl)
+                << CONFIG_PARAM_NAME_RDONLY("fail", stat_.fail)
+                << CONFIG_PARAM_NAME_RDONLY("fail_hit", stat_.fail_hit)
+                << CONFIG_PARAM_NAME_RDONLY("url_hit", stat_.url_hit)
+                << CONFIG_PARAM_NAME_RDONLY("waiter_alloc", stat_.waiter_alloc)
+                << CONFIG_PARAM_NAME_RDONLY("loop_lag", stat_.loop_lag)
+                << CONFIG_PARAM_NAME_RDONLY("max_loop_lag", stat_.max_loop_lag)
+                << CONFIG_PARAM_NAME_RDONLY("crash", stat_.crash)
+                << CONFIG_PARAM_NAME_RDONLY("restart", stat_.restart)
+                << CONFIG_PARAM_NAME_RDONLY("restart_give_up", stat_.restart_give_up)
+                << CONFIG_PARAM_NAME_RDONLY("recover", stat_.recover)
+                << CONFIG_PARAM_NAME_RDONLY("mttr", stat_.mttr)
+                << CONFIG_PARAM_NAME_RDONLY("prewarm", stat_.prewarm)
+                << CONFIG_PARAM_NAME_RDONLY("prewarm_hit", stat_.prewarm_hit);
+            if (expire_resolution_ == 0)
+                expire_resolution_ = 1;
+            rid_cache_.resize(url_cache_size);
+
+            keep_policy_ = KeepPolicy::create(keep_policy_name_, keep_history_);
+            idle_estimator_ = new IdleEstimator(keep_history_);
+            warm_snapshot_ = new WarmSnapshot(keep_history_, rate_half_life_);
+            LOG_DEBUG("[keep_policy] " << keep_policy_name_);
+        }
+
+        LiveManager::~LiveManager()
+        {
+            delete warm_snapshot_;
+            delete idle_estimator_;
+            delete keep_policy_;
+            while (free_waiters_) {
+                Waiter * waiter = free_waiters_;
+                free_waiters_ = waiter->next;
+                delete waiter;
             }
-        };
-
-        LiveManager::LiveManager(
-            util::daemon::Daemon & daemon)
-            : util::daemon::ModuleBase<LiveManager>(daemon, "LiveManager")
-            , live_module_(util::daemon::use_module<LiveModuleProxy>(daemon))
-            , timer_(io_svc())
-        {
-            std::string strParallel("1");
-            int iParallel = 0;
-            daemon.config().register_module("LiveProxy")
-                << CONFIG_PARAM_NAME_NOACC("max_parallel", strParallel);
-
-            LOG_DEBUG("[max_parallel] " << strParallel.c_str());
-
-            framework::string::parse2(strParallel,iParallel);
-
-            max_parallel_ = iParallel;
-        }
-
-        LiveManager::~LiveManager()
-        {
-        }
-
+        }
+
         bool LiveManager::startup(
-            error_code & ec)
-        {
-            timer_.expires_from_now(Duration::seconds(1), ec);
-            timer_.async_wait(boost::bind(&LiveManager::handle_timer, this, _1));
-            return !ec;
-        }
-
-        bool LiveManager::shutdown(
-            error_code & ec)
-        {
-            for (size_t i = 0; i < channels_.size(); ++i) {
-                stop_channel(channels_[i]);
-            }
-            channels_.erase(
-                std::remove(channels_.begin(), channels_.end(), (Channel *)0), channels_.end());
-            timer_.cancel(ec);
+            error_code & ec)
+        {
+            live_module_.set_fail_handler(
+                boost::bind(&LiveManager::handle_channels_failed<LiveModuleProxy::ChannelHandle>, this, _1));
+            check_time_ = now_msec() + check_interval_;
+            check_timer_.expires_from_now(Duration::milliseconds(check_interval_), ec);
+            check_timer_.async_wait(boost::bind(&LiveManager::handle_check_timer, this, _1));
             return !ec;
-        }
-
-        void LiveManager::set_max_parallel(
-            size_t max_parallel)
-        {
-            if (max_parallel_ != max_parallel) {
-                max_parallel_ = max_parallel;
-                check_parallel();
-            }
-        }
-
-        LiveManager::ChannelHandle LiveManager::start_channel(
-            std::string const & url, 
-            call_back_func const & call_back)
-        {
+        }
+
+        bool LiveManager::shutdown(
+            error_code & ec)
+        {
+            while (!channels_.empty()) {
+                Channel * channel = channels_.begin()->second;
+                stop_channel(channel);
+            }
+            armed_tick_ = 0;
+            timer_.cancel(ec);
+            check_timer_.cancel(ec);
+            return !ec;
+        }
+
+        void LiveManager::set_max_parallel(
+            size_t max_parallel)
+        {
+            if (max_parallel_ != max_parallel) {
+                max_parallel_ = max_parallel;
+                check_parallel();
+            }
+        }
+
+        LiveManager::ChannelHandle LiveManager::start_channel(
+            std::string const & url, 
+            call_back_func const & call_back)
+        {
             return start_channel(url, tcp_port, udp_port, call_back);
-        }
-
-        LiveManager::ChannelHandle LiveManager::start_channel(
-            std::string const & url, 
+        }
+
+        LiveManager::ChannelHandle LiveManager::start_channel(
+            std::string const & url, 
+            std::string const & rid, 
+            call_back_func const & call_back)
+        {
+            return start_channel(url, rid, tcp_port, udp_port, call_back);
+        }
+
+        LiveManager::ChannelHandle LiveManager::start_channel(
+            std::string const & url, 
             boost::uint16_t tcp_port, 
             boost::uint16_t udp_port, 
-            call_back_func const & call_back)
-        {
-            std::string url_decode = pptv::base64_decode(url.substr(1), JUST_LIVE_KEY);
-            std::string rid;
-            if (!url_decode.empty()) {
-                map_find(url_decode, "channel", rid, "&");
-            }
-            if (rid.empty()) {
-                io_svc().post(
-                    boost::bind(call_back, logic_error::failed_some, std::string()));
-                return ChannelHandle(NULL);
-            }
-
-            LOG_INFO("[start_channel] rid: " << rid);
-            Channel * channel = NULL;
-            for (size_t i = 0; i < channels_.size(); ++i) 
-            {
-                if (channels_[i]->rid == rid) 
-                {
-                    channel = channels_[i];
-                    assert(NULL != channel);
-                    channel->expire = 0;
-
-                    //˿ڵıȶ
-                    if(tcp_port != 0 && udp_port != 0  && (tcp_port != channel->tcp_port || udp_port != channel->udp_port))
-                    {
-                        LOG_INFO("[re_start_channel] old channel: " << (void *)channel);
-                        //ɾɵƵ
-                        stop_channel(channels_[i]);
-
-                        //Ƶ
-                        channels_.erase(
-                            std::remove(channels_.begin(), channels_.end(), (Channel *)0), channels_.end());
-
-                        //´򿪸Ƶ
-                        return start_channel(url,tcp_port,udp_port,call_back);       
-                    }
-
-                    LOG_INFO("[start_channel] old channel: " << (void *)channel);
-
-                    /*
-                    if ((channel->status == Channel::working  || channel->status == Channel::started) && (0 == channel->nref))
-                    {
-                    LOG_INFO("[change palce to front] status: " << (int)channel->status);
-                    channels_.erase(
-                    std::remove(channels_.begin(), channels_.end(),channel), channels_.end());
-
-                    channels_.insert(channels_.begin(), channel);
-                    }*/
-                    break;
-                }
-            }
-            if (channel == NULL) {
-                channel = new Channel;
-                channel->url = url;
-                channel->rid = rid;
-                channel->tcp_port = tcp_port;
-                channel->udp_port = udp_port;
-                channel->handle = live_module_.start_channel(
-                    url, tcp_port, udp_port, 
-                    boost::bind(&LiveManager::handle_start_channel, this, channel, _1, _2));
-                if (channel->handle == NULL) {
-                    io_svc().post(
-                        boost::bind(call_back, logic_error::failed_some, channel->url2));
-                    delete channel;
-                    return ChannelHandle(NULL);
-                }
-                LOG_INFO("[start_channel] new channel: " << (void *)channel);
-                /*std::vector<Channel *>::iterator iter = 
-                std::find_if(channels_.begin(), channels_.end(), find_channel_not_active());
-                channels_.insert(iter, channel);*/
-                channels_.push_back(channel);
-            }
-            ++channel->nref;
-            ChannelHandle handle(channel);
-            if (channel->status == Channel::working) {
-                io_svc().post(
-                    boost::bind(call_back, channel->ec, channel->url2));
-            }else {
-                channel->call_backs.push_back(call_back);
-                handle.cancel_token = channel->call_backs.size();
-            }
-            check_parallel();
-            return handle;
-        }
-
-        void LiveManager::stop_channel(
-            ChannelHandle & handle)
-        {
-            Channel * channel = handle.channel;
-            handle.channel = NULL;
-            if (channel == NULL)
-                return;
-            LOG_INFO("[stop_channel] rid: " << channel->rid << ", channel: " << (void *)channel);
-            if (handle.cancel_token && handle.cancel_token < channel->call_backs.size() + 1) {
-                call_back_func call_back;
-                call_back.swap(channel->call_backs[handle.cancel_token - 1]);
-                io_svc().post(boost::bind(
-                    call_back, boost::asio::error::operation_aborted, std::string()));
-            }
-            assert(channel && channel->nref > 0);
-            if (channel && --channel->nref == 0)
-            {
-                if (!find_channel_stopped()(channel)) 
+            call_back_func const & call_back)
+        {
+            // a copy, the cache slot may be taken by another url meanwhile
+            std::string rid = rid_cache_.rid_of(url);
+            stat_.url_hit = rid_cache_.hit();
+            return start_channel(url, rid, tcp_port, udp_port, call_back);
+        }
+
+        LiveManager::ChannelHandle LiveManager::start_channel(
+            std::string const & url, 
+            std::string const & rid, 
+            boost::uint16_t tcp_port, 
+            boost::uint16_t udp_port, 
+            call_back_func const & call_back)
+        {
+            if (rid.empty()) {
+                io_svc().post(
+                    boost::bind(call_back, logic_error::failed_some, std::string()));
+                return ChannelHandle(NULL);
+            }
+
+            LOG_INFO("[start_channel] rid: " << rid);
+            Channel * channel = NULL;
+            boost::unordered_map<std::string, Channel *>::iterator iter = channels_.find(rid);
+            if (iter != channels_.end()) {
+                channel = iter->second;
+                assert(NULL != channel);
+
+                //端口的比对
+                if(tcp_port != 0 && udp_port != 0  && (tcp_port != channel->tcp_port || udp_port != channel->udp_port))
                 {
-                    channel->expire = 10;
-                    channels_.erase(std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
-                    channels_.insert(channels_.begin(),channel);  //Ƶǰ
+                    LOG_INFO("[re_start_channel] old channel: " << (void *)channel);
+                    //删除旧的频道
+                    stop_channel(channel);
+
+                    //重新打开该频道
+                    return start_channel(url,rid,tcp_port,udp_port,call_back);       
+                }
+
+                LOG_INFO("[start_channel] old channel: " << (void *)channel);
+                if (channel->prewarmed) {
+                    channel->prewarmed = false;
+                    ++stat_.prewarm_hit;
                 }
+                if (channel->nref == 0) {
+                    idle_remove(channel);
+                    keep_policy_->on_busy(rid);
+                    ++stat_.idle_hit;
+                }
+                ++stat_.hit;
+            } else {
+                Failure const * failure = find_failure(rid);
+                if (failure) {
+                    LOG_INFO("[start_channel] failed recently, rid: " << rid << ", count: " << failure->count);
+                    ++stat_.fail_hit;
+                    io_svc().post(
+                        boost::bind(call_back, failure->ec, std::string()));
+                    return ChannelHandle(NULL);
+                }
+                channel = new Channel;
+                channel->url = url;
+                channel->rid = rid;
+                channel->tcp_port = tcp_port;
+                channel->udp_port = udp_port;
+                channel->handle = live_module_.start_channel(
+                    url, tcp_port, udp_port, 
+                    boost::bind(&LiveManager::handle_start_channel, this, channel, _1, _2));
+                if (channel->handle == NULL) {
+                    record_failure(rid, logic_error::failed_some);
+                    io_svc().post(
+                        boost::bind(call_back, logic_error::failed_some, channel->url2));
+                    delete channel;
+                    return ChannelHandle(NULL);
+                }
+                LOG_INFO("[start_channel] new channel: " << (void *)channel);
+                channels_[rid] = channel;
+                ++stat_.miss;
+            }
+            keep_policy_->on_request(rid);
+            idle_estimator_->on_request(rid, now_msec());
+            warm_snapshot_->on_request(rid, url, tcp_port, udp_port, now_msec());
+            ++channel->nref;
+            ChannelHandle handle(channel);
+            if (channel->status == Channel::working) {
+                io_svc().post(
+                    boost::bind(call_back, channel->ec, channel->url2));
+            }else {
+                Waiter * waiter = alloc_waiter();
+                waiter->call_back = call_back;
+                waiter->channel = channel;
+                waiter->prev = channel->last_waiter;
+                if (channel->last_waiter)
+                    channel->last_waiter->next = waiter;
                 else
+                    channel->first_waiter = waiter;
+                channel->last_waiter = waiter;
+                handle.waiter = waiter;
+                handle.waiter_seq = waiter->seq;
+            }
+            check_parallel();
+            return handle;
+        }
+
+        void LiveManager::stop_channel(
+            ChannelHandle & handle)
+        {
+            Channel * channel = handle.channel;
+            handle.channel = NULL;
+            if (channel == NULL)
+                return;
+            LOG_INFO("[stop_channel] rid: " << channel->rid << ", channel: " << (void *)channel);
+            Waiter * waiter = handle.waiter;
+            handle.waiter = NULL;
+            if (waiter && waiter->seq == handle.waiter_seq && waiter->channel == channel) {
+                if (waiter->prev)
+                    waiter->prev->next = waiter->next;
+                else
+                    channel->first_waiter = waiter->next;
+                if (waiter->next)
+                    waiter->next->prev = waiter->prev;
+                else
+                    channel->last_waiter = waiter->prev;
+                call_back_func call_back;
+                call_back.swap(waiter->call_back);
+                free_waiter(waiter);
+                io_svc().post(boost::bind(
+                    call_back, boost::asio::error::operation_aborted, std::string()));
+            }
+            assert(channel->nref > 0);
+            if (--channel->nref == 0)
+            {
+                if (channel->status == Channel::started 
+                    || channel->status == Channel::working 
+                    || channel->status == Channel::restarting) 
                 {
-                    //stop_channel   
+                    idle_estimator_->on_release(channel->rid, now_msec());
+                    boost::uint32_t ttl = choose_idle_ttl(channel->rid);
+                    LOG_INFO("[stop_channel] idle channel: " << (void *)channel << ", ttl: " << ttl);
+                    stat_.idle_ttl = ttl;
+                    idle_add(channel, ttl);
+                    keep_policy_->on_idle(channel->rid);
                 }
-            }
-            check_parallel();
-            return;
-        }
-
-        void LiveManager::check_parallel()
-        {
-
-            int iUserSize = 0;
-            iUserSize = count_if(channels_.begin(),channels_.end(),find_channel_working());
-            LOG_INFO("[check_parallel] max_parallel_: " << max_parallel_ << ", iUserSize: " << iUserSize);
-
-            int iLeftSize = ((max_parallel_ - iUserSize)<0)?0:(max_parallel_ - iUserSize); 
-            int iFindCount = 0;
-
-            for(size_t i = 0; i < channels_.size(); ++i )
-            {
-                if(0 == channels_[i]->nref)
-                {
-                    if( channels_[i]->status == LiveManager::Channel::cancel 
-                        || channels_[i]->status == LiveManager::Channel::stopped )
-                    {
-                        stop_channel(channels_[i]);
-                    }
-                    else
-                    {
-                        ++iFindCount;
-                        if(iFindCount > iLeftSize)
-                        {
-                            stop_channel(channels_[i]);
-                        }
-                    }
-                }
-            }
-
-            channels_.erase(
-                std::remove(channels_.begin(), channels_.end(), (Channel *)0), channels_.end());
-        }
-
-        struct find_channel_not_failed
-        {
-            bool operator()(LiveManager::Channel * channel) {
-                return std::find(failed.begin(), failed.end(), channel->handle) == failed.end(); }
-            std::vector<LiveModuleProxy::ChannelHandle> failed;
-        };
-
-        void LiveManager::handle_timer(
-            error_code const & ec)
-        {
-            LOG_SECTION();
-
-            if (!get_daemon().is_started()) {
-                return;
-            }
-
-            live_module_.dump_channels();
-
-            find_channel_not_failed finder;
-            if (live_module_.check_channels(finder.failed)) {
-                std::vector<Channel *>::iterator working_end = 
-                    std::find_if(channels_.begin(), channels_.end(), find_channel_stopped());
-                std::vector<Channel *>::iterator failed_beg = 
-                    std::stable_partition(channels_.begin(), working_end, finder);
-                for (; failed_beg != working_end; ++failed_beg) {
-                    LOG_INFO("[handle_timer] channel failed: " << (void *)*failed_beg);
-                    stop_channel(*failed_beg);
+                else if (channel->status == Channel::stopped)
+                {
+                    LOG_WARN("[stop_channel] deleted channel " << (void *)channel);
+                    delete channel;
+                }
+                // cancel: deleted when kernel call back arrives
+            }
+            check_parallel();
+            return;
+        }
+
+        void LiveManager::check_parallel()
+        {
+            size_t user_size = channels_.size() - idle_count_;
+            size_t left_size = (max_parallel_ > user_size) ? (max_parallel_ - user_size) : 0;
+            LOG_INFO("[check_parallel] max_parallel_: " << max_parallel_ << ", user_size: " << user_size);
+
+            while (idle_count_ > left_size) {
+                boost::unordered_map<std::string, Channel *>::iterator iter = 
+                    channels_.find(keep_policy_->victim());
+                assert(iter != channels_.end() && iter->second->nref == 0);
+                Channel * channel = iter->second;
+                LOG_INFO("[check_parallel] evict channel: " << (void *)channel << ", rid: " << channel->rid);
+                ++stat_.evict;
+                stop_channel(channel);
+            }
+        }
+
+        void LiveManager::handle_timer(
+            error_code const & ec)
+        {
+            LOG_SECTION();
+
+            // aborted by arm_timer, armed_tick_ is of the new wait
+            if (ec) {
+                return;
+            }
+
+            armed_tick_ = 0;
+            if (!get_daemon().is_started()) {
+                return;
+            }
+
+            boost::uint64_t now = tick_after(0);
+            while (!expire_queue_.empty() && expire_queue_.begin()->first <= now) {
+                Channel * channel = expire_queue_.begin()->second;
+                LOG_INFO("[handle_timer] channel expired: " << (void *)channel);
+                ++stat_.idle_expire;
+                stop_channel(channel);
+            }
+
+            if (!expire_queue_.empty()) {
+                arm_timer(expire_queue_.begin()->first);
+            }
+        }
+
+        void LiveManager::handle_check_timer(
+            error_code const & ec)
+        {
+            if (ec || !get_daemon().is_started()) {
+                return;
+            }
+
+            // how late this handler runs shows how busy the io thread is
+            boost::uint64_t now = now_msec();
+            stat_.loop_lag = now > check_time_ ? (boost::uint32_t)(now - check_time_) : 0;
+            if (stat_.max_loop_lag < stat_.loop_lag)
+                stat_.max_loop_lag = stat_.loop_lag;
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            live_module_.check_children();
+#endif
+            if (dump_interval_ && dump_time_ <= now) {
+                dump_time_ = now + dump_interval_;
+                live_module_.dump_channels();
+            }
+
+            prewarm_some();
+
+            while (!restart_queue_.empty() && restart_queue_.begin()->first <= now) {
+                Channel * channel = restart_queue_.begin()->second;
+                restart_queue_.erase(restart_queue_.begin());
+                channel->restart_iter = restart_queue_.end();
+                restart_channel(channel);
+            }
+
+            check_time_ = now + check_interval_;
+            check_timer_.expires_from_now(Duration::milliseconds(check_interval_));
+            check_timer_.async_wait(boost::bind(&LiveManager::handle_check_timer, this, _1));
+        }
+
+        // failures are rare, a scan of channels is fine
+        template <typename Handle>
+        void LiveManager::handle_channels_failed(
+            std::vector<Handle> const & failed)
+        {
+            std::vector<Channel *> failed_channels;
+            boost::unordered_map<std::string, Channel *>::const_iterator iter = channels_.begin();
+            for (; iter != channels_.end(); ++iter) {
+                if (std::find(failed.begin(), failed.end(), iter->second->handle) != failed.end())
+                    failed_channels.push_back(iter->second);
+            }
+            for (size_t i = 0; i < failed_channels.size(); ++i) {
+                Channel * channel = failed_channels[i];
+                LOG_INFO("[handle_channels_failed] channel failed: " << (void *)channel);
+                ++stat_.crash;
+                boost::uint32_t delay = record_crash(channel->rid);
+                // the kernel channel is gone, release its handle; new
+                // requests wait on the channel like on a first start, and
+                // waiters of one lost while starting stay for the restart
+                live_module_.stop_channel(channel->handle);
+                channel->handle = NULL;
+                channel->status = Channel::restarting;
+                channel->restart_iter = restart_queue_.end();
+                if (channel->nref == 0) {
+                    // nobody watching, not worth a restart
+                    stop_channel(channel);
+                    continue;
+                }
+                if (delay == (boost::uint32_t)-1) {
+                    ++stat_.restart_give_up;
+                    response_channel(channel, logic_error::failed_some, std::string());
+                    record_failure(channel->rid, logic_error::failed_some);
+                    stop_channel(channel);
+                    continue;
+                }
+                channel->crash_time = now_msec();
+                if (delay == 0) {
+                    restart_channel(channel);
+                } else {
+                    // resolution of check timer is fine for backoff
+                    channel->restart_iter = restart_queue_.insert(
+                        std::make_pair(channel->crash_time + delay, channel));
+                }
+            }
+        }
+
+        // same rid and ports as before crash, waiters stay on channel
+        void LiveManager::restart_channel(
+            Channel * channel)
+        {
+            LOG_INFO("[restart_channel] rid: " << channel->rid << ", channel: " << (void *)channel);
+            ++stat_.restart;
+            channel->status = Channel::started;
+            channel->handle = live_module_.start_channel(
+                channel->url, channel->tcp_port, channel->udp_port, 
+                boost::bind(&LiveManager::handle_start_channel, this, channel, _1, _2));
+            if (channel->handle == NULL) {
+                channel->status = Channel::restarting;
+                response_channel(channel, logic_error::failed_some, std::string());
+                record_failure(channel->rid, logic_error::failed_some);
+                stop_channel(channel);
+            }
+        }
+
+        void LiveManager::snapshot(
+            size_t count, 
+            std::vector<WarmSnapshot::Item> & items) const
+        {
+            warm_snapshot_->top(count, now_msec(), items);
+        }
+
+        void LiveManager::prewarm(
+            std::vector<WarmSnapshot::Item> const & items)
+        {
+            prewarm_queue_.insert(prewarm_queue_.end(), items.begin(), items.end());
+            prewarm_some();
+        }
+
+        // a prewarmed channel never evicts another one, it waits idle for
+        // idle_ttl_max like one just released
+        void LiveManager::prewarm_some()
+        {
+            size_t count = 0;
+            while (count < prewarm_batch_ && !prewarm_queue_.empty()) {
+                if (channels_.size() >= max_parallel_) {
+                    LOG_INFO("[prewarm_some] no room, skipped: " << prewarm_queue_.size());
+                    prewarm_queue_.clear();
+                    break;
+                }
+                WarmSnapshot::Item item = prewarm_queue_.front();
+                prewarm_queue_.pop_front();
+                std::string rid = rid_cache_.rid_of(item.url);
+                if (rid.empty() || channels_.find(rid) != channels_.end() || find_failure(rid))
+                    continue;
+                Channel * channel = new Channel;
+                channel->url = item.url;
+                channel->rid = rid;
+                channel->tcp_port = item.tcp_port;
+                channel->udp_port = item.udp_port;
+                channel->prewarmed = true;
+                channel->handle = live_module_.start_channel(
+                    channel->url, channel->tcp_port, channel->udp_port, 
+                    boost::bind(&LiveManager::handle_start_channel, this, channel, _1, _2));
+                if (channel->handle == NULL) {
+                    delete channel;
+                    continue;
                 }
+                LOG_INFO("[prewarm_some] rid: " << channel->rid << ", rate: " << item.rate);
+                channels_[channel->rid] = channel;
+                keep_policy_->on_request(channel->rid);
+                keep_policy_->on_idle(channel->rid);
+                idle_add(channel, idle_ttl_max_);
+                ++stat_.prewarm;
+                ++count;
+            }
+        }
+
+        boost::uint32_t LiveManager::record_crash(
+            std::string const & rid)
+        {
+            boost::uint64_t now = now_msec();
+            std::pair<boost::unordered_map<std::string, Crash>::iterator, bool> result = 
+                crashes_.insert(std::make_pair(rid, Crash()));
+            Crash & crash = result.first->second;
+            if (result.second) {
+                crash_order_.push_front(rid);
+            } else {
+                crash_order_.splice(crash_order_.begin(), crash_order_, crash.order);
+            }
+            crash.order = crash_order_.begin();
+            while (crashes_.size() > keep_history_ && crashes_.size() > 1) {
+                crashes_.erase(crash_order_.back());
+                crash_order_.pop_back();
             }
-
-            for (size_t i = 0; i < channels_.size(); ++i) {
-                if (channels_[i] && channels_[i]->nref == 0 && --channels_[i]->expire == 0) {
-                    stop_channel(channels_[i]);
-                }
-            }
-            channels_.erase(
-                std::remove(channels_.begin(), channels_.end(), (Channel *)0), channels_.end());
-            timer_.expires_from_now(Duration::seconds(1));
-            timer_.async_wait(boost::bind(&LiveManager::handle_timer, this, _1));
-        }
-
-        void LiveManager::handle_start_channel(
-            Channel * channel, 
-            error_code const & ec, 
-            std::string const & url)
-        {
-            std::vector<Channel *>::iterator iter = std::find(channels_.begin(), channels_.end(), channel);
-            if ( iter == channels_.end()) {
-                LOG_WARN("[handle_call_back_innner] already deleted channel " << (void *)channel);
-                return;
-            }
-            if (channel->status == Channel::cancel) {
-                channel->status = Channel::stopped;
-                stop_channel(*iter);
-                channels_.erase(
-                    std::remove(channels_.begin(), channels_.end(), (Channel *)0), channels_.end());
-            } else {
-                channel->status = Channel::working;
-                response_channel(channel, ec, url);
-            }
-        }
-
-        void LiveManager::response_channel(
-            Channel * channel, 
-            error_code const & ec, 
-            std::string const & url)
-        {
-            channel->ec = ec;
+            ++crash.count;
+            if (crash.window_count == 0 || crash.window_start + restart_window_ <= now) {
+                crash.window_start = now;
+                crash.window_count = 0;
+            }
+            ++crash.window_count;
+            LOG_WARN("[record_crash] rid: " << rid << ", count: " << crash.count << ", in window: " << crash.window_count);
+            if (crash.window_count > restart_max_)
+                return (boost::uint32_t)-1;
+            // first restart at once, then doubled from restart_backoff
+            boost::uint64_t delay = 0;
+            if (crash.window_count > 1) {
+                delay = restart_backoff_;
+                for (boost::uint32_t i = 2; i < crash.window_count && delay < restart_backoff_max_; ++i)
+                    delay *= 2;
+                if (delay > restart_backoff_max_)
+                    delay = restart_backoff_max_;
+            }
+            return (boost::uint32_t)delay;
+        }
+
+        boost::uint32_t LiveManager::crash_count(
+            std::string const & rid) const
+        {
+            boost::unordered_map<std::string, Crash>::const_iterator iter = crashes_.find(rid);
+            return iter == crashes_.end() ? 0 : iter->second.count;
+        }
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+        // nothing changes here until commit_hand_over
+        void LiveManager::hand_over(
+            HandOver & hand_over)
+        {
+            live_module_.hand_over(hand_over);
+            boost::unordered_map<void *, Channel *> handles;
+            boost::unordered_map<std::string, Channel *>::const_iterator iter = channels_.begin();
+            for (; iter != channels_.end(); ++iter) {
+                if (iter->second->status == Channel::working)
+                    handles[iter->second->handle] = iter->second;
+            }
+            for (size_t i = 0; i < hand_over.children.size(); ++i) {
+                std::vector<HandOver::Channel> & channels = hand_over.children[i].channels;
+                for (size_t j = 0; j < channels.size(); ++j) {
+                    HandOver::Channel & channel2 = channels[j];
+                    boost::unordered_map<void *, Channel *>::iterator iter2 = handles.find(channel2.handle);
+                    if (iter2 == handles.end())
+                        continue; // rid left empty, new process stops it
+                    Channel * channel = iter2->second;
+                    channel2.rid = channel->rid;
+                    channel2.url = channel->url;
+                    channel2.url2 = channel->url2;
+                    channel2.nref = channel->nref;
+                    LOG_INFO("[hand_over] rid: " << channel->rid << ", nref: " << channel->nref);
+                }
+            }
+        }
+
+        // a channel stopped since hand_over is no more in channels_, and
+        // its handle is gone with it
+        void LiveManager::commit_hand_over(
+            HandOver & hand_over, 
+            bool done)
+        {
+            live_module_.commit_hand_over(done);
+            boost::unordered_map<void *, Channel *> handles;
+            boost::unordered_map<std::string, Channel *>::const_iterator iter = channels_.begin();
+            for (; iter != channels_.end(); ++iter) {
+                if (iter->second->status == Channel::working)
+                    handles[iter->second->handle] = iter->second;
+            }
+            for (size_t i = 0; i < hand_over.children.size(); ++i) {
+                std::vector<HandOver::Channel> & channels = hand_over.children[i].channels;
+                for (size_t j = 0; j < channels.size(); ++j) {
+                    HandOver::Channel & channel2 = channels[j];
+                    boost::unordered_map<void *, Channel *>::iterator iter2 = handles.find(channel2.handle);
+                    channel2.handle = NULL;
+                    if (!done || iter2 == handles.end() || iter2->second->rid != channel2.rid)
+                        continue;
+                    Channel * channel = iter2->second;
+                    live_module_.stop_channel(channel->handle);
+                    LOG_INFO("[commit_hand_over] rid: " << channel->rid << ", nref: " << channel->nref);
+                    channels_.erase(channel->rid);
+                    keep_policy_->on_drop(channel->rid);
+                    if (channel->nref == 0) {
+                        idle_remove(channel);
+                        delete channel;
+                    } else {
+                        // clients go on with url2, deleted when released
+                        channel->status = Channel::stopped;
+                        channel->handle = NULL;
+                        channel->rid.clear();
+                    }
+                }
+            }
+        }
+
+        void LiveManager::take_over(
+            HandOver & hand_over, 
+            boost::uint32_t ttl)
+        {
+            live_module_.take_over(hand_over);
+            for (size_t i = 0; i < hand_over.children.size(); ++i) {
+                std::vector<HandOver::Channel> & channels = hand_over.children[i].channels;
+                for (size_t j = 0; j < channels.size(); ++j) {
+                    HandOver::Channel & channel2 = channels[j];
+                    if (channel2.handle == NULL)
+                        continue;
+                    LiveModuleProxy::ChannelHandle handle = (LiveModuleProxy::ChannelHandle)channel2.handle;
+                    channel2.handle = NULL;
+                    if (channel2.rid.empty() || channels_.find(channel2.rid) != channels_.end()) {
+                        live_module_.stop_channel(handle);
+                        continue;
+                    }
+                    Channel * channel = new Channel;
+                    channel->url = channel2.url;
+                    channel->rid = channel2.rid;
+                    channel->tcp_port = (boost::uint16_t)channel2.tcp_port;
+                    channel->udp_port = (boost::uint16_t)channel2.udp_port;
+                    channel->handle = handle;
+                    channel->status = Channel::working;
+                    channel->url2 = channel2.url2;
+                    channels_[channel->rid] = channel;
+                    // known to keep policy as a channel just released
+                    keep_policy_->on_request(channel->rid);
+                    keep_policy_->on_idle(channel->rid);
+                    boost::uint32_t ttl2 = choose_idle_ttl(channel->rid);
+                    idle_add(channel, ttl2 < ttl ? ttl : ttl2);
+                    LOG_INFO("[take_over] rid: " << channel->rid << ", nref in old: " << channel2.nref);
+                }
+            }
+            check_parallel();
+        }
+
+#endif
+
+        void LiveManager::handle_start_channel(
+            Channel * channel, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            if (channel->status == Channel::cancel) {
+                channel->status = Channel::stopped;
+                if (channel->nref == 0) {
+                    LOG_WARN("[handle_start_channel] deleted channel " << (void *)channel);
+                    delete channel;
+                }
+            } else {
+                channel->status = Channel::working;
+                response_channel(channel, ec, url);
+                if (ec) {
+                    // waiters coalesced on this start all get the failure,
+                    // later requests are answered by failure cache
+                    record_failure(channel->rid, ec);
+                    stop_channel(channel);
+                } else {
+                    erase_failure(channel->rid);
+                    if (channel->crash_time) {
+                        ++stat_.recover;
+                        stat_.recover_time += now_msec() - channel->crash_time;
+                        stat_.mttr = (boost::uint32_t)(stat_.recover_time / stat_.recover);
+                        channel->crash_time = 0;
+                    }
+                }
+            }
+        }
+
+        LiveManager::Failure const * LiveManager::find_failure(
+            std::string const & rid) const
+        {
+            boost::unordered_map<std::string, Failure>::const_iterator iter = failures_.find(rid);
+            if (iter == failures_.end() || iter->second.retry_time <= now_msec())
+                return NULL; // time to retry
+            return &iter->second;
+        }
+
+        void LiveManager::record_failure(
+            std::string const & rid, 
+            error_code const & ec)
+        {
+            boost::uint64_t now = now_msec();
+            std::pair<boost::unordered_map<std::string, Failure>::iterator, bool> result = 
+                failures_.insert(std::make_pair(rid, Failure()));
+            Failure & failure = result.first->second;
+            if (result.second) {
+                failure_order_.push_front(rid);
+            } else {
+                failure_order_.splice(failure_order_.begin(), failure_order_, failure.order);
+            }
+            failure.order = failure_order_.begin();
+            // oldest evicted even if not expired, the cache is bounded
+            while (failures_.size() > keep_history_ && failures_.size() > 1) {
+                failures_.erase(failure_order_.back());
+                failure_order_.pop_back();
+            }
+            ++failure.count;
+            failure.ec = ec;
+            boost::uint64_t backoff = fail_backoff_min_;
+            for (boost::uint32_t i = 1; i < failure.count && backoff < fail_backoff_max_; ++i)
+                backoff *= 2;
+            if (backoff > fail_backoff_max_)
+                backoff = fail_backoff_max_;
+            // jitter in [-1/4, 1/4] of backoff, spread retries of many workers
+            if (backoff >= 4)
+                backoff = backoff - backoff / 4 + (boost::uint64_t)rand_() % (backoff / 2 + 1);
+            failure.retry_time = now + backoff;
+            ++stat_.fail;
+            LOG_INFO("[record_failure] rid: " << rid << ", count: " << failure.count << ", retry after: " << backoff);
+        }
+
+        void LiveManager::erase_failure(
+            std::string const & rid)
+        {
+            boost::unordered_map<std::string, Failure>::iterator iter = failures_.find(rid);
+            if (iter != failures_.end()) {
+                failure_order_.erase(iter->second.order);
+                failures_.erase(iter);
+            }
+        }
+
+        void LiveManager::response_channel(
+            Channel * channel, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            channel->ec = ec;
             channel->url2 = url;
-            std::vector<call_back_func> call_backs;
-            call_backs.swap(channel->call_backs);
-            for (size_t i = 0; i < call_backs.size(); ++i) {
-                if (!call_backs[i].empty())
-                    io_svc().post(
-                    boost::bind(call_backs[i], ec, url));
-            }
-        }
-
-        void LiveManager::stop_channel(
-            Channel *& channel)
+            Waiter * waiters = channel->first_waiter;
+            if (waiters == NULL)
+                return;
+            channel->first_waiter = channel->last_waiter = NULL;
+            for (Waiter * waiter = waiters; waiter; waiter = waiter->next)
+                waiter->channel = NULL;
+            // wake all waiters with one post
+            io_svc().post(
+                boost::bind(&LiveManager::handle_response, this, waiters, ec, url));
+        }
+
+        void LiveManager::handle_response(
+            Waiter * waiters, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            while (waiters) {
+                Waiter * waiter = waiters;
+                waiters = waiter->next;
+                call_back_func call_back;
+                call_back.swap(waiter->call_back);
+                free_waiter(waiter);
+                call_back(ec, url);
+            }
+        }
+
+        LiveManager::Waiter * LiveManager::alloc_waiter()
+        {
+            Waiter * waiter = free_waiters_;
+            if (waiter) {
+                free_waiters_ = waiter->next;
+                waiter->next = NULL;
+            } else {
+                waiter = new Waiter;
+                ++stat_.waiter_alloc;
+            }
+            return waiter;
+        }
+
+        void LiveManager::free_waiter(
+            Waiter * waiter)
+        {
+            ++waiter->seq;
+            waiter->channel = NULL;
+            waiter->prev = NULL;
+            waiter->next = free_waiters_;
+            free_waiters_ = waiter;
+        }
+
+        void LiveManager::stop_channel(
+            Channel *& channel)
         {
             if(NULL == channel)
             {
                 LOG_WARN("[stop_channel NULL == channel]");
                 return;    
-            }
-            if (channel->status == Channel::started) {
-                channel->status = Channel::cancel;
-                response_channel(channel, boost::asio::error::operation_aborted, std::string());
-                live_module_.stop_channel(channel->handle);
-                channel->handle = NULL;
-                channel->rid.clear();
+            }
+            if (channel->status == Channel::started 
+                || channel->status == Channel::working 
+                || channel->status == Channel::restarting) {
+                channels_.erase(channel->rid);
+                if (channel->nref == 0)
+                    idle_remove(channel);
+                keep_policy_->on_drop(channel->rid);
+            }
+            if (channel->status == Channel::started) {
+                channel->status = Channel::cancel;
+                response_channel(channel, boost::asio::error::operation_aborted, std::string());
+                live_module_.stop_channel(channel->handle);
+                channel->handle = NULL;
+                channel->rid.clear();
                 return;
-            } else if (channel->status == Channel::working) {
-                channel->status = Channel::stopped;
-                live_module_.stop_channel(channel->handle);
-                channel->handle = NULL;
-                channel->rid.clear();
-            } else if (channel->status == Channel::cancel) {
+            } else if (channel->status == Channel::working) {
+                channel->status = Channel::stopped;
+                live_module_.stop_channel(channel->handle);
+                channel->handle = NULL;
+                channel->rid.clear();
+            } else if (channel->status == Channel::restarting) {
+                // no kernel channel until restarted
+                channel->status = Channel::stopped;
+                if (channel->restart_iter != restart_queue_.end())
+                    restart_queue_.erase(channel->restart_iter);
+                response_channel(channel, boost::asio::error::operation_aborted, std::string());
+                channel->rid.clear();
+            } else if (channel->status == Channel::cancel) {
                 return;
-            }
-            LOG_WARN("[kill_chancel] channel" << (void *)channel<<" status:"<<channel->status<<" nref:"<<channel->nref);
+            }
+            LOG_WARN("[kill_chancel] channel" << (void *)channel<<" status:"<<channel->status<<" nref:"<<channel->nref);
             if (channel->nref == 0) 
             { 
                 LOG_WARN("[kill_chancel] deleted channel " << (void *)channel<<" channel count:"<<channels_.size());
-                delete channel;
-                channel = NULL;
-            }
-        }
-
-    } // namespace live_worker
-} // namespace just
+                delete channel;
+                channel = NULL;
+            }
+        }
+
+        void LiveManager::idle_add(
+            Channel * channel,
+            boost::uint32_t ttl)
+        {
+            ++idle_count_;
+            schedule_expire(channel, ttl);
+        }
+
+        void LiveManager::idle_remove(
+            Channel * channel)
+        {
+            --idle_count_;
+            cancel_expire(channel);
+        }
+
+        boost::uint32_t LiveManager::choose_idle_ttl(
+            std::string const & rid) const
+        {
+            boost::uint64_t expect = idle_estimator_->estimate(rid);
+            if (expect == 0)
+                return idle_ttl_;
+            // not likely requested again within budget, release soon
+            if (expect > idle_ttl_max_)
+                return idle_ttl_min_;
+            if (expect < idle_ttl_min_)
+                return idle_ttl_min_;
+            return (boost::uint32_t)expect;
+        }
+
+        boost::uint64_t LiveManager::now_msec() const
+        {
+            return clock_timer::traits_type::subtract(
+                clock_timer::traits_type::now(), start_time_).total_milliseconds();
+        }
+
+        boost::uint64_t LiveManager::tick_after(
+            boost::uint32_t msec) const
+        {
+            return (now_msec() + msec + expire_resolution_ - 1) / expire_resolution_;
+        }
+
+        void LiveManager::schedule_expire(
+            Channel * channel,
+            boost::uint32_t msec)
+        {
+            assert(channel->expire == 0);
+            channel->expire = tick_after(msec);
+            if (channel->expire == 0)
+                channel->expire = 1;
+            channel->expire_iter = expire_queue_.insert(
+                std::make_pair(channel->expire, channel));
+            if (armed_tick_ == 0 || channel->expire < armed_tick_) {
+                arm_timer(channel->expire);
+            }
+        }
+
+        void LiveManager::cancel_expire(
+            Channel * channel)
+        {
+            if (channel->expire == 0)
+                return;
+            expire_queue_.erase(channel->expire_iter);
+            channel->expire = 0;
+            // the timer is left armed, it re-arms for the next tick when fired
+        }
+
+        void LiveManager::arm_timer(
+            boost::uint64_t tick)
+        {
+            armed_tick_ = tick;
+            error_code ec;
+            timer_.expires_at(clock_timer::traits_type::add(start_time_, 
+                Duration::milliseconds(tick * expire_resolution_)), ec);
+            timer_.async_wait(boost::bind(&LiveManager::handle_timer, this, _1));
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -1,108 +1,392 @@
-// LiveManager.h
-
-#ifndef _JUST_LIVE_WORKER_LIVE_MANAGER_H_
-#define _JUST_LIVE_WORKER_LIVE_MANAGER_H_
-
-#include <framework/timer/TimeTraits.h>
-
-#include <boost/function.hpp>
-
-namespace just
-{
-    namespace live_worker
-    {
-
-#ifndef JUST_LIVE_WORKER_MULTI_PROCESS
-        class LiveModule;
-        typedef LiveModule LiveModuleProxy;
-#else
-        class LiveModuleProxy;
-#endif
-
-        class LiveManager
-            : public util::daemon::ModuleBase<LiveManager>
-        {
-        public:
-            struct Channel;
-
-            struct ChannelHandle
-            {
-                ChannelHandle(
-                    Channel * channel = NULL)
-                    : channel(channel)
-                    , cancel_token(0)
-                {
-                }
-
-                Channel * channel;
-                size_t cancel_token;
-            };
-
-            typedef boost::function<void (
-                boost::system::error_code const &, 
-                std::string const &)> call_back_func;
-
-        public:
-            LiveManager(
-                util::daemon::Daemon & daemon);
-
-            ~LiveManager();
-
-        public:
-            virtual bool startup(
-                boost::system::error_code & ec);
-
-            virtual bool shutdown(
-                boost::system::error_code & ec);
-
-        public:
-            void set_max_parallel(
-                size_t max_parallel);
-
-            ChannelHandle start_channel(
-                std::string const & url, 
-                call_back_func const & call_back);
-
-            ChannelHandle start_channel(
-                std::string const & url, 
-                boost::uint16_t tcp_port, 
-                boost::uint16_t udp_port, 
-                call_back_func const & call_back);
-
-            void stop_channel(
-                ChannelHandle & handle);
-
-        private:
-            void handle_timer(
-                boost::system::error_code const & ec);
-
-            void handle_start_channel(
-                Channel * channel, 
-                boost::system::error_code const & ec, 
-                std::string const & url);
-
-            void response_channel(
-                Channel * channel, 
-                boost::system::error_code const & ec, 
-                std::string const & url);
-
-            void stop_channel(
-                Channel *& channel);
-
-            void check_parallel();
-
-        private:
-            static boost::uint16_t const udp_port = 0;
-            static boost::uint16_t const tcp_port = 0;
-
-        private:
-            LiveModuleProxy & live_module_;
-            std::vector<Channel *> channels_;
-            size_t max_parallel_;
-            clock_timer timer_;
-        };
-
-    } // namespace live_worker
-} // namespace just
-
-#endif // _JUST_LIVE_WORKER_LIVE_MANAGER_H_
+// LiveManager.h
+
+#ifndef _JUST_LIVE_WORKER_LIVE_MANAGER_H_
+#define _JUST_LIVE_WORKER_LIVE_MANAGER_H_
+
+#include "just/live_worker/RidCache.h"
+#include "just/live_worker/WarmSnapshot.h"
+
+#include <framework/timer/TimeTraits.h>
+
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/random/linear_congruential.hpp>
+
+#include <map>
+#include <deque>
+#include <list>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+#ifndef JUST_LIVE_WORKER_MULTI_PROCESS
+        class LiveModule;
+        typedef LiveModule LiveModuleProxy;
+#else
+        class LiveModuleProxy;
+        struct HandOver;
+#endif
+
+        class KeepPolicy;
+        class IdleEstimator;
+
+        class LiveManager
+            : public util::daemon::ModuleBase<LiveManager>
+        {
+        public:
+            struct Channel;
+
+            struct Waiter;
+
+            struct ChannelHandle
+            {
+                ChannelHandle(
+                    Channel * channel = NULL)
+                    : channel(channel)
+                    , waiter(NULL)
+                    , waiter_seq(0)
+                {
+                }
+
+                Channel * channel;
+                Waiter * waiter;            // pending call back, for cancel
+                boost::uint32_t waiter_seq; // waiter is reused when seq changes
+            };
+
+            typedef boost::function<void (
+                boost::system::error_code const &, 
+                std::string const &)> call_back_func;
+
+            struct Statistics
+            {
+                Statistics()
+                    : hit(0)
+                    , miss(0)
+                    , evict(0)
+                    , idle_hit(0)
+                    , idle_expire(0)
+                    , idle_ttl(0)
+                    , fail(0)
+                    , fail_hit(0)
+                    , url_hit(0)
+                    , waiter_alloc(0)
+                    , loop_lag(0)
+                    , max_loop_lag(0)
+                    , crash(0)
+                    , restart(0)
+                    , restart_give_up(0)
+                    , recover(0)
+                    , recover_time(0)
+                    , mttr(0)
+                    , prewarm(0)
+                    , prewarm_hit(0)
+                {
+                }
+
+                boost::uint64_t hit;    // request served by a warm channel
+                boost::uint64_t miss;   // request started a new channel
+                boost::uint64_t evict;  // idle channel evicted by keep policy
+                boost::uint64_t idle_hit;       // idle channel requested again before expire
+                boost::uint64_t idle_expire;    // idle channel expired
+                boost::uint32_t idle_ttl;       // last chosen idle ttl, msec
+                boost::uint64_t fail;       // channel failed to start
+                boost::uint64_t fail_hit;   // request answered by failure cache
+                boost::uint64_t url_hit;    // rid found in url cache
+                boost::uint64_t waiter_alloc;   // waiter allocated from heap, not pool
+                boost::uint32_t loop_lag;       // delay of check timer, msec
+                boost::uint32_t max_loop_lag;
+                boost::uint64_t crash;          // working channel lost its kernel
+                boost::uint64_t restart;        // crashed channel started again
+                boost::uint64_t restart_give_up;    // crashed with restart budget used up
+                boost::uint64_t recover;        // restarted channel working again
+                boost::uint64_t recover_time;   // msec, sum over recovered
+                boost::uint32_t mttr;           // msec, mean time crash to working again
+                boost::uint64_t prewarm;        // channel started from warm snapshot
+                boost::uint64_t prewarm_hit;    // prewarmed channel requested
+
+                Statistics & operator+=(
+                    Statistics const & r)
+                {
+                    hit += r.hit;
+                    miss += r.miss;
+                    evict += r.evict;
+                    idle_hit += r.idle_hit;
+                    idle_expire += r.idle_expire;
+                    idle_ttl = r.idle_ttl;
+                    fail += r.fail;
+                    fail_hit += r.fail_hit;
+                    url_hit += r.url_hit;
+                    waiter_alloc += r.waiter_alloc;
+                    if (loop_lag < r.loop_lag)
+                        loop_lag = r.loop_lag;
+                    if (max_loop_lag < r.max_loop_lag)
+                        max_loop_lag = r.max_loop_lag;
+                    crash += r.crash;
+                    restart += r.restart;
+                    restart_give_up += r.restart_give_up;
+                    recover += r.recover;
+                    recover_time += r.recover_time;
+                    mttr = recover ? (boost::uint32_t)(recover_time / recover) : 0;
+                    prewarm += r.prewarm;
+                    prewarm_hit += r.prewarm_hit;
+                    return *this;
+                }
+            };
+
+        public:
+            LiveManager(
+                util::daemon::Daemon & daemon);
+
+            ~LiveManager();
+
+        public:
+            virtual bool startup(
+                boost::system::error_code & ec);
+
+            virtual bool shutdown(
+                boost::system::error_code & ec);
+
+        public:
+            void set_max_parallel(
+                size_t max_parallel);
+
+            ChannelHandle start_channel(
+                std::string const & url, 
+                call_back_func const & call_back);
+
+            // rid of url already known to caller, empty if url is not valid
+            ChannelHandle start_channel(
+                std::string const & url, 
+                std::string const & rid, 
+                call_back_func const & call_back);
+
+            ChannelHandle start_channel(
+                std::string const & url, 
+                boost::uint16_t tcp_port, 
+                boost::uint16_t udp_port, 
+                call_back_func const & call_back);
+
+            void stop_channel(
+                ChannelHandle & handle);
+
+            Statistics const & stat() const
+            {
+                return stat_;
+            }
+
+            // crashes of rid seen so far, 0 if none or forgotten
+            boost::uint32_t crash_count(
+                std::string const & rid) const;
+
+            // hottest count rids by request rate, for warm snapshot
+            void snapshot(
+                size_t count, 
+                std::vector<WarmSnapshot::Item> & items) const;
+
+            // start channels of items with no client, prewarm_batch at
+            // once and as many each check interval after, while there is
+            // room under max_parallel; they wait as idle channels
+            void prewarm(
+                std::vector<WarmSnapshot::Item> const & items);
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            // hot upgrade, see LiveUpgrade. Channels to pass out are only
+            // described in hand_over; once the new process is done with it,
+            // commit_hand_over drops them here without stopping kernel, ones
+            // with clients are kept until released, as if stopped. If not
+            // done, they stay with us.
+            void hand_over(
+                HandOver & hand_over);
+
+            void commit_hand_over(
+                HandOver & hand_over, 
+                bool done);
+
+            // channels passed in are working and idle, kept at least ttl
+            void take_over(
+                HandOver & hand_over, 
+                boost::uint32_t ttl);
+#endif
+
+        private:
+            void handle_timer(
+                boost::system::error_code const & ec);
+
+            void handle_check_timer(
+                boost::system::error_code const & ec);
+
+            // Handle is LiveModuleProxy::ChannelHandle, not complete here
+            template <typename Handle>
+            void handle_channels_failed(
+                std::vector<Handle> const & failed);
+
+            ChannelHandle start_channel(
+                std::string const & url, 
+                std::string const & rid, 
+                boost::uint16_t tcp_port, 
+                boost::uint16_t udp_port, 
+                call_back_func const & call_back);
+
+            void restart_channel(
+                Channel * channel);
+
+            void prewarm_some();
+
+            void handle_start_channel(
+                Channel * channel, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void response_channel(
+                Channel * channel, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void handle_response(
+                Waiter * waiters, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void stop_channel(
+                Channel *& channel);
+
+            void check_parallel();
+
+        private:
+            // waiter pool
+            Waiter * alloc_waiter();
+
+            void free_waiter(
+                Waiter * waiter);
+
+        private:
+            // failure cache: rids failed to start, not retried until backoff expires
+            struct Failure
+            {
+                Failure()
+                    : count(0)
+                    , retry_time(0)
+                {
+                }
+
+                boost::uint32_t count;
+                boost::uint64_t retry_time; // msec
+                boost::system::error_code ec;
+                std::list<std::string>::iterator order;
+            };
+
+            Failure const * find_failure(
+                std::string const & rid) const;
+
+            void record_failure(
+                std::string const & rid, 
+                boost::system::error_code const & ec);
+
+            void erase_failure(
+                std::string const & rid);
+
+        private:
+            // crash history of a rid, restarts are budgeted per window
+            struct Crash
+            {
+                Crash()
+                    : count(0)
+                    , window_start(0)
+                    , window_count(0)
+                {
+                }
+
+                boost::uint32_t count;
+                boost::uint64_t window_start;   // msec
+                boost::uint32_t window_count;   // crashes since window_start
+                std::list<std::string>::iterator order;
+            };
+
+            // delay before restart, (boost::uint32_t)-1 if budget used up
+            boost::uint32_t record_crash(
+                std::string const & rid);
+
+        private:
+            // idle channels: nref == 0, in expire queue; which one to evict
+            // is up to keep policy
+            void idle_add(
+                Channel * channel,
+                boost::uint32_t ttl);
+
+            void idle_remove(
+                Channel * channel);
+
+            boost::uint32_t choose_idle_ttl(
+                std::string const & rid) const;
+
+        private:
+            // expire queue: idle channels keyed by expire tick
+            boost::uint64_t now_msec() const;
+
+            boost::uint64_t tick_after(
+                boost::uint32_t msec) const;
+
+            void schedule_expire(
+                Channel * channel,
+                boost::uint32_t msec);
+
+            void cancel_expire(
+                Channel * channel);
+
+            void arm_timer(
+                boost::uint64_t tick);
+
+        private:
+            static boost::uint16_t const udp_port = 0;
+            static boost::uint16_t const tcp_port = 0;
+
+        private:
+            LiveModuleProxy & live_module_;
+            // only started/working channels are indexed, by rid
+            boost::unordered_map<std::string, Channel *> channels_;
+            RidCache rid_cache_;
+            Waiter * free_waiters_;
+            size_t idle_count_;
+            size_t max_parallel_;
+            std::string keep_policy_name_;
+            size_t keep_history_;
+            KeepPolicy * keep_policy_;
+            Statistics stat_;
+            IdleEstimator * idle_estimator_;
+            WarmSnapshot * warm_snapshot_;
+            boost::uint32_t rate_half_life_;    // msec, of request rate in warm snapshot
+            size_t prewarm_batch_;              // channels prewarmed each check interval
+            std::deque<WarmSnapshot::Item> prewarm_queue_;
+            boost::uint32_t idle_ttl_;          // msec, for rid without history
+            boost::uint32_t idle_ttl_min_;      // msec
+            boost::uint32_t idle_ttl_max_;      // msec
+            boost::unordered_map<std::string, Failure> failures_;
+            std::list<std::string> failure_order_;  // most recently failed first
+            boost::uint32_t fail_backoff_min_;  // msec
+            boost::uint32_t fail_backoff_max_;  // msec
+            boost::minstd_rand rand_;           // jitter of fail backoff
+            boost::unordered_map<std::string, Crash> crashes_;
+            std::list<std::string> crash_order_;    // most recently crashed first
+            boost::uint32_t restart_max_;       // restarts per window
+            boost::uint32_t restart_window_;    // msec
+            boost::uint32_t restart_backoff_;   // msec, before second restart in window
+            boost::uint32_t restart_backoff_max_;   // msec
+            std::multimap<boost::uint64_t, Channel *> restart_queue_;   // by msec
+            boost::uint32_t expire_resolution_; // msec
+            boost::uint32_t check_interval_;    // msec
+            boost::uint32_t dump_interval_;     // msec, 0 no dump of channels
+            std::multimap<boost::uint64_t, Channel *> expire_queue_;
+            clock_timer::time_type start_time_;
+            boost::uint64_t armed_tick_;
+            boost::uint64_t check_time_;        // msec, when check timer should fire
+            boost::uint64_t dump_time_;         // msec, of next dump
+            clock_timer timer_;
+            clock_timer check_timer_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_LIVE_MANAGER_H_
@@ -1,189 +1,320 @@
-// LiveModule.cpp
-
-#include "just/live_worker/Common.h"
-#include "just/live_worker/LiveModule.h"
-#include "just/live_worker/LiveInterface.h"
-
-#include <live/Name.h>
-
-#include <framework/system/LogicError.h>
-#include <framework/string/Format.h>
-#include <framework/logger/Logger.h>
-#include <framework/logger/FormatRecord.h>
-#include <framework/logger/Section.h>
-using namespace framework::string;
-using namespace framework::system;
-
-#include <boost/bind.hpp>
-#include <boost/asio/io_service.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-using namespace boost::system;
-
-FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveModule", framework::logger::Debug)
-
-namespace just
-{
-    namespace live_worker
-    {
-
-        struct LiveModule::Channel
-        {
-            Channel(
-                LiveModule * module, 
-                void * handle, 
-                LiveModule::call_back_func const & call_back) 
-                : module(module)
-                , handle(handle)
-                , call_back(call_back)
-            {
-            }
-
-            LiveModule * module;
-            void * handle;
-            LiveModule::call_back_func call_back;
-        };
-
-        LiveModule::LiveModule(
-            util::daemon::Daemon & daemon)
-            : util::daemon::ModuleBase<LiveModule>(daemon, "LiveModule")
+// LiveModule.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveModule.h"
+#include "just/live_worker/LiveInterface.h"
+#include "just/live_worker/KernelExecutor.h"
+
+#include <live/Name.h>
+
+#include <framework/system/LogicError.h>
+#include <framework/string/Format.h>
+#include <framework/logger/Logger.h>
+#include <framework/logger/FormatRecord.h>
+#include <framework/logger/Section.h>
+using namespace framework::string;
+using namespace framework::system;
+
+#include <boost/bind.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/ref.hpp>
+using namespace boost::system;
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveModule", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // with LiveShards, there is one LiveModule per shard, but only one
+        // kernel in process, started once; accessed only in kernel thread
+        static size_t kernel_users = 0;
+
+        struct LiveModule::Channel
+        {
+            Channel(
+                LiveModule * module, 
+                void * handle, 
+                LiveModule::call_back_func const & call_back) 
+                : module(module)
+                , handle(handle)
+                , call_back(call_back)
+                , stopped(false)
+            {
+            }
+
+            LiveModule * module;
+            void * handle; // accessed only in kernel thread
+            LiveModule::call_back_func call_back;
+            bool stopped;
+        };
+
+        LiveModule::LiveModule(
+            util::daemon::Daemon & daemon)
+            : util::daemon::ModuleBase<LiveModule>(daemon, "LiveModule")
             , peer_type_(t_client)
-        {
+            , lib_path_(live::name_string())
+            , executor_(NULL)
+        {
             config().register_module("LiveModule") 
-                << CONFIG_PARAM_NAME_RDONLY("peer_type", peer_type_);
-            if (peer_type_ < t_client || peer_type_ > t_ssn )
-            {
-                peer_type_ = t_sn;
-            }
+                << CONFIG_PARAM_NAME_RDONLY("peer_type", peer_type_)
+                << CONFIG_PARAM_NAME_RDONLY("lib_path", lib_path_);
+            if (peer_type_ < t_client || peer_type_ > t_ssn )
+            {
+                peer_type_ = t_sn;
+            }
             
 
             LOG_DEBUG("[LiveModule] peer_type:"<<peer_type_);
 
-            live_ = new LiveInterface();
-        }
-
-        LiveModule::~LiveModule()
-        {
-            delete live_;
-        }
-
+            live_ = new LiveInterface();
+        }
+
+        LiveModule::~LiveModule()
+        {
+            delete live_;
+        }
+
         bool LiveModule::startup(
-            error_code & ec)
-        {
-            ec = 
-                live_->load(live::name_string());
-
-            if (!ec && !live_->startup(peer_type_))
-                ec = logic_error::failed_some;
-			if (ec == boost::system::errc::no_such_file_or_directory) {
-				ec.clear();
-			}
-            return !ec;
-        }
-
-        bool LiveModule::shutdown(
-            error_code & ec)
-        {
-            LOG_DEBUG("[shutdown] beg stop kernel");
-            live_->cleanup();
-            LOG_DEBUG("[shutdown] end stop kernel");
+            error_code & ec)
+        {
+            executor_ = &KernelExecutor::acquire();
+            executor_->call(boost::bind(&LiveModule::kernel_startup, this, boost::ref(ec)));
+			if (ec == boost::system::errc::no_such_file_or_directory) {
+				ec.clear();
+			}
+            return !ec;
+        }
+
+        bool LiveModule::shutdown(
+            error_code & ec)
+        {
+            if (executor_ == NULL)
+                return true;
+            executor_->call(boost::bind(&LiveModule::kernel_cleanup, this));
+            executor_ = NULL;
+            KernelExecutor::release();
             return true;
-        }
-
-        LiveModule::ChannelHandle LiveModule::start_channel( 
-            std::string const & url, 
-            boost::uint16_t tcp_port, 
-            boost::uint16_t udp_port, 
-            call_back_func const & call_back)
-        {
-            void * handle = live_->start_channel(
-                (std::string("synacast:/") + url).c_str(), tcp_port, udp_port);
-            if (handle == NULL) {
-                return NULL; // Failed.
-            }
-            Channel * channel = new Channel(this, handle, call_back);
-            channels_.push_back(channel);
-            live_->set_channel_callback(channel->handle, LiveModule::call_back_hook, (unsigned long)(channel));
-            LOG_INFO("[start_channel] channel " << (void *)channel);
-            return channel;
-        }
-
-        void LiveModule::stop_channel(
-            ChannelHandle handle)
-        {
-            Channel * channel = (Channel *)handle;
-            LOG_INFO("[stop_channel] channel " << (void *)channel);
-            live_->stop_channel(channel->handle);
-            channel->handle = NULL;
-            if (channel->call_back.empty()) {
-                channels_.erase(
-                    std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
-                delete channel;
-            } else {
-                call_back_func call_back;
-                call_back.swap(channel->call_back);
-                io_svc().post(boost::bind(call_back, 
-                    boost::asio::error::operation_aborted, std::string()));
-            }
-        }
-
-        void LiveModule::handle_call_back(
-            Channel * channel, 
-            error_code const & ec)
-        {
-            io_svc().post(boost::bind(
-                &LiveModule::handle_call_back_innner, this, channel, ec));
-        }
-
-        void LiveModule::handle_call_back_innner(
-            Channel * channel, 
-            error_code const & ec)
-        {
-            LOG_INFO("call_back channel " << (void *)channel);
-            if (channel->call_back.empty()) {
-                channels_.erase(
-                    std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
-                delete channel;
+        }
+
+        LiveModule::ChannelHandle LiveModule::start_channel( 
+            std::string const & url, 
+            boost::uint16_t tcp_port, 
+            boost::uint16_t udp_port, 
+            call_back_func const & call_back)
+        {
+            // kernel failure is reported with call_back
+            Channel * channel = new Channel(this, NULL, call_back);
+            channels_.push_back(channel);
+            executor_->post(boost::bind(&LiveModule::kernel_start_channel, this, 
+                channel, std::string("synacast:/") + url, tcp_port, udp_port));
+            LOG_INFO("[start_channel] channel " << (void *)channel);
+            return channel;
+        }
+
+        void LiveModule::stop_channel(
+            ChannelHandle handle)
+        {
+            Channel * channel = (Channel *)handle;
+            LOG_INFO("[stop_channel] channel " << (void *)channel);
+            channel->stopped = true;
+            if (!channel->call_back.empty()) {
+                call_back_func call_back;
+                call_back.swap(channel->call_back);
+                io_svc().post(boost::bind(call_back, 
+                    boost::asio::error::operation_aborted, std::string()));
+            }
+            // deleted after kernel stop finished
+            executor_->post(boost::bind(&LiveModule::kernel_stop_channel, this, channel));
+        }
+
+        void LiveModule::get_status(
+            ChannelHandle handle, 
+            status_call_back_func const & call_back)
+        {
+            // queued before any kernel stop of the channel, so it is alive 
+            // in kernel thread and when the result comes back
+            executor_->post(boost::bind(&LiveModule::kernel_get_status, this, 
+                (Channel *)handle, call_back));
+        }
+
+        void LiveModule::handle_call_back(
+            Channel * channel, 
+            error_code const & ec)
+        {
+            io_svc().post(boost::bind(
+                &LiveModule::handle_call_back_innner, this, channel, ec));
+        }
+
+        void LiveModule::handle_call_back_innner(
+            Channel * channel, 
+            error_code const & ec)
+        {
+            LOG_INFO("call_back channel " << (void *)channel);
+            if (channel->stopped || channel->call_back.empty()) {
                 return;
             }
-            std::string url;
-            if (!ec) {
-                CCoreStatus cs;
-                live_->get_channel_status(channel->handle, cs);
+            if (!ec) {
+                executor_->post(boost::bind(&LiveModule::kernel_get_url, this, channel));
+                return;
+            }
+            response_channel(channel, ec, std::string());
+        }
+
+        void LiveModule::response_channel(
+            Channel * channel, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            if (channel->stopped || channel->call_back.empty()) {
+                return;
+            }
+            call_back_func call_back;
+            call_back.swap(channel->call_back);
+            io_svc().post(boost::bind(call_back, ec, url));
+        }
+
+        void LiveModule::handle_stop_channel(
+            Channel * channel)
+        {
+            channels_.erase(
+                std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
+            delete channel;
+        }
+
+        void LiveModule::handle_get_status(
+            Channel * channel, 
+            ChannelStatus const & status, 
+            status_call_back_func const & call_back)
+        {
+            if (!channel->stopped)
+                call_back(status);
+        }
+
+        void LiveModule::dump_channels()
+        {
+            // kernel stop of these channels is queued after the dump, 
+            // so they are not deleted before the dump runs
+            std::vector<Channel *> channels;
+            for (size_t i = 0; i < channels_.size(); ++i) {
+                if (!channels_[i]->stopped)
+                    channels.push_back(channels_[i]);
+            }
+            executor_->post(boost::bind(&LiveModule::kernel_dump_channels, this, channels));
+        }
+
+        // below runs in kernel thread
+
+        void LiveModule::kernel_startup(
+            error_code & ec)
+        {
+            ec = 
+                live_->load(lib_path_);
+
+            if (!ec && kernel_users == 0 && !live_->startup(peer_type_))
+                ec = logic_error::failed_some;
+            if (!ec)
+                ++kernel_users;
+        }
+
+        void LiveModule::kernel_cleanup()
+        {
+            if (kernel_users == 0 || --kernel_users > 0)
+                return;
+            LOG_DEBUG("[shutdown] beg stop kernel");
+            live_->cleanup();
+            LOG_DEBUG("[shutdown] end stop kernel");
+        }
+
+        void LiveModule::kernel_start_channel(
+            Channel * channel, 
+            std::string const & url, 
+            boost::uint16_t tcp_port, 
+            boost::uint16_t udp_port)
+        {
+            channel->handle = live_->start_channel(url.c_str(), tcp_port, udp_port);
+            if (channel->handle == NULL) {
+                io_svc().post(boost::bind(
+                    &LiveModule::response_channel, this, channel, logic_error::failed_some, std::string()));
+                return;
+            }
+            live_->set_channel_callback(channel->handle, LiveModule::call_back_hook, (unsigned long)(channel));
+        }
+
+        void LiveModule::kernel_stop_channel(
+            Channel * channel)
+        {
+            if (channel->handle) {
+                live_->stop_channel(channel->handle);
+                channel->handle = NULL;
+            }
+            io_svc().post(boost::bind(&LiveModule::handle_stop_channel, this, channel));
+        }
+
+        void LiveModule::kernel_get_url(
+            Channel * channel)
+        {
+            std::string url;
+            error_code ec;
+            CCoreStatus cs;
+            if (channel->handle && live_->get_channel_status(channel->handle, cs)) {
                 url = "http://127.0.0.1:" + format(cs.m_uMediaListenPort) + "/secret.tmp";
+            } else {
+                ec = logic_error::failed_some;
+            }
+            io_svc().post(boost::bind(&LiveModule::response_channel, this, channel, ec, url));
+        }
+
+        void LiveModule::kernel_get_status(
+            Channel * channel, 
+            status_call_back_func const & call_back)
+        {
+            ChannelStatus status;
+            CCoreStatus cs;
+            if (channel->handle && live_->get_channel_status(channel->handle, cs)) {
+                status.buffer_percent = cs.m_BufferPercent;
+                status.buffer_time = cs.m_BufferTime;
+                status.download_speed = cs.m_DownloadSpeed;
+                status.upload_speed = cs.m_UploadSpeed;
+                status.connection_count = cs.m_ConnectionCount;
+                status.peer_count = cs.m_TotalPeerCount;
             }
-            call_back_func call_back;
-            call_back.swap(channel->call_back);
-            io_svc().post(boost::bind(call_back, ec, url));
-        }
-
-        void LiveModule::dump_channels()
-        {
-            for (size_t i = 0; i < channels_.size(); ++i) {
-                CCoreStatus cs;
-                live_->get_channel_status(channels_[i]->handle, cs);
-                LOG_TRACE("dump_channels [%d]  p: %d%%  t: %ds  d: %dk  u: %dk  c: %d   s: %d   t: %d"
-                    % cs.m_uMediaListenPort
-                    % cs.m_BufferPercent
-                    % (cs.m_BufferTime / 1000)
-                    % (cs.m_DownloadSpeed / 1024)
-                    % (cs.m_UploadSpeed / 1024)
-                    % cs.m_ConnectionCount
-                    % cs.m_PendingPeerCount
-                    % cs.m_TotalPeerCount);
-            }
-        }
-
-        int LiveModule::call_back_hook(
-            unsigned int ChannelHandle, 
-            unsigned int Msg, 
-            unsigned int wParam, 
-            unsigned int lParam)
-        {
-            Channel * channel = (Channel *)ChannelHandle;
-            channel->module->handle_call_back(channel, 
-                Msg == UM_LIVEMSG_PLAY ? error_code() : logic_error::failed_some);
-            return 0;
-        }
-
-    } // namespace live_worker
-} // namespace just
+            io_svc().post(boost::bind(&LiveModule::handle_get_status, this, channel, status, call_back));
+        }
+
+        void LiveModule::kernel_dump_channels(
+            std::vector<Channel *> const & channels)
+        {
+            for (size_t i = 0; i < channels.size(); ++i) {
+                if (channels[i]->handle == NULL)
+                    continue;
+                CCoreStatus cs;
+                live_->get_channel_status(channels[i]->handle, cs);
+                LOG_TRACE("dump_channels [%d]  p: %d%%  t: %ds  d: %dk  u: %dk  c: %d   s: %d   t: %d"
+                    % cs.m_uMediaListenPort
+                    % cs.m_BufferPercent
+                    % (cs.m_BufferTime / 1000)
+                    % (cs.m_DownloadSpeed / 1024)
+                    % (cs.m_UploadSpeed / 1024)
+                    % cs.m_ConnectionCount
+                    % cs.m_PendingPeerCount
+                    % cs.m_TotalPeerCount);
+            }
+        }
+
+        int LiveModule::call_back_hook(
+            unsigned int ChannelHandle, 
+            unsigned int Msg, 
+            unsigned int wParam, 
+            unsigned int lParam)
+        {
+            Channel * channel = (Channel *)ChannelHandle;
+            channel->module->handle_call_back(channel, 
+                Msg == UM_LIVEMSG_PLAY ? error_code() : logic_error::failed_some);
+            return 0;
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -1,91 +1,165 @@
-// LiveModule.h
-
-#ifndef _JUST_LIVE_WORKER_LIVE_MODULE_H_
-#define _JUST_LIVE_WORKER_LIVE_MODULE_H_
-
-#include <boost/asio/deadline_timer.hpp>
-#include <boost/function.hpp>
-
-namespace just
-{
-    namespace live_worker
-    {
-
-        class LiveInterface;
-
-        class LiveModule
-            : public util::daemon::ModuleBase<LiveModule>
-        {
-        public:
-            struct Channel;
-
-            typedef Channel * ChannelHandle;
-
-            typedef boost::function<void (
-                boost::system::error_code const &, 
-                std::string const &)> call_back_func;
-
-        public:
-            LiveModule(
-                util::daemon::Daemon & daemon);
-
-            ~LiveModule();
-
-        public:
-            virtual bool startup(
-                boost::system::error_code & ec);
-
-            virtual bool shutdown(
-                boost::system::error_code & ec);
-
-        public:
-            ChannelHandle start_channel(
-                std::string const & url,
-                boost::uint16_t tcp_port, 
-                boost::uint16_t udp_port, 
-                call_back_func const & call_back);
-
-            void stop_channel(
-                ChannelHandle handle);
-
-            size_t check_channels(
-                 std::vector<ChannelHandle> & failed)
-            {
-                 return 0;
-            }
-
-            void dump_channels();
-
-        private:
-            void handle_call_back(
-                Channel * channel, 
-                boost::system::error_code const & ec);
-
-            void handle_call_back_innner(
-                Channel * channel, 
-                boost::system::error_code const & ec);
-
-        private:
-            static int call_back_hook(
-                unsigned int ChannelHandle, 
-                unsigned int Msg, 
-                unsigned int wParam, 
-                unsigned int lParam);
-
-        private:
-            enum PeerTypeEnum
-            {
-                t_client, 
-                t_sn,
-                t_ssn,
-            };
-
-            int peer_type_;
-            LiveInterface * live_;
-            std::vector<Channel *> channels_;
-        };
-
-    } // namespace live_worker
-} // namespace just
-
-#endif // _JUST_LIVE_WORKER_LIVE_MODULE_H_
+// LiveModule.h
+
+#ifndef _JUST_LIVE_WORKER_LIVE_MODULE_H_
+#define _JUST_LIVE_WORKER_LIVE_MODULE_H_
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/function.hpp>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        class LiveInterface;
+        class KernelExecutor;
+
+        class LiveModule
+            : public util::daemon::ModuleBase<LiveModule>
+        {
+        public:
+            struct Channel;
+
+            typedef Channel * ChannelHandle;
+
+            typedef boost::function<void (
+                boost::system::error_code const &, 
+                std::string const &)> call_back_func;
+
+            // kernel status of a channel
+            struct ChannelStatus
+            {
+                ChannelStatus()
+                    : buffer_percent(0)
+                    , buffer_time(0)
+                    , download_speed(0)
+                    , upload_speed(0)
+                    , connection_count(0)
+                    , peer_count(0)
+                {
+                }
+
+                boost::uint32_t buffer_percent;
+                boost::uint32_t buffer_time;        // msec
+                boost::uint32_t download_speed;     // bytes per second
+                boost::uint32_t upload_speed;       // bytes per second
+                boost::uint32_t connection_count;
+                boost::uint32_t peer_count;
+            };
+
+            typedef boost::function<void (
+                ChannelStatus const &)> status_call_back_func;
+
+        public:
+            LiveModule(
+                util::daemon::Daemon & daemon);
+
+            ~LiveModule();
+
+        public:
+            virtual bool startup(
+                boost::system::error_code & ec);
+
+            virtual bool shutdown(
+                boost::system::error_code & ec);
+
+        public:
+            ChannelHandle start_channel(
+                std::string const & url,
+                boost::uint16_t tcp_port, 
+                boost::uint16_t udp_port, 
+                call_back_func const & call_back);
+
+            void stop_channel(
+                ChannelHandle handle);
+
+            // call_back is not called if the channel is stopped meanwhile
+            void get_status(
+                ChannelHandle handle, 
+                status_call_back_func const & call_back);
+
+            typedef boost::function<void (
+                std::vector<ChannelHandle> const &)> fail_handler_func;
+
+            // channels in process do not fail after started
+            void set_fail_handler(
+                fail_handler_func const & handler)
+            {
+            }
+
+            void dump_channels();
+
+        private:
+            void handle_call_back(
+                Channel * channel, 
+                boost::system::error_code const & ec);
+
+            void handle_call_back_innner(
+                Channel * channel, 
+                boost::system::error_code const & ec);
+
+            void response_channel(
+                Channel * channel, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void handle_stop_channel(
+                Channel * channel);
+
+            void handle_get_status(
+                Channel * channel, 
+                ChannelStatus const & status, 
+                status_call_back_func const & call_back);
+
+        private:
+            // run in kernel thread
+            void kernel_startup(
+                boost::system::error_code & ec);
+
+            void kernel_cleanup();
+
+            void kernel_start_channel(
+                Channel * channel, 
+                std::string const & url, 
+                boost::uint16_t tcp_port, 
+                boost::uint16_t udp_port);
+
+            void kernel_stop_channel(
+                Channel * channel);
+
+            void kernel_get_url(
+                Channel * channel);
+
+            void kernel_get_status(
+                Channel * channel, 
+                status_call_back_func const & call_back);
+
+            void kernel_dump_channels(
+                std::vector<Channel *> const & channels);
+
+        private:
+            static int call_back_hook(
+                unsigned int ChannelHandle, 
+                unsigned int Msg, 
+                unsigned int wParam, 
+                unsigned int lParam);
+
+        private:
+            enum PeerTypeEnum
+            {
+                t_client, 
+                t_sn,
+                t_ssn,
+            };
+
+            int peer_type_;
+            std::string lib_path_; // kernel library, may be a mock
+            LiveInterface * live_;
+            KernelExecutor * executor_;
+            std::vector<Channel *> channels_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_LIVE_MODULE_H_
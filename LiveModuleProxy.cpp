@@ -1,35 +1,54 @@
-// LiveModuleProxy.cpp
-
-#include "just/live_worker/Common.h"
-#include "just/live_worker/LiveModuleProxy.h"
-#include "just/live_worker/LiveModule.h"
-
-#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
-
-#include <framework/string/Format.h>
-#include <framework/logger/StreamRecord.h>
-#include <framework/logger/Section.h>
-#include <framework/system/LogicError.h>
-using namespace framework::string;
-using namespace framework::system;
-
-#include <util/serialization/ErrorCode.h>
-#include <util/archive/TextIArchive.h>
-#include <util/archive/TextOArchive.h>
-
-#include <boost/bind.hpp>
-#include <boost/ref.hpp>
-#include <boost/asio/local/stream_protocol.hpp>
-#include <boost/asio/local/connect_pair.hpp>
-#include <boost/asio/streambuf.hpp>
-using namespace boost::system;
-
-#include <unistd.h> // for fork
+// LiveModuleProxy.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveModuleProxy.h"
+#include "just/live_worker/LiveModule.h"
+#include "just/live_worker/ChildMessage.h"
+#include "just/live_worker/StatusTable.h"
+#include "just/live_worker/CpuPlacement.h"
+#include "just/live_worker/HandOver.h"
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+#include <framework/string/Format.h>
+#include <framework/logger/StreamRecord.h>
+#include <framework/logger/Section.h>
+#include <framework/system/LogicError.h>
+using namespace framework::string;
+using namespace framework::system;
+using namespace framework::timer;
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/thread/mutex.hpp>
+using namespace boost::system;
+
+#include <fstream>
+#include <sstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <stdio.h> // for sscanf
+#include <stdlib.h> // for atoi
+#include <unistd.h> // for fork
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h> // for waitpid
-
-FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveModuleProxy", framework::logger::Debug)
-
+#include <signal.h> // for kill
+#include <sched.h>
+#include <pthread.h> // for pthread_getaffinity_np
+
+extern char ** environ;
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveModuleProxy", framework::logger::Debug)
+
 namespace boost { namespace asio { namespace detail { namespace socket_ops {
 
 static int close(socket_type s, boost::system::error_code& ec)
@@ -40,40 +59,117 @@ static int close(socket_type s, boost::system::error_code& ec)
 
 }}}}
 
-namespace just
-{
-    namespace live_worker
-    {
-
-        struct LiveModuleProxy::Channel
-        {
-            Channel()
-                : local_socket_(NULL)
-            {
-                error_code ec;
-                boost::asio::local::stream_protocol protocol;
+namespace just
+{
+    namespace live_worker
+    {
+
+        // children of all LiveModuleProxy (one per shard) in process, so
+        // that a pid reaped by any of them is handed to its owner
+        static boost::mutex child_owners_mutex;
+        static boost::unordered_map<pid_t, LiveModuleProxy *> child_owners;
+
+        // close fds of process above stderr but those in keep; with
+        // sockets_only, regular files and devices are left open
+        static void close_fds(
+            std::vector<int> const & keep, 
+            bool sockets_only)
+        {
+            std::vector<int> fds;
+            DIR * dir = ::opendir("/proc/self/fd");
+            if (dir == NULL)
+                return;
+            while (struct dirent * entry = ::readdir(dir)) {
+                if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+                    continue;
+                int fd = ::atoi(entry->d_name);
+                if (fd > 2 && fd != ::dirfd(dir) 
+                    && std::find(keep.begin(), keep.end(), fd) == keep.end())
+                    fds.push_back(fd);
+            }
+            ::closedir(dir);
+            for (size_t i = 0; i < fds.size(); ++i) {
+                struct stat st;
+                if (sockets_only && (::fstat(fds[i], &st) < 0 
+                    || !(S_ISSOCK(st.st_mode) || S_ISFIFO(st.st_mode))))
+                    continue;
+                ::close(fds[i]);
+            }
+        }
+
+        struct LiveModuleProxy::Child
+        {
+            enum StatusEnum
+            {
+                starting, 
+                ready, 
+                stopping, 
+                lost,   // connection closed, not reaped yet
+                handing,    // passed to new process, not forgotten till it is done
+            };
+
+            Child()
+                : pid(0)
+                , status(starting)
+                , start_time(0)
+                , cpu(-1)
+                , cpu_ticks(0)
+                , load(0)
+                , table(NULL)
+                , adopted(false)
+                , read_closed(false)
+                , writing(false)
+                , local_socket_(NULL)
+                , out_index_(0)
+            {
+                error_code ec;
+                boost::asio::local::stream_protocol protocol;
                 boost::asio::detail::socket_ops::socketpair(protocol.family(), 
                     protocol.type(), protocol.protocol(), native_sockets_, ec);
-            }
+                // parent end never goes to an exec'ed child
+                ::fcntl(native_sockets_[0], F_SETFD, FD_CLOEXEC);
+            }
+
+            // in exec'ed child, the child end is inherited; in a new parent
+            // after hot upgrade, the parent end is received from old one
+            explicit Child(
+                boost::asio::detail::socket_type fd)
+                : pid(0)
+                , status(starting)
+                , start_time(0)
+                , cpu(-1)
+                , cpu_ticks(0)
+                , load(0)
+                , table(NULL)
+                , adopted(false)
+                , read_closed(false)
+                , writing(false)
+                , local_socket_(NULL)
+                , out_index_(0)
+            {
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+                native_sockets_[0] = boost::asio::detail::invalid_socket;
+                native_sockets_[1] = fd;
+            }
 
-            ~Channel()
+            ~Child()
             {
                 if (local_socket_) {
                     delete local_socket_;
                 } else {
-                    error_code ec;
+                    error_code ec;
 
                     boost::asio::detail::socket_ops::close(native_sockets_[0], ec);
                     boost::asio::detail::socket_ops::close(native_sockets_[1], ec);
                 }
             }
-
-            void after_fork(
+
+            void after_fork(
                 bool parent, 
-                boost::asio::io_service & io_svc)
-            {
-                local_socket_ = new boost::asio::local::stream_protocol::socket(io_svc);
-                error_code ec;
+                boost::asio::io_service & io_svc)
+            {
+                local_socket_ = new boost::asio::local::stream_protocol::socket(io_svc);
+                error_code ec;
                 if (parent) {
                     boost::asio::detail::socket_ops::close(native_sockets_[1], ec);
                     local_socket_->assign(boost::asio::local::stream_protocol(), native_sockets_[0]);
@@ -81,249 +177,1207 @@ namespace just
                     boost::asio::detail::socket_ops::close(native_sockets_[0], ec);
                     local_socket_->assign(boost::asio::local::stream_protocol(), native_sockets_[1]);
                 }
-            }
-
-            void wait_start_channel(
-                LiveModuleProxy::call_back_func const & call_back)
-            {
-                error_code ec;
-                local_socket_->async_read_some(buf_.prepare(2048), 
-                    boost::bind(&Channel::handle_parent_read_some, this, call_back, _1, _2));
-            }
-
-            void handle_parent_read_some(
-                LiveModuleProxy::call_back_func const & call_back, 
-                error_code const & ecc, 
-                size_t bytes_transferred)
-            {
-                LOG_DEBUG("[handle_parent_read_some] ec = " 
-                    << ecc.message() << " bytes_transferred = " << bytes_transferred);
-                error_code const & ec = ecc;
-                std::string url;
-                if (!ec) {
-                    buf_.commit(bytes_transferred);
-                    util::archive::TextIArchive<> ia(buf_);
-                    ia >> ec >> url;
-                    assert(ia);
-                }
-                call_back(ec, url);
-            }
-
-            LiveModule::call_back_func get_call_back()
-            {
-                return boost::bind(&Channel::handle_start_channel, this, _1, _2);
-            }
-
-            // parent call this to notify child to stop channel and exit
-            void stop_channel(
-                error_code const & ec, 
-                std::string const & url)
-            {
-                boost::asio::streambuf buf;
-                {
-                    util::archive::TextOArchive<> oa(buf);
-                    oa << ec << url;
-                }
-                error_code ec1;
-                local_socket_->send(buf.data(), 0, ec1);
-            }
-
-            // child call this to wait for notify from  parent to stop channel and exit
-            void wait_stop_channel(
-                LiveModuleProxy::call_back_func const & call_back)
-            {
-                local_socket_->async_read_some(buf_.prepare(2048), 
-                    boost::bind(&Channel::handle_child_read_some, this, call_back, _1, _2));
-            }
-
-            // child has received stop msg from parent
-            void handle_child_read_some(
-                LiveModuleProxy::call_back_func const & call_back, 
-                error_code const & ecc, 
-                size_t bytes_transferred)
-            {
-                LOG_DEBUG("[handle_child_read_some] ec = " 
-                    << ecc.message() << " bytes_transferred = " << bytes_transferred);
-                error_code const & ec = ecc;
-                std::string url;
-                if (!ec) {
-                    std::istream is(&buf_);
-                    url.resize(buf_.size());
-                    is.read(&url[0], buf_.size());
-                }
-                call_back(ec, url);
-            }
-
-            // child finish starting channel, notify parent
-            void handle_start_channel(
-                error_code const & ec, 
-                std::string const & url)
-            {
-                boost::asio::streambuf buf;
-                {
-                    util::archive::TextOArchive<> oa(buf);
-                    oa << ec << url;
-                }
-                error_code ec1;
-                local_socket_->send(buf.data(), 0, ec1);
-            }
-
-            LiveModule::call_back_func call_back;
-            pid_t pid;
-            LiveModule::ChannelHandle handle;
-
-        private:
-            boost::asio::local::stream_protocol::socket * local_socket_;
-            boost::asio::detail::socket_type native_sockets_[2];
-            boost::asio::streambuf buf_;
-        };
-
-        LiveModuleProxy::LiveModuleProxy(
-            util::daemon::Daemon & daemon)
-            : util::daemon::ModuleBase<LiveModuleProxy>(daemon, "LiveModuleProxy")
-        {
-        }
-
-        LiveModuleProxy::~LiveModuleProxy()
-        {
-        }
-
-        bool LiveModuleProxy::startup(
-            error_code & ec)
-        {
-            return true;
-        }
-
-        bool LiveModuleProxy::shutdown(
-            error_code & ec)
-        {
-            return true;
-        }
-
-        LiveModuleProxy::ChannelHandle LiveModuleProxy::start_channel( 
-            std::string const & url, 
-            boost::uint16_t tcp_port, 
-            boost::uint16_t udp_port, 
-            LiveModule::call_back_func const & call_back)
-        {
-            Channel * channel = new Channel;
-            LOG_INFO("[start_channel] channel " << (void *)channel);
-            pid_t pid = ::fork();
-            if (pid > 0) {
-                channel->after_fork(true, io_svc());
-                channel->call_back = call_back;
-                channel->pid = pid;
-                channel->wait_start_channel(
-                    boost::bind(&LiveModuleProxy::handle_start_channel, this, 
-                    channel, _1, _2));
-                return channel;
-            } else if (pid == 0) {
-                util::daemon::Daemon daemon;
-                daemon.config().profile() = get_daemon().config().profile();
-                LiveModule & live_module = util::daemon::use_module<LiveModule>(daemon);
-                channel->after_fork(false, daemon.io_svc());
+            }
+
+            // in a new child, drop the parent end of a sibling without
+            // touching the reactor shared with parent
+            void close_in_child()
+            {
+                if (local_socket_)
+                    ::close(local_socket_->native_handle());
+            }
+
+            void close()
+            {
                 error_code ec;
-                daemon.start(ec);
-                if (ec) {
-                    channel->get_call_back()(logic_error::failed_some, std::string());
-                } else {
-                    channel->handle = live_module.start_channel(
-                        url, tcp_port, udp_port, channel->get_call_back());
-                    if (channel->handle == NULL) {
-                        channel->get_call_back()(logic_error::failed_some, std::string());
-                        daemon.stop(ec);
-                    } else {
-                        channel->wait_stop_channel(
-                            boost::bind(&LiveModuleProxy::handle_stop_channel, this, 
-                            boost::ref(daemon), channel, _1, _2));
-                        daemon.run(ec);
-                    }
-                }
-                ::_exit(0);
-                return NULL;
-            } else {
-                delete channel;
-                return NULL;
-            }
-        }
-
-        void LiveModuleProxy::stop_channel(
-            ChannelHandle handle)
-        {
-            Channel * channel = (Channel *)handle;
-            LOG_INFO("[stop_channel] channel " << (void *)channel);
-            channel->stop_channel(error_code(), ""); 
-            if (channel->call_back.empty()) {
-                LOG_INFO("[stop_channel] delete channel " << (void *)channel);
-                channels_.erase(
-                    std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
-                delete channel;
-            } else {
-                call_back_func call_back;
-                call_back.swap(channel->call_back);
-                io_svc().post(boost::bind(call_back, 
-                    boost::asio::error::operation_aborted, std::string()));
-            }
-        }
-
-        struct find_channel_by_pid
-        {
-            find_channel_by_pid(pid_t pid) : pid_(pid) {}
-            bool operator()(LiveModuleProxy::Channel * channel) { return channel->pid == pid_; }
-            pid_t pid_;
+                local_socket_->close(ec);
+            }
+
+            boost::asio::local::stream_protocol::socket & socket()
+            {
+                return *local_socket_;
+            }
+
+            boost::asio::detail::socket_type child_end() const
+            {
+                return native_sockets_[1];
+            }
+
+            void read(
+                boost::function<void (error_code const &, size_t)> const & handler)
+            {
+                local_socket_->async_read_some(buf.prepare(4096), handler);
+            }
+
+            // messages are queued while a write is in flight, and written
+            // together by the next one
+            void send(
+                ChildMessage const & msg)
+            {
+                msg.encode(out_[out_index_]);
+                if (!writing)
+                    start_write();
+            }
+
+            // a reaped child is deleted when no io is pending on it
+            static void release(
+                Child * child)
+            {
+                if (child->pid == 0 && child->read_closed && !child->writing)
+                    delete child;
+            }
+
+            pid_t pid;          // 0 when reaped
+            StatusEnum status;
+            boost::uint64_t start_time; // msec, forked or spawned
+            int cpu;            // pinned to, -1 if not
+            boost::uint64_t cpu_ticks;  // utime + stime, last read
+            boost::uint32_t load;       // per mille of one cpu
+            StatusTable * table;        // slots of its channels
+            bool adopted;       // taken over from old parent, not our child
+            std::map<boost::uint32_t, Channel *> channels; // by id
+            // id and slot of channels stopped while handing, told to child
+            // if it stays with us
+            std::vector<std::pair<boost::uint32_t, boost::uint32_t> > stopped;
+            bool read_closed;   // no read pending
+            bool writing;
+            boost::asio::streambuf buf;
+
+        private:
+            void start_write()
+            {
+                boost::asio::streambuf & out = out_[out_index_];
+                if (out.size() == 0)
+                    return;
+                writing = true;
+                out_index_ ^= 1;
+                boost::asio::async_write(*local_socket_, out, 
+                    boost::bind(&Child::handle_write, this, _1));
+            }
+
+            void handle_write(
+                error_code const & ec)
+            {
+                writing = false;
+                if (ec)
+                    out_[out_index_].consume(out_[out_index_].size());
+                else
+                    start_write();
+                release(this);
+            }
+
+        private:
+            boost::asio::local::stream_protocol::socket * local_socket_;
+            boost::asio::detail::socket_type native_sockets_[2];
+            boost::asio::streambuf out_[2]; // one filled while the other is written
+            int out_index_;
         };
-
-        size_t LiveModuleProxy::check_channels(
-            std::vector<ChannelHandle> & failed)
+
+        struct LiveModuleProxy::Channel
         {
-            pid_t pid = ::waitpid(-1, NULL, WNOHANG);
-            while (pid > 0) {
-                std::vector<Channel *>::const_iterator iter = 
-                    std::find_if(channels_.begin(), channels_.end(), find_channel_by_pid(pid));  
-                if (iter != channels_.end()) {
-                    failed.push_back(*iter);
+            Channel(
+                std::string const & url, 
+                boost::uint16_t tcp_port, 
+                boost::uint16_t udp_port, 
+                call_back_func const & call_back)
+                : id(0)
+                , url(url)
+                , tcp_port(tcp_port)
+                , udp_port(udp_port)
+                , call_back(call_back)
+                , child(NULL)
+                , start_time(0)
+                , slot(StatusTable::npos)
+                , update_time(0)
+            {
+            }
+
+            boost::uint32_t id; // unique in parent
+            LiveModule::ChannelStatus status; // last read from status table
+            std::string url;
+            boost::uint16_t tcp_port;
+            boost::uint16_t udp_port;
+            call_back_func call_back;
+            Child * child;
+            boost::uint64_t start_time; // msec
+            boost::uint32_t slot;       // in status table, npos if none
+            boost::uint64_t update_time;    // StatusTable::now_msec, status written or placed on child
+        };
+
+        // runs in child process, executes commands from parent with its LiveModule
+        struct LiveModuleProxy::ChildHost
+        {
+            ChildHost(
+                util::daemon::Daemon & daemon, 
+                LiveModule & live_module, 
+                Child * child, 
+                StatusTable & status_table, 
+                boost::uint32_t status_interval)
+                : daemon(daemon)
+                , live_module(live_module)
+                , child(child)
+                , status_table(status_table)
+                , status_interval(status_interval ? status_interval : 1)
+                , status_timer(daemon.io_svc())
+            {
+            }
+
+            // serve parent until told to exit, or parent is lost
+            static void run(
+                util::daemon::Daemon & daemon, 
+                Child * child, 
+                StatusTable & status_table, 
+                boost::uint32_t status_interval)
+            {
+                LiveModule & live_module = util::daemon::use_module<LiveModule>(daemon);
+                child->after_fork(false, daemon.io_svc());
+                ChildHost host(daemon, live_module, child, status_table, status_interval);
+                error_code ec;
+                daemon.start(ec);
+                host.send_ready(ec);
+                if (!ec) {
+                    host.read();
+                    host.start_status_timer();
+                    daemon.run(ec);
+                }
+            }
+
+            void send_ready(
+                error_code const & ec)
+            {
+                ChildMessage msg(ChildMessage::ready);
+                msg << ec;
+                child->send(msg);
+            }
+
+            void read()
+            {
+                child->read(boost::bind(&ChildHost::handle_read, this, _1, _2));
+            }
+
+            void handle_read(
+                error_code const & ec, 
+                size_t bytes_transferred)
+            {
+                if (ec) {
+                    LOG_DEBUG("[handle_read] parent lost, ec = " << ec.message());
+                    stop();
+                    return;
+                }
+                child->buf.commit(bytes_transferred);
+                ChildMessage msg;
+                error_code ec1;
+                while (msg.decode(child->buf, ec1)) {
+                    if (msg.type == ChildMessage::start) {
+                        boost::uint32_t tcp_port = 0;
+                        boost::uint32_t udp_port = 0;
+                        std::string url;
+                        boost::uint32_t slot = StatusTable::npos;
+                        msg >> tcp_port >> udp_port >> url >> slot;
+                        assert(msg);
+                        handles[msg.id] = live_module.start_channel(url, tcp_port, udp_port, 
+                            boost::bind(&ChildHost::handle_start_channel, this, msg.id, _1, _2));
+                        slots[msg.id] = slot;
+                    } else if (msg.type == ChildMessage::stop) {
+                        stop_channel(msg.id);
+                    } else if (msg.type == ChildMessage::heartbeat) {
+                        child->send(msg);
+                    } else if (msg.type == ChildMessage::exit) {
+                        stop();
+                        return;
+                    }
+                }
+                if (ec1) {
+                    LOG_WARN("[handle_read] bad message from parent");
+                    stop();
+                    return;
+                }
+                read();
+            }
+
+            void handle_start_channel(
+                boost::uint32_t id, 
+                error_code const & ec, 
+                std::string const & url)
+            {
+                ChildMessage msg(ChildMessage::started, id);
+                msg << ec << url;
+                child->send(msg);
+            }
+
+            void start_status_timer()
+            {
+                status_timer.expires_from_now(Duration::milliseconds(status_interval));
+                status_timer.async_wait(boost::bind(&ChildHost::handle_status_timer, this, _1));
+            }
+
+            void handle_status_timer(
+                error_code const & ec)
+            {
+                if (ec)
+                    return;
+                std::map<boost::uint32_t, LiveModule::ChannelHandle>::const_iterator iter = handles.begin();
+                for (; iter != handles.end(); ++iter) {
+                    live_module.get_status(iter->second, 
+                        boost::bind(&ChildHost::handle_status, this, iter->first, _1));
+                }
+                start_status_timer();
+            }
+
+            void handle_status(
+                boost::uint32_t id, 
+                LiveModule::ChannelStatus const & status)
+            {
+                // slot is given back to parent once channel is stopped
+                std::map<boost::uint32_t, boost::uint32_t>::const_iterator iter = slots.find(id);
+                if (iter != slots.end())
+                    status_table.write(iter->second, id, status);
+            }
+
+            void stop_channel(
+                boost::uint32_t id)
+            {
+                std::map<boost::uint32_t, LiveModule::ChannelHandle>::iterator iter = handles.find(id);
+                if (iter == handles.end())
+                    return;
+                LOG_INFO("[stop_channel] id " << id);
+                live_module.stop_channel(iter->second);
+                handles.erase(iter);
+                slots.erase(id);
+            }
+
+            void stop()
+            {
+                LOG_INFO("[stop] channels " << handles.size());
+                while (!handles.empty())
+                    stop_channel(handles.begin()->first);
+                error_code ec;
+                status_timer.cancel(ec);
+                daemon.stop(ec);
+            }
+
+            util::daemon::Daemon & daemon;
+            LiveModule & live_module;
+            Child * child;
+            std::map<boost::uint32_t, LiveModule::ChannelHandle> handles; // by channel id
+            std::map<boost::uint32_t, boost::uint32_t> slots; // status slot by channel id
+            StatusTable & status_table;
+            boost::uint32_t status_interval;
+            clock_timer status_timer;
+        };
+
+        LiveModuleProxy::LiveModuleProxy(
+            util::daemon::Daemon & daemon)
+            : util::daemon::ModuleBase<LiveModuleProxy>(daemon, "LiveModuleProxy")
+            , starting_(0)
+            , pool_min_(2)
+            , pool_max_(8)
+            , channels_per_child_(1)
+            , placement_("pack")
+            , child_mode_("fork")
+            , cpu_placement_(new CpuPlacement)
+            , cpu_policy_("none")
+            , numa_node_(-1)
+            , load_time_(0)
+            , status_table_(new StatusTable)
+            , status_slots_(1024)
+            , status_interval_(200)
+            , status_stale_(10000)
+            , next_id_(0)
+            , refill_posted_(false)
+            , signals_(NULL)
+            , start_time_(clock_timer::traits_type::now())
+        {
+            config().register_module("LiveModuleProxy")
+                << CONFIG_PARAM_NAME_RDWR("pool_min", pool_min_)
+                << CONFIG_PARAM_NAME_RDWR("pool_max", pool_max_)
+                << CONFIG_PARAM_NAME_RDWR("channels_per_child", channels_per_child_)
+                << CONFIG_PARAM_NAME_RDWR("placement", placement_)
+                << CONFIG_PARAM_NAME_RDONLY("child_mode", child_mode_)
+                << CONFIG_PARAM_NAME_RDONLY("cpu_policy", cpu_policy_)
+                << CONFIG_PARAM_NAME_RDONLY("reactor_cpus", reactor_cpus_)
+                << CONFIG_PARAM_NAME_RDONLY("numa_node", numa_node_)
+                << CONFIG_PARAM_NAME_RDONLY("cpu_status", cpu_status_)
+                << CONFIG_PARAM_NAME_RDONLY("status_slots", status_slots_)
+                << CONFIG_PARAM_NAME_RDONLY("status_interval", status_interval_)
+                << CONFIG_PARAM_NAME_RDWR("status_stale", status_stale_)
+                << CONFIG_PARAM_NAME_RDONLY("fork", stat_.fork)
+                << CONFIG_PARAM_NAME_RDONLY("pool_hit", stat_.pool_hit)
+                << CONFIG_PARAM_NAME_RDONLY("pool_miss", stat_.pool_miss)
+                << CONFIG_PARAM_NAME_RDONLY("start_latency", stat_.start_latency)
+                << CONFIG_PARAM_NAME_RDONLY("max_start_latency", stat_.max_start_latency)
+                << CONFIG_PARAM_NAME_RDONLY("rss_per_channel", stat_.rss_per_channel)
+                << CONFIG_PARAM_NAME_RDONLY("heartbeat_rtt", stat_.heartbeat_rtt)
+                << CONFIG_PARAM_NAME_RDONLY("child_crash", stat_.child_crash)
+                << CONFIG_PARAM_NAME_RDONLY("crash_notify", stat_.crash_notify)
+                << CONFIG_PARAM_NAME_RDONLY("max_crash_notify", stat_.max_crash_notify)
+                << CONFIG_PARAM_NAME_RDONLY("download_speed", stat_.download_speed)
+                << CONFIG_PARAM_NAME_RDONLY("upload_speed", stat_.upload_speed)
+                << CONFIG_PARAM_NAME_RDONLY("peer_count", stat_.peer_count)
+                << CONFIG_PARAM_NAME_RDONLY("status_stale", stat_.status_stale)
+                << CONFIG_PARAM_NAME_RDONLY("spawn_time", stat_.spawn_time)
+                << CONFIG_PARAM_NAME_RDONLY("max_spawn_time", stat_.max_spawn_time)
+                << CONFIG_PARAM_NAME_RDONLY("ready_latency", stat_.ready_latency);
+        }
+
+        LiveModuleProxy::~LiveModuleProxy()
+        {
+            delete signals_;
+            boost::mutex::scoped_lock lock(child_owners_mutex);
+            for (size_t i = 0; i < children_.size(); ++i) {
+                child_owners.erase(children_[i]->pid);
+                Child * child = children_[i];
+                std::map<boost::uint32_t, Channel *>::iterator iter = child->channels.begin();
+                for (; iter != child->channels.end(); ++iter)
+                    iter->second->child = NULL;
+                delete child;
+            }
+            delete status_table_;
+            for (size_t i = 0; i < adopted_tables_.size(); ++i)
+                delete adopted_tables_[i];
+            delete cpu_placement_;
+        }
+
+        void LiveModuleProxy::set_exec_only()
+        {
+            if (child_mode_ != "exec") {
+                LOG_WARN("[set_exec_only] child_mode " << child_mode_ << " changed to exec");
+                child_mode_ = "exec";
+            }
+        }
+
+        bool LiveModuleProxy::startup(
+            error_code & ec)
+        {
+            // before any child is forked
+            if (!status_table_->create(status_slots_, ec))
+                return false;
+            if (!cpu_placement_->init(cpu_policy_, reactor_cpus_, numa_node_, ec)) {
+                LOG_WARN("[startup] bad cpu placement, policy: " << cpu_policy_ 
+                    << ", reactor_cpus: " << reactor_cpus_ << ", numa_node: " << numa_node_);
+                return false;
+            }
+            io_svc().post(boost::bind(&CpuPlacement::pin_reactor, cpu_placement_));
+            if (child_mode_ == "exec") {
+                // children run same binary with our arguments
+                char path[1024];
+                ssize_t len = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+                if (len <= 0) {
+                    ec.assign(errno, system_category());
+                    return false;
+                }
+                exe_path_.assign(path, len);
+                std::ifstream ifs("/proc/self/cmdline");
+                std::string arg;
+                std::getline(ifs, arg, '\0'); // program name
+                while (std::getline(ifs, arg, '\0'))
+                    cmdline_.push_back(arg);
+            }
+            signals_ = new boost::asio::signal_set(io_svc());
+            signals_->add(SIGCHLD, ec);
+            if (ec)
+                return false;
+            signals_->async_wait(
+                boost::bind(&LiveModuleProxy::handle_signal, this, _1, _2));
+            post_refill();
+            return true;
+        }
+
+        bool LiveModuleProxy::shutdown(
+            error_code & ec)
+        {
+            // children exit on stop, or when they see the socket closed
+            for (size_t i = 0; i < children_.size(); ++i) {
+                if (children_[i]->status != Child::lost)
+                    kill_child(children_[i]);
+            }
+            idle_children_.clear();
+            signals_->cancel(ec);
+            return true;
+        }
+
+        LiveModuleProxy::ChannelHandle LiveModuleProxy::start_channel( 
+            std::string const & url, 
+            boost::uint16_t tcp_port, 
+            boost::uint16_t udp_port, 
+            LiveModule::call_back_func const & call_back)
+        {
+            // failure is reported with call_back
+            Channel * channel = new Channel(url, tcp_port, udp_port, call_back);
+            channel->id = ++next_id_;
+            channel->start_time = now_msec();
+            LOG_INFO("[start_channel] channel " << (void *)channel);
+            Child * child = place_channel();
+            if (child) {
+                ++stat_.pool_hit;
+                assign_channel(child, channel);
+            } else {
+                ++stat_.pool_miss;
+                pending_channels_.push_back(channel);
+                if (starting_ < pending_channels_.size() && fork_child() == NULL) {
+                    pending_channels_.pop_back();
+                    response_channel(channel, logic_error::failed_some, std::string());
+                }
+            }
+            post_refill();
+            return channel;
+        }
+
+        void LiveModuleProxy::stop_channel(
+            ChannelHandle handle)
+        {
+            Channel * channel = (Channel *)handle;
+            LOG_INFO("[stop_channel] channel " << (void *)channel);
+            if (channel->child && channel->child->status == Child::handing) {
+                Child * child = channel->child;
+                child->channels.erase(channel->id);
+                child->stopped.push_back(std::make_pair(channel->id, channel->slot));
+            } else if (channel->child) {
+                Child * child = channel->child;
+                child->channels.erase(channel->id);
+                child->table->free(channel->slot);
+                if (child->status == Child::ready) {
+                    child->send(ChildMessage(ChildMessage::stop, channel->id));
+                    // an empty child goes back to pool, trimmed to pool_max there;
+                    // an adopted one is not pooled, see take_over
+                    if (child->channels.empty() && child->adopted) {
+                        kill_child(child);
+                    } else if (child->channels.empty()) {
+                        idle_children_.push_back(child);
+                        post_refill();
+                    }
                 }
-                pid = ::waitpid(-1, NULL, WNOHANG);
-            }
-            return failed.size();
-        }
-
-        void LiveModuleProxy::dump_channels()
-        {
-        }
-
-        void LiveModuleProxy::handle_start_channel(
-            Channel * channel, 
-            error_code const & ec, 
-            std::string const & url)
-        {
-            LOG_INFO("[handle_start_channel] channel = " << (void *)channel << ", ec = " << ec.message() << ", ur; = " << url);
-            if (channel->call_back.empty()) {
-                LOG_INFO("[handle_start_channel] delete channel " << (void *)channel);
-                channels_.erase(
-                    std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
-                delete channel;
             } else {
-                call_back_func call_back;
-                call_back.swap(channel->call_back);
-                io_svc().post(boost::bind(call_back, ec, url));
-            }
-        }
-
-        void LiveModuleProxy::handle_stop_channel(
-            util::daemon::Daemon & daemon, 
-            Channel * channel, 
-            error_code const & ec, 
-            std::string const & msg)
-        {
-            LOG_INFO("[handle_stop_channel] channel = " << (void *)channel);
-            LiveModule & live_module = util::daemon::use_module<LiveModule>(daemon);
-            live_module.stop_channel(channel->handle);
+                pending_channels_.remove(channel);
+            }
+            response_channel(channel, boost::asio::error::operation_aborted, std::string());
+            delete channel;
+        }
+
+        // any LiveModuleProxy in process may get SIGCHLD first
+        void LiveModuleProxy::handle_signal(
+            error_code const & ec, 
+            int signal_number)
+        {
+            if (ec)
+                return;
+            boost::uint64_t now = now_msec();
+            int status = 0;
+            pid_t pid = ::waitpid(-1, &status, WNOHANG);
+            while (pid > 0) {
+                LiveModuleProxy * owner = NULL;
+                {
+                    boost::mutex::scoped_lock lock(child_owners_mutex);
+                    boost::unordered_map<pid_t, LiveModuleProxy *>::iterator iter = child_owners.find(pid);
+                    if (iter != child_owners.end()) {
+                        owner = iter->second;
+                        child_owners.erase(iter);
+                    }
+                }
+                if (owner == this)
+                    handle_child_exit(pid, status, now);
+                else if (owner)
+                    owner->io_svc().post(boost::bind(
+                        &LiveModuleProxy::handle_child_exit, owner, pid, status, owner->now_msec()));
+                pid = ::waitpid(-1, &status, WNOHANG);
+            }
+            signals_->async_wait(
+                boost::bind(&LiveModuleProxy::handle_signal, this, _1, _2));
+        }
+
+        void LiveModuleProxy::handle_child_exit(
+            pid_t pid, 
+            int status, 
+            boost::uint64_t detect_time)
+        {
+            boost::unordered_map<pid_t, Child *>::iterator iter = pids_.find(pid);
+            if (iter == pids_.end())
+                return;
+            Child * child = iter->second;
+            pids_.erase(iter);
+            children_.erase(
+                std::remove(children_.begin(), children_.end(), child), children_.end());
+            cpu_placement_->free(child->cpu);
+            if (WIFSIGNALED(status))
+                LOG_WARN("[handle_child_exit] pid = " << pid << ", signal = " << WTERMSIG(status));
+            else
+                LOG_INFO("[handle_child_exit] pid = " << pid << ", exit = " << WEXITSTATUS(status));
+            lose_child(child, detect_time);
+            child->pid = 0;
+            child->close(); // deleted when pending io finished
+            Child::release(child);
+        }
+
+        // the child is dead or dying, seen by its socket closed or by SIGCHLD,
+        // whichever comes first
+        void LiveModuleProxy::lose_child(
+            Child * child, 
+            boost::uint64_t detect_time)
+        {
+            if (child->status == Child::lost)
+                return;
+            LOG_INFO("[lose_child] pid = " << child->pid << ", channels = " << child->channels.size());
+            if (child->status == Child::starting)
+                --starting_;
+            else if (child->status == Child::ready && child->channels.empty())
+                idle_children_.remove(child);
+            child->status = Child::lost;
+            for (size_t i = 0; i < child->stopped.size(); ++i)
+                child->table->free(child->stopped[i].second);
+            child->stopped.clear();
+            post_refill();
+            if (child->channels.empty())
+                return;
+            ++stat_.child_crash;
+            std::vector<ChannelHandle> failed;
+            std::map<boost::uint32_t, Channel *>::iterator iter = child->channels.begin();
+            for (; iter != child->channels.end(); ++iter) {
+                Channel * channel = iter->second;
+                channel->child = NULL;
+                child->table->free(channel->slot);
+                channel->slot = StatusTable::npos;
+                if (channel->call_back.empty() || !fail_handler_.empty()) {
+                    // a starting one gets no call back, the fail handler
+                    // restarts or stops it like a working one
+                    channel->call_back.clear();
+                    failed.push_back(channel);
+                } else {
+                    response_channel(channel, logic_error::failed_some, std::string());
+                }
+            }
+            child->channels.clear();
+            if (!failed.empty() && !fail_handler_.empty())
+                fail_handler_(failed);
+            // runs after call backs to clients posted above
+            io_svc().post(boost::bind(&LiveModuleProxy::handle_crash_notified, this, detect_time));
+        }
+
+        void LiveModuleProxy::handle_crash_notified(
+            boost::uint64_t detect_time)
+        {
+            stat_.crash_notify = (boost::uint32_t)(now_msec() - detect_time);
+            if (stat_.max_crash_notify < stat_.crash_notify)
+                stat_.max_crash_notify = stat_.crash_notify;
+        }
+
+        void LiveModuleProxy::check_children()
+        {
+            // heartbeat is answered by io thread of child
+            ChildMessage heartbeat(ChildMessage::heartbeat);
+            heartbeat << (boost::uint32_t)now_msec();
+            for (size_t i = 0; i < children_.size(); ++i) {
+                Child * child = children_[i];
+                if (child->status == Child::ready)
+                    child->send(heartbeat);
+            }
+
+            // status is written by kernel call backs of child, a child
+            // not updating its started channels has a stuck kernel
+            boost::uint64_t now = StatusTable::now_msec();
+            boost::uint32_t download_speed = 0;
+            boost::uint32_t upload_speed = 0;
+            boost::uint32_t peer_count = 0;
+            for (size_t i = 0; i < children_.size(); ++i) {
+                Child * child = children_[i];
+                if (child->status != Child::ready)
+                    continue;
+                bool stale = false;
+                std::map<boost::uint32_t, Channel *>::const_iterator iter = child->channels.begin();
+                for (; iter != child->channels.end(); ++iter) {
+                    Channel * channel = iter->second;
+                    boost::uint64_t update_time = 0;
+                    if (child->table->read(channel->slot, channel->id, channel->status, update_time)) {
+                        channel->update_time = update_time;
+                        download_speed += channel->status.download_speed;
+                        upload_speed += channel->status.upload_speed;
+                        peer_count += channel->status.peer_count;
+                    }
+                    if (channel->slot != StatusTable::npos && channel->call_back.empty() 
+                        && channel->update_time + status_stale_ < now)
+                        stale = true;
+                }
+                if (stale) {
+                    LOG_WARN("[check_children] status stale, kill pid = " << child->pid);
+                    ++stat_.status_stale;
+                    ::kill(child->pid, SIGKILL);
+                }
+            }
+            stat_.download_speed = download_speed;
+            stat_.upload_speed = upload_speed;
+            stat_.peer_count = peer_count;
+
+            // placement by load needs it fresh
+            if (cpu_policy_ == "load")
+                sample_load();
+        }
+
+        void LiveModuleProxy::dump_channels()
+        {
+            for (size_t i = 0; i < children_.size(); ++i) {
+                Child * child = children_[i];
+                std::map<boost::uint32_t, Channel *>::const_iterator iter = child->channels.begin();
+                for (; iter != child->channels.end(); ++iter) {
+                    Channel * channel = iter->second;
+                    if (channel->update_time == 0)
+                        continue;
+                    LiveModule::ChannelStatus const & status = channel->status;
+                    LOG_TRACE("dump_channels [" << channel->id << "] pid: " << child->pid 
+                        << " p: " << status.buffer_percent << "% t: " << status.buffer_time / 1000 
+                        << "s d: " << status.download_speed / 1024 << "k u: " << status.upload_speed / 1024 
+                        << "k c: " << status.connection_count << " t: " << status.peer_count);
+                }
+            }
+
+            if (cpu_policy_ != "load")
+                sample_load();
+
+            // resident memory of children, per hosted channel
+            size_t page_kb = ::sysconf(_SC_PAGESIZE) / 1024;
+            size_t rss = 0;
+            size_t count = 0;
+            for (size_t i = 0; i < children_.size(); ++i) {
+                Child * child = children_[i];
+                if (child->channels.empty())
+                    continue;
+                std::ifstream ifs(("/proc/" + format(child->pid) + "/statm").c_str());
+                size_t size = 0;
+                size_t resident = 0;
+                if (!(ifs >> size >> resident))
+                    continue;
+                rss += resident * page_kb;
+                count += child->channels.size();
+                LOG_TRACE("[dump_channels] pid: " << child->pid << ", cpu: " << child->cpu 
+                    << ", load: " << child->load << ", channels: " << child->channels.size() 
+                    << ", rss: " << resident * page_kb << "k");
+            }
+            stat_.rss_per_channel = count ? (boost::uint32_t)(rss / count) : 0;
+        }
+
+        // cpu time of children since last sample, load of their cpus
+        void LiveModuleProxy::sample_load()
+        {
+            boost::uint64_t load_time = now_msec();
+            boost::uint64_t elapsed = load_time - load_time_;
+            load_time_ = load_time;
+            long ticks_per_sec = ::sysconf(_SC_CLK_TCK);
+            cpu_placement_->clear_load();
+            for (size_t i = 0; i < children_.size(); ++i) {
+                Child * child = children_[i];
+                std::ifstream ifs(("/proc/" + format(child->pid) + "/stat").c_str());
+                std::string line;
+                if (!std::getline(ifs, line) || line.rfind(')') == std::string::npos)
+                    continue;
+                // fields after "(comm)": state ... cmajflt, then utime stime
+                std::istringstream iss(line.substr(line.rfind(')') + 1));
+                std::string skip;
+                for (int j = 0; j < 11; ++j)
+                    iss >> skip;
+                boost::uint64_t utime = 0;
+                boost::uint64_t stime = 0;
+                if (!(iss >> utime >> stime))
+                    continue;
+                if (child->cpu_ticks && elapsed && ticks_per_sec > 0)
+                    child->load = (boost::uint32_t)((utime + stime - child->cpu_ticks) 
+                        * 1000 * 1000 / ticks_per_sec / elapsed);
+                child->cpu_ticks = utime + stime;
+                cpu_placement_->add_load(child->cpu, child->load);
+            }
+            cpu_status_ = cpu_placement_->status();
+        }
+
+        LiveModuleProxy::Child * LiveModuleProxy::fork_child()
+        {
+            Child * child = new Child;
+            child->table = status_table_;
+            child->cpu = cpu_placement_->alloc();
+            // registered before any proxy can reap it; and the child end is
+            // closed before another proxy forks, so no sibling inherits it
+            boost::mutex::scoped_lock lock(child_owners_mutex);
+            clock_timer::time_type begin = clock_timer::traits_type::now();
+            pid_t pid = child_mode_ == "exec" ? spawn_child(child) : ::fork();
+            if (pid == 0) {
+                child_main(child);
+                ::_exit(0);
+            } else if (pid < 0) {
+                LOG_WARN("[fork_child] " << child_mode_ << " failed, errno = " << errno);
+                cpu_placement_->free(child->cpu);
+                delete child;
+                return NULL;
+            }
+            stat_.spawn_time = (boost::uint32_t)clock_timer::traits_type::subtract(
+                clock_timer::traits_type::now(), begin).total_microseconds();
+            if (stat_.max_spawn_time < stat_.spawn_time)
+                stat_.max_spawn_time = stat_.spawn_time;
+            LOG_INFO("[fork_child] pid = " << pid << ", cpu = " << child->cpu);
+            ++stat_.fork;
+            ++starting_;
+            child->pid = pid;
+            child->start_time = now_msec();
+            child_owners[pid] = this;
+            child->after_fork(true, io_svc());
+            lock.unlock();
+            children_.push_back(child);
+            pids_[pid] = child;
+            child->read(boost::bind(&LiveModuleProxy::handle_child_read, this, child, _1, _2));
+            return child;
+        }
+
+        // in child process, never returns. Sockets and pipes of parent are
+        // closed: listeners, clients and parent ends of children of every
+        // shard, the child would keep them open. Files are shared with
+        // parent, as the logger is.
+        void LiveModuleProxy::child_main(
+            Child * child)
+        {
+            for (size_t i = 0; i < children_.size(); ++i)
+                children_[i]->close_in_child();
+            std::vector<int> keep;
+            keep.push_back(child->child_end());
+            close_fds(keep, true);
+            if (child->cpu >= 0)
+                CpuPlacement::pin_thread(child->cpu);
+            else
+                cpu_placement_->pin_children();
+            util::daemon::Daemon daemon;
+            daemon.config().profile() = get_daemon().config().profile();
+            ChildHost::run(daemon, child, *status_table_, status_interval_);
+            ::_exit(0);
+        }
+
+        // the exec'ed child starts with a clean address space, and only the
+        // child end of socketpair and the status table are passed to it
+        pid_t LiveModuleProxy::spawn_child(
+            Child * child)
+        {
+            std::string param = "--channel_host=" 
+                + format(child->child_end()) + "," + format(status_table_->fd()) + "," 
+                + format(status_table_->size()) + "," + format(status_interval_) + "," 
+                + format(child->cpu);
+            std::vector<char *> argv;
+            argv.push_back((char *)exe_path_.c_str());
+            argv.push_back((char *)param.c_str());
+            for (size_t i = 0; i < cmdline_.size(); ++i)
+                argv.push_back((char *)cmdline_[i].c_str());
+            argv.push_back(NULL);
+            // a host not pinned by cpu inherits affinity of this thread,
+            // which may be on reactor cpus
+            cpu_set_t saved;
+            bool repin = child->cpu < 0 
+                && ::pthread_getaffinity_np(::pthread_self(), sizeof(saved), &saved) == 0 
+                && cpu_placement_->pin_children();
+            pid_t pid = 0;
+            int err = ::posix_spawn(&pid, exe_path_.c_str(), NULL, NULL, &argv[0], environ);
+            if (repin)
+                ::pthread_setaffinity_np(::pthread_self(), sizeof(saved), &saved);
+            if (err) {
+                errno = err;
+                return -1;
+            }
+            return pid;
+        }
+
+        // asio opens sockets without FD_CLOEXEC, an exec'ed child inherits
+        // listeners and clients of parent along with the fds meant for it
+        void LiveModuleProxy::close_inherited_fds(
+            std::string const & param)
+        {
+            int sock_fd = -1;
+            int table_fd = -1;
+            if (sscanf(param.c_str(), "%d,%d", &sock_fd, &table_fd) != 2)
+                return;
+            std::vector<int> keep;
+            keep.push_back(sock_fd);
+            keep.push_back(table_fd);
+            close_fds(keep, false);
+        }
+
+        int LiveModuleProxy::run_channel_host(
+            util::daemon::Daemon & daemon, 
+            std::string const & param)
+        {
+            int sock_fd = -1;
+            int table_fd = -1;
+            unsigned int slots = 0;
+            unsigned int status_interval = 0;
+            int cpu = -1;
+            if (sscanf(param.c_str(), "%d,%d,%u,%u,%d", &sock_fd, &table_fd, &slots, &status_interval, &cpu) != 5)
+                return 1;
+            // before any thread is started
+            if (cpu >= 0)
+                CpuPlacement::pin_thread(cpu);
+            StatusTable status_table;
+            error_code ec;
+            if (!status_table.attach(table_fd, slots, ec)) {
+                LOG_WARN("[run_channel_host] status table, ec = " << ec.message());
+                return 1;
+            }
+            ChildHost::run(daemon, new Child(sock_fd), status_table, status_interval);
+            return 0;
+        }
+
+        // a child is passed only at a message boundary: nothing half read
+        // in buf, nothing queued to write, and no channel still starting
+        void LiveModuleProxy::hand_over(
+            HandOver & hand_over)
+        {
+            hand_over.next_id = next_id_;
+            std::map<StatusTable *, boost::uint32_t> tables;
+            std::vector<Child *> children = children_;
+            for (size_t i = 0; i < children.size(); ++i) {
+                Child * child = children[i];
+                if (child->status != Child::ready || child->channels.empty() 
+                    || child->writing || child->buf.size() > 0)
+                    continue;
+                bool working = true;
+                std::map<boost::uint32_t, Channel *>::const_iterator iter = child->channels.begin();
+                for (; iter != child->channels.end() && working; ++iter)
+                    working = iter->second->call_back.empty();
+                if (!working)
+                    continue;
+                // the socket and table are passed as dups, the child sees no
+                // close when ours are closed
+                int fd = ::fcntl(child->socket().native_handle(), F_DUPFD_CLOEXEC, 0);
+                if (fd < 0)
+                    continue;
+                if (tables.find(child->table) == tables.end()) {
+                    HandOver::Table table;
+                    table.fd = ::fcntl(child->table->fd(), F_DUPFD_CLOEXEC, 0);
+                    table.size = (boost::uint32_t)child->table->size();
+                    if (table.fd < 0) {
+                        ::close(fd);
+                        continue;
+                    }
+                    tables[child->table] = (boost::uint32_t)hand_over.tables.size();
+                    hand_over.tables.push_back(table);
+                }
+                HandOver::Child child2;
+                child2.pid = child->pid;
+                child2.fd = fd;
+                child2.table = tables[child->table];
+                for (iter = child->channels.begin(); iter != child->channels.end(); ++iter) {
+                    Channel * channel = iter->second;
+                    HandOver::Channel channel2;
+                    channel2.id = channel->id;
+                    channel2.slot = channel->slot;
+                    channel2.tcp_port = channel->tcp_port;
+                    channel2.udp_port = channel->udp_port;
+                    channel2.url = channel->url;
+                    channel2.handle = channel;
+                    child2.channels.push_back(channel2);
+                }
+                LOG_INFO("[hand_over] pid = " << child->pid << ", channels = " << child2.channels.size());
+                hand_over.children.push_back(child2);
+                // no heartbeat, no new channel, stops held back
+                child->status = Child::handing;
+            }
+        }
+
+        void LiveModuleProxy::commit_hand_over(
+            bool done)
+        {
+            std::vector<Child *> children = children_;
+            for (size_t i = 0; i < children.size(); ++i) {
+                Child * child = children[i];
+                if (child->status != Child::handing)
+                    continue;
+                LOG_INFO("[commit_hand_over] pid = " << child->pid << ", done = " << done);
+                if (!done) {
+                    child->status = Child::ready;
+                    for (size_t j = 0; j < child->stopped.size(); ++j) {
+                        child->table->free(child->stopped[j].second);
+                        child->send(ChildMessage(ChildMessage::stop, child->stopped[j].first));
+                    }
+                    child->stopped.clear();
+                    if (child->channels.empty() && child->adopted) {
+                        kill_child(child);
+                    } else if (child->channels.empty()) {
+                        idle_children_.push_back(child);
+                        post_refill();
+                    }
+                    continue;
+                }
+                std::map<boost::uint32_t, Channel *>::iterator iter = child->channels.begin();
+                for (; iter != child->channels.end(); ++iter) {
+                    // slot is still written by child, never reused here
+                    iter->second->child = NULL;
+                    iter->second->slot = StatusTable::npos;
+                }
+                child->channels.clear();
+                child->stopped.clear();
+                // forgotten as if reaped, it is not killed by our shutdown
+                {
+                    boost::mutex::scoped_lock lock(child_owners_mutex);
+                    child_owners.erase(child->pid);
+                }
+                pids_.erase(child->pid);
+                children_.erase(
+                    std::remove(children_.begin(), children_.end(), child), children_.end());
+                cpu_placement_->free(child->cpu);
+                child->status = Child::lost;
+                child->pid = 0;
+                child->close();
+                Child::release(child);
+            }
+        }
+
+        // adopted children keep the channels passed with them and are killed
+        // once empty; they are never placed new channels on, so slots of
+        // their tables are only allocated by old parent
+        void LiveModuleProxy::take_over(
+            HandOver & hand_over)
+        {
+            if (next_id_ < hand_over.next_id)
+                next_id_ = hand_over.next_id;
+            std::vector<StatusTable *> tables;
+            for (size_t i = 0; i < hand_over.tables.size(); ++i) {
+                HandOver::Table & table = hand_over.tables[i];
+                StatusTable * table2 = new StatusTable;
+                error_code ec;
+                if (table.fd < 0 || !table2->attach(table.fd, table.size, ec)) {
+                    LOG_WARN("[take_over] status table, ec = " << ec.message());
+                    if (table.fd >= 0)
+                        ::close(table.fd);
+                    delete table2;
+                    table2 = NULL;
+                } else {
+                    adopted_tables_.push_back(table2);
+                }
+                table.fd = -1; // owned by table2 now
+                tables.push_back(table2);
+            }
+            boost::uint64_t now = StatusTable::now_msec();
+            for (size_t i = 0; i < hand_over.children.size(); ++i) {
+                HandOver::Child & child2 = hand_over.children[i];
+                StatusTable * table = child2.table < tables.size() ? tables[child2.table] : NULL;
+                if (table == NULL) {
+                    // child exits when it sees the socket closed
+                    if (child2.fd >= 0)
+                        ::close(child2.fd);
+                    child2.fd = -1;
+                    continue;
+                }
+                Child * child = new Child(child2.fd);
+                child2.fd = -1;
+                child->after_fork(false, io_svc());
+                child->pid = child2.pid;
+                child->status = Child::ready;
+                child->start_time = now_msec();
+                child->table = table;
+                child->adopted = true;
+                for (size_t j = 0; j < child2.channels.size(); ++j) {
+                    HandOver::Channel & channel2 = child2.channels[j];
+                    Channel * channel = new Channel(channel2.url, 
+                        (boost::uint16_t)channel2.tcp_port, (boost::uint16_t)channel2.udp_port, call_back_func());
+                    channel->id = channel2.id;
+                    channel->start_time = now_msec();
+                    channel->slot = channel2.slot;
+                    channel->update_time = now;
+                    channel->child = child;
+                    child->channels[channel->id] = channel;
+                    channel2.handle = channel;
+                }
+                LOG_INFO("[take_over] pid = " << child->pid << ", channels = " << child->channels.size());
+                children_.push_back(child);
+                child->read(boost::bind(&LiveModuleProxy::handle_child_read, this, child, _1, _2));
+                if (child->channels.empty())
+                    kill_child(child);
+            }
+        }
+
+        void LiveModuleProxy::post_refill()
+        {
+            if (refill_posted_)
+                return;
+            refill_posted_ = true;
+            io_svc().post(boost::bind(&LiveModuleProxy::handle_refill, this));
+        }
+
+        // fork one child each round, so that the io thread is not blocked for long
+        void LiveModuleProxy::handle_refill()
+        {
+            refill_posted_ = false;
+            if (!get_daemon().is_started())
+                return;
+            size_t pool_max = pool_max_ < pool_min_ ? pool_min_ : pool_max_;
+            while (idle_children_.size() > pool_max) {
+                Child * child = idle_children_.back();
+                idle_children_.pop_back();
+                kill_child(child);
+            }
+            if (idle_children_.size() + starting_ < pool_min_ + pending_channels_.size()
+                && fork_child()) {
+                post_refill();
+            }
+        }
+
+        // pack: the fullest child with room, so that fewer children are
+        // used; spread: an idle child first, then the emptiest one.
+        // A child never hosts more than channels_per_child channels.
+        LiveModuleProxy::Child * LiveModuleProxy::place_channel()
+        {
+            size_t per_child = channels_per_child_ ? channels_per_child_ : 1;
+            bool spread = placement_ == "spread";
+            Child * best = NULL;
+            for (size_t i = 0; i < children_.size(); ++i) {
+                Child * child = children_[i];
+                size_t count = child->channels.size();
+                if (child->status != Child::ready || child->adopted || count == 0 || count >= per_child)
+                    continue;
+                if (best == NULL 
+                    || (spread ? count < best->channels.size() : count > best->channels.size()))
+                    best = child;
+            }
+            if ((spread || best == NULL) && !idle_children_.empty()) {
+                // with cpu placement, the idle child on the least loaded cpu
+                std::list<Child *>::iterator iter = idle_children_.begin();
+                if (cpu_placement_->enabled()) {
+                    std::list<Child *>::iterator iter2 = iter;
+                    for (++iter2; iter2 != idle_children_.end(); ++iter2) {
+                        if (cpu_placement_->load((*iter2)->cpu) < cpu_placement_->load((*iter)->cpu))
+                            iter = iter2;
+                    }
+                }
+                best = *iter;
+                idle_children_.erase(iter);
+            }
+            return best;
+        }
+
+        void LiveModuleProxy::assign_channel(
+            Child * child, 
+            Channel * channel)
+        {
+            child->channels[channel->id] = channel;
+            channel->child = child;
+            channel->slot = child->table->alloc();
+            channel->update_time = StatusTable::now_msec();
+            if (channel->slot == StatusTable::npos)
+                LOG_WARN("[assign_channel] status table full, channel " << channel->id);
+            ChildMessage msg(ChildMessage::start, channel->id);
+            msg << (boost::uint32_t)channel->tcp_port << (boost::uint32_t)channel->udp_port 
+                << channel->url << channel->slot;
+            child->send(msg);
+        }
+
+        void LiveModuleProxy::handle_child_read(
+            Child * child, 
+            error_code const & ec, 
+            size_t bytes_transferred)
+        {
+            if (ec) {
+                child->read_closed = true;
+                if (child->pid == 0) {
+                    Child::release(child);
+                    return;
+                }
+                LOG_INFO("[handle_child_read] child lost, pid = " << child->pid << ", ec = " << ec.message());
+                lose_child(child, now_msec());
+                if (child->adopted) {
+                    // reaped by its real parent, no SIGCHLD comes to us
+                    children_.erase(
+                        std::remove(children_.begin(), children_.end(), child), children_.end());
+                    child->pid = 0;
+                    child->close();
+                    Child::release(child);
+                }
+                return;
+            }
+            child->buf.commit(bytes_transferred);
+            ChildMessage msg;
             error_code ec1;
-            daemon.stop(ec1);
-        }
-
-    } // namespace live_worker
-} // namespace just
-
-#endif
+            while (msg.decode(child->buf, ec1)) {
+                error_code ec2;
+                if (msg.type == ChildMessage::ready) {
+                    msg >> ec2;
+                    handle_child_ready(child, ec2);
+                } else if (msg.type == ChildMessage::started) {
+                    std::string url;
+                    msg >> ec2 >> url;
+                    assert(msg);
+                    handle_start_channel(child, msg.id, ec2, url);
+                } else if (msg.type == ChildMessage::heartbeat) {
+                    boost::uint32_t send_time = 0;
+                    msg >> send_time;
+                    stat_.heartbeat_rtt = (boost::uint32_t)now_msec() - send_time;
+                }
+            }
+            if (ec1) {
+                // stream is out of sync, the child is useless
+                LOG_WARN("[handle_child_read] bad message, pid = " << child->pid);
+                ::kill(child->pid, SIGKILL);
+            }
+            child->read(boost::bind(&LiveModuleProxy::handle_child_read, this, child, _1, _2));
+        }
+
+        void LiveModuleProxy::handle_child_ready(
+            Child * child, 
+            error_code const & ec)
+        {
+            LOG_INFO("[handle_child_ready] pid = " << child->pid << ", ec = " << ec.message());
+            --starting_;
+            stat_.ready_latency = (boost::uint32_t)(now_msec() - child->start_time);
+            if (ec) {
+                // child exits by itself
+                child->status = Child::stopping;
+                post_refill();
+                return;
+            }
+            child->status = Child::ready;
+            size_t per_child = placement_ == "spread" || channels_per_child_ == 0 ? 1 : channels_per_child_;
+            while (!pending_channels_.empty() && child->channels.size() < per_child) {
+                Channel * channel = pending_channels_.front();
+                pending_channels_.pop_front();
+                assign_channel(child, channel);
+            }
+            if (child->channels.empty())
+                idle_children_.push_back(child);
+            post_refill();
+        }
+
+        void LiveModuleProxy::handle_start_channel(
+            Child * child, 
+            boost::uint32_t id, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            std::map<boost::uint32_t, Channel *>::const_iterator iter = child->channels.find(id);
+            LOG_INFO("[handle_start_channel] id = " << id << ", ec = " << ec.message() << ", url = " << url);
+            if (iter == child->channels.end())
+                return; // stopped meanwhile
+            Channel * channel = iter->second;
+            stat_.start_latency = (boost::uint32_t)(now_msec() - channel->start_time);
+            if (stat_.max_start_latency < stat_.start_latency)
+                stat_.max_start_latency = stat_.start_latency;
+            response_channel(channel, ec, url);
+        }
+
+        void LiveModuleProxy::response_channel(
+            Channel * channel, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            if (channel->call_back.empty())
+                return;
+            call_back_func call_back;
+            call_back.swap(channel->call_back);
+            io_svc().post(boost::bind(call_back, ec, url));
+        }
+
+        void LiveModuleProxy::kill_child(
+            Child * child)
+        {
+            LOG_INFO("[kill_child] pid = " << child->pid);
+            child->status = Child::stopping;
+            child->send(ChildMessage(ChildMessage::exit));
+        }
+
+        boost::uint64_t LiveModuleProxy::now_msec() const
+        {
+            return clock_timer::traits_type::subtract(
+                clock_timer::traits_type::now(), start_time_).total_milliseconds();
+        }
+
+    } // namespace live_worker
+} // namespace just
+
+#endif
@@ -1,87 +1,288 @@
-// LiveModuleProxy.h
-
-#ifndef _JUST_LIVE_WORKER_LIVE_MODULE_PROXY_H_
-#define _JUST_LIVE_WORKER_LIVE_MODULE_PROXY_H_
-
-#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
-#  ifdef BOOST_WINDOWS_API
-#    undef JUST_LIVE_WORKER_MULTI_PROCESS
-#  endif
-#endif
-
-#ifndef JUST_LIVE_WORKER_MULTI_PROCESS
-#  include "just/live_worker/LiveModule.h"
-#endif
-
-namespace just
-{
-    namespace live_worker
-    {
-
-#ifndef JUST_LIVE_WORKER_MULTI_PROCESS
-
-        typedef LiveModule LiveModuleProxy;
-
-#else
-        class LiveModuleProxy
-            : public util::daemon::ModuleBase<LiveModuleProxy>
-        {
-        public:
-            struct Channel;
-
-            typedef Channel * ChannelHandle;
-
-            typedef boost::function<void (
-                boost::system::error_code const &, 
-                std::string const &)> call_back_func;
-
-        public:
-            LiveModuleProxy(
-                util::daemon::Daemon & daemon);
-
-            ~LiveModuleProxy();
-
-        public:
-            virtual bool startup(
-                boost::system::error_code & ec);
-
-            virtual bool shutdown(
-                boost::system::error_code & ec);
-
-        public:
-            ChannelHandle start_channel(
-                std::string const & url,
-                boost::uint16_t tcp_port, 
-                boost::uint16_t udp_port, 
-                call_back_func const & call_back);
-
-            void stop_channel(
-                ChannelHandle handle);
-
-            void dump_channels();
-
-            size_t check_channels(
-                 std::vector<ChannelHandle> & failed);
-
-        private:
-            void handle_start_channel(
-                Channel * channel, 
-                boost::system::error_code const & ec, 
-                std::string const & url);
-
-            void handle_stop_channel(
-                util::daemon::Daemon & daemon, 
-                Channel * channel, 
-                boost::system::error_code const & ec, 
-                std::string const & msg);
-
-        private:
-            std::vector<Channel *> channels_;
-        };
-
-#endif
-
-    } // namespace live_worker
-} // namespace just
-
-#endif // _JUST_LIVE_WORKER_LIVE_MODULE_PROXY_H_
+// LiveModuleProxy.h
+
+#ifndef _JUST_LIVE_WORKER_LIVE_MODULE_PROXY_H_
+#define _JUST_LIVE_WORKER_LIVE_MODULE_PROXY_H_
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+#  ifdef BOOST_WINDOWS_API
+#    undef JUST_LIVE_WORKER_MULTI_PROCESS
+#  endif
+#endif
+
+#ifndef JUST_LIVE_WORKER_MULTI_PROCESS
+#  include "just/live_worker/LiveModule.h"
+#else
+#  include "just/live_worker/LiveModule.h"
+#  include <framework/timer/TimeTraits.h>
+#  include <boost/function.hpp>
+#  include <boost/unordered_map.hpp>
+#  include <boost/asio/signal_set.hpp>
+#  include <list>
+#endif
+
+namespace just
+{
+    namespace live_worker
+    {
+
+#ifndef JUST_LIVE_WORKER_MULTI_PROCESS
+
+        typedef LiveModule LiveModuleProxy;
+
+#else
+        // Channels run in child processes, each with its own LiveModule
+        // hosting up to channels_per_child channels. Children are forked
+        // ahead into a pool, where they have started LiveModule and wait on
+        // their socketpair for a start command. Children report status of
+        // their channels through a StatusTable shared with the parent.
+        // With child_mode "exec", a child is not a copy of the parent but a
+        // new channel host process, see run_channel_host. Shards of
+        // LiveShards always exec.
+        struct ChildMessage;
+
+        class StatusTable;
+
+        class CpuPlacement;
+
+        struct HandOver;
+
+        class LiveModuleProxy
+            : public util::daemon::ModuleBase<LiveModuleProxy>
+        {
+        public:
+            struct Channel;
+
+            typedef Channel * ChannelHandle;
+
+            typedef boost::function<void (
+                boost::system::error_code const &, 
+                std::string const &)> call_back_func;
+
+            typedef boost::function<void (
+                std::vector<ChannelHandle> const &)> fail_handler_func;
+
+            struct Statistics
+            {
+                Statistics()
+                    : fork(0)
+                    , pool_hit(0)
+                    , pool_miss(0)
+                    , start_latency(0)
+                    , max_start_latency(0)
+                    , rss_per_channel(0)
+                    , heartbeat_rtt(0)
+                    , child_crash(0)
+                    , crash_notify(0)
+                    , max_crash_notify(0)
+                    , download_speed(0)
+                    , upload_speed(0)
+                    , peer_count(0)
+                    , status_stale(0)
+                    , spawn_time(0)
+                    , max_spawn_time(0)
+                    , ready_latency(0)
+                {
+                }
+
+                boost::uint64_t fork;       // children forked
+                boost::uint64_t pool_hit;   // channel placed on a ready child
+                boost::uint64_t pool_miss;  // channel had to wait for a new child
+                boost::uint32_t start_latency;      // msec, start_channel to started, last one
+                boost::uint32_t max_start_latency;
+                boost::uint32_t rss_per_channel;    // KB, resident memory of children per channel
+                boost::uint32_t heartbeat_rtt;      // msec, last heartbeat round trip
+                boost::uint64_t child_crash;        // children lost with channels
+                boost::uint32_t crash_notify;       // msec, child lost to clients notified, last one
+                boost::uint32_t max_crash_notify;
+                boost::uint32_t download_speed;     // bytes per second, all channels
+                boost::uint32_t upload_speed;       // bytes per second, all channels
+                boost::uint32_t peer_count;         // all channels
+                boost::uint64_t status_stale;       // children killed for not updating status
+                boost::uint32_t spawn_time;         // usec, parent blocked in fork or spawn, last one
+                boost::uint32_t max_spawn_time;
+                boost::uint32_t ready_latency;      // msec, child started to ready, last one
+            };
+
+        public:
+            LiveModuleProxy(
+                util::daemon::Daemon & daemon);
+
+            ~LiveModuleProxy();
+
+        public:
+            virtual bool startup(
+                boost::system::error_code & ec);
+
+            virtual bool shutdown(
+                boost::system::error_code & ec);
+
+        public:
+            ChannelHandle start_channel(
+                std::string const & url,
+                boost::uint16_t tcp_port, 
+                boost::uint16_t udp_port, 
+                call_back_func const & call_back);
+
+            void stop_channel(
+                ChannelHandle handle);
+
+            // heartbeat, stale status and speeds, each check interval
+            void check_children();
+
+            // channel status to trace log, memory and load of children;
+            // reads /proc of every child
+            void dump_channels();
+
+            // handler is called at once with started channels whose child died
+            void set_fail_handler(
+                fail_handler_func const & handler)
+            {
+                fail_handler_ = handler;
+            }
+
+            Statistics const & stat() const
+            {
+                return stat_;
+            }
+
+            // children are exec'ed whatever child_mode is; a fork while
+            // other threads run may copy a lock held by one of them
+            void set_exec_only();
+
+        public:
+            // hot upgrade, see LiveUpgrade. Children hosting only working
+            // channels are passed out with dups of their sockets and tables,
+            // and held with no new channel and no message to them.
+            void hand_over(
+                HandOver & hand_over);
+
+            // once new process is done, children passed out are forgotten;
+            // their channels stay with no child until stop_channel, which
+            // then tells no child. If not done, children are ours again and
+            // told of channels stopped meanwhile.
+            void commit_hand_over(
+                bool done);
+
+            // adopt children passed by old process, handle of each channel
+            // is set; fds in hand_over are taken, used or closed
+            void take_over(
+                HandOver & hand_over);
+
+        public:
+            // body of an exec'ed child, param is what spawn_child put after
+            // --channel_host=; daemon has config loaded and nothing else
+            static int run_channel_host(
+                util::daemon::Daemon & daemon, 
+                std::string const & param);
+
+            // first thing in an exec'ed child, before daemon and logger open
+            // theirs: closes every fd but stdio and those passed in param
+            static void close_inherited_fds(
+                std::string const & param);
+
+        private:
+            struct Child;
+
+            struct ChildHost;
+
+            // fork a child into the pool, NULL if fork failed
+            Child * fork_child();
+
+            // posix_spawn a channel host, instead of fork
+            pid_t spawn_child(
+                Child * child);
+
+            void child_main(
+                Child * child);
+
+            void post_refill();
+
+            void handle_refill();
+
+            Child * place_channel();
+
+            void assign_channel(
+                Child * child, 
+                Channel * channel);
+
+            void handle_signal(
+                boost::system::error_code const & ec, 
+                int signal_number);
+
+            void handle_child_exit(
+                pid_t pid, 
+                int status, 
+                boost::uint64_t detect_time);
+
+            void lose_child(
+                Child * child, 
+                boost::uint64_t detect_time);
+
+            void handle_crash_notified(
+                boost::uint64_t detect_time);
+
+            void handle_child_read(
+                Child * child, 
+                boost::system::error_code const & ec, 
+                size_t bytes_transferred);
+
+            void handle_child_ready(
+                Child * child, 
+                boost::system::error_code const & ec);
+
+            void handle_start_channel(
+                Child * child, 
+                boost::uint32_t id, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void response_channel(
+                Channel * channel, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void kill_child(
+                Child * child);
+
+            void sample_load();
+
+            boost::uint64_t now_msec() const;
+
+        private:
+            std::vector<Child *> children_;         // all living children
+            boost::unordered_map<pid_t, Child *> pids_;
+            std::list<Child *> idle_children_;      // ready, no channel
+            std::list<Channel *> pending_channels_; // waiting for a ready child
+            size_t starting_;                       // forked, not ready yet
+            size_t pool_min_;
+            size_t pool_max_;
+            size_t channels_per_child_;
+            std::string placement_;                 // "pack" or "spread"
+            std::string child_mode_;                // "fork" or "exec"
+            CpuPlacement * cpu_placement_;
+            std::string cpu_policy_;                // see CpuPlacement
+            std::string reactor_cpus_;              // cpu list for io thread
+            int numa_node_;                         // children on this node, -1 any
+            std::string cpu_status_;                // CpuPlacement::status
+            boost::uint64_t load_time_;             // msec, cpu time of children last read
+            std::string exe_path_;                  // for exec
+            std::vector<std::string> cmdline_;      // for exec, our arguments
+            StatusTable * status_table_;
+            std::vector<StatusTable *> adopted_tables_; // of old parents
+            size_t status_slots_;
+            boost::uint32_t status_interval_;       // msec, status written by children
+            boost::uint32_t status_stale_;          // msec, child killed if no status
+            boost::uint32_t next_id_;
+            bool refill_posted_;
+            fail_handler_func fail_handler_;
+            boost::asio::signal_set * signals_;     // SIGCHLD
+            Statistics stat_;
+            clock_timer::time_type start_time_;
+        };
+
+#endif
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_LIVE_MODULE_PROXY_H_
@@ -1,180 +1,646 @@
-// LiveProxy.cpp
-
-#include "just/live_worker/Common.h"
-#include "just/live_worker/LiveProxy.h"
-#include "just/live_worker/LiveManager.h"
-
-#include <util/protocol/http/HttpProxy.h>
-#include <util/protocol/http/HttpRequest.h>
-#include <util/protocol/http/HttpResponse.h>
-
-#include <framework/network/TcpSocket.hpp>
-#include <framework/logger/Logger.h>
-#include <framework/logger/StreamRecord.h>
-#include <framework/string/Url.h>
-#include <framework/string/Parse.h>
-
-using namespace boost::system;
-
-FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveProxy", framework::logger::Debug)
-
-namespace just
-{
-    namespace live_worker
-    {
-
-        class Proxy;
-
-        class ProxyManager
-            : public framework::network::ServerManager<Proxy, ProxyManager>
-        {
-        public:
-            ProxyManager(
-                boost::asio::io_service & io_svc, 
-                LiveManager & module)
-                : framework::network::ServerManager<Proxy, ProxyManager>(io_svc)
-                , module_(module)
-            {
-            }
-
-        public:
-            void insert_proxy(
-                Proxy * proxy)
-            {
-                proxys_.push_back(proxy);
-            }
-
-            void remove_proxy(
-                Proxy * proxy)
-            {
-                proxys_.erase(
-                    std::remove(proxys_.begin(), proxys_.end(), proxy), proxys_.end());
-            }
-
-        public:
-            LiveManager & module()
-            {
-                return module_;
-            }
-
-            void stop();
-
-        private:
-            LiveManager & module_;
-            std::vector<Proxy *> proxys_;
-        };
-
-        class Proxy
-            : public util::protocol::HttpProxy
-        {
-        public:
-            Proxy(
-                ProxyManager & mgr)
-                : HttpProxy(mgr.io_svc())
-                , mgr_(mgr)
-                , channel_(NULL)
-            {
+// LiveProxy.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveProxy.h"
+#include "just/live_worker/LiveShards.h"
+#include "just/live_worker/LiveModuleProxy.h"
+#include "just/live_worker/Relay.h"
+#include "just/live_worker/SpliceSession.h"
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+#  include "just/live_worker/LiveUpgrade.h"
+#  include <sys/socket.h>
+#endif
+
+#include <util/protocol/http/HttpProxy.h>
+#include <util/protocol/http/HttpRequest.h>
+#include <util/protocol/http/HttpResponse.h>
+
+#include <framework/network/TcpSocket.hpp>
+#include <framework/logger/Logger.h>
+#include <framework/logger/StreamRecord.h>
+#include <framework/string/Url.h>
+#include <framework/string/Parse.h>
+
+#include <boost/thread/mutex.hpp>
+using namespace boost::system;
+
+#include <algorithm>
+#include <sstream>
+
+#include <sys/resource.h>
+using namespace framework::timer;
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveProxy", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        class Proxy;
+
+        class ProxyManager
+            : public framework::network::ServerManager<Proxy, ProxyManager>
+        {
+        public:
+            ProxyManager(
+                boost::asio::io_service & io_svc, 
+                LiveShards & module)
+                : framework::network::ServerManager<Proxy, ProxyManager>(io_svc)
+                , module_(module)
+                , io_index_(0)
+                , accept_svc_(io_svc)
+                , acceptor_(NULL)
+                , relay_(NULL)
+                , relay_shared_(false)
+                , relay_splice_(false)
+                , hls_(false)
+                , time_shift_(false)
+            {
+            }
+
+            ~ProxyManager()
+            {
+                delete acceptor_;
+                delete relay_;
+            }
+
+        public:
+            // proxies may be destroyed in other io threads
+            void insert_proxy(
+                Proxy * proxy)
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                proxys_.push_back(proxy);
+            }
+
+            void remove_proxy(
+                Proxy * proxy)
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                proxys_.erase(
+                    std::remove(proxys_.begin(), proxys_.end(), proxy), proxys_.end());
+            }
+
+            // proxies are created one at a time in accept handler, 
+            // io_index() is the index of last returned io_service
+            boost::asio::io_service & next_io_svc()
+            {
+                io_index_ = (io_index_ + 1) % module_.io_count();
+                return module_.io_svc_at(io_index_);
+            }
+
+            size_t io_index() const
+            {
+                return io_index_;
+            }
+
+        public:
+            LiveShards & module()
+            {
+                return module_;
+            }
+
+            void stop();
+
+            // hot upgrade: accept on listener passed by old process, instead
+            // of start
+            void adopt(
+                int fd, 
+                boost::system::error_code & ec);
+
+            // connections accepted are served to end
+            void stop_accept();
+
+            size_t proxy_count()
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                return proxys_.size();
+            }
+
+            // shared: clients of a channel share one upstream, see Relay;
+            // splice: a client moves the body of its own upstream with 
+            // splice, see SpliceSession; neither: HttpProxy relays
+            void enable_relay(
+                size_t capacity, 
+                boost::uint64_t memory_limit, 
+                boost::uint32_t linger, 
+                bool shared, 
+                bool splice)
+            {
+                relay_ = new RelayHub(capacity, memory_limit, linger);
+                relay_shared_ = shared;
+                relay_splice_ = splice;
+            }
+
+            RelayHub * relay()
+            {
+                return relay_;
+            }
+
+            bool relay_shared() const
+            {
+                return relay_shared_;
+            }
+
+            bool relay_splice() const
+            {
+                return relay_splice_;
+            }
+
+            // HLS requests are served from relays, see HlsSegmenter
+            void enable_hls(
+                bool hls)
+            {
+                hls_ = hls;
+            }
+
+            bool hls() const
+            {
+                return hls_;
+            }
+
+            // time-shift requests are served from relays, see TimeShift
+            void enable_time_shift(
+                bool time_shift)
+            {
+                time_shift_ = time_shift;
+            }
+
+            bool time_shift() const
+            {
+                return time_shift_;
+            }
+
+        private:
+            void start_accept();
+
+            void handle_accept(
+                Proxy * proxy, 
+                boost::system::error_code const & ec);
+
+        private:
+            LiveShards & module_;
+            size_t io_index_;
+            boost::mutex mutex_;
+            std::vector<Proxy *> proxys_;
+            boost::asio::io_service & accept_svc_;
+            boost::asio::ip::tcp::acceptor * acceptor_; // adopted
+            RelayHub * relay_;
+            bool relay_shared_;
+            bool relay_splice_;
+            bool hls_;
+            bool time_shift_;
+        };
+
+        class Proxy
+            : public util::protocol::HttpProxy
+        {
+        public:
+            Proxy(
+                ProxyManager & mgr)
+                : HttpProxy(mgr.next_io_svc())
+                , mgr_(mgr)
+                , io_index_(mgr.io_index())
+                , time_shift_(false)
+                , time_shift_back_(-1)
+                , time_shift_offset_(-1)
+                , hls_(false)
+                , hls_sequence_(-1)
+            {
                 mgr_.insert_proxy(this);
-            }
-
-            virtual ~Proxy()
-            {
+            }
+
+            virtual ~Proxy()
+            {
                 mgr_.remove_proxy(this);
-            }
-
-            virtual void on_receive_request_head(
-                util::protocol::HttpRequestHead & request_head, 
-                response_type const & resp)
-            {
-                request_head.get_content(std::cout);
-                std::string url = request_head.path;
-                channel_ = mgr_.module().start_channel(framework::string::Url::decode(url), 
-                    boost::bind(&Proxy::on_channel_ready, this, resp, _1, _2));
-            }
-
-            virtual void on_receive_response_head( 
-                util::protocol::HttpResponseHead & response_head)
-            {
-                response_head.get_content(std::cout);
-            }
-
-            virtual void on_broken_pipe()
-            {
-                mgr_.module().stop_channel(channel_);
+            }
+
+            virtual void on_receive_request_head(
+                util::protocol::HttpRequestHead & request_head, 
+                response_type const & resp)
+            {
+                request_head.get_content(std::cout);
+                std::string url = request_head.path;
+                parse_request(request_head, url);
+                channel_ = mgr_.module().start_channel(io_index_, framework::string::Url::decode(url), 
+                    boost::bind(&Proxy::on_channel_ready, this, resp, _1, _2));
+            }
+
+            virtual void on_receive_response_head( 
+                util::protocol::HttpResponseHead & response_head)
+            {
+                response_head.get_content(std::cout);
+            }
+
+            virtual void on_broken_pipe()
+            {
+                mgr_.module().stop_channel(channel_);
                 HttpProxy::on_broken_pipe();
-            }
-
-            virtual void on_error(
-                boost::system::error_code const & ec)
-            {
-                LOG_WARN("on_error " << ec.message());
-                if (ec == boost::asio::error::address_in_use)
-                    mgr_.module().get_daemon().post_stop();
-            }
-
-            virtual void on_finish()
-            {
-                mgr_.module().stop_channel(channel_);
-            }
-
+            }
+
+            virtual void on_error(
+                boost::system::error_code const & ec)
+            {
+                LOG_WARN("on_error " << ec.message());
+                if (ec == boost::asio::error::address_in_use)
+                    mgr_.module().get_daemon().post_stop();
+            }
+
+            virtual void on_finish()
+            {
+                mgr_.module().stop_channel(channel_);
+            }
+
             void on_channel_ready(
                 response_type const & resp, 
                 boost::system::error_code const & ec, 
                 std::string const & url_str)
             {
+                if (!ec && mgr_.relay_shared()) {
+                    // no upstream of our own, the response is written to our
+                    // socket by the session; resp is called when it ends, so
+                    // that HttpProxy closes us as on any failed request
+                    relay_.reset(new RelaySession(mgr_.module().io_svc_at(io_index_), *this, 
+                        boost::bind(&Proxy::on_relay_end, this, resp, _1)));
+                    if (hls_)
+                        relay_->hls(hls_uri_, hls_sequence_);
+                    else if (time_shift_)
+                        relay_->time_shift(time_shift_back_, time_shift_offset_);
+                    if (mgr_.relay()->join(url_str, relay_))
+                        return;
+                    relay_.reset();
+                    // not a stream HttpProxy could relay
+                    if (hls_) {
+                        resp(boost::asio::error::no_buffer_space, false);
+                        return;
+                    }
+                    // relay memory used up, HttpProxy relays this one
+                }
+                if (!ec && mgr_.relay_splice()) {
+                    splice_.reset(new SpliceSession(mgr_.module().io_svc_at(io_index_), *this, 
+                        *mgr_.relay(), boost::bind(&Proxy::on_relay_end, this, resp, _1)));
+                    splice_->start(url_str);
+                    return;
+                }
                 framework::string::Url url(url_str);
                 get_request_head().host.reset(url.host() + ":" + url.svc());
                 get_request_head().path = url.path();
                 resp(ec, true);
-            }
-
-        private:
-            ProxyManager & mgr_;
-            LiveManager::ChannelHandle channel_;
-        };
-
-        void ProxyManager::stop()
-        {
-            framework::network::ServerManager<Proxy, ProxyManager>::stop();
-            for (size_t i = 0; i < proxys_.size(); ++i) {
-                error_code ec;
-                proxys_[i]->cancel(ec);
-            }
-        }
-
-        LiveProxy::LiveProxy(
-            util::daemon::Daemon & daemon)
-            : just::common::CommonModuleBase<LiveProxy>(daemon, "LiveProxy")
-            , module_(util::daemon::use_module<LiveManager>(daemon))
-            , portMgr_(util::daemon::use_module<just::common::PortManager>(daemon))
-            , addr_("0.0.0.0:9001+")
-        {
-            daemon.config().register_module("LiveProxy")
-                << CONFIG_PARAM_NAME_RDWR("addr", addr_);
-
-            mgr_ = new ProxyManager(io_svc(),module_);
-        }
-
-        LiveProxy::~LiveProxy()
-        {
-            delete mgr_;
-        }
-
+            }
+
+            void on_relay_end(
+                response_type const & resp, 
+                boost::system::error_code const & ec)
+            {
+                relay_.reset();
+                splice_.reset();
+                resp(ec ? ec : error_code(boost::asio::error::eof), false);
+            }
+
+            void post_cancel()
+            {
+                mgr_.module().io_svc_at(io_index_).post(
+                    boost::bind(&Proxy::handle_cancel, this));
+            }
+
+        private:
+            // "hls" and "hls_segment=N.ts" parameters ask for the playlist
+            // of the channel and a segment of it, see RelaySession::hls;
+            // "offset" (seconds behind live) and "timeshift" parameters, or
+            // a Range of "bytes=N-", ask for time-shift of the channel, see
+            // RelaySession::time_shift; the parameters are taken off url
+            // only when enabled, else they go upstream as they are
+            void parse_request(
+                util::protocol::HttpRequestHead & request_head, 
+                std::string & url)
+            {
+                std::string::size_type query = url.find('?');
+                if (query != std::string::npos) {
+                    std::string params;
+                    std::string::size_type pos = query + 1;
+                    while (pos <= url.size()) {
+                        std::string::size_type end = url.find('&', pos);
+                        if (end == std::string::npos)
+                            end = url.size();
+                        std::string param = url.substr(pos, end - pos);
+                        if (mgr_.hls() && param == "hls") {
+                            hls_ = true;
+                        } else if (mgr_.hls() && param.compare(0, 12, "hls_segment=") == 0) {
+                            hls_ = true;
+                            hls_sequence_ = strtoull(param.c_str() + 12, NULL, 10);
+                        } else if (mgr_.time_shift() && param.compare(0, 7, "offset=") == 0) {
+                            time_shift_ = true;
+                            time_shift_back_ = strtoull(param.c_str() + 7, NULL, 10) * 1000;
+                        } else if (mgr_.time_shift() && (param == "timeshift" || param.compare(0, 10, "timeshift=") == 0)) {
+                            time_shift_ = true;
+                        } else if (!param.empty()) {
+                            params += (params.empty() ? "?" : "&") + param;
+                        }
+                        pos = end + 1;
+                    }
+                    url = url.substr(0, query) + params;
+                    // relative to the playlist, its path kept
+                    hls_uri_ = (params.empty() ? "?" : params + "&") + "hls_segment=";
+                }
+                if (hls_ || !mgr_.time_shift())
+                    return;
+                std::ostringstream oss;
+                request_head.get_content(oss);
+                std::string head = oss.str();
+                std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+                static char const range_prefix[] = "\nrange: bytes=";
+                std::string::size_type range = head.find(range_prefix);
+                if (range != std::string::npos) {
+                    char const * p = head.c_str() + range + sizeof(range_prefix) - 1;
+                    char * end = NULL;
+                    boost::uint64_t offset = strtoull(p, &end, 10);
+                    if (end != p && *end == '-') {
+                        time_shift_ = true;
+                        time_shift_offset_ = offset;
+                    }
+                }
+            }
+
+            void handle_cancel()
+            {
+                error_code ec;
+                cancel(ec);
+                if (relay_) {
+                    boost::shared_ptr<RelaySession> relay = relay_;
+                    relay->close();
+                }
+                if (splice_) {
+                    boost::shared_ptr<SpliceSession> splice = splice_;
+                    splice->close();
+                }
+            }
+
+        private:
+            ProxyManager & mgr_;
+            size_t io_index_;
+            LiveShards::ChannelHandle channel_;
+            boost::shared_ptr<RelaySession> relay_;
+            boost::shared_ptr<SpliceSession> splice_;
+            bool time_shift_;
+            boost::uint64_t time_shift_back_;       // msec
+            boost::uint64_t time_shift_offset_;
+            bool hls_;
+            std::string hls_uri_;
+            boost::uint64_t hls_sequence_;          // -1 for the playlist
+        };
+
+        void ProxyManager::stop()
+        {
+            stop_accept();
+            boost::mutex::scoped_lock lock(mutex_);
+            for (size_t i = 0; i < proxys_.size(); ++i) {
+                proxys_[i]->post_cancel();
+            }
+        }
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+        void ProxyManager::adopt(
+            int fd, 
+            error_code & ec)
+        {
+            sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+            ::getsockname(fd, (sockaddr *)&addr, &len);
+            acceptor_ = new boost::asio::ip::tcp::acceptor(accept_svc_);
+            acceptor_->assign(addr.ss_family == AF_INET6 
+                ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(), fd, ec);
+            if (!ec)
+                start_accept();
+        }
+
+        // as ServerManager does: the proxy is the socket of its client
+        void ProxyManager::start_accept()
+        {
+            Proxy * proxy = new Proxy(*this);
+            acceptor_->async_accept(*proxy, 
+                boost::bind(&ProxyManager::handle_accept, this, proxy, _1));
+        }
+
+        void ProxyManager::handle_accept(
+            Proxy * proxy, 
+            error_code const & ec)
+        {
+            if (ec) {
+                delete proxy;
+                if (ec != boost::asio::error::operation_aborted)
+                    LOG_WARN("[handle_accept] ec = " << ec.message());
+                return;
+            }
+            proxy->start();
+            start_accept();
+        }
+
+#endif
+
+        void ProxyManager::stop_accept()
+        {
+            framework::network::ServerManager<Proxy, ProxyManager>::stop();
+            if (acceptor_) {
+                error_code ec;
+                acceptor_->close(ec);
+            }
+        }
+
+        LiveProxy::LiveProxy(
+            util::daemon::Daemon & daemon)
+            : just::common::CommonModuleBase<LiveProxy>(daemon, "LiveProxy")
+            , module_(util::daemon::use_module<LiveShards>(daemon))
+            , portMgr_(util::daemon::use_module<just::common::PortManager>(daemon))
+            , addr_("0.0.0.0:9001+")
+            , upgrade_drain_(60000)
+            , upgrade_(NULL)
+            , drain_left_(0)
+            , drain_timer_(io_svc())
+            , relay_(false)
+            , relay_buffer_(4 * 1024 * 1024)
+            , relay_memory_(256)
+            , relay_linger_(30000)
+            , relay_splice_(false)
+            , time_shift_segment_(16)
+            , time_shift_segments_(16)
+            , time_shift_max_(16)
+            , hls_(false)
+            , hls_segment_(4000)
+            , hls_window_(6)
+            , stat_timer_(io_svc())
+            , stat_cpu_(0)
+            , stat_bytes_(0)
+        {
+            daemon.config().register_module("LiveProxy")
+                << CONFIG_PARAM_NAME_RDWR("addr", addr_)
+                << CONFIG_PARAM_NAME_RDONLY("upgrade_path", upgrade_path_)
+                << CONFIG_PARAM_NAME_RDWR("upgrade_drain", upgrade_drain_)
+                << CONFIG_PARAM_NAME_RDONLY("relay", relay_)
+                << CONFIG_PARAM_NAME_RDONLY("relay_buffer", relay_buffer_)
+                << CONFIG_PARAM_NAME_RDONLY("relay_memory", relay_memory_)
+                << CONFIG_PARAM_NAME_RDONLY("relay_linger", relay_linger_)
+                << CONFIG_PARAM_NAME_RDONLY("relay_splice", relay_splice_)
+                << CONFIG_PARAM_NAME_RDONLY("time_shift_path", time_shift_path_)
+                << CONFIG_PARAM_NAME_RDONLY("time_shift_segment", time_shift_segment_)
+                << CONFIG_PARAM_NAME_RDONLY("time_shift_segments", time_shift_segments_)
+                << CONFIG_PARAM_NAME_RDONLY("time_shift_max", time_shift_max_)
+                << CONFIG_PARAM_NAME_RDONLY("hls", hls_)
+                << CONFIG_PARAM_NAME_RDONLY("hls_segment", hls_segment_)
+                << CONFIG_PARAM_NAME_RDONLY("hls_window", hls_window_)
+                << CONFIG_PARAM_NAME_RDONLY("relay_upstreams", stat_.relay_upstreams)
+                << CONFIG_PARAM_NAME_RDONLY("relay_sessions", stat_.relay_sessions)
+                << CONFIG_PARAM_NAME_RDONLY("relay_overrun", stat_.relay_overrun)
+                << CONFIG_PARAM_NAME_RDONLY("relay_fallback", stat_.relay_fallback)
+                << CONFIG_PARAM_NAME_RDONLY("relay_gop_hit", stat_.relay_gop_hit)
+                << CONFIG_PARAM_NAME_RDONLY("relay_memory_used", stat_.relay_memory_used)
+                << CONFIG_PARAM_NAME_RDONLY("time_shifts", stat_.time_shifts)
+                << CONFIG_PARAM_NAME_RDONLY("time_shift_hit", stat_.time_shift_hit)
+                << CONFIG_PARAM_NAME_RDONLY("hls_channels", stat_.hls_channels)
+                << CONFIG_PARAM_NAME_RDONLY("hls_requests", stat_.hls_requests)
+                << CONFIG_PARAM_NAME_RDONLY("relay_mbps", stat_.relay_mbps)
+                << CONFIG_PARAM_NAME_RDONLY("cpu_load", stat_.cpu_load)
+                << CONFIG_PARAM_NAME_RDONLY("cpu_per_gbps", stat_.cpu_per_gbps);
+
+            mgr_ = new ProxyManager(io_svc(),module_);
+        }
+
+        LiveProxy::~LiveProxy()
+        {
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            delete upgrade_;
+#endif
+            delete mgr_;
+        }
+
         bool LiveProxy::startup(
-            error_code & ec)
-        {
-            mgr_->start(addr_,ec);
-            if(!ec)
-                portMgr_.set_port(just::common::live,addr_.port());
-            return !ec;
-        }
-
-        bool LiveProxy::shutdown(
-            error_code & ec)
-        {
-            mgr_->stop();
-            return !ec;
-        }
-
-    } // namespace live_worker
-} // namespace just
+            error_code & ec)
+        {
+            boost::uint16_t port = addr_.port();
+            bool adopted = false;
+            mgr_->enable_relay(relay_buffer_, (boost::uint64_t)relay_memory_ << 20, 
+                relay_linger_, relay_, relay_splice_);
+            mgr_->relay()->set_time_shift(time_shift_path_, (size_t)time_shift_segment_ << 20, 
+                time_shift_segments_, time_shift_max_);
+            mgr_->relay()->set_hls(hls_segment_, hls_window_);
+            mgr_->enable_hls(hls_ && relay_);
+            mgr_->enable_time_shift(!time_shift_path_.empty() && relay_);
+            stat_time_ = clock_timer::traits_type::now();
+            error_code ec0;
+            handle_stat_timer(ec0);
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            // an old process on upgrade_path passes its listener and
+            // channels; if it fails, we start as usual without them
+            if (!upgrade_path_.empty()) {
+                upgrade_ = new LiveUpgrade(io_svc(), module_);
+                int listener = -1;
+                error_code ec1;
+                if (upgrade_->take_over(upgrade_path_, upgrade_drain_, listener, ec1)) {
+                    port = LiveUpgrade::port_of(listener);
+                    mgr_->adopt(listener, ec1);
+                    adopted = !ec1;
+                    if (!adopted)
+                        LOG_WARN("[startup] adopt listener failed, ec = " << ec1.message());
+                }
+            }
+#endif
+            if (!adopted) {
+                mgr_->start(addr_,ec);
+                port = addr_.port();
+            }
+            if(!ec)
+                portMgr_.set_port(just::common::live,port);
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            if (!ec && upgrade_) {
+                error_code ec1;
+                if (!upgrade_->listen(upgrade_path_, port, 
+                    boost::bind(&LiveProxy::handle_handed_over, this), ec1))
+                    LOG_WARN("[startup] upgrade path " << upgrade_path_ << ", ec = " << ec1.message());
+            }
+#endif
+            return !ec;
+        }
+
+        bool LiveProxy::shutdown(
+            error_code & ec)
+        {
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            if (upgrade_)
+                upgrade_->close();
+#endif
+            error_code ec1;
+            drain_timer_.cancel(ec1);
+            stat_timer_.cancel(ec1);
+            mgr_->stop();
+            return !ec;
+        }
+
+        // the new process accepts now, we exit once our clients are gone
+        void LiveProxy::handle_handed_over()
+        {
+            LOG_INFO("[handle_handed_over] draining, clients: " << mgr_->proxy_count());
+            mgr_->stop_accept();
+            drain_left_ = upgrade_drain_;
+            error_code ec;
+            handle_drain_timer(ec);
+        }
+
+        void LiveProxy::handle_drain_timer(
+            error_code const & ec)
+        {
+            if (ec || !get_daemon().is_started())
+                return;
+            if (mgr_->proxy_count() == 0 || drain_left_ == 0) {
+                LOG_INFO("[handle_drain_timer] drained, clients left: " << mgr_->proxy_count());
+                get_daemon().post_stop();
+                return;
+            }
+            boost::uint32_t interval = drain_left_ < 1000 ? drain_left_ : 1000;
+            drain_left_ -= interval;
+            drain_timer_.expires_from_now(Duration::milliseconds(interval));
+            drain_timer_.async_wait(boost::bind(&LiveProxy::handle_drain_timer, this, _1));
+        }
+
+        // cpu of this process only, channel children are not counted
+        void LiveProxy::handle_stat_timer(
+            error_code const & ec)
+        {
+            if (ec)
+                return;
+            clock_timer::time_type now = clock_timer::traits_type::now();
+            boost::uint64_t msec = clock_timer::traits_type::subtract(now, stat_time_).total_milliseconds();
+            rusage usage;
+            ::getrusage(RUSAGE_SELF, &usage);
+            boost::uint64_t cpu = 
+                (boost::uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+                + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+            RelayHub * relay = mgr_->relay();
+            boost::uint64_t bytes = relay ? relay->stat().bytes_out : 0;
+            if (msec) {
+                stat_.cpu_load = (boost::uint32_t)((cpu - stat_cpu_) / msec);
+                stat_.relay_mbps = (boost::uint32_t)((bytes - stat_bytes_) * 8 / 1000 / msec);
+                stat_.cpu_per_gbps = stat_.relay_mbps 
+                    ? (boost::uint32_t)((boost::uint64_t)stat_.cpu_load * 1000 / stat_.relay_mbps) : 0;
+            }
+            if (relay) {
+                stat_.relay_upstreams = relay->stat().upstreams;
+                stat_.relay_sessions = relay->stat().sessions;
+                stat_.relay_overrun = relay->stat().overrun;
+                stat_.relay_fallback = relay->stat().fallback;
+                stat_.relay_gop_hit = relay->stat().gop_hit;
+                stat_.relay_memory_used = (boost::uint32_t)(relay->stat().memory >> 20);
+                stat_.time_shifts = relay->stat().time_shifts;
+                stat_.time_shift_hit = relay->stat().time_shift_hit;
+                stat_.hls_channels = relay->stat().hls_channels;
+                stat_.hls_requests = relay->stat().hls_requests;
+            }
+            stat_time_ = now;
+            stat_cpu_ = cpu;
+            stat_bytes_ = bytes;
+            stat_timer_.expires_from_now(Duration::milliseconds(5000));
+            stat_timer_.async_wait(boost::bind(&LiveProxy::handle_stat_timer, this, _1));
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -1,46 +1,114 @@
-// LiveProxy.h
-
-#ifndef _JUST_LIVE_WORKER_LIVE_PROXY_H_
-#define _JUST_LIVE_WORKER_LIVE_PROXY_H_
-
-#include <just/common/PortManager.h>
-
-#include <framework/network/NetName.h>
-
-#include <boost/function.hpp>
-
-namespace just
-{
-    namespace live_worker
-    {
-
-        class LiveManager;
-        class ProxyManager;
-
-        class LiveProxy
-            : public just::common::CommonModuleBase<LiveProxy>
-        {
-        public:
-            LiveProxy(
-                util::daemon::Daemon & daemon);
-
-            ~LiveProxy();
-
-        public:
-            virtual bool startup(
-                boost::system::error_code & ec);
-
-            virtual bool shutdown(
-                boost::system::error_code & ec);
-
-        private:
-            LiveManager & module_;
-            just::common::PortManager& portMgr_;
-            ProxyManager * mgr_;
-            framework::network::NetName addr_;
-        };
-
-    } // namespace live_worker
-} // namespace just
-
-#endif // _JUST_LIVE_WORKER_LIVE_PROXY_H_
+// LiveProxy.h
+
+#ifndef _JUST_LIVE_WORKER_LIVE_PROXY_H_
+#define _JUST_LIVE_WORKER_LIVE_PROXY_H_
+
+#include <just/common/PortManager.h>
+
+#include <framework/network/NetName.h>
+#include <framework/timer/TimeTraits.h>
+
+#include <boost/function.hpp>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        class LiveShards;
+        class ProxyManager;
+        class LiveUpgrade;
+
+        class LiveProxy
+            : public just::common::CommonModuleBase<LiveProxy>
+        {
+        public:
+            LiveProxy(
+                util::daemon::Daemon & daemon);
+
+            ~LiveProxy();
+
+        public:
+            virtual bool startup(
+                boost::system::error_code & ec);
+
+            virtual bool shutdown(
+                boost::system::error_code & ec);
+
+        private:
+            void handle_handed_over();
+
+            void handle_drain_timer(
+                boost::system::error_code const & ec);
+
+            void handle_stat_timer(
+                boost::system::error_code const & ec);
+
+        private:
+            struct Statistics
+            {
+                Statistics()
+                    : relay_upstreams(0)
+                    , relay_sessions(0)
+                    , relay_overrun(0)
+                    , relay_fallback(0)
+                    , relay_gop_hit(0)
+                    , relay_memory_used(0)
+                    , time_shifts(0)
+                    , time_shift_hit(0)
+                    , hls_channels(0)
+                    , hls_requests(0)
+                    , relay_mbps(0)
+                    , cpu_load(0)
+                    , cpu_per_gbps(0)
+                {
+                }
+
+                boost::uint32_t relay_upstreams;
+                boost::uint32_t relay_sessions;
+                boost::uint32_t relay_overrun;
+                boost::uint32_t relay_fallback; // splice not possible, copied
+                boost::uint32_t relay_gop_hit;  // clients started at a keyframe in ring
+                boost::uint32_t relay_memory_used;  // MB
+                boost::uint32_t time_shifts;    // channels with a disk ring
+                boost::uint32_t time_shift_hit; // clients started behind the memory ring
+                boost::uint32_t hls_channels;   // channels cut into HLS segments
+                boost::uint32_t hls_requests;   // playlists and segments served
+                boost::uint32_t relay_mbps;     // Mbit/s delivered by Relay and SpliceSession
+                boost::uint32_t cpu_load;       // per mille of one cpu, this process
+                boost::uint32_t cpu_per_gbps;   // cpu_load per Gbit/s of relay_mbps
+            };
+
+        private:
+            LiveShards & module_;
+            just::common::PortManager& portMgr_;
+            ProxyManager * mgr_;
+            framework::network::NetName addr_;
+            std::string upgrade_path_;          // unix socket for hot upgrade, see LiveUpgrade
+            boost::uint32_t upgrade_drain_;     // msec, old process serves clients at most
+            LiveUpgrade * upgrade_;
+            boost::uint32_t drain_left_;        // msec
+            clock_timer drain_timer_;
+            bool relay_;                        // clients of a channel share one upstream, see Relay
+            boost::uint32_t relay_buffer_;      // bytes of ring per channel
+            boost::uint32_t relay_memory_;      // MB of rings of all channels
+            boost::uint32_t relay_linger_;      // msec a ring is kept after its last client
+            bool relay_splice_;                 // without relay, body moved by splice, see SpliceSession
+            std::string time_shift_path_;       // directory of disk rings, off if empty, see TimeShift
+            boost::uint32_t time_shift_segment_;    // MB of a segment file
+            boost::uint32_t time_shift_segments_;   // segment files of a channel
+            boost::uint32_t time_shift_max_;        // channels with a disk ring
+            bool hls_;                          // with relay, HLS playlist and segments, see HlsSegmenter
+            boost::uint32_t hls_segment_;       // msec, least duration of a segment
+            boost::uint32_t hls_window_;        // segments in playlist
+            Statistics stat_;
+            clock_timer stat_timer_;
+            clock_timer::time_type stat_time_;
+            boost::uint64_t stat_cpu_;          // usec
+            boost::uint64_t stat_bytes_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_LIVE_PROXY_H_
@@ -0,0 +1,429 @@
+// LiveShards.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveShards.h"
+#include "just/live_worker/LiveModuleProxy.h"
+
+#include <framework/logger/Logger.h>
+#include <framework/logger/StreamRecord.h>
+using namespace framework::timer;
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/asio/io_service.hpp>
+using namespace boost::system;
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveShards", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        struct LiveShards::Shard
+        {
+            Shard()
+                : daemon(NULL)
+                , manager(NULL)
+                , io_svc(NULL)
+                , thread(NULL)
+            {
+            }
+
+            util::daemon::Daemon * daemon; // NULL if in main daemon
+            LiveManager * manager;
+            boost::asio::io_service * io_svc;
+            boost::thread * thread;
+        };
+
+        struct LiveShards::Request
+        {
+            Request()
+                : shard(0)
+                , io_svc(NULL)
+                , stopped(false)
+            {
+            }
+
+            size_t shard;
+            boost::asio::io_service * io_svc; // of client
+            // below only accessed in thread of shard
+            LiveManager::ChannelHandle handle;
+            bool stopped;
+        };
+
+        LiveShards::LiveShards(
+            util::daemon::Daemon & daemon)
+            : util::daemon::ModuleBase<LiveShards>(daemon, "LiveShards")
+            , shard_count_(1)
+            , snapshot_interval_(60000)
+            , snapshot_size_(100)
+            , snapshot_time_(0)
+            , snapshot_pending_(0)
+            , steady_hit_ratio_(90)
+            , steady_time_(0)
+            , start_time_(clock_timer::traits_type::now())
+            , timer_(io_svc())
+        {
+            config().register_module("LiveShards")
+                << CONFIG_PARAM_NAME_RDONLY("shard_count", shard_count_)
+                << CONFIG_PARAM_NAME_RDONLY("snapshot_path", snapshot_path_)
+                << CONFIG_PARAM_NAME_RDWR("snapshot_interval", snapshot_interval_)
+                << CONFIG_PARAM_NAME_RDWR("snapshot_size", snapshot_size_)
+                << CONFIG_PARAM_NAME_RDWR("steady_hit_ratio", steady_hit_ratio_)
+                << CONFIG_PARAM_NAME_RDONLY("steady_time", steady_time_)
+                << CONFIG_PARAM_NAME_RDONLY("hit", stat_.hit)
+                << CONFIG_PARAM_NAME_RDONLY("miss", stat_.miss)
+                << CONFIG_PARAM_NAME_RDONLY("evict", stat_.evict)
+                << CONFIG_PARAM_NAME_RDONLY("idle_hit", stat_.idle_hit)
+                << CONFIG_PARAM_NAME_RDONLY("idle_expire", stat_.idle_expire)
+                << CONFIG_PARAM_NAME_RDONLY("fail", stat_.fail)
+                << CONFIG_PARAM_NAME_RDONLY("fail_hit", stat_.fail_hit)
+                << CONFIG_PARAM_NAME_RDONLY("max_loop_lag", stat_.max_loop_lag)
+                << CONFIG_PARAM_NAME_RDONLY("crash", stat_.crash)
+                << CONFIG_PARAM_NAME_RDONLY("restart", stat_.restart)
+                << CONFIG_PARAM_NAME_RDONLY("mttr", stat_.mttr)
+                << CONFIG_PARAM_NAME_RDONLY("prewarm", stat_.prewarm)
+                << CONFIG_PARAM_NAME_RDONLY("prewarm_hit", stat_.prewarm_hit);
+
+            LOG_DEBUG("[shard_count] " << shard_count_);
+
+            if (shard_count_ <= 1) {
+                Shard * shard = new Shard;
+                shard->manager = &util::daemon::use_module<LiveManager>(daemon);
+                shard->io_svc = &io_svc();
+                shards_.push_back(shard);
+            } else {
+                // kernel and channels live only in shard daemons
+                for (size_t i = 0; i < shard_count_; ++i) {
+                    Shard * shard = new Shard;
+                    shard->daemon = new util::daemon::Daemon;
+                    shard->daemon->config().profile() = daemon.config().profile();
+                    shard->manager = &util::daemon::use_module<LiveManager>(*shard->daemon);
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+                    // shards fork from their own threads
+                    util::daemon::use_module<LiveModuleProxy>(*shard->daemon).set_exec_only();
+#endif
+                    shard->io_svc = &shard->daemon->io_svc();
+                    shards_.push_back(shard);
+                }
+            }
+            rid_caches_.resize(shards_.size());
+            shard_stats_.resize(shards_.size());
+            snapshots_.resize(shards_.size());
+        }
+
+        LiveShards::~LiveShards()
+        {
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                delete shards_[i]->daemon;
+                delete shards_[i];
+            }
+        }
+
+        bool LiveShards::startup(
+            error_code & ec)
+        {
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                Shard * shard = shards_[i];
+                if (shard->daemon == NULL)
+                    continue;
+                shard->daemon->start(ec);
+                if (ec) {
+                    LOG_WARN("[startup] shard " << i << " failed: " << ec.message());
+                    return false;
+                }
+                shard->thread = new boost::thread(
+                    boost::bind(&LiveShards::run_shard, shard));
+            }
+            if (!snapshot_path_.empty())
+                load_snapshot();
+            start_time_ = clock_timer::traits_type::now();
+            timer_.expires_from_now(Duration::seconds(1), ec);
+            timer_.async_wait(boost::bind(&LiveShards::handle_timer, this, _1));
+            return !ec;
+        }
+
+        bool LiveShards::shutdown(
+            error_code & ec)
+        {
+            timer_.cancel(ec);
+            if (!snapshot_path_.empty()) {
+                // shards are still running, take their latest rates
+                for (size_t i = 0; i < shards_.size(); ++i) {
+                    call_in_shard(i, boost::bind(&LiveManager::snapshot, 
+                        shards_[i]->manager, snapshot_size_, boost::ref(snapshots_[i])));
+                }
+                save_snapshot();
+            }
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (shards_[i]->thread)
+                    shards_[i]->daemon->post_stop();
+            }
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (shards_[i]->thread) {
+                    shards_[i]->thread->join();
+                    delete shards_[i]->thread;
+                    shards_[i]->thread = NULL;
+                }
+            }
+            return true;
+        }
+
+        boost::asio::io_service & LiveShards::io_svc_at(
+            size_t io_index)
+        {
+            return *shards_[io_index]->io_svc;
+        }
+
+        LiveShards::ChannelHandle LiveShards::start_channel(
+            size_t io_index, 
+            std::string const & url, 
+            call_back_func const & call_back)
+        {
+            ChannelHandle request(new Request);
+            request->io_svc = shards_[io_index]->io_svc;
+            // decoded once here, the shard takes it along
+            std::string rid = rid_caches_[io_index].rid_of(url);
+            request->shard = rid.empty() 
+                ? io_index : boost::hash<std::string>()(rid) % shards_.size();
+            // inline if the shard is on this thread
+            shards_[request->shard]->io_svc->dispatch(
+                boost::bind(&LiveShards::handle_start_channel, this, request, url, rid, call_back));
+            return request;
+        }
+
+        void LiveShards::stop_channel(
+            ChannelHandle & handle)
+        {
+            ChannelHandle request;
+            request.swap(handle);
+            if (!request)
+                return;
+            shards_[request->shard]->io_svc->dispatch(
+                boost::bind(&LiveShards::handle_stop_channel, this, request));
+        }
+
+        void LiveShards::run_shard(
+            Shard * shard)
+        {
+            error_code ec;
+            shard->daemon->run(ec);
+        }
+
+        static void call_and_notify(
+            boost::function<void ()> const & handler, 
+            boost::mutex & mutex, 
+            boost::condition_variable & cond, 
+            bool & done)
+        {
+            handler();
+            boost::mutex::scoped_lock lock(mutex);
+            done = true;
+            cond.notify_all();
+        }
+
+        // inline if the shard is in this daemon
+        void LiveShards::call_in_shard(
+            size_t index, 
+            boost::function<void ()> const & handler)
+        {
+            Shard * shard = shards_[index];
+            if (shard->thread == NULL) {
+                handler();
+                return;
+            }
+            boost::mutex mutex;
+            boost::condition_variable cond;
+            bool done = false;
+            shard->io_svc->post(boost::bind(call_and_notify, 
+                boost::cref(handler), boost::ref(mutex), boost::ref(cond), boost::ref(done)));
+            boost::mutex::scoped_lock lock(mutex);
+            while (!done)
+                cond.wait(lock);
+        }
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+        void LiveShards::hand_over(
+            size_t index, 
+            HandOver & hand_over)
+        {
+            call_in_shard(index, boost::bind(&LiveManager::hand_over, 
+                shards_[index]->manager, boost::ref(hand_over)));
+        }
+
+        void LiveShards::commit_hand_over(
+            size_t index, 
+            HandOver & hand_over, 
+            bool done)
+        {
+            call_in_shard(index, boost::bind(&LiveManager::commit_hand_over, 
+                shards_[index]->manager, boost::ref(hand_over), done));
+        }
+
+        void LiveShards::take_over(
+            size_t index, 
+            HandOver & hand_over, 
+            boost::uint32_t ttl)
+        {
+            call_in_shard(index, boost::bind(&LiveManager::take_over, 
+                shards_[index]->manager, boost::ref(hand_over), ttl));
+        }
+
+#endif
+
+        void LiveShards::handle_start_channel(
+            ChannelHandle const & request, 
+            std::string const & url, 
+            std::string const & rid, 
+            call_back_func const & call_back)
+        {
+            if (request->stopped)
+                return;
+            request->handle = shards_[request->shard]->manager->start_channel(url, rid, 
+                boost::bind(&LiveShards::handle_channel_ready, request->io_svc, call_back, _1, _2));
+        }
+
+        void LiveShards::handle_stop_channel(
+            ChannelHandle const & request)
+        {
+            request->stopped = true;
+            shards_[request->shard]->manager->stop_channel(request->handle);
+        }
+
+        void LiveShards::handle_channel_ready(
+            boost::asio::io_service * io_svc, 
+            call_back_func const & call_back, 
+            error_code const & ec, 
+            std::string const & url)
+        {
+            io_svc->dispatch(boost::bind(call_back, ec, url));
+        }
+
+        void LiveShards::handle_timer(
+            error_code const & ec)
+        {
+            if (ec || !get_daemon().is_started()) {
+                return;
+            }
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                shards_[i]->io_svc->post(
+                    boost::bind(&LiveShards::collect_stat, this, i));
+            }
+            check_steady();
+            snapshot_time_ += 1000;
+            if (!snapshot_path_.empty() && snapshot_time_ >= snapshot_interval_ && snapshot_pending_ == 0) {
+                snapshot_time_ = 0;
+                snapshot_pending_ = shards_.size();
+                for (size_t i = 0; i < shards_.size(); ++i) {
+                    shards_[i]->io_svc->post(
+                        boost::bind(&LiveShards::collect_snapshot, this, i));
+                }
+            }
+            timer_.expires_from_now(Duration::seconds(1));
+            timer_.async_wait(boost::bind(&LiveShards::handle_timer, this, _1));
+        }
+
+        // in thread of shard, also io thread of rid_caches_[index]
+        void LiveShards::collect_stat(
+            size_t index)
+        {
+            LiveManager::Statistics stat = shards_[index]->manager->stat();
+            stat.url_hit += rid_caches_[index].hit();
+            io_svc().post(boost::bind(&LiveShards::handle_collect_stat, 
+                this, index, stat));
+        }
+
+        void LiveShards::handle_collect_stat(
+            size_t index, 
+            LiveManager::Statistics const & stat)
+        {
+            shard_stats_[index] = stat;
+            stat_ = LiveManager::Statistics();
+            for (size_t i = 0; i < shard_stats_.size(); ++i) {
+                stat_ += shard_stats_[i];
+            }
+        }
+
+        // hit ratio over last 10 seconds, first time it reaches
+        // steady_hit_ratio; compare runs with and without snapshot_path
+        void LiveShards::check_steady()
+        {
+            hit_window_.push_back(std::make_pair(stat_.hit, stat_.miss));
+            if (hit_window_.size() > 10)
+                hit_window_.pop_front();
+            if (steady_time_ || hit_window_.size() < 2)
+                return;
+            boost::uint64_t hit = hit_window_.back().first - hit_window_.front().first;
+            boost::uint64_t miss = hit_window_.back().second - hit_window_.front().second;
+            // a few requests say nothing
+            if (hit + miss >= 10 && hit * 100 >= (hit + miss) * steady_hit_ratio_) {
+                steady_time_ = (boost::uint32_t)clock_timer::traits_type::subtract(
+                    clock_timer::traits_type::now(), start_time_).total_milliseconds();
+                LOG_INFO("[check_steady] steady after " << steady_time_ << " msec, prewarm: " << stat_.prewarm 
+                    << ", prewarm_hit: " << stat_.prewarm_hit);
+            }
+        }
+
+        // in thread of shard
+        void LiveShards::collect_snapshot(
+            size_t index)
+        {
+            std::vector<WarmSnapshot::Item> items;
+            shards_[index]->manager->snapshot(snapshot_size_, items);
+            io_svc().post(boost::bind(&LiveShards::handle_collect_snapshot, 
+                this, index, items));
+        }
+
+        void LiveShards::handle_collect_snapshot(
+            size_t index, 
+            std::vector<WarmSnapshot::Item> const & items)
+        {
+            snapshots_[index] = items;
+            if (--snapshot_pending_ == 0)
+                save_snapshot();
+        }
+
+        void LiveShards::save_snapshot()
+        {
+            std::vector<WarmSnapshot::Item> items;
+            for (size_t i = 0; i < snapshots_.size(); ++i)
+                items.insert(items.end(), snapshots_[i].begin(), snapshots_[i].end());
+            WarmSnapshot::sort(items, snapshot_size_);
+            error_code ec;
+            if (!WarmSnapshot::save(snapshot_path_, items, ec))
+                LOG_WARN("[save_snapshot] " << snapshot_path_ << ", ec = " << ec.message());
+        }
+
+        // rids go to shards by hash as requests do, shard_count may have
+        // changed since saved
+        void LiveShards::load_snapshot()
+        {
+            std::vector<WarmSnapshot::Item> items;
+            error_code ec;
+            if (!WarmSnapshot::load(snapshot_path_, items, ec)) {
+                LOG_INFO("[load_snapshot] " << snapshot_path_ << ", ec = " << ec.message());
+                return;
+            }
+            WarmSnapshot::sort(items, snapshot_size_);
+            LOG_INFO("[load_snapshot] rids: " << items.size());
+            RidCache rid_cache;
+            std::vector<std::vector<WarmSnapshot::Item> > shard_items(shards_.size());
+            for (size_t i = 0; i < items.size(); ++i) {
+                std::string const & rid = rid_cache.rid_of(items[i].url);
+                if (!rid.empty())
+                    shard_items[boost::hash<std::string>()(rid) % shards_.size()].push_back(items[i]);
+            }
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (!shard_items[i].empty())
+                    shards_[i]->io_svc->post(boost::bind(&LiveManager::prewarm, 
+                        shards_[i]->manager, shard_items[i]));
+            }
+        }
+
+    } // namespace live_worker
+} // namespace just
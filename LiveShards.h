@@ -0,0 +1,162 @@
+// LiveShards.h
+
+#ifndef _JUST_LIVE_WORKER_LIVE_SHARDS_H_
+#define _JUST_LIVE_WORKER_LIVE_SHARDS_H_
+
+#include "just/live_worker/LiveManager.h"
+#include "just/live_worker/RidCache.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <deque>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Spreads channels over shard_count LiveManager, each in its own
+        // daemon and io thread, selected by hash of rid. Client connections
+        // are spread over the same io threads. With shard_count <= 1, the
+        // LiveManager of this daemon is used directly; otherwise channel
+        // children are exec'ed, never forked.
+        // With snapshot_path, the hottest rids of all shards are saved there
+        // every snapshot_interval and at shutdown, and prewarmed by their
+        // shards at startup.
+        class LiveShards
+            : public util::daemon::ModuleBase<LiveShards>
+        {
+        public:
+            struct Request;
+
+            typedef boost::shared_ptr<Request> ChannelHandle;
+
+            typedef LiveManager::call_back_func call_back_func;
+
+        public:
+            LiveShards(
+                util::daemon::Daemon & daemon);
+
+            ~LiveShards();
+
+        public:
+            virtual bool startup(
+                boost::system::error_code & ec);
+
+            virtual bool shutdown(
+                boost::system::error_code & ec);
+
+        public:
+            size_t io_count() const
+            {
+                return shards_.size();
+            }
+
+            boost::asio::io_service & io_svc_at(
+                size_t io_index);
+
+            // call from thread of io_svc_at(io_index), call_back is called there too
+            ChannelHandle start_channel(
+                size_t io_index, 
+                std::string const & url, 
+                call_back_func const & call_back);
+
+            void stop_channel(
+                ChannelHandle & handle);
+
+            // sum of all shards, refreshed every second
+            LiveManager::Statistics const & stat() const
+            {
+                return stat_;
+            }
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+            // hot upgrade, see LiveUpgrade; call from thread of this daemon,
+            // returns when the shard has done it
+            void hand_over(
+                size_t index, 
+                HandOver & hand_over);
+
+            void commit_hand_over(
+                size_t index, 
+                HandOver & hand_over, 
+                bool done);
+
+            void take_over(
+                size_t index, 
+                HandOver & hand_over, 
+                boost::uint32_t ttl);
+#endif
+
+        private:
+            struct Shard;
+
+            static void run_shard(
+                Shard * shard);
+
+            // run handler in thread of shard and wait for it
+            void call_in_shard(
+                size_t index, 
+                boost::function<void ()> const & handler);
+
+            void handle_start_channel(
+                ChannelHandle const & request, 
+                std::string const & url, 
+                std::string const & rid, 
+                call_back_func const & call_back);
+
+            void handle_stop_channel(
+                ChannelHandle const & request);
+
+            static void handle_channel_ready(
+                boost::asio::io_service * io_svc, 
+                call_back_func const & call_back, 
+                boost::system::error_code const & ec, 
+                std::string const & url);
+
+            void handle_timer(
+                boost::system::error_code const & ec);
+
+            void collect_stat(
+                size_t index);
+
+            void handle_collect_stat(
+                size_t index, 
+                LiveManager::Statistics const & stat);
+
+            void check_steady();
+
+            void collect_snapshot(
+                size_t index);
+
+            void handle_collect_snapshot(
+                size_t index, 
+                std::vector<WarmSnapshot::Item> const & items);
+
+            void save_snapshot();
+
+            void load_snapshot();
+
+        private:
+            size_t shard_count_;
+            std::vector<Shard *> shards_;
+            std::vector<RidCache> rid_caches_; // one per io thread
+            std::vector<LiveManager::Statistics> shard_stats_;
+            LiveManager::Statistics stat_;
+            std::string snapshot_path_;
+            boost::uint32_t snapshot_interval_; // msec
+            size_t snapshot_size_;              // rids kept, and prewarmed at most
+            boost::uint32_t snapshot_time_;     // msec, since last save
+            std::vector<std::vector<WarmSnapshot::Item> > snapshots_;  // by shard
+            size_t snapshot_pending_;           // shards not collected yet
+            boost::uint32_t steady_hit_ratio_;  // percent
+            boost::uint32_t steady_time_;       // msec, startup to steady hit ratio
+            std::deque<std::pair<boost::uint64_t, boost::uint64_t> > hit_window_;  // hit, miss by second
+            clock_timer::time_type start_time_;
+            clock_timer timer_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_LIVE_SHARDS_H_
@@ -0,0 +1,511 @@
+// LiveUpgrade.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveModuleProxy.h"
+#include "just/live_worker/LiveUpgrade.h"
+#include "just/live_worker/LiveShards.h"
+#include "just/live_worker/ChildMessage.h"
+#include "just/live_worker/HandOver.h"
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+#include <framework/system/LogicError.h>
+#include <framework/logger/Logger.h>
+#include <framework/logger/StreamRecord.h>
+using namespace framework::system;
+
+#include <boost/bind.hpp>
+using namespace boost::system;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h> // for atoi
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.LiveUpgrade", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // records on upgrade socket, framed as ChildMessage; fds ride on
+        // the record they belong to
+        enum UpgradeMessageEnum
+        {
+            upgrade_hello = 1,  // new -> old: shard_count
+            upgrade_begin,      // old -> new: ec, shard_count; listener fd
+            upgrade_shard,      // old -> new: id = shard index; next_id, table sizes; table fds
+            upgrade_child,      // old -> new: pid, table; socket fd
+            upgrade_channel,    // old -> new: id = channel id; slot, tcp_port, udp_port, nref, rid, url, url2
+            upgrade_end,        // old -> new
+            upgrade_done,       // new -> old: ec, all taken over
+        };
+
+        // the exchange is short, done with blocking calls bounded by this
+        static int const upgrade_timeout = 10; // seconds
+
+        static size_t const max_fds = 64;
+
+        static void close_fds(
+            std::vector<int> & fds)
+        {
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (fds[i] >= 0)
+                    ::close(fds[i]);
+            }
+            fds.clear();
+        }
+
+        static void close_fds(
+            std::vector<HandOver> & hand_overs)
+        {
+            for (size_t i = 0; i < hand_overs.size(); ++i) {
+                HandOver & hand_over = hand_overs[i];
+                for (size_t j = 0; j < hand_over.tables.size(); ++j) {
+                    if (hand_over.tables[j].fd >= 0)
+                        ::close(hand_over.tables[j].fd);
+                    hand_over.tables[j].fd = -1;
+                }
+                for (size_t j = 0; j < hand_over.children.size(); ++j) {
+                    if (hand_over.children[j].fd >= 0)
+                        ::close(hand_over.children[j].fd);
+                    hand_over.children[j].fd = -1;
+                }
+            }
+        }
+
+        static void set_timeout(
+            int fd)
+        {
+            struct timeval tv = {upgrade_timeout, 0};
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
+
+        LiveUpgrade::LiveUpgrade(
+            boost::asio::io_service & io_svc,
+            LiveShards & shards)
+            : io_svc_(io_svc)
+            , shards_(shards)
+            , acceptor_(NULL)
+            , socket_(NULL)
+            , port_(0)
+        {
+        }
+
+        LiveUpgrade::~LiveUpgrade()
+        {
+            close();
+        }
+
+        bool LiveUpgrade::take_over(
+            std::string const & path,
+            boost::uint32_t ttl,
+            int & listener,
+            error_code & ec)
+        {
+            int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                ec.assign(errno, system_category());
+                return false;
+            }
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                // no old process
+                ec.assign(errno, system_category());
+                ::close(fd);
+                return false;
+            }
+            set_timeout(fd);
+            LOG_INFO("[take_over] old process found at " << path);
+
+            std::vector<HandOver> hand_overs(shards_.io_count());
+            std::vector<int> fds;
+            ChildMessage msg(upgrade_hello);
+            msg << (boost::uint32_t)hand_overs.size();
+            listener = -1;
+            bool ok = send(fd, msg, fds, ec) && recv(fd, msg, fds, ec);
+            if (ok) {
+                boost::uint32_t shard_count = 0;
+                msg >> ec >> shard_count;
+                if (!msg || msg.type != upgrade_begin || fds.size() != 1) {
+                    ok = false;
+                    if (!ec)
+                        ec = logic_error::failed_some;
+                } else {
+                    ok = !ec;
+                    listener = fds[0];
+                    fds.clear();
+                }
+            }
+            HandOver * hand_over = NULL;
+            while (ok && recv(fd, msg, fds, ec)) {
+                if (msg.type == upgrade_end) {
+                    break;
+                } else if (msg.type == upgrade_shard && msg.id < hand_overs.size()) {
+                    hand_over = &hand_overs[msg.id];
+                    boost::uint32_t count = 0;
+                    msg >> hand_over->next_id >> count;
+                    ok = msg && count == fds.size();
+                    for (boost::uint32_t i = 0; i < count && ok; ++i) {
+                        HandOver::Table table;
+                        table.fd = fds[i];
+                        msg >> table.size;
+                        hand_over->tables.push_back(table);
+                    }
+                    if (ok)
+                        fds.clear(); // owned by hand_over
+                    ok = ok && msg;
+                } else if (msg.type == upgrade_child && hand_over && fds.size() == 1) {
+                    HandOver::Child child;
+                    child.fd = fds[0];
+                    fds.clear();
+                    msg >> child.pid >> child.table;
+                    hand_over->children.push_back(child);
+                    ok = msg;
+                } else if (msg.type == upgrade_channel && hand_over && !hand_over->children.empty()) {
+                    HandOver::Channel channel;
+                    channel.id = msg.id;
+                    msg >> channel.slot >> channel.tcp_port >> channel.udp_port >> channel.nref
+                        >> channel.rid >> channel.url >> channel.url2;
+                    hand_over->children.back().channels.push_back(channel);
+                    ok = msg;
+                } else {
+                    ok = false;
+                }
+                close_fds(fds); // not consumed
+            }
+            if (!ok || ec) {
+                // children passed so far exit on their sockets closed
+                LOG_WARN("[take_over] failed, ec = " << ec.message());
+                if (!ec)
+                    ec = logic_error::failed_some;
+                close_fds(fds);
+                close_fds(hand_overs);
+                if (listener >= 0)
+                    ::close(listener);
+                listener = -1;
+                ::close(fd);
+                return false;
+            }
+            for (size_t i = 0; i < hand_overs.size(); ++i) {
+                LOG_INFO("[take_over] shard " << i << ", children: " << hand_overs[i].children.size());
+                shards_.take_over(i, hand_overs[i], ttl);
+            }
+            ChildMessage done(upgrade_done);
+            done << ec;
+            send(fd, done, fds, ec);
+            ::close(fd);
+            ec.clear();
+            return true;
+        }
+
+        bool LiveUpgrade::listen(
+            std::string const & path,
+            boost::uint16_t port,
+            call_back_func const & call_back,
+            error_code & ec)
+        {
+            // a socket file left by an old process, taken over or dead
+            ::unlink(path.c_str());
+            acceptor_ = new boost::asio::local::stream_protocol::acceptor(io_svc_);
+            acceptor_->open(boost::asio::local::stream_protocol(), ec);
+            if (!ec)
+                acceptor_->bind(boost::asio::local::stream_protocol::endpoint(path), ec);
+            if (!ec)
+                acceptor_->listen(1, ec);
+            if (ec) {
+                close();
+                return false;
+            }
+            ::fcntl(acceptor_->native_handle(), F_SETFD, FD_CLOEXEC);
+            port_ = port;
+            call_back_ = call_back;
+            start_accept();
+            return true;
+        }
+
+        void LiveUpgrade::close()
+        {
+            error_code ec;
+            if (socket_) {
+                socket_->close(ec);
+                delete socket_;
+                socket_ = NULL;
+            }
+            if (acceptor_) {
+                acceptor_->close(ec);
+                delete acceptor_;
+                acceptor_ = NULL;
+            }
+        }
+
+        void LiveUpgrade::start_accept()
+        {
+            delete socket_;
+            socket_ = new boost::asio::local::stream_protocol::socket(io_svc_);
+            acceptor_->async_accept(*socket_,
+                boost::bind(&LiveUpgrade::handle_accept, this, _1));
+        }
+
+        // io thread is blocked for the exchange, as it is for a fork
+        void LiveUpgrade::handle_accept(
+            error_code const & ec)
+        {
+            if (ec) {
+                if (ec != boost::asio::error::operation_aborted)
+                    LOG_WARN("[handle_accept] ec = " << ec.message());
+                return;
+            }
+            int fd = ::fcntl(socket_->native_handle(), F_DUPFD_CLOEXEC, 0);
+            error_code ec1;
+            socket_->close(ec1);
+            if (fd < 0) {
+                start_accept();
+                return;
+            }
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            set_timeout(fd);
+            bool ok = hand_over(fd, ec1);
+            ::close(fd);
+            if (!ok) {
+                LOG_WARN("[handle_accept] hand over failed, ec = " << ec1.message());
+                start_accept();
+                return;
+            }
+            // the new process owns upgrade_path now
+            LOG_INFO("[handle_accept] handed over");
+            close();
+            call_back_();
+        }
+
+        bool LiveUpgrade::hand_over(
+            int fd,
+            error_code & ec)
+        {
+            std::vector<int> fds;
+            ChildMessage msg;
+            if (!recv(fd, msg, fds, ec))
+                return false;
+            close_fds(fds);
+            boost::uint32_t shard_count = 0;
+            msg >> shard_count;
+            ChildMessage begin(upgrade_begin);
+            int listener = find_listener(port_);
+            if (!msg || msg.type != upgrade_hello || shard_count != shards_.io_count()) {
+                LOG_WARN("[hand_over] shard count mismatch, " << shard_count << " != " << shards_.io_count());
+                ec = logic_error::invalid_argument;
+            } else if (listener < 0) {
+                LOG_WARN("[hand_over] listener not found, port = " << port_);
+                ec = logic_error::failed_some;
+            } else {
+                fds.push_back(listener);
+            }
+            begin << ec << (boost::uint32_t)shards_.io_count();
+            if (!send(fd, begin, fds, ec) || ec)
+                return false;
+            fds.clear();
+
+            // children passed out are held, not forgotten until the new
+            // process says it is done; on any error they stay with us
+            std::vector<HandOver> hand_overs(shards_.io_count());
+            for (size_t i = 0; i < hand_overs.size(); ++i) {
+                shards_.hand_over(i, hand_overs[i]);
+                LOG_INFO("[hand_over] shard " << i << ", children: " << hand_overs[i].children.size());
+            }
+            bool ok = true;
+            for (size_t i = 0; i < hand_overs.size() && ok; ++i) {
+                HandOver & hand_over = hand_overs[i];
+                ChildMessage shard(upgrade_shard, (boost::uint32_t)i);
+                shard << hand_over.next_id << (boost::uint32_t)hand_over.tables.size();
+                for (size_t j = 0; j < hand_over.tables.size(); ++j) {
+                    shard << hand_over.tables[j].size;
+                    fds.push_back(hand_over.tables[j].fd);
+                }
+                ok = send(fd, shard, fds, ec);
+                fds.clear();
+                for (size_t j = 0; j < hand_over.children.size() && ok; ++j) {
+                    HandOver::Child & child = hand_over.children[j];
+                    ChildMessage msg2(upgrade_child);
+                    msg2 << child.pid << child.table;
+                    fds.push_back(child.fd);
+                    ok = send(fd, msg2, fds, ec);
+                    fds.clear();
+                    for (size_t k = 0; k < child.channels.size() && ok; ++k) {
+                        HandOver::Channel & channel = child.channels[k];
+                        ChildMessage msg3(upgrade_channel, channel.id);
+                        msg3 << channel.slot << channel.tcp_port << channel.udp_port << channel.nref
+                            << channel.rid << channel.url << channel.url2;
+                        ok = send(fd, msg3, fds, ec);
+                    }
+                }
+            }
+            // our dups, the new process has its own now
+            close_fds(hand_overs);
+            if (ok)
+                ok = send(fd, ChildMessage(upgrade_end), fds, ec);
+            if (ok)
+                ok = recv(fd, msg, fds, ec);
+            if (ok) {
+                close_fds(fds);
+                msg >> ec;
+                if (!msg || msg.type != upgrade_done)
+                    ec = logic_error::failed_some;
+                ok = !ec;
+            }
+            for (size_t i = 0; i < hand_overs.size(); ++i)
+                shards_.commit_hand_over(i, hand_overs[i], ok);
+            return ok;
+        }
+
+        // the acceptor is in ServerManager, found by what the kernel knows
+        int LiveUpgrade::find_listener(
+            boost::uint16_t port)
+        {
+            DIR * dir = ::opendir("/proc/self/fd");
+            if (dir == NULL)
+                return -1;
+            int listener = -1;
+            while (struct dirent * ent = ::readdir(dir)) {
+                int fd = ::atoi(ent->d_name);
+                if (ent->d_name[0] < '0' || ent->d_name[0] > '9' || fd == ::dirfd(dir))
+                    continue;
+                int value = 0;
+                socklen_t len = sizeof(value);
+                if (::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &value, &len) < 0 || value == 0)
+                    continue;
+                if (port_of(fd) == port) {
+                    listener = fd;
+                    break;
+                }
+            }
+            ::closedir(dir);
+            return listener;
+        }
+
+        boost::uint16_t LiveUpgrade::port_of(
+            int fd)
+        {
+            struct sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+            if (::getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+                return 0;
+            if (addr.ss_family == AF_INET)
+                return ntohs(((struct sockaddr_in *)&addr)->sin_port);
+            if (addr.ss_family == AF_INET6)
+                return ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+            return 0;
+        }
+
+        bool LiveUpgrade::send(
+            int fd,
+            ChildMessage const & msg,
+            std::vector<int> const & fds,
+            error_code & ec)
+        {
+            boost::asio::streambuf buf;
+            msg.encode(buf);
+            std::string data(boost::asio::buffer_cast<char const *>(buf.data()), buf.size());
+            char control[CMSG_SPACE(sizeof(int) * max_fds)];
+            size_t pos = 0;
+            while (pos < data.size()) {
+                struct iovec iov = {(void *)(data.data() + pos), data.size() - pos};
+                struct msghdr hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.msg_iov = &iov;
+                hdr.msg_iovlen = 1;
+                // fds go with first byte only
+                if (pos == 0 && !fds.empty()) {
+                    assert(fds.size() <= max_fds);
+                    memset(control, 0, sizeof(control));
+                    hdr.msg_control = control;
+                    hdr.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+                    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr);
+                    cmsg->cmsg_level = SOL_SOCKET;
+                    cmsg->cmsg_type = SCM_RIGHTS;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+                    memcpy(CMSG_DATA(cmsg), &fds[0], sizeof(int) * fds.size());
+                }
+                ssize_t n = ::sendmsg(fd, &hdr, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0) {
+                    ec.assign(n < 0 ? errno : EPIPE, system_category());
+                    return false;
+                }
+                pos += n;
+            }
+            return true;
+        }
+
+        // header first, fds come with it; then body, so no read runs into
+        // next record
+        bool LiveUpgrade::recv(
+            int fd,
+            ChildMessage & msg,
+            std::vector<int> & fds,
+            error_code & ec)
+        {
+            boost::asio::streambuf buf;
+            char * header = boost::asio::buffer_cast<char *>(buf.prepare(ChildMessage::header_size));
+            char control[CMSG_SPACE(sizeof(int) * max_fds)];
+            size_t pos = 0;
+            while (pos < ChildMessage::header_size) {
+                struct iovec iov = {header + pos, ChildMessage::header_size - pos};
+                struct msghdr hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.msg_iov = &iov;
+                hdr.msg_iovlen = 1;
+                hdr.msg_control = control;
+                hdr.msg_controllen = sizeof(control);
+                ssize_t n = ::recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0) {
+                    ec.assign(n < 0 ? errno : ECONNRESET, system_category());
+                    return false;
+                }
+                for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                        continue;
+                    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    int const * p = (int const *)CMSG_DATA(cmsg);
+                    fds.insert(fds.end(), p, p + count);
+                }
+                pos += n;
+            }
+            buf.commit(ChildMessage::header_size);
+            boost::uint32_t size = 0;
+            memcpy(&size, header, sizeof(size)); // first field of header
+            if (size > ChildMessage::max_size) {
+                ec = logic_error::failed_some;
+                return false;
+            }
+            char * body = boost::asio::buffer_cast<char *>(buf.prepare(size));
+            pos = 0;
+            while (pos < size) {
+                ssize_t n = ::recv(fd, body + pos, size - pos, MSG_WAITALL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0) {
+                    ec.assign(n < 0 ? errno : ECONNRESET, system_category());
+                    return false;
+                }
+                pos += n;
+            }
+            buf.commit(size);
+            return msg.decode(buf, ec);
+        }
+
+    } // namespace live_worker
+} // namespace just
+
+#endif
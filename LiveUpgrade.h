@@ -0,0 +1,100 @@
+// LiveUpgrade.h
+
+#ifndef _JUST_LIVE_WORKER_LIVE_UPGRADE_H_
+#define _JUST_LIVE_WORKER_LIVE_UPGRADE_H_
+
+#include <boost/function.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        class LiveShards;
+
+        struct ChildMessage;
+
+        // Binary upgrade with no downtime. A new process started with same
+        // upgrade_path connects to the old one there, and gets over the
+        // unix socket (fds with SCM_RIGHTS) the listening socket of
+        // LiveProxy, and of each shard the children with working channels,
+        // their status tables and the channel table of LiveManager. The old
+        // process then stops accepting, serves its clients to end and
+        // exits; the new one binds upgrade_path for the next upgrade.
+        // Both must have the same shard_count, a channel stays in its shard.
+        class LiveUpgrade
+        {
+        public:
+            typedef boost::function<void ()> call_back_func;
+
+        public:
+            LiveUpgrade(
+                boost::asio::io_service & io_svc,
+                LiveShards & shards);
+
+            ~LiveUpgrade();
+
+        public:
+            // new process, before listening; false if there is no old
+            // process or it failed, else listener is the socket taken over
+            bool take_over(
+                std::string const & path,
+                boost::uint32_t ttl,
+                int & listener,
+                boost::system::error_code & ec);
+
+            // old process, wait for a new one on path; call_back is called
+            // once a new process has taken over listener of tcp port
+            bool listen(
+                std::string const & path,
+                boost::uint16_t port,
+                call_back_func const & call_back,
+                boost::system::error_code & ec);
+
+            void close();
+
+        public:
+            // listening socket of tcp port in this process, -1 if none
+            static int find_listener(
+                boost::uint16_t port);
+
+            // local tcp port of socket
+            static boost::uint16_t port_of(
+                int fd);
+
+        private:
+            void start_accept();
+
+            void handle_accept(
+                boost::system::error_code const & ec);
+
+            bool hand_over(
+                int fd,
+                boost::system::error_code & ec);
+
+            static bool send(
+                int fd,
+                ChildMessage const & msg,
+                std::vector<int> const & fds,
+                boost::system::error_code & ec);
+
+            static bool recv(
+                int fd,
+                ChildMessage & msg,
+                std::vector<int> & fds,
+                boost::system::error_code & ec);
+
+        private:
+            boost::asio::io_service & io_svc_;
+            LiveShards & shards_;
+            boost::asio::local::stream_protocol::acceptor * acceptor_;
+            boost::asio::local::stream_protocol::socket * socket_;
+            boost::uint16_t port_;
+            call_back_func call_back_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_LIVE_UPGRADE_H_
@@ -1,10 +1,10 @@
-// Name.h
-
-#ifndef _JUST_LIVE_WORKER_NAME_H_
-#define _JUST_LIVE_WORKER_NAME_H_
-
-#include "just/live_worker/Define.h"
-
-#include <framework/system/AutoName.h>
-
-#endif // _JUST_LIVE_WORKER_NAME_H_
+// Name.h
+
+#ifndef _JUST_LIVE_WORKER_NAME_H_
+#define _JUST_LIVE_WORKER_NAME_H_
+
+#include "just/live_worker/Define.h"
+
+#include <framework/system/AutoName.h>
+
+#endif // _JUST_LIVE_WORKER_NAME_H_
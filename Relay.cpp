@@ -0,0 +1,919 @@
+// Relay.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/Relay.h"
+#include "just/live_worker/TimeShift.h"
+#include "just/live_worker/HlsSegmenter.h"
+
+#include <framework/logger/Logger.h>
+#include <framework/logger/StreamRecord.h>
+#include <framework/string/Url.h>
+#include <framework/string/Parse.h>
+
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+using namespace boost::system;
+using namespace framework::timer;
+
+#include <sstream>
+
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#endif
+
+FRAMEWORK_LOGGER_DECLARE_MODULE_LEVEL("just.live_worker.Relay", framework::logger::Debug)
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // upstream reads and session writes at most this
+        static size_t const chunk_size = 64 * 1024;
+
+        static size_t const ts_packet_size = 188;
+
+        // a PAT further before a random access point is not taken with it
+        static size_t const pat_distance = 16 * ts_packet_size;
+
+        static boost::uint64_t const no_offset = (boost::uint64_t)-1;
+
+        RelaySession::RelaySession(
+            boost::asio::io_service & io_svc,
+            boost::asio::ip::tcp::socket & socket,
+            end_func const & end)
+            : io_svc_(io_svc)
+            , socket_(socket)
+            , end_(end)
+            , offset_(0)
+            , head_sent_(false)
+            , writing_(false)
+            , waiting_(false)
+            , time_shift_(false)
+            , back_(no_offset)
+            , range_(no_offset)
+            , range_end_(no_offset)
+            , hls_(false)
+            , hls_sequence_(no_offset)
+        {
+            file_.fd = -1;
+            file_.offset = 0;
+            file_.size = 0;
+        }
+
+        void RelaySession::time_shift(
+            boost::uint64_t back,
+            boost::uint64_t offset)
+        {
+            time_shift_ = true;
+            back_ = back;
+            range_ = offset;
+        }
+
+        void RelaySession::hls(
+            std::string const & uri,
+            boost::uint64_t sequence)
+        {
+            hls_ = true;
+            hls_uri_ = uri;
+            hls_sequence_ = sequence;
+        }
+
+        void RelaySession::start(
+            boost::shared_ptr<Relay> const & relay)
+        {
+            relay_ = relay;
+            pump();
+        }
+
+        // a write in progress is ended by canceling socket
+        void RelaySession::close()
+        {
+            if (!writing_)
+                finish(boost::asio::error::operation_aborted);
+        }
+
+        void RelaySession::pump()
+        {
+            if (!relay_ || writing_)
+                return;
+            error_code ec;
+            relay_->read(*this, buf_, file_, ec);
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            if (file_.size) {
+                send_file();
+                return;
+            }
+            if (buf_.empty())
+                return; // woken by relay
+            writing_ = true;
+            if (segment_) {
+                boost::array<boost::asio::const_buffer, 2> buffers = {{
+                    boost::asio::buffer(buf_), boost::asio::buffer(segment_->data) }};
+                boost::asio::async_write(socket_, buffers,
+                    boost::bind(&RelaySession::handle_write, shared_from_this(), _1, _2));
+                return;
+            }
+            boost::asio::async_write(socket_, boost::asio::buffer(buf_),
+                boost::bind(&RelaySession::handle_write, shared_from_this(), _1, _2));
+        }
+
+        void RelaySession::handle_write(
+            error_code const & ec,
+            size_t bytes_transferred)
+        {
+            writing_ = false;
+            if (!relay_)
+                return;
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            __sync_fetch_and_add(&relay_->hub().stat().bytes_out, (boost::uint64_t)bytes_transferred);
+            pump();
+        }
+
+        // offset_ is moved here, not by Relay::read
+        void RelaySession::send_file()
+        {
+#ifdef __linux__
+            error_code ec;
+            socket_.non_blocking(true, ec);
+            if (!ec) {
+                off_t offset = (off_t)file_.offset;
+                ssize_t n = ::sendfile(socket_.native_handle(), file_.fd, &offset, file_.size);
+                if (n > 0 && !relay_->kept(offset_)) {
+                    finish(boost::asio::error::no_buffer_space);
+                    return;
+                }
+                if (n > 0) {
+                    offset_ += n;
+                    __sync_fetch_and_add(&relay_->hub().stat().bytes_out, (boost::uint64_t)n);
+                    io_svc_.post(boost::bind(&RelaySession::pump, shared_from_this()));
+                    return;
+                }
+                if (n < 0 && errno == EAGAIN) {
+                    writing_ = true;
+                    socket_.async_write_some(boost::asio::null_buffers(),
+                        boost::bind(&RelaySession::handle_send_file, shared_from_this(), _1));
+                    return;
+                }
+                ec.assign(n < 0 ? errno : EIO, system_category());
+            }
+            finish(ec);
+#else
+            finish(boost::asio::error::operation_not_supported);
+#endif
+        }
+
+        void RelaySession::handle_send_file(
+            error_code const & ec)
+        {
+            writing_ = false;
+            if (!relay_)
+                return;
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            pump();
+        }
+
+        void RelaySession::finish(
+            error_code const & ec)
+        {
+            if (!relay_)
+                return;
+            relay_->detach(this);
+            relay_.reset();
+            end_func end;
+            end.swap(end_);
+            end(ec);
+        }
+
+        Relay::Relay(
+            boost::asio::io_service & io_svc,
+            RelayHub & hub,
+            std::string const & url,
+            size_t capacity)
+            : io_svc_(io_svc)
+            , hub_(hub)
+            , url_(url)
+            , socket_(io_svc)
+            , linger_timer_(io_svc)
+            , start_time_(clock_timer::traits_type::now())
+            , parse_off_(0)
+            , synced_(false)
+            , last_pat_(no_offset)
+            , ring_(capacity)
+            , write_off_(0)
+            , head_done_(false)
+            , ended_(false)
+            , closing_(false)
+            , lingering_(false)
+            , packet_off_(0)
+            , time_shift_(NULL)
+            , time_shift_pending_(false)
+            , hls_(NULL)
+            , hls_pending_(false)
+            , hls_time_(0)
+        {
+            __sync_fetch_and_add(&hub_.stat().memory, (boost::uint64_t)ring_.size());
+        }
+
+        Relay::~Relay()
+        {
+            if (time_shift_)
+                hub_.destroy_time_shift(time_shift_);
+            if (hls_) {
+                __sync_fetch_and_sub(&hub_.stat().memory, hls_->memory());
+                __sync_fetch_and_sub(&hub_.stat().hls_channels, 1);
+                delete hls_;
+            }
+            __sync_fetch_and_sub(&hub_.stat().memory, (boost::uint64_t)ring_.size());
+        }
+
+        void Relay::start()
+        {
+            __sync_fetch_and_add(&hub_.stat().upstreams, 1);
+            framework::string::Url url(url_);
+            error_code ec;
+            boost::asio::ip::address addr =
+                boost::asio::ip::address::from_string(url.host(), ec);
+            boost::uint16_t port = 0;
+            framework::string::parse2(url.svc(), port);
+            if (ec || port == 0) {
+                end(ec ? ec : error_code(boost::asio::error::invalid_argument));
+                return;
+            }
+            // HTTP/1.0, so that the body is not chunked and can be joined
+            // at any byte
+            request_ = "GET " + url.path() + " HTTP/1.0\r\n"
+                "Host: " + url.host() + ":" + url.svc() + "\r\n\r\n";
+            socket_.async_connect(boost::asio::ip::tcp::endpoint(addr, port),
+                boost::bind(&Relay::handle_connect, shared_from_this(), _1));
+        }
+
+        bool Relay::attach(
+            boost::shared_ptr<RelaySession> const & session)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (closing_ || ended_)
+                return false;
+            lingering_ = false;
+            if (session->time_shift_)
+                enable_time_shift();
+            if (session->hls_) {
+                enable_hls();
+                __sync_fetch_and_add(&hub_.stat().hls_requests, 1);
+            }
+            sessions_.push_back(session);
+            __sync_fetch_and_add(&hub_.stat().sessions, 1);
+            return true;
+        }
+
+        void Relay::detach(
+            RelaySession * session)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            for (size_t i = 0; i < sessions_.size(); ++i) {
+                if (sessions_[i].get() == session) {
+                    sessions_[i] = sessions_.back();
+                    sessions_.pop_back();
+                    __sync_fetch_and_sub(&hub_.stat().sessions, 1);
+                    break;
+                }
+            }
+            if (sessions_.empty() && !closing_) {
+                if (hub_.linger() && !ended_) {
+                    lingering_ = true;
+                    io_svc_.post(boost::bind(&Relay::start_linger, shared_from_this()));
+                } else {
+                    closing_ = true;
+                    io_svc_.post(boost::bind(&Relay::handle_close, shared_from_this()));
+                }
+            }
+        }
+
+        void Relay::expire()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (lingering_ && sessions_.empty() && !closing_) {
+                closing_ = true;
+                io_svc_.post(boost::bind(&Relay::handle_close, shared_from_this()));
+            }
+        }
+
+        // prepare moves begin before the file is written, a reader of it
+        // finds its offset gone
+        bool Relay::kept(
+            boost::uint64_t offset)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (time_shift_ && offset >= time_shift_->begin())
+                return true;
+            __sync_fetch_and_add(&hub_.stat().overrun, 1);
+            return false;
+        }
+
+        void Relay::read(
+            RelaySession & session,
+            std::vector<char> & buf,
+            RelaySession::FileChunk & file,
+            error_code & ec)
+        {
+            buf.clear();
+            file.size = 0;
+            boost::mutex::scoped_lock lock(mutex_);
+            if (session.hls_) {
+                read_hls(session, buf, ec);
+                return;
+            }
+            if (!session.head_sent_ && !head_done_) {
+                if (ended_)
+                    ec = end_ec_;
+                else
+                    session.waiting_ = true;
+                return;
+            }
+            boost::uint64_t floor = trim_points();
+            if (!session.head_sent_) {
+                session.head_sent_ = true;
+                boost::uint64_t begin = 
+                    (time_shift_ && time_shift_->begin() < floor) ? time_shift_->begin() : floor;
+                boost::uint64_t point = no_offset;
+                bool partial = false;
+                if (session.back_ != no_offset && time_shift_) {
+                    boost::uint64_t now = now_msec();
+                    point = time_shift_->find(now > session.back_ ? now - session.back_ : 0);
+                    if (point >= time_shift_->end())
+                        point = no_offset;
+                }
+                if (session.range_ != no_offset) {
+                    // a range gone is served from the oldest point
+                    if (session.range_ < begin) {
+                        session.offset_ = packet_off_;
+                        if (!points_.empty())
+                            session.offset_ = points_.front();
+                        if (time_shift_ && time_shift_->find(0) < time_shift_->end())
+                            session.offset_ = time_shift_->find(0);
+                    } else {
+                        session.offset_ = session.range_ > write_off_ ? write_off_ : session.range_;
+                    }
+                    // only bytes already here have a last byte to name
+                    partial = session.offset_ == session.range_ && session.offset_ < write_off_;
+                    if (partial)
+                        session.range_end_ = write_off_;
+                } else if (point != no_offset) {
+                    session.offset_ = point;
+                } else if (points_.empty()) {
+                    session.offset_ = packet_off_;
+                } else {
+                    session.offset_ = points_.back();
+                    __sync_fetch_and_add(&hub_.stat().gop_hit, 1);
+                }
+                if (session.offset_ < floor)
+                    __sync_fetch_and_add(&hub_.stat().time_shift_hit, 1);
+                // offset of first byte, for a later Range of this stream; a
+                // range not served from where asked is answered as without it
+                std::ostringstream oss;
+                std::string::size_type status_end = head_.find("\r\n");
+                if (partial)
+                    oss << "HTTP/1.0 206 Partial Content";
+                else
+                    oss << head_.substr(0, status_end);
+                oss << head_.substr(status_end, head_.size() - status_end - 2);
+                if (partial)
+                    oss << "Content-Range: bytes " << session.offset_ << "-" << session.range_end_ - 1 << "/*\r\n";
+                oss << "X-Stream-Offset: " << session.offset_ << "\r\n\r\n";
+                std::string head = oss.str();
+                buf.assign(head.begin(), head.end());
+                return;
+            }
+            if (session.offset_ >= session.range_end_) {
+                ec = boost::asio::error::eof;
+                return;
+            }
+            if (session.offset_ < floor) {
+                if (time_shift_ && time_shift_->locate(
+                    session.offset_, file.fd, file.offset, file.size)) {
+                    if (file.size > chunk_size)
+                        file.size = chunk_size;
+                    if (file.size > session.range_end_ - session.offset_)
+                        file.size = (size_t)(session.range_end_ - session.offset_);
+                    return;
+                }
+                __sync_fetch_and_add(&hub_.stat().overrun, 1);
+                ec = boost::asio::error::no_buffer_space;
+                return;
+            }
+            size_t size = (size_t)(write_off_ - session.offset_);
+            if (size == 0) {
+                if (ended_)
+                    ec = end_ec_;
+                else
+                    session.waiting_ = true;
+                return;
+            }
+            if (size > chunk_size)
+                size = chunk_size;
+            if (size > session.range_end_ - session.offset_)
+                size = (size_t)(session.range_end_ - session.offset_);
+            buf.resize(size);
+            size_t pos = (size_t)(session.offset_ % ring_.size());
+            size_t size1 = ring_.size() - pos;
+            if (size1 >= size) {
+                memcpy(&buf[0], &ring_[pos], size);
+            } else {
+                memcpy(&buf[0], &ring_[pos], size1);
+                memcpy(&buf[size1], &ring_[0], size - size1);
+            }
+            session.offset_ += size;
+        }
+
+        // the head of upstream is not passed, a segment has no more of it
+        // than the ts
+        void Relay::read_hls(
+            RelaySession & session,
+            std::vector<char> & buf,
+            error_code & ec)
+        {
+            session.segment_.reset();
+            if (session.head_sent_) {
+                ec = boost::asio::error::eof;
+                return;
+            }
+            if (hls_ == NULL || hls_->empty()) {
+                if (ended_) {
+                    ec = end_ec_;
+                    return;
+                }
+                // the first segment is waited for, if the stream has points
+                if (now_msec() - hls_time_ < (boost::uint64_t)hub_.hls_duration() * 3) {
+                    session.waiting_ = true;
+                    return;
+                }
+            }
+            session.head_sent_ = true;
+            std::ostringstream oss;
+            if (session.hls_sequence_ == no_offset && hls_ && !hls_->empty()) {
+                std::string m3u8;
+                hls_->playlist(session.hls_uri_, m3u8);
+                boost::uint32_t max_age = hub_.hls_duration() / 2000;
+                oss << "HTTP/1.0 200 OK\r\n"
+                    << "Content-Type: application/vnd.apple.mpegurl\r\n"
+                    << "Content-Length: " << m3u8.size() << "\r\n"
+                    << "Cache-Control: max-age=" << (max_age ? max_age : 1) << "\r\n\r\n"
+                    << m3u8;
+            } else if (session.hls_sequence_ != no_offset && hls_
+                && (session.segment_ = hls_->segment(session.hls_sequence_))) {
+                oss << "HTTP/1.0 200 OK\r\n"
+                    << "Content-Type: video/mp2t\r\n"
+                    << "Content-Length: " << session.segment_->data.size() << "\r\n"
+                    << "Cache-Control: max-age=" 
+                    << (boost::uint64_t)hub_.hls_duration() * hub_.hls_window() / 1000 << "\r\n\r\n";
+            } else {
+                oss << "HTTP/1.0 404 Not Found\r\n"
+                    << "Content-Length: 0\r\n\r\n";
+            }
+            std::string response = oss.str();
+            buf.assign(response.begin(), response.end());
+        }
+
+        void Relay::handle_connect(
+            error_code const & ec)
+        {
+            if (ec) {
+                end(ec);
+                return;
+            }
+            boost::asio::async_write(socket_, boost::asio::buffer(request_),
+                boost::bind(&Relay::handle_write_request, shared_from_this(), _1));
+        }
+
+        void Relay::handle_write_request(
+            error_code const & ec)
+        {
+            if (ec) {
+                end(ec);
+                return;
+            }
+            boost::asio::async_read_until(socket_, head_buf_, "\r\n\r\n",
+                boost::bind(&Relay::handle_read_head, shared_from_this(), _1, _2));
+        }
+
+        void Relay::handle_read_head(
+            error_code const & ec,
+            size_t bytes_transferred)
+        {
+            if (ec) {
+                end(ec);
+                return;
+            }
+            std::string head(boost::asio::buffers_begin(head_buf_.data()),
+                boost::asio::buffers_begin(head_buf_.data()) + bytes_transferred);
+            head_buf_.consume(bytes_transferred);
+            // body read with head
+            std::vector<char> body(boost::asio::buffers_begin(head_buf_.data()),
+                boost::asio::buffers_end(head_buf_.data()));
+            head_buf_.consume(body.size());
+            if (!body.empty())
+                write_time_shift(&body[0], body.size());
+            std::vector<boost::uint64_t> points;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                head_.swap(head);
+                head_done_ = true;
+                if (!body.empty())
+                    append(&body[0], body.size());
+                parse(write_off_, points);
+                commit_time_shift(body.size(), points);
+                points_.insert(points_.end(), points.begin(), points.end());
+                packet_off_ = synced_ ? parse_off_ : write_off_;
+                wake(lock);
+            }
+            // segments cut here are published with next body
+            if (!body.empty())
+                write_hls(&body[0], body.size(), write_off_ - body.size(), points);
+            __sync_fetch_and_add(&hub_.stat().bytes_in, (boost::uint64_t)body.size());
+            read_body();
+        }
+
+        // into the ring directly, write_off_ is changed only in this thread
+        void Relay::read_body()
+        {
+            size_t pos = (size_t)(write_off_ % ring_.size());
+            size_t size = ring_.size() - pos;
+            if (size > chunk_size)
+                size = chunk_size;
+            socket_.async_read_some(boost::asio::buffer(&ring_[pos], size),
+                boost::bind(&Relay::handle_read_body, shared_from_this(), _1, _2));
+        }
+
+        void Relay::handle_read_body(
+            error_code const & ec,
+            size_t bytes_transferred)
+        {
+            if (ec) {
+                end(ec);
+                return;
+            }
+            // the new bytes are not read by sessions before write_off_ moves
+            std::vector<boost::uint64_t> points;
+            parse(write_off_ + bytes_transferred, points);
+            write_time_shift(&ring_[(size_t)(write_off_ % ring_.size())], bytes_transferred);
+            write_hls(&ring_[(size_t)(write_off_ % ring_.size())], bytes_transferred, write_off_, points);
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                write_off_ += bytes_transferred;
+                commit_time_shift(bytes_transferred, points);
+                commit_hls();
+                points_.insert(points_.end(), points.begin(), points.end());
+                trim_points();
+                packet_off_ = synced_ ? parse_off_ : write_off_;
+                wake(lock);
+            }
+            __sync_fetch_and_add(&hub_.stat().bytes_in, (boost::uint64_t)bytes_transferred);
+            read_body();
+        }
+
+        void Relay::append(
+            char const * data,
+            size_t size)
+        {
+            while (size) {
+                size_t pos = (size_t)(write_off_ % ring_.size());
+                size_t size1 = ring_.size() - pos;
+                if (size1 > size)
+                    size1 = size;
+                memcpy(&ring_[pos], data, size1);
+                write_off_ += size1;
+                data += size1;
+                size -= size1;
+            }
+        }
+
+        // the chunk after write_off_ may be being read into
+        boost::uint64_t Relay::trim_points()
+        {
+            boost::uint64_t floor = write_off_ + chunk_size;
+            floor = floor > ring_.size() ? floor - ring_.size() : 0;
+            while (!points_.empty() && points_.front() < floor)
+                points_.pop_front();
+            return floor;
+        }
+
+        void Relay::end(
+            error_code const & ec)
+        {
+            bool idle = false;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (ended_)
+                    return;
+                ended_ = true;
+                end_ec_ = ec;
+                // lingering, nobody else will close it
+                if (sessions_.empty() && !closing_)
+                    idle = closing_ = true;
+                wake(lock);
+            }
+            if (ec != boost::asio::error::operation_aborted)
+                LOG_INFO("[end] url = " << url_ << ", ec = " << ec.message());
+            error_code ec1;
+            socket_.close(ec1);
+            linger_timer_.cancel(ec1);
+            __sync_fetch_and_sub(&hub_.stat().upstreams, 1);
+            if (idle)
+                hub_.remove(url_, this);
+        }
+
+        // sessions are woken in their own io threads
+        void Relay::wake(
+            boost::mutex::scoped_lock & lock)
+        {
+            std::vector<boost::shared_ptr<RelaySession> > sessions;
+            for (size_t i = 0; i < sessions_.size(); ++i) {
+                if (sessions_[i]->waiting_) {
+                    sessions_[i]->waiting_ = false;
+                    sessions.push_back(sessions_[i]);
+                }
+            }
+            lock.unlock();
+            for (size_t i = 0; i < sessions.size(); ++i) {
+                sessions[i]->io_svc_.post(
+                    boost::bind(&RelaySession::pump, sessions[i]));
+            }
+        }
+
+        void Relay::parse(
+            boost::uint64_t end,
+            std::vector<boost::uint64_t> & points)
+        {
+            while (parse_off_ + ts_packet_size <= end) {
+                if (byte_at(parse_off_) != 0x47) {
+                    synced_ = false;
+                    ++parse_off_;
+                    continue;
+                }
+                if (!synced_) {
+                    // two sync bytes a packet apart
+                    if (parse_off_ + ts_packet_size >= end)
+                        break;
+                    if (byte_at(parse_off_ + ts_packet_size) != 0x47) {
+                        ++parse_off_;
+                        continue;
+                    }
+                    synced_ = true;
+                }
+                boost::uint16_t pid = ((byte_at(parse_off_ + 1) & 0x1f) << 8) | byte_at(parse_off_ + 2);
+                boost::uint8_t flags = byte_at(parse_off_ + 3);
+                if (pid == 0) {
+                    last_pat_ = parse_off_;
+                } else if ((flags & 0x20) && byte_at(parse_off_ + 4) > 0
+                    && (byte_at(parse_off_ + 5) & 0x40)) {
+                    if (last_pat_ != no_offset && parse_off_ - last_pat_ <= pat_distance)
+                        points.push_back(last_pat_);
+                    else
+                        points.push_back(parse_off_);
+                }
+                parse_off_ += ts_packet_size;
+            }
+        }
+
+        // the mapping is written without lock; sessions sending from the
+        // file written have located before prepare, see Relay::kept
+        void Relay::write_time_shift(
+            char const * data,
+            size_t size)
+        {
+            if (time_shift_ == NULL)
+                return;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                time_shift_->prepare(size);
+            }
+            error_code ec;
+            if (!time_shift_->write(data, size, ec) && ec)
+                LOG_WARN("[write_time_shift] url = " << url_ << ", ec = " << ec.message());
+        }
+
+        void Relay::commit_time_shift(
+            size_t size,
+            std::vector<boost::uint64_t> const & points)
+        {
+            if (time_shift_ == NULL)
+                return;
+            time_shift_->commit(size);
+            boost::uint64_t now = now_msec();
+            for (size_t i = 0; i < points.size(); ++i)
+                time_shift_->add_point(points[i], now);
+        }
+
+        void Relay::enable_time_shift()
+        {
+            if (time_shift_ || time_shift_pending_)
+                return;
+            time_shift_pending_ = true;
+            io_svc_.post(boost::bind(&Relay::handle_enable_time_shift, shared_from_this()));
+        }
+
+        // from now on, the past is kept from the moment of first request
+        void Relay::handle_enable_time_shift()
+        {
+            TimeShift * time_shift = hub_.create_time_shift();
+            if (time_shift == NULL)
+                return;
+            boost::mutex::scoped_lock lock(mutex_);
+            time_shift->start(write_off_);
+            time_shift_ = time_shift;
+        }
+
+        void Relay::write_hls(
+            char const * data,
+            size_t size,
+            boost::uint64_t offset,
+            std::vector<boost::uint64_t> const & points)
+        {
+            if (hls_ == NULL)
+                return;
+            hls_->write(data, size, offset, points, now_msec());
+        }
+
+        void Relay::commit_hls()
+        {
+            if (hls_ == NULL)
+                return;
+            boost::uint64_t memory = hls_->memory();
+            // segments take what the rings and other segments leave
+            boost::uint64_t used = hub_.stat().memory - memory;
+            hls_->commit(hub_.memory_limit() > used ? hub_.memory_limit() - used : 0);
+            // a decrease is added as its complement
+            __sync_fetch_and_add(&hub_.stat().memory, hls_->memory() - memory);
+        }
+
+        void Relay::enable_hls()
+        {
+            if (hls_ || hls_pending_)
+                return;
+            hls_pending_ = true;
+            hls_time_ = now_msec();
+            io_svc_.post(boost::bind(&Relay::handle_enable_hls, shared_from_this()));
+        }
+
+        // the first segment starts at the next random access point
+        void Relay::handle_enable_hls()
+        {
+            HlsSegmenter * hls = new HlsSegmenter(hub_.hls_duration(), hub_.hls_window());
+            __sync_fetch_and_add(&hub_.stat().hls_channels, 1);
+            boost::mutex::scoped_lock lock(mutex_);
+            hls_ = hls;
+        }
+
+        boost::uint64_t Relay::now_msec() const
+        {
+            return clock_timer::traits_type::subtract(
+                clock_timer::traits_type::now(), start_time_).total_milliseconds();
+        }
+
+        void Relay::start_linger()
+        {
+            linger_timer_.expires_from_now(Duration::milliseconds(hub_.linger()));
+            linger_timer_.async_wait(
+                boost::bind(&Relay::handle_linger, shared_from_this(), _1));
+        }
+
+        void Relay::handle_linger(
+            error_code const & ec)
+        {
+            if (ec)
+                return;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (!lingering_ || !sessions_.empty() || closing_)
+                    return;
+                closing_ = true;
+            }
+            handle_close();
+        }
+
+        void Relay::handle_close()
+        {
+            end(boost::asio::error::operation_aborted);
+            hub_.remove(url_, this);
+        }
+
+        RelayHub::RelayHub(
+            size_t capacity,
+            boost::uint64_t memory_limit,
+            boost::uint32_t linger)
+            : capacity_(capacity < chunk_size * 4 ? chunk_size * 4 : capacity)
+            , memory_limit_(memory_limit)
+            , linger_(linger)
+            , time_shift_segment_size_(0)
+            , time_shift_segment_count_(0)
+            , time_shift_max_(0)
+            , hls_duration_(4000)
+            , hls_window_(6)
+        {
+        }
+
+        void RelayHub::set_time_shift(
+            std::string const & path,
+            size_t segment_size,
+            size_t segment_count,
+            size_t max)
+        {
+            time_shift_path_ = path;
+            time_shift_segment_size_ = segment_size;
+            time_shift_segment_count_ = segment_count;
+            time_shift_max_ = max;
+        }
+
+        void RelayHub::set_hls(
+            boost::uint32_t duration,
+            size_t window)
+        {
+            hls_duration_ = duration;
+            hls_window_ = window;
+        }
+
+        TimeShift * RelayHub::create_time_shift()
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (time_shift_path_.empty() || stat_.time_shifts >= time_shift_max_)
+                    return NULL;
+                ++stat_.time_shifts;
+            }
+            TimeShift * time_shift = new TimeShift(
+                time_shift_segment_size_, time_shift_segment_count_);
+            error_code ec;
+            if (!time_shift->open(time_shift_path_, ec)) {
+                LOG_WARN("[create_time_shift] path = " << time_shift_path_ << ", ec = " << ec.message());
+                destroy_time_shift(time_shift);
+                return NULL;
+            }
+            return time_shift;
+        }
+
+        void RelayHub::destroy_time_shift(
+            TimeShift * time_shift)
+        {
+            delete time_shift;
+            boost::mutex::scoped_lock lock(mutex_);
+            --stat_.time_shifts;
+        }
+
+        bool RelayHub::join(
+            std::string const & url,
+            boost::shared_ptr<RelaySession> const & session)
+        {
+            boost::shared_ptr<Relay> relay;
+            bool created = false;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                relays_t::iterator iter = relays_.find(url);
+                if (iter != relays_.end())
+                    relay = iter->second.lock();
+                if (!relay || !relay->attach(session)) {
+                    if (stat_.memory + capacity_ > memory_limit_) {
+                        for (iter = relays_.begin(); iter != relays_.end(); ++iter) {
+                            boost::shared_ptr<Relay> relay2 = iter->second.lock();
+                            if (relay2)
+                                relay2->expire();
+                        }
+                        return false;
+                    }
+                    relay.reset(new Relay(session->io_svc(), *this, url, capacity_));
+                    relays_[url] = relay;
+                    relay->attach(session);
+                    created = true;
+                }
+            }
+            if (created)
+                relay->start();
+            session->start(relay);
+            return true;
+        }
+
+        void RelayHub::remove(
+            std::string const & url,
+            Relay * relay)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            relays_t::iterator iter = relays_.find(url);
+            if (iter != relays_.end()) {
+                boost::shared_ptr<Relay> relay2 = iter->second.lock();
+                if (!relay2 || relay2.get() == relay)
+                    relays_.erase(iter);
+            }
+        }
+
+    } // namespace live_worker
+} // namespace just
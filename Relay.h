@@ -0,0 +1,415 @@
+// Relay.h
+
+#ifndef _JUST_LIVE_WORKER_RELAY_H_
+#define _JUST_LIVE_WORKER_RELAY_H_
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/function.hpp>
+
+#include <map>
+#include <deque>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        class Relay;
+        class RelayHub;
+        class TimeShift;
+        class HlsSegmenter;
+        struct HlsSegment;
+
+        // A client of a relay, sends the response head of upstream and then
+        // the stream from its own offset in the ring, or from the disk ring
+        // of the relay with sendfile if it is behind the ring. A HLS client
+        // gets one response, the playlist or a segment of the relay, see
+        // HlsSegmenter. Runs in the io thread of its socket.
+        class RelaySession
+            : public boost::enable_shared_from_this<RelaySession>
+        {
+        public:
+            typedef boost::function<void (
+                boost::system::error_code const &)> end_func;
+
+        public:
+            RelaySession(
+                boost::asio::io_service & io_svc,
+                boost::asio::ip::tcp::socket & socket,
+                end_func const & end);
+
+        public:
+            // before start, a time-shift request: back msec behind live, or
+            // from stream offset (http Range); -1 for none of them. A range
+            // served from its offset is answered 206 up to the live edge
+            // and ends there, else 200 from where it could start
+            void time_shift(
+                boost::uint64_t back,
+                boost::uint64_t offset);
+
+            // before start, a HLS request: segment of sequence, or -1 for
+            // the playlist with segments at uri
+            void hls(
+                std::string const & uri,
+                boost::uint64_t sequence);
+
+            void start(
+                boost::shared_ptr<Relay> const & relay);
+
+            // socket is going away, end_ is called if not yet
+            void close();
+
+            boost::asio::io_service & io_svc()
+            {
+                return io_svc_;
+            }
+
+        private:
+            friend class Relay;
+
+            struct FileChunk
+            {
+                int fd;
+                boost::uint64_t offset;
+                size_t size;            // 0 if none
+            };
+
+            void pump();
+
+            void handle_write(
+                boost::system::error_code const & ec,
+                size_t bytes_transferred);
+
+            void send_file();
+
+            void handle_send_file(
+                boost::system::error_code const & ec);
+
+            void finish(
+                boost::system::error_code const & ec);
+
+        private:
+            boost::asio::io_service & io_svc_;  // of socket_
+            boost::asio::ip::tcp::socket & socket_;
+            end_func end_;
+            boost::shared_ptr<Relay> relay_;
+            boost::uint64_t offset_;    // in stream of relay
+            bool head_sent_;
+            bool writing_;
+            bool waiting_;              // for data, guarded by mutex of relay
+            std::vector<char> buf_;
+            bool time_shift_;
+            boost::uint64_t back_;
+            boost::uint64_t range_;
+            boost::uint64_t range_end_; // past last byte of a 206 body, -1 if none
+            FileChunk file_;
+            bool hls_;
+            std::string hls_uri_;
+            boost::uint64_t hls_sequence_;
+            boost::shared_ptr<HlsSegment const> segment_;   // written after buf_
+        };
+
+        // The one upstream connection of a channel. The response body is read
+        // into a ring, every session copies out of it at its own offset; a
+        // session falling behind by the size of the ring is ended.
+        // If the body is ts, the random access points in the ring (a PAT
+        // just before a packet with random_access_indicator) are indexed,
+        // and a new session starts at the last one: it gets at once the
+        // burst from there, then goes on live. After its last session the
+        // relay lingers for a while, to start the next one so.
+        // HLS clients have their segments cut from it as well, the channel
+        // is kept by lingering between their requests.
+        class Relay
+            : public boost::enable_shared_from_this<Relay>
+        {
+        public:
+            Relay(
+                boost::asio::io_service & io_svc,
+                RelayHub & hub,
+                std::string const & url,
+                size_t capacity);
+
+            ~Relay();
+
+        public:
+            void start();
+
+            // false if the relay is closing, join a new one then
+            bool attach(
+                boost::shared_ptr<RelaySession> const & session);
+
+            // last session leaving closes upstream, after lingering
+            void detach(
+                RelaySession * session);
+
+            // close now if lingering, from any thread
+            void expire();
+
+            // after sendfile from offset, false if the bytes may have been
+            // overwritten meanwhile
+            bool kept(
+                boost::uint64_t offset);
+
+            // next bytes for session into buf, or where they are on disk
+            // into file, a HLS segment is set into session; all empty with
+            // no ec if none yet
+            void read(
+                RelaySession & session,
+                std::vector<char> & buf,
+                RelaySession::FileChunk & file,
+                boost::system::error_code & ec);
+
+            RelayHub & hub()
+            {
+                return hub_;
+            }
+
+        private:
+            void handle_connect(
+                boost::system::error_code const & ec);
+
+            void handle_write_request(
+                boost::system::error_code const & ec);
+
+            void handle_read_head(
+                boost::system::error_code const & ec,
+                size_t bytes_transferred);
+
+            void read_body();
+
+            void handle_read_body(
+                boost::system::error_code const & ec,
+                size_t bytes_transferred);
+
+            // append to ring, under lock
+            void append(
+                char const * data,
+                size_t size);
+
+            // drop points no more in ring, under lock; returns the oldest
+            // offset still readable from ring
+            boost::uint64_t trim_points();
+
+            void end(
+                boost::system::error_code const & ec);
+
+            void wake(
+                boost::mutex::scoped_lock & lock);
+
+            // index ts packets read up to end, in this thread
+            void parse(
+                boost::uint64_t end,
+                std::vector<boost::uint64_t> & points);
+
+            boost::uint8_t byte_at(
+                boost::uint64_t off) const
+            {
+                return (boost::uint8_t)ring_[(size_t)(off % ring_.size())];
+            }
+
+            // in this thread, before and after under lock the ring takes the
+            // bytes and their random access points
+            void write_time_shift(
+                char const * data,
+                size_t size);
+
+            void commit_time_shift(
+                size_t size,
+                std::vector<boost::uint64_t> const & points);
+
+            // under lock, the response to a HLS session
+            void read_hls(
+                RelaySession & session,
+                std::vector<char> & buf,
+                boost::system::error_code & ec);
+
+            // as write_time_shift and commit_time_shift, for the segmenter
+            void write_hls(
+                char const * data,
+                size_t size,
+                boost::uint64_t offset,
+                std::vector<boost::uint64_t> const & points);
+
+            void commit_hls();
+
+            // under lock, the segmenter is made in this thread
+            void enable_hls();
+
+            void handle_enable_hls();
+
+            // under lock, the disk ring is made in this thread
+            void enable_time_shift();
+
+            void handle_enable_time_shift();
+
+            boost::uint64_t now_msec() const;
+
+            void start_linger();
+
+            void handle_linger(
+                boost::system::error_code const & ec);
+
+            void handle_close();
+
+        private:
+            boost::asio::io_service & io_svc_;
+            RelayHub & hub_;
+            std::string url_;
+            boost::asio::ip::tcp::socket socket_;
+            std::string request_;
+            boost::asio::streambuf head_buf_;
+            clock_timer linger_timer_;
+            clock_timer::time_type start_time_;
+            boost::uint64_t parse_off_; // next packet, or next byte to sync at
+            bool synced_;
+            boost::uint64_t last_pat_;
+
+            boost::mutex mutex_;
+            std::vector<char> ring_;
+            boost::uint64_t write_off_; // bytes of body read
+            std::string head_;
+            bool head_done_;
+            bool ended_;
+            boost::system::error_code end_ec_;
+            bool closing_;
+            bool lingering_;
+            boost::uint64_t packet_off_;            // a packet boundary, or write_off_ if not ts
+            std::deque<boost::uint64_t> points_;    // random access points in ring, oldest first
+            TimeShift * time_shift_;                // set in this thread, NULL if disabled
+            bool time_shift_pending_;
+            HlsSegmenter * hls_;                    // set in this thread, NULL until a HLS request
+            bool hls_pending_;
+            boost::uint64_t hls_time_;              // of first HLS request
+            std::vector<boost::shared_ptr<RelaySession> > sessions_;
+        };
+
+        // Relays by upstream url, shared by all io threads of LiveProxy; the
+        // statistics count SpliceSession too
+        class RelayHub
+        {
+        public:
+            struct Statistics
+            {
+                Statistics()
+                    : upstreams(0)
+                    , sessions(0)
+                    , overrun(0)
+                    , fallback(0)
+                    , gop_hit(0)
+                    , time_shifts(0)
+                    , time_shift_hit(0)
+                    , hls_channels(0)
+                    , hls_requests(0)
+                    , memory(0)
+                    , bytes_in(0)
+                    , bytes_out(0)
+                {
+                }
+
+                // changed from many threads with __sync builtins
+                boost::uint32_t upstreams;
+                boost::uint32_t sessions;
+                boost::uint32_t overrun;
+                boost::uint32_t fallback;   // of SpliceSession
+                boost::uint32_t gop_hit;    // sessions started at a random access point
+                boost::uint32_t time_shifts;    // relays with a disk ring
+                boost::uint32_t time_shift_hit; // sessions started in the past
+                boost::uint32_t hls_channels;   // relays with a segmenter
+                boost::uint32_t hls_requests;
+                boost::uint64_t memory;     // bytes of rings and HLS segments
+                boost::uint64_t bytes_in;
+                boost::uint64_t bytes_out;
+            };
+
+        public:
+            // rings and HLS segments of all relays take at most memory_limit
+            // bytes, a ring capacity; linger msec after last session, 0 for
+            // none
+            RelayHub(
+                size_t capacity,
+                boost::uint64_t memory_limit,
+                boost::uint32_t linger);
+
+        public:
+            // session joins the relay of url, a new relay runs in io thread
+            // of session; false if there is no memory for a new one, then
+            // lingering relays are expired for next time
+            bool join(
+                std::string const & url,
+                boost::shared_ptr<RelaySession> const & session);
+
+            void remove(
+                std::string const & url,
+                Relay * relay);
+
+            Statistics & stat()
+            {
+                return stat_;
+            }
+
+            boost::uint32_t linger() const
+            {
+                return linger_;
+            }
+
+            boost::uint64_t memory_limit() const
+            {
+                return memory_limit_;
+            }
+
+            // disk rings in path, of segment_count segments, for at most
+            // max relays; off if path is empty
+            void set_time_shift(
+                std::string const & path,
+                size_t segment_size,
+                size_t segment_count,
+                size_t max);
+
+            // a new disk ring, NULL if off or there are max of them
+            TimeShift * create_time_shift();
+
+            void destroy_time_shift(
+                TimeShift * time_shift);
+
+            // HLS segments of at least duration msec, window of them in
+            // playlist
+            void set_hls(
+                boost::uint32_t duration,
+                size_t window);
+
+            boost::uint32_t hls_duration() const
+            {
+                return hls_duration_;
+            }
+
+            size_t hls_window() const
+            {
+                return hls_window_;
+            }
+
+        private:
+            typedef std::map<std::string, boost::weak_ptr<Relay> > relays_t;
+
+            size_t capacity_;
+            boost::uint64_t memory_limit_;
+            boost::uint32_t linger_;
+            std::string time_shift_path_;
+            size_t time_shift_segment_size_;
+            size_t time_shift_segment_count_;
+            size_t time_shift_max_;
+            boost::uint32_t hls_duration_;
+            size_t hls_window_;
+            boost::mutex mutex_;
+            relays_t relays_;
+            Statistics stat_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_RELAY_H_
@@ -0,0 +1,54 @@
+// RidCache.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/RidCache.h"
+
+#include <util/protocol/pptv/Base64.h>
+using namespace util::protocol;
+
+#include <framework/string/Slice.h>
+using namespace framework::string;
+
+#include <boost/functional/hash.hpp>
+
+static const char JUST_LIVE_KEY[] = "trinity";
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        RidCache::RidCache(
+            size_t size)
+            : slots_(size ? size : 1)
+            , hit_(0)
+        {
+        }
+
+        void RidCache::resize(
+            size_t size)
+        {
+            slots_.clear();
+            slots_.resize(size ? size : 1);
+        }
+
+        std::string const & RidCache::rid_of(
+            std::string const & url)
+        {
+            Slot & slot = slots_[boost::hash<std::string>()(url) % slots_.size()];
+            if (slot.url == url) {
+                ++hit_;
+                return slot.rid;
+            }
+            // assign into the slot to reuse its string buffers
+            slot.url = url;
+            slot.rid.clear();
+            std::string url_decode = pptv::base64_decode(url.substr(1), JUST_LIVE_KEY);
+            if (!url_decode.empty()) {
+                map_find(url_decode, "channel", slot.rid, "&");
+            }
+            return slot.rid;
+        }
+
+    } // namespace live_worker
+} // namespace just
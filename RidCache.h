@@ -0,0 +1,46 @@
+// RidCache.h
+
+#ifndef _JUST_LIVE_WORKER_RID_CACHE_H_
+#define _JUST_LIVE_WORKER_RID_CACHE_H_
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Maps request path to the rid of channel, direct mapped with
+        // fixed size. Not thread safe, one per io thread.
+        class RidCache
+        {
+        public:
+            RidCache(
+                size_t size = 256);
+
+        public:
+            void resize(
+                size_t size);
+
+            // empty if url is not a valid live url
+            std::string const & rid_of(
+                std::string const & url);
+
+            boost::uint64_t hit() const
+            {
+                return hit_;
+            }
+
+        private:
+            struct Slot
+            {
+                std::string url;
+                std::string rid;
+            };
+
+            std::vector<Slot> slots_;
+            boost::uint64_t hit_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_RID_CACHE_H_
@@ -0,0 +1,264 @@
+// SpliceSession.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/SpliceSession.h"
+#include "just/live_worker/Relay.h"
+
+#include <framework/string/Url.h>
+#include <framework/string/Parse.h>
+
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+using namespace boost::system;
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // a pipe holds 64K by default
+        static size_t const chunk_size = 64 * 1024;
+
+        // chunks moved before giving the io thread to others
+        static size_t const chunks_per_pump = 16;
+
+        SpliceSession::SpliceSession(
+            boost::asio::io_service & io_svc,
+            boost::asio::ip::tcp::socket & socket,
+            RelayHub & hub,
+            end_func const & end)
+            : io_svc_(io_svc)
+            , socket_(socket)
+            , hub_(hub)
+            , end_(end)
+            , upstream_(io_svc)
+            , piped_(0)
+            , spliced_(false)
+            , closed_(false)
+        {
+            pipe_[0] = pipe_[1] = -1;
+        }
+
+        SpliceSession::~SpliceSession()
+        {
+#ifdef __linux__
+            if (pipe_[0] >= 0) {
+                ::close(pipe_[0]);
+                ::close(pipe_[1]);
+            }
+#endif
+        }
+
+        void SpliceSession::start(
+            std::string const & url_str)
+        {
+            __sync_fetch_and_add(&hub_.stat().upstreams, 1);
+            __sync_fetch_and_add(&hub_.stat().sessions, 1);
+            framework::string::Url url(url_str);
+            error_code ec;
+            boost::asio::ip::address addr =
+                boost::asio::ip::address::from_string(url.host(), ec);
+            boost::uint16_t port = 0;
+            framework::string::parse2(url.svc(), port);
+            if (ec || port == 0) {
+                finish(ec ? ec : error_code(boost::asio::error::invalid_argument));
+                return;
+            }
+            // HTTP/1.0, the body is not chunked and goes through unparsed
+            request_ = "GET " + url.path() + " HTTP/1.0\r\n"
+                "Host: " + url.host() + ":" + url.svc() + "\r\n\r\n";
+            upstream_.async_connect(boost::asio::ip::tcp::endpoint(addr, port),
+                boost::bind(&SpliceSession::handle_connect, shared_from_this(), _1));
+        }
+
+        // waits on socket_ are ended by canceling it, those on upstream_ here
+        void SpliceSession::close()
+        {
+            closed_ = true;
+            error_code ec;
+            upstream_.close(ec);
+        }
+
+        void SpliceSession::handle_connect(
+            error_code const & ec)
+        {
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            boost::asio::async_write(upstream_, boost::asio::buffer(request_),
+                boost::bind(&SpliceSession::handle_write_request, shared_from_this(), _1));
+        }
+
+        void SpliceSession::handle_write_request(
+            error_code const & ec)
+        {
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            boost::asio::async_read_until(upstream_, head_buf_, "\r\n\r\n",
+                boost::bind(&SpliceSession::handle_read_head, shared_from_this(), _1, _2));
+        }
+
+        // head and the body read with it are written as they are
+        void SpliceSession::handle_read_head(
+            error_code const & ec,
+            size_t bytes_transferred)
+        {
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            buf_.assign(boost::asio::buffers_begin(head_buf_.data()),
+                boost::asio::buffers_end(head_buf_.data()));
+            head_buf_.consume(buf_.size());
+            __sync_fetch_and_add(&hub_.stat().bytes_in, (boost::uint64_t)(buf_.size() - bytes_transferred));
+            boost::asio::async_write(socket_, boost::asio::buffer(buf_),
+                boost::bind(&SpliceSession::handle_write_head, shared_from_this(), _1));
+        }
+
+        void SpliceSession::handle_write_head(
+            error_code const & ec)
+        {
+            if (ec || closed_) {
+                finish(ec ? ec : error_code(boost::asio::error::operation_aborted));
+                return;
+            }
+#ifdef __linux__
+            error_code ec1;
+            error_code ec2;
+            upstream_.non_blocking(true, ec1);
+            socket_.non_blocking(true, ec2);
+            if (!ec1 && !ec2 && ::pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) == 0) {
+                pump();
+                return;
+            }
+            pipe_[0] = pipe_[1] = -1;
+#endif
+            __sync_fetch_and_add(&hub_.stat().fallback, 1);
+            read_copy();
+        }
+
+        void SpliceSession::pump()
+        {
+            if (closed_) {
+                finish(boost::asio::error::operation_aborted);
+                return;
+            }
+#ifdef __linux__
+            int upstream = upstream_.native_handle();
+            int socket = socket_.native_handle();
+            for (size_t i = 0; i < chunks_per_pump; ++i) {
+                if (piped_) {
+                    ssize_t n = ::splice(pipe_[0], NULL, socket, NULL, piped_,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+                    if (n < 0) {
+                        if (errno == EAGAIN) {
+                            socket_.async_write_some(boost::asio::null_buffers(),
+                                boost::bind(&SpliceSession::handle_wait, shared_from_this(), _1));
+                        } else {
+                            finish(error_code(errno, system_category()));
+                        }
+                        return;
+                    }
+                    piped_ -= n;
+                    __sync_fetch_and_add(&hub_.stat().bytes_out, (boost::uint64_t)n);
+                    continue;
+                }
+                ssize_t n = ::splice(upstream, NULL, pipe_[1], NULL, chunk_size,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n == 0) {
+                    finish(boost::asio::error::eof);
+                    return;
+                }
+                if (n < 0) {
+                    if (errno == EAGAIN) {
+                        upstream_.async_read_some(boost::asio::null_buffers(),
+                            boost::bind(&SpliceSession::handle_wait, shared_from_this(), _1));
+                    } else if (errno == EINVAL && !spliced_) {
+                        // sockets that cannot splice, nothing is lost yet
+                        __sync_fetch_and_add(&hub_.stat().fallback, 1);
+                        read_copy();
+                    } else {
+                        finish(error_code(errno, system_category()));
+                    }
+                    return;
+                }
+                spliced_ = true;
+                piped_ += n;
+                __sync_fetch_and_add(&hub_.stat().bytes_in, (boost::uint64_t)n);
+            }
+            io_svc_.post(boost::bind(&SpliceSession::pump, shared_from_this()));
+#endif
+        }
+
+        void SpliceSession::handle_wait(
+            error_code const & ec)
+        {
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            pump();
+        }
+
+        void SpliceSession::read_copy()
+        {
+            if (closed_) {
+                finish(boost::asio::error::operation_aborted);
+                return;
+            }
+            buf_.resize(chunk_size);
+            upstream_.async_read_some(boost::asio::buffer(buf_),
+                boost::bind(&SpliceSession::handle_read_copy, shared_from_this(), _1, _2));
+        }
+
+        void SpliceSession::handle_read_copy(
+            error_code const & ec,
+            size_t bytes_transferred)
+        {
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            __sync_fetch_and_add(&hub_.stat().bytes_in, (boost::uint64_t)bytes_transferred);
+            boost::asio::async_write(socket_, boost::asio::buffer(&buf_[0], bytes_transferred),
+                boost::bind(&SpliceSession::handle_write_copy, shared_from_this(), _1, _2));
+        }
+
+        void SpliceSession::handle_write_copy(
+            error_code const & ec,
+            size_t bytes_transferred)
+        {
+            if (ec) {
+                finish(ec);
+                return;
+            }
+            __sync_fetch_and_add(&hub_.stat().bytes_out, (boost::uint64_t)bytes_transferred);
+            read_copy();
+        }
+
+        void SpliceSession::finish(
+            error_code const & ec)
+        {
+            closed_ = true;
+            if (!end_)
+                return;
+            error_code ec1;
+            upstream_.close(ec1);
+            __sync_fetch_and_sub(&hub_.stat().upstreams, 1);
+            __sync_fetch_and_sub(&hub_.stat().sessions, 1);
+            end_func end;
+            end.swap(end_);
+            end(ec);
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -0,0 +1,99 @@
+// SpliceSession.h
+
+#ifndef _JUST_LIVE_WORKER_SPLICE_SESSION_H_
+#define _JUST_LIVE_WORKER_SPLICE_SESSION_H_
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        class RelayHub;
+
+        // A client with its own upstream connection, the response head is
+        // copied and the body moved with splice() through a pipe, never
+        // entering user space. Falls back to copying through a buffer if
+        // the pipe or the first splice fails. Runs in the io thread of its
+        // socket.
+        class SpliceSession
+            : public boost::enable_shared_from_this<SpliceSession>
+        {
+        public:
+            typedef boost::function<void (
+                boost::system::error_code const &)> end_func;
+
+        public:
+            SpliceSession(
+                boost::asio::io_service & io_svc,
+                boost::asio::ip::tcp::socket & socket,
+                RelayHub & hub,
+                end_func const & end);
+
+            ~SpliceSession();
+
+        public:
+            void start(
+                std::string const & url);
+
+            // socket is going away, end_ is called if not yet
+            void close();
+
+        private:
+            void handle_connect(
+                boost::system::error_code const & ec);
+
+            void handle_write_request(
+                boost::system::error_code const & ec);
+
+            void handle_read_head(
+                boost::system::error_code const & ec,
+                size_t bytes_transferred);
+
+            void handle_write_head(
+                boost::system::error_code const & ec);
+
+            // splice until would block, then wait for the socket blocking
+            void pump();
+
+            void handle_wait(
+                boost::system::error_code const & ec);
+
+            // buffered path
+            void read_copy();
+
+            void handle_read_copy(
+                boost::system::error_code const & ec,
+                size_t bytes_transferred);
+
+            void handle_write_copy(
+                boost::system::error_code const & ec,
+                size_t bytes_transferred);
+
+            void finish(
+                boost::system::error_code const & ec);
+
+        private:
+            boost::asio::io_service & io_svc_;
+            boost::asio::ip::tcp::socket & socket_;
+            RelayHub & hub_;
+            end_func end_;
+            boost::asio::ip::tcp::socket upstream_;
+            std::string request_;
+            boost::asio::streambuf head_buf_;
+            std::vector<char> buf_;
+            int pipe_[2];
+            size_t piped_;              // bytes in pipe
+            bool spliced_;              // a splice has succeeded
+            bool closed_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_SPLICE_SESSION_H_
@@ -0,0 +1,192 @@
+// StatusTable.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/LiveModuleProxy.h"
+#include "just/live_worker/StatusTable.h"
+
+#ifdef JUST_LIVE_WORKER_MULTI_PROCESS
+
+using namespace boost::system;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h> // for mkstemp
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // one cache line, slots of different children do not share lines
+        struct StatusTable::Slot
+        {
+            boost::uint32_t seq;
+            boost::uint32_t id;             // channel written by child
+            boost::uint64_t update_time;    // msec, 0 if never written
+            boost::uint32_t buffer_percent;
+            boost::uint32_t buffer_time;
+            boost::uint32_t download_speed;
+            boost::uint32_t upload_speed;
+            boost::uint32_t connection_count;
+            boost::uint32_t peer_count;
+            char reserved[24];
+        };
+
+        StatusTable::StatusTable()
+            : fd_(-1)
+            , slots_(NULL)
+            , count_(0)
+        {
+        }
+
+        StatusTable::~StatusTable()
+        {
+            if (slots_)
+                ::munmap(slots_, sizeof(Slot) * count_);
+            if (fd_ >= 0)
+                ::close(fd_);
+        }
+
+        // a file in tmpfs rather than anonymous memory, so that it can be
+        // passed to an exec'ed child by fd
+        bool StatusTable::create(
+            size_t count,
+            error_code & ec)
+        {
+            assert(slots_ == NULL);
+            char path[] = "/dev/shm/live_worker.XXXXXX";
+            int fd = ::mkstemp(path);
+            if (fd < 0) {
+                char tmp_path[] = "/tmp/live_worker.XXXXXX";
+                fd = ::mkstemp(tmp_path);
+                if (fd >= 0)
+                    ::unlink(tmp_path);
+            } else {
+                ::unlink(path);
+            }
+            if (fd < 0 || ::ftruncate(fd, sizeof(Slot) * count) < 0) {
+                ec.assign(errno, system_category());
+                if (fd >= 0)
+                    ::close(fd);
+                return false;
+            }
+            if (!map(fd, count, ec)) {
+                ::close(fd);
+                return false;
+            }
+            // new file is zero filled
+            for (size_t i = 0; i < count; ++i)
+                free_slots_.push_back((boost::uint32_t)i);
+            return true;
+        }
+
+        bool StatusTable::attach(
+            int fd,
+            size_t count,
+            error_code & ec)
+        {
+            assert(slots_ == NULL);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+            return map(fd, count, ec);
+        }
+
+        bool StatusTable::map(
+            int fd,
+            size_t count,
+            error_code & ec)
+        {
+            void * p = ::mmap(NULL, sizeof(Slot) * count, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ec.assign(errno, system_category());
+                return false;
+            }
+            fd_ = fd;
+            slots_ = (Slot *)p;
+            count_ = count;
+            return true;
+        }
+
+        boost::uint32_t StatusTable::alloc()
+        {
+            if (free_slots_.empty())
+                return npos;
+            boost::uint32_t index = free_slots_.front();
+            free_slots_.pop_front();
+            return index;
+        }
+
+        void StatusTable::free(
+            boost::uint32_t index)
+        {
+            if (index != npos)
+                free_slots_.push_back(index);
+        }
+
+        bool StatusTable::read(
+            boost::uint32_t index,
+            boost::uint32_t id,
+            LiveModule::ChannelStatus & status,
+            boost::uint64_t & update_time) const
+        {
+            if (index >= count_)
+                return false;
+            Slot const & slot = slots_[index];
+            // never spin on a writer, next read will do
+            for (int i = 0; i < 4; ++i) {
+                boost::uint32_t seq = *(boost::uint32_t const volatile *)&slot.seq;
+                __sync_synchronize();
+                if (seq & 1)
+                    continue;
+                boost::uint32_t slot_id = slot.id;
+                update_time = slot.update_time;
+                status.buffer_percent = slot.buffer_percent;
+                status.buffer_time = slot.buffer_time;
+                status.download_speed = slot.download_speed;
+                status.upload_speed = slot.upload_speed;
+                status.connection_count = slot.connection_count;
+                status.peer_count = slot.peer_count;
+                __sync_synchronize();
+                if (*(boost::uint32_t const volatile *)&slot.seq == seq)
+                    return slot_id == id && update_time != 0;
+            }
+            return false;
+        }
+
+        void StatusTable::write(
+            boost::uint32_t index,
+            boost::uint32_t id,
+            LiveModule::ChannelStatus const & status)
+        {
+            if (index >= count_)
+                return;
+            Slot & slot = slots_[index];
+            boost::uint32_t volatile & seq = *(boost::uint32_t volatile *)&slot.seq;
+            seq = seq + 1;
+            __sync_synchronize();
+            slot.id = id;
+            slot.update_time = now_msec();
+            slot.buffer_percent = status.buffer_percent;
+            slot.buffer_time = status.buffer_time;
+            slot.download_speed = status.download_speed;
+            slot.upload_speed = status.upload_speed;
+            slot.connection_count = status.connection_count;
+            slot.peer_count = status.peer_count;
+            __sync_synchronize();
+            seq = seq + 1;
+        }
+
+        boost::uint64_t StatusTable::now_msec()
+        {
+            struct timespec ts;
+            ::clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (boost::uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        }
+
+    } // namespace live_worker
+} // namespace just
+
+#endif
@@ -0,0 +1,103 @@
+// StatusTable.h
+
+#ifndef _JUST_LIVE_WORKER_STATUS_TABLE_H_
+#define _JUST_LIVE_WORKER_STATUS_TABLE_H_
+
+#include "just/live_worker/LiveModule.h"
+
+#include <deque>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Status of channels hosted by children, in memory shared with the
+        // parent. It is mapped before any child is started: a forked child
+        // inherits the mapping, an exec'ed child maps the inherited fd.
+        // A channel owns one slot while placed on a child; the child is the
+        // only writer of it and the parent reads it with no syscall or
+        // message.
+        // A slot is a seqlock: the writer makes seq odd, writes fields and
+        // makes seq even again; the reader copies fields and retries if seq
+        // was odd or changed meanwhile.
+        class StatusTable
+        {
+        public:
+            static boost::uint32_t const npos = (boost::uint32_t)-1;
+
+        public:
+            StatusTable();
+
+            ~StatusTable();
+
+        public:
+            bool create(
+                size_t count,
+                boost::system::error_code & ec);
+
+            // in exec'ed child, fd and count passed from parent; also in a
+            // new parent for tables of adopted children, no slot is
+            // allocated from an attached table
+            bool attach(
+                int fd,
+                size_t count,
+                boost::system::error_code & ec);
+
+            size_t size() const
+            {
+                return count_;
+            }
+
+            // backing file, already unlinked, kept open across exec
+            int fd() const
+            {
+                return fd_;
+            }
+
+        public:
+            // parent side, slots freed first are reused first, so that a
+            // child still writing a stopped channel is not likely to hit
+            // its next owner
+            boost::uint32_t alloc();
+
+            void free(
+                boost::uint32_t index);
+
+            // false if slot is busy or not written for channel id yet
+            bool read(
+                boost::uint32_t index,
+                boost::uint32_t id,
+                LiveModule::ChannelStatus & status,
+                boost::uint64_t & update_time) const;
+
+        public:
+            // child side
+            void write(
+                boost::uint32_t index,
+                boost::uint32_t id,
+                LiveModule::ChannelStatus const & status);
+
+        public:
+            // msec, same clock in parent and children
+            static boost::uint64_t now_msec();
+
+        private:
+            struct Slot;
+
+            bool map(
+                int fd,
+                size_t count,
+                boost::system::error_code & ec);
+
+        private:
+            int fd_;
+            Slot * slots_;
+            size_t count_;
+            std::deque<boost::uint32_t> free_slots_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_STATUS_TABLE_H_
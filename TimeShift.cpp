@@ -0,0 +1,185 @@
+// TimeShift.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/TimeShift.h"
+
+using namespace boost::system;
+
+#include <sstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        static boost::uint64_t const no_segment = (boost::uint64_t)-1;
+
+        TimeShift::TimeShift(
+            size_t segment_size,
+            size_t segment_count)
+            : segment_size_(segment_size)
+            , segment_count_(segment_count < 2 ? 2 : segment_count)
+            , map_(NULL)
+            , map_segment_(no_segment)
+            , base_(0)
+            , begin_(0)
+            , end_(0)
+            , broken_(false)
+        {
+            // whole pages, the mapping starts at offset 0 of a file
+            size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+            segment_size_ = (segment_size_ + page - 1) / page * page;
+        }
+
+        TimeShift::~TimeShift()
+        {
+            if (map_)
+                ::munmap(map_, segment_size_);
+            for (size_t i = 0; i < fds_.size(); ++i)
+                ::close(fds_[i]);
+        }
+
+        bool TimeShift::open(
+            std::string const & path,
+            error_code & ec)
+        {
+            static boost::uint32_t serial = 0;
+            boost::uint32_t n = __sync_fetch_and_add(&serial, 1);
+            for (size_t i = 0; i < segment_count_; ++i) {
+                std::ostringstream oss;
+                oss << path << "/live_worker." << ::getpid() << "." << n << "." << i;
+                std::string name = oss.str();
+                int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+                if (fd < 0) {
+                    ec.assign(errno, system_category());
+                    return false;
+                }
+                ::unlink(name.c_str());
+                fds_.push_back(fd);
+                if (::ftruncate(fd, segment_size_) < 0) {
+                    ec.assign(errno, system_category());
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void TimeShift::start(
+            boost::uint64_t offset)
+        {
+            base_ = begin_ = end_ = offset;
+        }
+
+        void TimeShift::prepare(
+            size_t size)
+        {
+            if (size == 0)
+                return;
+            // the file of last segment written has held segment_count_ before,
+            // the one after it is kept spare
+            boost::uint64_t last = (end_ + size - 1 - base_) / segment_size_;
+            if (last + 2 > segment_count_) {
+                boost::uint64_t begin = base_ + (last + 2 - segment_count_) * segment_size_;
+                if (begin > begin_)
+                    begin_ = begin;
+            }
+            while (!points_.empty() && points_.front().offset < begin_)
+                points_.pop_front();
+        }
+
+        bool TimeShift::write(
+            char const * data,
+            size_t size,
+            error_code & ec)
+        {
+            if (broken_)
+                return false;
+            boost::uint64_t offset = end_;
+            while (size) {
+                boost::uint64_t segment = (offset - base_) / segment_size_;
+                size_t pos = (size_t)((offset - base_) % segment_size_);
+                if (segment != map_segment_) {
+                    if (map_)
+                        ::munmap(map_, segment_size_);
+                    map_segment_ = segment;
+                    void * map = ::mmap(NULL, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fds_[(size_t)(segment % segment_count_)], 0);
+                    if (map == MAP_FAILED) {
+                        ec.assign(errno, system_category());
+                        map_ = NULL;
+                        map_segment_ = no_segment;
+                        broken_ = true;
+                        return false;
+                    }
+                    map_ = (char *)map;
+                }
+                size_t size1 = segment_size_ - pos;
+                if (size1 > size)
+                    size1 = size;
+                memcpy(map_ + pos, data, size1);
+                offset += size1;
+                data += size1;
+                size -= size1;
+            }
+            return true;
+        }
+
+        void TimeShift::commit(
+            size_t size)
+        {
+            end_ += size;
+            if (broken_) {
+                begin_ = end_;
+                points_.clear();
+            }
+        }
+
+        void TimeShift::add_point(
+            boost::uint64_t offset,
+            boost::uint64_t time)
+        {
+            if (broken_ || offset < begin_ || offset >= end_)
+                return;
+            Point point;
+            point.offset = offset;
+            point.time = time;
+            points_.push_back(point);
+        }
+
+        bool TimeShift::locate(
+            boost::uint64_t offset,
+            int & fd,
+            boost::uint64_t & file_offset,
+            size_t & size) const
+        {
+            if (offset < begin_ || offset >= end_)
+                return false;
+            boost::uint64_t segment = (offset - base_) / segment_size_;
+            fd = fds_[(size_t)(segment % segment_count_)];
+            file_offset = (offset - base_) % segment_size_;
+            size = segment_size_ - (size_t)file_offset;
+            if (size > end_ - offset)
+                size = (size_t)(end_ - offset);
+            return true;
+        }
+
+        boost::uint64_t TimeShift::find(
+            boost::uint64_t time) const
+        {
+            if (points_.empty())
+                return end_;
+            // points are few, a few per second of stream
+            for (size_t i = points_.size(); i > 0; --i) {
+                if (points_[i - 1].time <= time)
+                    return points_[i - 1].offset;
+            }
+            return points_.front().offset;
+        }
+
+    } // namespace live_worker
+} // namespace just
@@ -0,0 +1,105 @@
+// TimeShift.h
+
+#ifndef _JUST_LIVE_WORKER_TIME_SHIFT_H_
+#define _JUST_LIVE_WORKER_TIME_SHIFT_H_
+
+#include <deque>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Disk ring of a channel's stream: segment_count files of
+        // segment_size bytes, the stream written to them in turn through a
+        // mapping of the current one, and the random access points with
+        // their time. Files are unlinked once created, nothing is left
+        // behind. Offsets are of the stream, as of Relay.
+        // One writer thread; prepare, commit, add_point and the readers
+        // under a lock of the owner, write without it. The file written
+        // next is already out of begin(), so that bytes located by a reader
+        // stay a segment's time on disk; whether they did is told by
+        // begin() after reading.
+        class TimeShift
+        {
+        public:
+            TimeShift(
+                size_t segment_size,
+                size_t segment_count);
+
+            ~TimeShift();
+
+        public:
+            bool open(
+                std::string const & path,
+                boost::system::error_code & ec);
+
+            // stream offset of first byte written
+            void start(
+                boost::uint64_t offset);
+
+        public:
+            // before write of size bytes, drops the data to be overwritten
+            // by it and by the next segment
+            void prepare(
+                size_t size);
+
+            bool write(
+                char const * data,
+                size_t size,
+                boost::system::error_code & ec);
+
+            // after write, makes the bytes readable
+            void commit(
+                size_t size);
+
+            void add_point(
+                boost::uint64_t offset,
+                boost::uint64_t time);
+
+        public:
+            boost::uint64_t begin() const
+            {
+                return begin_;
+            }
+
+            boost::uint64_t end() const
+            {
+                return end_;
+            }
+
+            // where offset is on disk, size is what follows it in same file
+            bool locate(
+                boost::uint64_t offset,
+                int & fd,
+                boost::uint64_t & file_offset,
+                size_t & size) const;
+
+            // last random access point at or before time, else the first;
+            // end() if there is none
+            boost::uint64_t find(
+                boost::uint64_t time) const;
+
+        private:
+            struct Point
+            {
+                boost::uint64_t offset;
+                boost::uint64_t time;   // msec
+            };
+
+            size_t segment_size_;
+            size_t segment_count_;
+            std::vector<int> fds_;
+            char * map_;
+            boost::uint64_t map_segment_;   // absolute segment number mapped
+            boost::uint64_t base_;
+            boost::uint64_t begin_;
+            boost::uint64_t end_;
+            bool broken_;                   // write failed, nothing readable
+            std::deque<Point> points_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_TIME_SHIFT_H_
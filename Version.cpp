@@ -1,5 +1,5 @@
-// Version.cpp
-
-#include "just/live_worker/Common.h"
-#define VERSION_SOURCE
-#include "just/live_worker/Version.h"
+// Version.cpp
+
+#include "just/live_worker/Common.h"
+#define VERSION_SOURCE
+#include "just/live_worker/Version.h"
@@ -1,12 +1,12 @@
-// Version.h
-
-#ifndef _JUST_LIVE_WORKER_VERSION_H_
-#define _JUST_LIVE_WORKER_VERSION_H_
-
-#include "just/live_worker/Define.h"
-
-#include <framework/system/AutoVersion.h>
-
-#include <just/common/Version.h>
-
-#endif // _JUST_LIVE_WORKER_VERSION_H_
+// Version.h
+
+#ifndef _JUST_LIVE_WORKER_VERSION_H_
+#define _JUST_LIVE_WORKER_VERSION_H_
+
+#include "just/live_worker/Define.h"
+
+#include <framework/system/AutoVersion.h>
+
+#include <just/common/Version.h>
+
+#endif // _JUST_LIVE_WORKER_VERSION_H_
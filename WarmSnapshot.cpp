@@ -0,0 +1,168 @@
+// WarmSnapshot.cpp
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/WarmSnapshot.h"
+
+#include <framework/system/LogicError.h>
+using namespace framework::system;
+
+using namespace boost::system;
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h> // for rename
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        static char const snapshot_header[] = "# live_worker warm snapshot 1";
+
+        WarmSnapshot::WarmSnapshot(
+            size_t history_size,
+            boost::uint32_t half_life)
+            : history_size_(history_size ? history_size : 1)
+            , half_life_(half_life ? half_life : 1)
+        {
+        }
+
+        void WarmSnapshot::on_request(
+            std::string const & rid,
+            std::string const & url,
+            boost::uint16_t tcp_port,
+            boost::uint16_t udp_port,
+            boost::uint64_t now)
+        {
+            std::pair<entries_t::iterator, bool> result =
+                entries_.insert(std::make_pair(rid, Entry()));
+            Entry & entry = result.first->second;
+            if (result.second) {
+                lru_.push_front(rid);
+                if (entries_.size() > history_size_) {
+                    entries_.erase(lru_.back());
+                    lru_.pop_back();
+                }
+            } else {
+                lru_.splice(lru_.begin(), lru_, entry.lru);
+            }
+            entry.lru = lru_.begin();
+            entry.url = url;
+            entry.tcp_port = tcp_port;
+            entry.udp_port = udp_port;
+            entry.score = decay(entry, now) + 1;
+            entry.time = now;
+        }
+
+        void WarmSnapshot::top(
+            size_t count,
+            boost::uint64_t now,
+            std::vector<Item> & items) const
+        {
+            items.clear();
+            // a steady rate r per msec holds score at r * half_life / ln 2
+            double per_hour = log(2.0) / half_life_ * 3600 * 1000;
+            entries_t::const_iterator iter = entries_.begin();
+            for (; iter != entries_.end(); ++iter) {
+                Item item;
+                item.url = iter->second.url;
+                item.tcp_port = iter->second.tcp_port;
+                item.udp_port = iter->second.udp_port;
+                item.rate = (boost::uint32_t)(decay(iter->second, now) * per_hour + 0.5);
+                if (item.rate)
+                    items.push_back(item);
+            }
+            sort(items, count);
+        }
+
+        bool WarmSnapshot::save(
+            std::string const & path,
+            std::vector<Item> const & items,
+            error_code & ec)
+        {
+            std::string tmp_path = path + ".tmp";
+            {
+                std::ofstream ofs(tmp_path.c_str());
+                ofs << snapshot_header << "\n";
+                // url last, it is the rest of line
+                for (size_t i = 0; i < items.size(); ++i) {
+                    Item const & item = items[i];
+                    ofs << item.rate << " " << item.tcp_port << " " << item.udp_port
+                        << " " << item.url << "\n";
+                }
+                ofs.flush();
+                if (!ofs) {
+                    ec.assign(errno ? errno : EIO, system_category());
+                    return false;
+                }
+            }
+            if (::rename(tmp_path.c_str(), path.c_str()) < 0) {
+                ec.assign(errno, system_category());
+                return false;
+            }
+            return true;
+        }
+
+        bool WarmSnapshot::load(
+            std::string const & path,
+            std::vector<Item> & items,
+            error_code & ec)
+        {
+            items.clear();
+            std::ifstream ifs(path.c_str());
+            if (!ifs) {
+                ec.assign(ENOENT, system_category());
+                return false;
+            }
+            std::string line;
+            if (!std::getline(ifs, line) || line != snapshot_header) {
+                ec = logic_error::invalid_argument;
+                return false;
+            }
+            while (std::getline(ifs, line)) {
+                std::istringstream iss(line);
+                Item item;
+                if (!(iss >> item.rate >> item.tcp_port >> item.udp_port))
+                    continue;
+                iss >> std::ws;
+                std::getline(iss, item.url);
+                if (!item.url.empty())
+                    items.push_back(item);
+            }
+            return true;
+        }
+
+        static bool hotter(
+            WarmSnapshot::Item const & l,
+            WarmSnapshot::Item const & r)
+        {
+            return l.rate > r.rate;
+        }
+
+        void WarmSnapshot::sort(
+            std::vector<Item> & items,
+            size_t count)
+        {
+            if (items.size() > count) {
+                std::partial_sort(items.begin(), items.begin() + count, items.end(), hotter);
+                items.resize(count);
+            } else {
+                std::sort(items.begin(), items.end(), hotter);
+            }
+        }
+
+        double WarmSnapshot::decay(
+            Entry const & entry,
+            boost::uint64_t now) const
+        {
+            if (now <= entry.time)
+                return entry.score;
+            return entry.score * pow(0.5, (double)(now - entry.time) / half_life_);
+        }
+
+    } // namespace live_worker
+} // namespace just
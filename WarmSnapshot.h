@@ -0,0 +1,108 @@
+// WarmSnapshot.h
+
+#ifndef _JUST_LIVE_WORKER_WARM_SNAPSHOT_H_
+#define _JUST_LIVE_WORKER_WARM_SNAPSHOT_H_
+
+#include <boost/unordered_map.hpp>
+
+#include <list>
+
+namespace just
+{
+    namespace live_worker
+    {
+
+        // Request rate per rid, decayed with a half life, and the file
+        // keeping the hottest rids across restarts, so that their channels
+        // can be started again before the first wave of clients.
+        class WarmSnapshot
+        {
+        public:
+            struct Item
+            {
+                Item()
+                    : tcp_port(0)
+                    , udp_port(0)
+                    , rate(0)
+                {
+                }
+
+                std::string url;
+                boost::uint16_t tcp_port;
+                boost::uint16_t udp_port;
+                boost::uint32_t rate;   // requests per hour
+            };
+
+        public:
+            WarmSnapshot(
+                size_t history_size,
+                boost::uint32_t half_life);
+
+        public:
+            // rid is requested at time now (msec)
+            void on_request(
+                std::string const & rid,
+                std::string const & url,
+                boost::uint16_t tcp_port,
+                boost::uint16_t udp_port,
+                boost::uint64_t now);
+
+            // hottest count rids at time now, hottest first
+            void top(
+                size_t count,
+                boost::uint64_t now,
+                std::vector<Item> & items) const;
+
+        public:
+            // written to a temporary file and renamed, never seen half written
+            static bool save(
+                std::string const & path,
+                std::vector<Item> const & items,
+                boost::system::error_code & ec);
+
+            static bool load(
+                std::string const & path,
+                std::vector<Item> & items,
+                boost::system::error_code & ec);
+
+            // hottest first, at most count
+            static void sort(
+                std::vector<Item> & items,
+                size_t count);
+
+        private:
+            struct Entry
+            {
+                Entry()
+                    : tcp_port(0)
+                    , udp_port(0)
+                    , score(0)
+                    , time(0)
+                {
+                }
+
+                std::string url;
+                boost::uint16_t tcp_port;
+                boost::uint16_t udp_port;
+                double score;           // requests, decayed to time
+                boost::uint64_t time;   // msec
+                std::list<std::string>::iterator lru;
+            };
+
+            typedef boost::unordered_map<std::string, Entry> entries_t;
+
+            double decay(
+                Entry const & entry,
+                boost::uint64_t now) const;
+
+        private:
+            size_t history_size_;
+            boost::uint32_t half_life_; // msec
+            entries_t entries_;
+            std::list<std::string> lru_;
+        };
+
+    } // namespace live_worker
+} // namespace just
+
+#endif // _JUST_LIVE_WORKER_WARM_SNAPSHOT_H_
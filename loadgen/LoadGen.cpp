@@ -0,0 +1,594 @@
+// LoadGen.cpp
+
+// Load generator for live_worker: N concurrent http clients request
+// channels picked by a Zipf distribution, hold each for a while, then
+// request the next one. Reports per interval and in total:
+//   rps       requests completed per second
+//   ttfb      time to first response byte, p50/p99, msec
+//   warm      share of requests with ttfb below warm_ms, the start delay
+//             of a cold channel (see mock kernel) is well above it
+//   err       failed requests (connect error, non 200 or early close)
+//   mbps      Mbit/s received, response heads included
+//   ttff      time to first frame, to the first ts packet with
+//             random_access_indicator, p50/p99, msec
+//
+// With hls=1 a client is a HLS viewer instead: it polls the playlist of
+// its channel and gets each new segment, starting at the last one, each
+// request on its own connection. A channel held counts as one request,
+// ttfb is of its first playlist and ttff of its first segment. Comparing
+// err and mbps of both modes at rising clients gives the viewers a
+// server takes in each.
+//
+// Options (--name=value):
+//   host=127.0.0.1 port=9001 clients=100 channels=1000 zipf=1.0
+//   hold=5000 (msec) duration=60 (sec) interval=5 (sec) warm_ms=100
+//   hls=0
+
+#include <util/protocol/pptv/Base64.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <vector>
+
+static const char JUST_LIVE_KEY[] = "trinity";
+
+namespace just
+{
+    namespace live_worker
+    {
+        namespace loadgen
+        {
+
+            typedef boost::posix_time::ptime ptime;
+
+            static ptime now()
+            {
+                return boost::posix_time::microsec_clock::universal_time();
+            }
+
+            struct Options
+            {
+                Options()
+                    : host("127.0.0.1")
+                    , port(9001)
+                    , clients(100)
+                    , channels(1000)
+                    , zipf(1.0)
+                    , hold(5000)
+                    , duration(60)
+                    , interval(5)
+                    , warm_ms(100)
+                    , hls(false)
+                {
+                }
+
+                bool parse(
+                    int argc,
+                    char * argv[])
+                {
+                    std::map<std::string, std::string> args;
+                    for (int i = 1; i < argc; ++i) {
+                        std::string arg(argv[i]);
+                        std::string::size_type p = arg.find('=');
+                        if (arg.compare(0, 2, "--") != 0 || p == std::string::npos)
+                            return false;
+                        args[arg.substr(2, p - 2)] = arg.substr(p + 1);
+                    }
+                    try {
+                        get(args, "host", host);
+                        get(args, "port", port);
+                        get(args, "clients", clients);
+                        get(args, "channels", channels);
+                        get(args, "zipf", zipf);
+                        get(args, "hold", hold);
+                        get(args, "duration", duration);
+                        get(args, "interval", interval);
+                        get(args, "warm_ms", warm_ms);
+                        get(args, "hls", hls);
+                    } catch (boost::bad_lexical_cast const &) {
+                        return false;
+                    }
+                    return args.empty() && clients > 0 && channels > 0 && interval > 0;
+                }
+
+                template <typename T>
+                static void get(
+                    std::map<std::string, std::string> & args,
+                    char const * name,
+                    T & value)
+                {
+                    std::map<std::string, std::string>::iterator iter = args.find(name);
+                    if (iter != args.end()) {
+                        value = boost::lexical_cast<T>(iter->second);
+                        args.erase(iter);
+                    }
+                }
+
+                std::string host;
+                unsigned short port;
+                size_t clients;
+                size_t channels;
+                double zipf;
+                size_t hold;        // msec
+                size_t duration;    // sec
+                size_t interval;    // sec
+                size_t warm_ms;
+                bool hls;
+            };
+
+            // channel i (0 based) is picked with probability ~ 1 / (i + 1)^s
+            class Zipf
+            {
+            public:
+                Zipf(
+                    size_t n,
+                    double s)
+                    : cdf_(n)
+                {
+                    double sum = 0.0;
+                    for (size_t i = 0; i < n; ++i) {
+                        sum += 1.0 / std::pow((double)(i + 1), s);
+                        cdf_[i] = sum;
+                    }
+                    for (size_t i = 0; i < n; ++i)
+                        cdf_[i] /= sum;
+                }
+
+                size_t next() const
+                {
+                    double u = (double)rand() / ((double)RAND_MAX + 1.0);
+                    size_t i = std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+                    return i < cdf_.size() ? i : cdf_.size() - 1;
+                }
+
+            private:
+                std::vector<double> cdf_;
+            };
+
+            struct Statistics
+            {
+                Statistics()
+                    : requests(0)
+                    , warm(0)
+                    , errors(0)
+                    , bytes(0)
+                {
+                }
+
+                void clear()
+                {
+                    *this = Statistics();
+                }
+
+                size_t requests;
+                size_t warm;
+                size_t errors;
+                boost::uint64_t bytes;
+                std::vector<boost::uint32_t> ttfb; // msec
+                std::vector<boost::uint32_t> ttff; // msec
+            };
+
+            class Client
+            {
+            public:
+                Client(
+                    boost::asio::io_service & io_svc,
+                    Options const & options,
+                    Zipf const & zipf,
+                    boost::asio::ip::tcp::endpoint const & endpoint,
+                    Statistics & stat)
+                    : options_(options)
+                    , zipf_(zipf)
+                    , endpoint_(endpoint)
+                    , stat_(stat)
+                    , socket_(io_svc)
+                    , timer_(io_svc)
+                    , poll_timer_(io_svc)
+                    , first_byte_(false)
+                    , first_frame_(false)
+                    , packet_pos_(0)
+                    , response_(false)
+                    , in_playlist_(false)
+                    , last_sequence_(-1)
+                    , poll_(1000)
+                    , stopped_(false)
+                {
+                }
+
+            public:
+                void start()
+                {
+                    boost::system::error_code ec;
+                    socket_.close(ec);
+                    poll_timer_.cancel(ec);
+                    if (stopped_)
+                        return;
+                    std::string param = "channel="
+                        + boost::lexical_cast<std::string>(zipf_.next()) + "&type=live";
+                    path_ = "/" + util::protocol::pptv::base64_encode(param, JUST_LIVE_KEY);
+                    start_time_ = now();
+                    first_byte_ = false;
+                    first_frame_ = false;
+                    last_sequence_ = -1;
+                    segments_.clear();
+                    timer_.expires_at(start_time_ + boost::posix_time::milliseconds(options_.hold));
+                    timer_.async_wait(boost::bind(&Client::handle_hold, this, _1));
+                    request(options_.hls ? path_ + "?hls" : path_);
+                }
+
+                void stop()
+                {
+                    stopped_ = true;
+                    boost::system::error_code ec;
+                    socket_.close(ec);
+                    timer_.cancel(ec);
+                    poll_timer_.cancel(ec);
+                }
+
+            private:
+                void request(
+                    std::string const & target)
+                {
+                    boost::system::error_code ec;
+                    socket_.close(ec);
+                    request_ = "GET " + target
+                        + " HTTP/1.1\r\nHost: " + options_.host + "\r\nConnection: close\r\n\r\n";
+                    response_ = false;
+                    in_playlist_ = options_.hls && target == path_ + "?hls";
+                    playlist_.clear();
+                    packet_pos_ = 0;
+                    socket_.async_connect(endpoint_,
+                        boost::bind(&Client::handle_connect, this, _1));
+                }
+
+                // aborted by hold timer, a new request is made then
+                void handle_connect(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec) {
+                        if (ec != boost::asio::error::operation_aborted)
+                            fail();
+                        return;
+                    }
+                    boost::asio::async_write(socket_, boost::asio::buffer(request_),
+                        boost::bind(&Client::handle_write, this, _1));
+                }
+
+                void handle_write(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec) {
+                        if (ec != boost::asio::error::operation_aborted)
+                            fail();
+                        return;
+                    }
+                    read();
+                }
+
+                void read()
+                {
+                    socket_.async_read_some(boost::asio::buffer(buf_, sizeof(buf_)),
+                        boost::bind(&Client::handle_read, this, _1, _2));
+                }
+
+                void handle_read(
+                    boost::system::error_code const & ec,
+                    size_t bytes)
+                {
+                    if (ec) {
+                        // a HLS response ends so
+                        if (ec == boost::asio::error::eof && options_.hls && response_)
+                            return handle_response();
+                        // closed by hold timer, or by server before hold time
+                        if (ec != boost::asio::error::operation_aborted)
+                            fail();
+                        return;
+                    }
+                    if (!response_) {
+                        response_ = true;
+                        if (bytes < 12 || memcmp(buf_ + 9, "200", 3) != 0)
+                            return fail();
+                        if (!first_byte_) {
+                            first_byte_ = true;
+                            boost::uint32_t ttfb = (boost::uint32_t)(now() - start_time_).total_milliseconds();
+                            stat_.ttfb.push_back(ttfb);
+                            if (ttfb < options_.warm_ms)
+                                ++stat_.warm;
+                        }
+                        char const * body = std::search(buf_, buf_ + bytes, "\r\n\r\n", "\r\n\r\n" + 4);
+                        if (body != buf_ + bytes)
+                            consume(body + 4, buf_ + bytes - body - 4);
+                    } else {
+                        consume(buf_, bytes);
+                    }
+                    stat_.bytes += bytes;
+                    read();
+                }
+
+                void consume(
+                    char const * data,
+                    size_t size)
+                {
+                    if (in_playlist_)
+                        playlist_.append(data, size);
+                    else
+                        scan(data, size);
+                }
+
+                // next segment, or the playlist again after half its target
+                // duration
+                void handle_response()
+                {
+                    if (in_playlist_)
+                        parse_playlist();
+                    if (!segments_.empty()) {
+                        std::string uri = segments_.front();
+                        segments_.pop_front();
+                        request(path_ + uri);
+                        return;
+                    }
+                    boost::system::error_code ec;
+                    socket_.close(ec);
+                    poll_timer_.expires_from_now(boost::posix_time::milliseconds(poll_));
+                    poll_timer_.async_wait(boost::bind(&Client::handle_poll, this, _1));
+                }
+
+                // segments are relative to the playlist, in query only; the
+                // first playlist gives only its last one, as to a live player
+                void parse_playlist()
+                {
+                    bool first = last_sequence_ < 0;
+                    std::istringstream iss(playlist_);
+                    std::string line;
+                    while (std::getline(iss, line)) {
+                        if (line.compare(0, 22, "#EXT-X-TARGETDURATION:") == 0) {
+                            poll_ = (size_t)atoi(line.c_str() + 22) * 500;
+                            if (poll_ < 500)
+                                poll_ = 500;
+                            continue;
+                        }
+                        std::string::size_type p = line.find("hls_segment=");
+                        if (line.empty() || line[0] == '#' || p == std::string::npos)
+                            continue;
+                        long long sequence = atoll(line.c_str() + p + 12);
+                        if (sequence <= last_sequence_)
+                            continue;
+                        if (first)
+                            segments_.clear();
+                        segments_.push_back(line);
+                        last_sequence_ = sequence;
+                    }
+                }
+
+                void handle_poll(
+                    boost::system::error_code const & ec)
+                {
+                    if (!ec)
+                        request(path_ + "?hls");
+                }
+
+                // look for first random access point, resyncing on lost sync
+                void scan(
+                    char const * data,
+                    size_t size)
+                {
+                    boost::uint8_t const * p = (boost::uint8_t const *)data;
+                    while (size && !first_frame_) {
+                        if (packet_pos_ == 0 && *p != 0x47) {
+                            ++p;
+                            --size;
+                        } else if (packet_pos_ < sizeof(header_)) {
+                            header_[packet_pos_++] = *p++;
+                            --size;
+                            if (packet_pos_ == sizeof(header_) && (header_[3] & 0x20)
+                                && header_[4] > 0 && (header_[5] & 0x40)) {
+                                first_frame_ = true;
+                                stat_.ttff.push_back(
+                                    (boost::uint32_t)(now() - start_time_).total_milliseconds());
+                            }
+                        } else {
+                            size_t skip = std::min(packet_size - packet_pos_, size);
+                            p += skip;
+                            size -= skip;
+                            packet_pos_ = (packet_pos_ + skip) % packet_size;
+                        }
+                    }
+                }
+
+                void handle_hold(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    if (first_byte_)
+                        ++stat_.requests;
+                    start();
+                }
+
+                void fail()
+                {
+                    ++stat_.errors;
+                    boost::system::error_code ec;
+                    timer_.cancel(ec);
+                    poll_timer_.cancel(ec);
+                    socket_.close(ec);
+                    // do not hammer a failing server
+                    timer_.expires_from_now(boost::posix_time::milliseconds(100));
+                    timer_.async_wait(boost::bind(&Client::handle_retry, this, _1));
+                }
+
+                void handle_retry(
+                    boost::system::error_code const & ec)
+                {
+                    if (!ec)
+                        start();
+                }
+
+            private:
+                Options const & options_;
+                Zipf const & zipf_;
+                boost::asio::ip::tcp::endpoint endpoint_;
+                Statistics & stat_;
+                boost::asio::ip::tcp::socket socket_;
+                boost::asio::deadline_timer timer_;
+                boost::asio::deadline_timer poll_timer_;
+                std::string request_;
+                std::string path_;  // of channel
+                ptime start_time_;
+                static size_t const packet_size = 188;
+
+                char buf_[4096];
+                bool first_byte_;
+                bool first_frame_;
+                size_t packet_pos_;
+                boost::uint8_t header_[6];
+                bool response_;     // of current request, head seen
+                // hls
+                bool in_playlist_;
+                std::string playlist_;
+                std::deque<std::string> segments_;
+                long long last_sequence_;
+                size_t poll_;       // msec
+                bool stopped_;
+            };
+
+            class LoadGen
+            {
+            public:
+                LoadGen(
+                    Options const & options)
+                    : options_(options)
+                    , zipf_(options.channels, options.zipf)
+                    , timer_(io_svc_)
+                    , elapsed_(0)
+                {
+                }
+
+                ~LoadGen()
+                {
+                    for (size_t i = 0; i < clients_.size(); ++i)
+                        delete clients_[i];
+                }
+
+            public:
+                int run()
+                {
+                    boost::system::error_code ec;
+                    boost::asio::ip::tcp::endpoint endpoint(
+                        boost::asio::ip::address::from_string(options_.host, ec), options_.port);
+                    if (ec) {
+                        fprintf(stderr, "bad host %s\n", options_.host.c_str());
+                        return 1;
+                    }
+                    for (size_t i = 0; i < options_.clients; ++i) {
+                        clients_.push_back(new Client(io_svc_, options_, zipf_, endpoint, interval_stat_));
+                        clients_.back()->start();
+                    }
+                    start_time_ = now();
+                    timer_.expires_from_now(boost::posix_time::seconds(options_.interval));
+                    timer_.async_wait(boost::bind(&LoadGen::handle_timer, this, _1));
+                    io_svc_.run();
+                    report("total", total_stat_, (now() - start_time_).total_milliseconds());
+                    return 0;
+                }
+
+            private:
+                void handle_timer(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    elapsed_ += options_.interval;
+                    report("interval", interval_stat_, options_.interval * 1000);
+                    total_stat_.requests += interval_stat_.requests;
+                    total_stat_.warm += interval_stat_.warm;
+                    total_stat_.errors += interval_stat_.errors;
+                    total_stat_.bytes += interval_stat_.bytes;
+                    total_stat_.ttfb.insert(total_stat_.ttfb.end(),
+                        interval_stat_.ttfb.begin(), interval_stat_.ttfb.end());
+                    total_stat_.ttff.insert(total_stat_.ttff.end(),
+                        interval_stat_.ttff.begin(), interval_stat_.ttff.end());
+                    interval_stat_.clear();
+                    if (elapsed_ >= options_.duration) {
+                        for (size_t i = 0; i < clients_.size(); ++i)
+                            clients_[i]->stop();
+                        return;
+                    }
+                    timer_.expires_at(timer_.expires_at() + boost::posix_time::seconds(options_.interval));
+                    timer_.async_wait(boost::bind(&LoadGen::handle_timer, this, _1));
+                }
+
+                static void report(
+                    char const * title,
+                    Statistics & stat,
+                    boost::int64_t msec)
+                {
+                    std::sort(stat.ttfb.begin(), stat.ttfb.end());
+                    std::sort(stat.ttff.begin(), stat.ttff.end());
+                    printf("%-8s rps: %.1f  ttfb p50: %ums  p99: %ums  warm: %.1f%%  err: %u  mbps: %.1f"
+                        "  ttff p50: %ums  p99: %ums\n",
+                        title,
+                        msec > 0 ? stat.requests * 1000.0 / msec : 0.0,
+                        percentile(stat.ttfb, 50),
+                        percentile(stat.ttfb, 99),
+                        stat.ttfb.empty() ? 0.0 : stat.warm * 100.0 / stat.ttfb.size(),
+                        (unsigned int)stat.errors,
+                        msec > 0 ? stat.bytes * 8.0 / 1000.0 / msec : 0.0,
+                        percentile(stat.ttff, 50),
+                        percentile(stat.ttff, 99));
+                    fflush(stdout);
+                }
+
+                // of sorted values
+                static boost::uint32_t percentile(
+                    std::vector<boost::uint32_t> const & values,
+                    size_t pct)
+                {
+                    return values.empty() ? 0 : values[values.size() * pct / 100];
+                }
+
+            private:
+                Options const & options_;
+                Zipf zipf_;
+                boost::asio::io_service io_svc_;
+                boost::asio::deadline_timer timer_;
+                std::vector<Client *> clients_;
+                Statistics interval_stat_;
+                Statistics total_stat_;
+                ptime start_time_;
+                size_t elapsed_;    // sec
+            };
+
+        } // namespace loadgen
+    } // namespace live_worker
+} // namespace just
+
+int main(int argc, char * argv[])
+{
+    just::live_worker::loadgen::Options options;
+    if (!options.parse(argc, argv)) {
+        fprintf(stderr,
+            "usage: %s [--host=127.0.0.1] [--port=9001] [--clients=100] [--channels=1000]\n"
+            "    [--zipf=1.0] [--hold=5000] [--duration=60] [--interval=5] [--warm_ms=100]\n"
+            "    [--hls=0]\n",
+            argv[0]);
+        return 1;
+    }
+    just::live_worker::loadgen::LoadGen load_gen(options);
+    return load_gen.run();
+}
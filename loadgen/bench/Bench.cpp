@@ -0,0 +1,1307 @@
+// Bench.cpp
+
+// Micro benchmarks of the parts of live_worker that run without the kernel
+// and the daemon. Each prints the way it was done before next to the way
+// it is done now, each of them run in a process of its own so that cpu
+// time and sockets of one do not count in the other:
+//   index  start and stop of channels at max_parallel warm channels: the
+//          channel vector scanned by rid, an idle channel moved to its
+//          front (before), the rid index with a keep policy (now); ops/s
+//   ipc    round trips to a child over a socketpair: text archive, one
+//          read per message (before), framed messages one at a time and
+//          window of them in flight (now); round trips/s
+//   relay  clients of one channel: an upstream connection each copied
+//          through as by HttpProxy (before), one shared relay (now);
+//          upstream connections, Mbit/s and cpu sec per delivered Gbit
+//   gop    new clients of a running channel: from its upstream at the
+//          live frame (before), from the last random access point in the
+//          relay ring (now); time to first frame p50/p99
+//   hls    viewers of one channel: a relayed ts stream each (before), a
+//          poller of playlist and segments each (now); connections open,
+//          Mbit/s and cpu sec per viewer minute
+// The stream is a ts of one video pid at 25 frames per second with a
+// random access point each second, paced as by live_mock; a connection
+// to it starts at the live frame.
+//
+// Usage: live_bench <index|ipc|relay|gop|hls> [--name=value ...]
+//   index: channels=10000 rids=12000 clients=1000 ops=200000 keep_policy=lru
+//   ipc:   duration=5 window=16
+//   relay: clients=100 bitrate=2000 (kbps) duration=10 (sec)
+//   gop:   clients=20 bitrate=2000
+//   hls:   clients=100 bitrate=2000 duration=30 hls_segment=2000 (msec)
+//          hls_window=6
+
+#include "just/live_worker/Common.h"
+#include "just/live_worker/KeepPolicy.h"
+#include "just/live_worker/ChildMessage.h"
+#include "just/live_worker/Relay.h"
+
+#include <util/archive/TextIArchive.h>
+#include <util/archive/TextOArchive.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/random/linear_congruential.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace just
+{
+    namespace live_worker
+    {
+        namespace bench
+        {
+
+            typedef boost::posix_time::ptime ptime;
+
+            static ptime now()
+            {
+                return boost::posix_time::microsec_clock::universal_time();
+            }
+
+            static double cpu_seconds()
+            {
+                struct rusage usage;
+                getrusage(RUSAGE_SELF, &usage);
+                return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+                    + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+            }
+
+            // of sorted values
+            static boost::uint32_t percentile(
+                std::vector<boost::uint32_t> const & values,
+                size_t pct)
+            {
+                return values.empty() ? 0 : values[values.size() * pct / 100];
+            }
+
+            class Options
+            {
+            public:
+                bool parse(
+                    int argc,
+                    char * argv[])
+                {
+                    for (int i = 0; i < argc; ++i) {
+                        std::string arg(argv[i]);
+                        std::string::size_type p = arg.find('=');
+                        if (arg.compare(0, 2, "--") != 0 || p == std::string::npos)
+                            return false;
+                        args_[arg.substr(2, p - 2)] = arg.substr(p + 1);
+                    }
+                    return true;
+                }
+
+                template <typename T>
+                T get(
+                    char const * name,
+                    T value) const
+                {
+                    std::map<std::string, std::string>::const_iterator iter = args_.find(name);
+                    if (iter != args_.end())
+                        value = boost::lexical_cast<T>(iter->second);
+                    return value;
+                }
+
+            private:
+                std::map<std::string, std::string> args_;
+            };
+
+            // index
+
+            // LiveManager channels before the rid index: found by comparing
+            // rid of each, an idle channel moved to front, check_parallel
+            // counts and scans all of them
+            class VectorIndex
+            {
+            public:
+                struct Channel
+                {
+                    std::string rid;
+                    size_t nref;
+                };
+
+                VectorIndex(
+                    Options const & options)
+                    : max_parallel_(options.get<size_t>("channels", 10000))
+                {
+                }
+
+                Channel * start(
+                    std::string const & rid)
+                {
+                    Channel * channel = NULL;
+                    for (size_t i = 0; i < channels_.size(); ++i) {
+                        if (channels_[i]->rid == rid) {
+                            channel = channels_[i];
+                            break;
+                        }
+                    }
+                    if (channel == NULL) {
+                        channel = new Channel;
+                        channel->rid = rid;
+                        channel->nref = 0;
+                        channels_.push_back(channel);
+                    }
+                    ++channel->nref;
+                    check_parallel();
+                    return channel;
+                }
+
+                void stop(
+                    Channel * channel)
+                {
+                    if (--channel->nref == 0) {
+                        channels_.erase(std::remove(channels_.begin(), channels_.end(), channel), channels_.end());
+                        channels_.insert(channels_.begin(), channel);
+                    }
+                    check_parallel();
+                }
+
+            private:
+                struct is_working
+                {
+                    bool operator()(
+                        Channel * channel) const
+                    {
+                        return channel->nref > 0;
+                    }
+                };
+
+                void check_parallel()
+                {
+                    size_t user_size = std::count_if(channels_.begin(), channels_.end(), is_working());
+                    size_t left_size = max_parallel_ > user_size ? max_parallel_ - user_size : 0;
+                    size_t found = 0;
+                    for (size_t i = 0; i < channels_.size(); ++i) {
+                        if (channels_[i]->nref == 0 && ++found > left_size) {
+                            delete channels_[i];
+                            channels_[i] = NULL;
+                        }
+                    }
+                    channels_.erase(
+                        std::remove(channels_.begin(), channels_.end(), (Channel *)0), channels_.end());
+                }
+
+            private:
+                size_t max_parallel_;
+                std::vector<Channel *> channels_;
+            };
+
+            // LiveManager channels now: rid index, idle count and expire
+            // queue, the keep policy picks the idle channel to evict
+            class RidIndex
+            {
+            public:
+                struct Channel
+                {
+                    std::string rid;
+                    size_t nref;
+                    std::multimap<boost::uint64_t, Channel *>::iterator expire_iter;
+                };
+
+                RidIndex(
+                    Options const & options)
+                    : max_parallel_(options.get<size_t>("channels", 10000))
+                    , keep_policy_(KeepPolicy::create(
+                        options.get<std::string>("keep_policy", "lru"), max_parallel_))
+                    , idle_count_(0)
+                    , tick_(0)
+                {
+                }
+
+                ~RidIndex()
+                {
+                    delete keep_policy_;
+                }
+
+                Channel * start(
+                    std::string const & rid)
+                {
+                    Channel * channel = NULL;
+                    boost::unordered_map<std::string, Channel *>::iterator iter = channels_.find(rid);
+                    if (iter != channels_.end()) {
+                        channel = iter->second;
+                        if (channel->nref == 0) {
+                            --idle_count_;
+                            expire_queue_.erase(channel->expire_iter);
+                            keep_policy_->on_busy(rid);
+                        }
+                    } else {
+                        channel = new Channel;
+                        channel->rid = rid;
+                        channel->nref = 0;
+                        channels_[rid] = channel;
+                    }
+                    keep_policy_->on_request(rid);
+                    ++channel->nref;
+                    check_parallel();
+                    return channel;
+                }
+
+                void stop(
+                    Channel * channel)
+                {
+                    if (--channel->nref == 0) {
+                        ++idle_count_;
+                        channel->expire_iter = expire_queue_.insert(
+                            std::make_pair(++tick_ + 60000, channel));
+                        keep_policy_->on_idle(channel->rid);
+                    }
+                    check_parallel();
+                }
+
+            private:
+                void check_parallel()
+                {
+                    size_t user_size = channels_.size() - idle_count_;
+                    size_t left_size = max_parallel_ > user_size ? max_parallel_ - user_size : 0;
+                    while (idle_count_ > left_size) {
+                        boost::unordered_map<std::string, Channel *>::iterator iter =
+                            channels_.find(keep_policy_->victim());
+                        Channel * channel = iter->second;
+                        channels_.erase(iter);
+                        --idle_count_;
+                        expire_queue_.erase(channel->expire_iter);
+                        keep_policy_->on_drop(channel->rid);
+                        delete channel;
+                    }
+                }
+
+            private:
+                size_t max_parallel_;
+                KeepPolicy * keep_policy_;
+                boost::unordered_map<std::string, Channel *> channels_;
+                size_t idle_count_;
+                std::multimap<boost::uint64_t, Channel *> expire_queue_;
+                boost::uint64_t tick_;
+            };
+
+            // clients each hold a channel, the oldest released for a new
+            // request of a random rid
+            template <typename Index>
+            static void bench_index(
+                char const * title,
+                Options const & options)
+            {
+                size_t rids = options.get<size_t>("rids", 12000);
+                size_t clients = options.get<size_t>("clients", 1000);
+                size_t ops = options.get<size_t>("ops", 200000);
+                std::vector<std::string> names(rids);
+                for (size_t i = 0; i < rids; ++i)
+                    names[i] = "2dfb4d8e6c7a4b0c9e1f" + boost::lexical_cast<std::string>(i);
+                Index index(options);
+                boost::minstd_rand rand(1);
+                std::deque<typename Index::Channel *> held;
+                // warm up to a full pool
+                for (size_t i = 0; i < rids; ++i)
+                    index.stop(index.start(names[i]));
+                ptime start = now();
+                for (size_t i = 0; i < ops; ++i) {
+                    if (held.size() == clients) {
+                        index.stop(held.front());
+                        held.pop_front();
+                    }
+                    held.push_back(index.start(names[rand() % rids]));
+                }
+                double seconds = (now() - start).total_microseconds() / 1000000.0;
+                printf("%-8s ops: %u  time: %.3fs  ops/s: %.0f\n",
+                    title, (unsigned int)ops, seconds, ops / seconds);
+            }
+
+            // ipc
+
+            typedef boost::asio::local::stream_protocol::socket local_socket;
+
+            // child side of the text archive: one message a read, as the
+            // parent and child did before the framed protocol
+            static void text_child(
+                local_socket * socket)
+            {
+                boost::asio::streambuf buf;
+                boost::system::error_code ec;
+                while (true) {
+                    size_t size = socket->read_some(buf.prepare(2048), ec);
+                    if (ec)
+                        return;
+                    buf.commit(size);
+                    boost::system::error_code ec1;
+                    std::string url;
+                    {
+                        util::archive::TextIArchive<> ia(buf);
+                        ia >> ec1 >> url;
+                    }
+                    buf.consume(buf.size());
+                    boost::asio::streambuf out;
+                    {
+                        util::archive::TextOArchive<> oa(out);
+                        oa << ec1 << url;
+                    }
+                    boost::asio::write(*socket, out, ec);
+                }
+            }
+
+            static void framed_child(
+                local_socket * socket)
+            {
+                boost::asio::streambuf buf;
+                boost::asio::streambuf out;
+                boost::system::error_code ec;
+                while (true) {
+                    size_t size = socket->read_some(buf.prepare(4096), ec);
+                    if (ec)
+                        return;
+                    buf.commit(size);
+                    ChildMessage msg;
+                    while (msg.decode(buf, ec)) {
+                        boost::system::error_code ec1;
+                        std::string url;
+                        msg >> ec1 >> url;
+                        ChildMessage reply(ChildMessage::started, msg.id);
+                        reply << ec1 << url;
+                        reply.encode(out);
+                    }
+                    if (ec)
+                        return;
+                    boost::asio::write(*socket, out, ec);
+                }
+            }
+
+            static std::string const ipc_url =
+                "http://127.0.0.1:9000/secret.tmp?channel=2dfb4d8e6c7a4b0c9e1f5a3b7c9d1e2f&type=live&tcp_port=9100&udp_port=9101";
+
+            static void bench_ipc_text(
+                Options const & options)
+            {
+                boost::asio::io_service io_svc;
+                local_socket parent(io_svc);
+                local_socket child(io_svc);
+                boost::asio::local::connect_pair(parent, child);
+                boost::thread thread(boost::bind(text_child, &child));
+                size_t duration = options.get<size_t>("duration", 5);
+                boost::asio::streambuf buf;
+                boost::system::error_code ec;
+                size_t count = 0;
+                ptime start = now();
+                ptime end = start + boost::posix_time::seconds(duration);
+                while (now() < end) {
+                    boost::asio::streambuf out;
+                    {
+                        util::archive::TextOArchive<> oa(out);
+                        oa << ec << ipc_url;
+                    }
+                    boost::asio::write(parent, out, ec);
+                    size_t size = parent.read_some(buf.prepare(2048), ec);
+                    if (ec)
+                        break;
+                    buf.commit(size);
+                    boost::system::error_code ec1;
+                    std::string url;
+                    {
+                        util::archive::TextIArchive<> ia(buf);
+                        ia >> ec1 >> url;
+                    }
+                    buf.consume(buf.size());
+                    ++count;
+                }
+                double seconds = (now() - start).total_microseconds() / 1000000.0;
+                printf("%-8s round trips: %u  per sec: %.0f\n",
+                    "text", (unsigned int)count, count / seconds);
+                parent.close(ec);
+                thread.join();
+            }
+
+            static void bench_ipc_framed(
+                char const * title,
+                size_t window,
+                Options const & options)
+            {
+                boost::asio::io_service io_svc;
+                local_socket parent(io_svc);
+                local_socket child(io_svc);
+                boost::asio::local::connect_pair(parent, child);
+                boost::thread thread(boost::bind(framed_child, &child));
+                size_t duration = options.get<size_t>("duration", 5);
+                boost::asio::streambuf buf;
+                boost::asio::streambuf out;
+                boost::system::error_code ec;
+                size_t count = 0;
+                boost::uint32_t id = 0;
+                ptime start = now();
+                ptime end = start + boost::posix_time::seconds(duration);
+                for (size_t i = 0; i < window; ++i) {
+                    ChildMessage msg(ChildMessage::start, ++id);
+                    msg << ec << ipc_url;
+                    msg.encode(out);
+                }
+                boost::asio::write(parent, out, ec);
+                while (!ec && now() < end) {
+                    size_t size = parent.read_some(buf.prepare(4096), ec);
+                    if (ec)
+                        break;
+                    buf.commit(size);
+                    ChildMessage reply;
+                    while (reply.decode(buf, ec)) {
+                        boost::system::error_code ec1;
+                        std::string url;
+                        reply >> ec1 >> url;
+                        ++count;
+                        ChildMessage msg(ChildMessage::start, ++id);
+                        msg << ec1 << url;
+                        msg.encode(out);
+                    }
+                    if (!ec && out.size())
+                        boost::asio::write(parent, out, ec);
+                }
+                double seconds = (now() - start).total_microseconds() / 1000000.0;
+                printf("%-8s round trips: %u  per sec: %.0f\n",
+                    title, (unsigned int)count, count / seconds);
+                parent.close(ec);
+                thread.join();
+            }
+
+            // stream
+
+            // ts of live_mock reduced to what Relay parses: PAT and PMT
+            // packets, then the first packet of each video frame with an
+            // adaptation field, random access on each gop_size frame
+            class TsSource
+            {
+            public:
+                static size_t const packet_size = 188;
+                static boost::uint16_t const pmt_pid = 0x1000;
+                static boost::uint16_t const video_pid = 0x0100;
+                static boost::uint32_t const frame_rate = 25;
+                static boost::uint32_t const gop_size = 25;
+
+            public:
+                TsSource(
+                    boost::uint32_t bitrate, // kbps
+                    boost::uint64_t frame)
+                    : frame_packets_(bitrate * 1000 / 8 / packet_size / frame_rate)
+                    , frame_(frame)
+                    , cc_(0)
+                {
+                    if (frame_packets_ == 0)
+                        frame_packets_ = 1;
+                }
+
+            public:
+                void next_frame(
+                    std::vector<boost::uint8_t> & buf)
+                {
+                    bool key = frame_ % gop_size == 0;
+                    if (key) {
+                        put_packet(buf, 0, true);
+                        put_packet(buf, pmt_pid, true);
+                    }
+                    for (size_t i = 0; i < frame_packets_; ++i) {
+                        boost::uint8_t * p = put_packet(buf, video_pid, i == 0);
+                        if (i == 0) {
+                            p[3] |= 0x20;
+                            p[4] = 7;
+                            p[5] = key ? 0x50 : 0x10; // random access, pcr
+                        }
+                    }
+                    ++frame_;
+                }
+
+                static bool random_access(
+                    boost::uint8_t const * p)
+                {
+                    boost::uint16_t pid = ((p[1] & 0x1f) << 8) | p[2];
+                    return pid != 0 && (p[3] & 0x20) && p[4] > 0 && (p[5] & 0x40);
+                }
+
+            private:
+                boost::uint8_t * put_packet(
+                    std::vector<boost::uint8_t> & buf,
+                    boost::uint16_t pid,
+                    bool unit_start)
+                {
+                    buf.resize(buf.size() + packet_size);
+                    boost::uint8_t * p = &buf[buf.size() - packet_size];
+                    p[0] = 0x47;
+                    p[1] = (unit_start ? 0x40 : 0x00) | ((pid >> 8) & 0x1f);
+                    p[2] = pid & 0xff;
+                    p[3] = 0x10 | (cc_++ & 0x0f);
+                    memset(p + 4, 0xff, packet_size - 4);
+                    return p;
+                }
+
+            private:
+                size_t frame_packets_;
+                boost::uint64_t frame_;
+                boost::uint8_t cc_;
+            };
+
+            // the kernel side of a channel, a live ts over http in a thread
+            // of its own
+            class Upstream
+            {
+            public:
+                Upstream(
+                    boost::uint32_t bitrate)
+                    : acceptor_(io_svc_, boost::asio::ip::tcp::endpoint(
+                        boost::asio::ip::address_v4::loopback(), 0))
+                    , bitrate_(bitrate)
+                    , start_time_(now())
+                    , connections_(0)
+                {
+                    accept();
+                    thread_ = new boost::thread(
+                        boost::bind(&boost::asio::io_service::run, &io_svc_));
+                }
+
+                ~Upstream()
+                {
+                    io_svc_.stop();
+                    thread_->join();
+                    delete thread_;
+                }
+
+                std::string url() const
+                {
+                    return "http://127.0.0.1:"
+                        + boost::lexical_cast<std::string>(acceptor_.local_endpoint().port()) + "/secret.tmp";
+                }
+
+                boost::asio::ip::tcp::endpoint endpoint() const
+                {
+                    return acceptor_.local_endpoint();
+                }
+
+                size_t connections() const
+                {
+                    return connections_;
+                }
+
+            private:
+                class Session
+                    : public boost::enable_shared_from_this<Session>
+                {
+                public:
+                    Session(
+                        boost::asio::io_service & io_svc,
+                        boost::uint32_t bitrate,
+                        boost::uint64_t frame)
+                        : socket_(io_svc)
+                        , timer_(io_svc)
+                        , source_(bitrate, frame)
+                    {
+                    }
+
+                    boost::asio::ip::tcp::socket & socket()
+                    {
+                        return socket_;
+                    }
+
+                    void start()
+                    {
+                        boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+                            boost::bind(&Session::handle_request, shared_from_this(), _1));
+                    }
+
+                private:
+                    void handle_request(
+                        boost::system::error_code const & ec)
+                    {
+                        if (ec)
+                            return;
+                        static char const head[] =
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: video/mp2t\r\n"
+                            "Connection: close\r\n"
+                            "\r\n";
+                        buf_.assign(head, head + sizeof(head) - 1);
+                        source_.next_frame(buf_);
+                        timer_.expires_from_now(boost::posix_time::milliseconds(0));
+                        boost::asio::async_write(socket_, boost::asio::buffer(buf_),
+                            boost::bind(&Session::handle_write, shared_from_this(), _1));
+                    }
+
+                    void handle_write(
+                        boost::system::error_code const & ec)
+                    {
+                        if (ec)
+                            return;
+                        timer_.expires_at(timer_.expires_at()
+                            + boost::posix_time::milliseconds(1000 / TsSource::frame_rate));
+                        timer_.async_wait(
+                            boost::bind(&Session::handle_timer, shared_from_this(), _1));
+                    }
+
+                    void handle_timer(
+                        boost::system::error_code const & ec)
+                    {
+                        if (ec)
+                            return;
+                        buf_.clear();
+                        source_.next_frame(buf_);
+                        boost::asio::async_write(socket_, boost::asio::buffer(buf_),
+                            boost::bind(&Session::handle_write, shared_from_this(), _1));
+                    }
+
+                private:
+                    boost::asio::ip::tcp::socket socket_;
+                    boost::asio::deadline_timer timer_;
+                    boost::asio::streambuf request_;
+                    std::vector<boost::uint8_t> buf_;
+                    TsSource source_;
+                };
+
+                void accept()
+                {
+                    boost::uint64_t frame = (now() - start_time_).total_milliseconds()
+                        * TsSource::frame_rate / 1000;
+                    boost::shared_ptr<Session> session(new Session(io_svc_, bitrate_, frame));
+                    acceptor_.async_accept(session->socket(),
+                        boost::bind(&Upstream::handle_accept, this, session, _1));
+                }
+
+                void handle_accept(
+                    boost::shared_ptr<Session> session,
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    __sync_fetch_and_add(&connections_, 1);
+                    session->start();
+                    accept();
+                }
+
+            private:
+                boost::asio::io_service io_svc_;
+                boost::asio::ip::tcp::acceptor acceptor_;
+                boost::uint32_t bitrate_;
+                ptime start_time_;
+                size_t connections_;
+                boost::thread * thread_;
+            };
+
+            // LiveProxy reduced to its relay part, in one io thread: "?hls"
+            // asks for the playlist, "?hls_segment=N.ts" for a segment, else
+            // the ts stream; served by the shared relay, or by an upstream
+            // connection of its own copied through (copy) as by HttpProxy
+            class Server
+            {
+            public:
+                Server(
+                    Upstream & upstream,
+                    RelayHub * hub)
+                    : upstream_(upstream)
+                    , hub_(hub)
+                    , connections_(0)
+                    , acceptor_(io_svc_, boost::asio::ip::tcp::endpoint(
+                        boost::asio::ip::address_v4::loopback(), 0))
+                {
+                    accept();
+                    thread_ = new boost::thread(
+                        boost::bind(&boost::asio::io_service::run, &io_svc_));
+                }
+
+                // connections and relays left are destroyed with io_svc_
+                ~Server()
+                {
+                    io_svc_.stop();
+                    thread_->join();
+                    delete thread_;
+                }
+
+                boost::asio::ip::tcp::endpoint endpoint() const
+                {
+                    return acceptor_.local_endpoint();
+                }
+
+                // open client connections
+                size_t connections() const
+                {
+                    return connections_;
+                }
+
+            private:
+                class Connection
+                    : public boost::enable_shared_from_this<Connection>
+                {
+                public:
+                    Connection(
+                        Server & server)
+                        : server_(server)
+                        , socket_(server.io_svc_)
+                        , upstream_(server.io_svc_)
+                        , accepted_(false)
+                    {
+                    }
+
+                    ~Connection()
+                    {
+                        if (accepted_)
+                            __sync_fetch_and_sub(&server_.connections_, 1);
+                    }
+
+                    boost::asio::ip::tcp::socket & socket()
+                    {
+                        return socket_;
+                    }
+
+                    void start()
+                    {
+                        accepted_ = true;
+                        __sync_fetch_and_add(&server_.connections_, 1);
+                        boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+                            boost::bind(&Connection::handle_request, shared_from_this(), _1));
+                    }
+
+                private:
+                    void handle_request(
+                        boost::system::error_code const & ec)
+                    {
+                        if (ec)
+                            return;
+                        std::string line;
+                        std::istream is(&request_);
+                        std::getline(is, line);
+                        if (server_.hub_ == NULL) {
+                            upstream_.async_connect(server_.upstream_.endpoint(),
+                                boost::bind(&Connection::handle_connect, shared_from_this(), _1));
+                            return;
+                        }
+                        session_.reset(new RelaySession(server_.io_svc_, socket_,
+                            boost::bind(&Connection::handle_end, shared_from_this(), _1)));
+                        std::string::size_type p = line.find("?hls");
+                        if (p != std::string::npos) {
+                            boost::uint64_t sequence = (boost::uint64_t)-1;
+                            if (line.compare(p, 13, "?hls_segment=") == 0)
+                                sequence = strtoull(line.c_str() + p + 13, NULL, 10);
+                            session_->hls("?hls_segment=", sequence);
+                        }
+                        if (!server_.hub_->join(server_.upstream_.url(), session_))
+                            session_.reset();
+                    }
+
+                    void handle_end(
+                        boost::system::error_code const & ec)
+                    {
+                        session_.reset();
+                        boost::system::error_code ec1;
+                        socket_.close(ec1);
+                    }
+
+                    void handle_connect(
+                        boost::system::error_code const & ec)
+                    {
+                        if (ec)
+                            return;
+                        static char const request[] = "GET /secret.tmp HTTP/1.0\r\n\r\n";
+                        boost::asio::async_write(upstream_,
+                            boost::asio::buffer(request, sizeof(request) - 1),
+                            boost::bind(&Connection::handle_write, shared_from_this(), _1));
+                    }
+
+                    void handle_read(
+                        boost::system::error_code const & ec,
+                        size_t bytes_transferred)
+                    {
+                        if (ec)
+                            return;
+                        boost::asio::async_write(socket_,
+                            boost::asio::buffer(buf_, bytes_transferred),
+                            boost::bind(&Connection::handle_write, shared_from_this(), _1));
+                    }
+
+                    void handle_write(
+                        boost::system::error_code const & ec)
+                    {
+                        if (ec)
+                            return;
+                        upstream_.async_read_some(boost::asio::buffer(buf_),
+                            boost::bind(&Connection::handle_read, shared_from_this(), _1, _2));
+                    }
+
+                private:
+                    Server & server_;
+                    boost::asio::ip::tcp::socket socket_;
+                    boost::asio::ip::tcp::socket upstream_;
+                    boost::asio::streambuf request_;
+                    boost::shared_ptr<RelaySession> session_;
+                    bool accepted_;
+                    char buf_[16 * 1024];
+                };
+
+                void accept()
+                {
+                    boost::shared_ptr<Connection> connection(new Connection(*this));
+                    acceptor_.async_accept(connection->socket(),
+                        boost::bind(&Server::handle_accept, this, connection, _1));
+                }
+
+                void handle_accept(
+                    boost::shared_ptr<Connection> connection,
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    connection->start();
+                    accept();
+                }
+
+            private:
+                Upstream & upstream_;
+                RelayHub * hub_;
+                size_t connections_;
+                boost::asio::io_service io_svc_;
+                boost::asio::ip::tcp::acceptor acceptor_;
+                boost::thread * thread_;
+            };
+
+            // body bytes received by all clients
+            static boost::uint64_t received = 0;
+
+            static boost::uint32_t errors = 0;
+
+            // http get of path, body counted in received; done is called
+            // with the body if keep, else it is dropped as read
+            class Request
+                : public boost::enable_shared_from_this<Request>
+            {
+            public:
+                typedef boost::function<void (bool, std::string const &)> done_func;
+
+                Request(
+                    boost::asio::io_service & io_svc,
+                    boost::asio::ip::tcp::endpoint const & endpoint,
+                    std::string const & path,
+                    bool keep,
+                    done_func const & done)
+                    : socket_(io_svc)
+                    , endpoint_(endpoint)
+                    , request_("GET " + path + " HTTP/1.0\r\n\r\n")
+                    , keep_(keep)
+                    , done_(done)
+                    , head_(true)
+                {
+                }
+
+                void start()
+                {
+                    socket_.async_connect(endpoint_,
+                        boost::bind(&Request::handle_connect, shared_from_this(), _1));
+                }
+
+            private:
+                void handle_connect(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec) {
+                        finish(false);
+                        return;
+                    }
+                    boost::asio::async_write(socket_, boost::asio::buffer(request_),
+                        boost::bind(&Request::handle_write, shared_from_this(), _1));
+                }
+
+                void handle_write(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec) {
+                        finish(false);
+                        return;
+                    }
+                    read();
+                }
+
+                void read()
+                {
+                    socket_.async_read_some(boost::asio::buffer(buf_),
+                        boost::bind(&Request::handle_read, shared_from_this(), _1, _2));
+                }
+
+                void handle_read(
+                    boost::system::error_code const & ec,
+                    size_t bytes_transferred)
+                {
+                    if (ec) {
+                        finish(!head_ && ec == boost::asio::error::eof);
+                        return;
+                    }
+                    char const * p = buf_;
+                    size_t size = bytes_transferred;
+                    if (head_) {
+                        head_buf_.append(p, size);
+                        std::string::size_type end = head_buf_.find("\r\n\r\n");
+                        if (end == std::string::npos) {
+                            read();
+                            return;
+                        }
+                        head_ = false;
+                        if (head_buf_.compare(0, 12, "HTTP/1.0 200") != 0) {
+                            finish(false);
+                            return;
+                        }
+                        body_.assign(head_buf_, end + 4, std::string::npos);
+                        size = body_.size();
+                        if (!keep_)
+                            body_.clear();
+                    } else if (keep_) {
+                        body_.append(p, size);
+                    }
+                    __sync_fetch_and_add(&received, (boost::uint64_t)size);
+                    read();
+                }
+
+                void finish(
+                    bool ok)
+                {
+                    if (!ok)
+                        __sync_fetch_and_add(&errors, 1);
+                    done_func done;
+                    done.swap(done_);
+                    if (done)
+                        done(ok, body_);
+                }
+
+            private:
+                boost::asio::ip::tcp::socket socket_;
+                boost::asio::ip::tcp::endpoint endpoint_;
+                std::string request_;
+                bool keep_;
+                done_func done_;
+                bool head_;
+                std::string head_buf_;
+                std::string body_;
+                char buf_[16 * 1024];
+            };
+
+            // polls the playlist each half segment and gets each new
+            // segment, starting at the last one, as a player does
+            class Viewer
+            {
+            public:
+                Viewer(
+                    boost::asio::io_service & io_svc,
+                    boost::asio::ip::tcp::endpoint const & endpoint,
+                    boost::uint32_t poll)
+                    : io_svc_(io_svc)
+                    , endpoint_(endpoint)
+                    , timer_(io_svc)
+                    , poll_(poll)
+                    , next_((boost::uint64_t)-1)
+                {
+                }
+
+                void start()
+                {
+                    get_playlist();
+                }
+
+            private:
+                void get_playlist()
+                {
+                    boost::shared_ptr<Request> request(new Request(io_svc_, endpoint_, "/c?hls", true,
+                        boost::bind(&Viewer::handle_playlist, this, _1, _2)));
+                    request->start();
+                }
+
+                void handle_playlist(
+                    bool ok,
+                    std::string const & m3u8)
+                {
+                    segments_.clear();
+                    std::string::size_type p = 0;
+                    while (ok && (p = m3u8.find("hls_segment=", p)) != std::string::npos) {
+                        p += 12;
+                        boost::uint64_t sequence = strtoull(m3u8.c_str() + p, NULL, 10);
+                        if (next_ == (boost::uint64_t)-1 || sequence >= next_)
+                            segments_.push_back(sequence);
+                    }
+                    // a new viewer starts at the last segment
+                    if (next_ == (boost::uint64_t)-1 && segments_.size() > 1)
+                        segments_.erase(segments_.begin(), segments_.end() - 1);
+                    get_segment();
+                }
+
+                void get_segment()
+                {
+                    if (segments_.empty()) {
+                        timer_.expires_from_now(boost::posix_time::milliseconds(poll_));
+                        timer_.async_wait(boost::bind(&Viewer::handle_timer, this, _1));
+                        return;
+                    }
+                    boost::uint64_t sequence = segments_.front();
+                    segments_.pop_front();
+                    next_ = sequence + 1;
+                    boost::shared_ptr<Request> request(new Request(io_svc_, endpoint_,
+                        "/c?hls_segment=" + boost::lexical_cast<std::string>(sequence) + ".ts", false,
+                        boost::bind(&Viewer::handle_segment, this, _1, _2)));
+                    request->start();
+                }
+
+                void handle_segment(
+                    bool ok,
+                    std::string const &)
+                {
+                    get_segment();
+                }
+
+                void handle_timer(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    get_playlist();
+                }
+
+            private:
+                boost::asio::io_service & io_svc_;
+                boost::asio::ip::tcp::endpoint endpoint_;
+                boost::asio::deadline_timer timer_;
+                boost::uint32_t poll_;
+                boost::uint64_t next_;    // sequence of next segment to get
+                std::deque<boost::uint64_t> segments_;
+            };
+
+            static void run_io(
+                boost::asio::io_service & io_svc)
+            {
+                boost::asio::io_service::work work(io_svc);
+                io_svc.run();
+            }
+
+            static void stop_io(
+                boost::asio::io_service & io_svc,
+                boost::thread & thread)
+            {
+                io_svc.stop();
+                thread.join();
+            }
+
+            // relay
+
+            static void bench_relay(
+                char const * title,
+                bool shared,
+                Options const & options)
+            {
+                size_t clients = options.get<size_t>("clients", 100);
+                size_t duration = options.get<size_t>("duration", 10);
+                Upstream upstream(options.get<boost::uint32_t>("bitrate", 2000));
+                RelayHub hub(4 << 20, 256 << 20, 0);
+                Server server(upstream, shared ? &hub : NULL);
+                boost::asio::io_service io_svc;
+                for (size_t i = 0; i < clients; ++i) {
+                    boost::shared_ptr<Request> request(new Request(io_svc, server.endpoint(),
+                        "/c", false, Request::done_func()));
+                    request->start();
+                }
+                boost::thread thread(boost::bind(run_io, boost::ref(io_svc)));
+                // all joined
+                boost::this_thread::sleep(boost::posix_time::seconds(2));
+                boost::uint64_t bytes = received;
+                double cpu = cpu_seconds();
+                ptime start = now();
+                boost::this_thread::sleep(boost::posix_time::seconds(duration));
+                bytes = received - bytes;
+                cpu = cpu_seconds() - cpu;
+                double seconds = (now() - start).total_microseconds() / 1000000.0;
+                printf("%-8s upstreams: %u  clients: %u  mbps: %.1f  cpu: %.1f%%  cpu sec per gbit: %.4f  err: %u\n",
+                    title, (unsigned int)upstream.connections(), (unsigned int)server.connections(),
+                    bytes * 8 / 1000000.0 / seconds, cpu * 100 / seconds,
+                    bytes ? cpu / (bytes * 8 / 1000000000.0) : 0.0, (unsigned int)errors);
+                stop_io(io_svc, thread);
+            }
+
+            // gop
+
+            // usec from connect to the first random access point in body
+            static boost::uint32_t first_frame(
+                boost::asio::ip::tcp::endpoint const & endpoint)
+            {
+                boost::asio::io_service io_svc;
+                boost::asio::ip::tcp::socket socket(io_svc);
+                ptime start = now();
+                boost::system::error_code ec;
+                socket.connect(endpoint, ec);
+                static char const request[] = "GET /c HTTP/1.0\r\n\r\n";
+                boost::asio::write(socket, boost::asio::buffer(request, sizeof(request) - 1), ec);
+                boost::asio::streambuf buf;
+                size_t head = boost::asio::read_until(socket, buf, "\r\n\r\n", ec);
+                if (ec)
+                    return (boost::uint32_t)-1;
+                buf.consume(head);
+                boost::uint8_t packet[TsSource::packet_size];
+                while (true) {
+                    while (buf.size() < TsSource::packet_size) {
+                        size_t size = socket.read_some(buf.prepare(16 * 1024), ec);
+                        if (ec)
+                            return (boost::uint32_t)-1;
+                        buf.commit(size);
+                    }
+                    memcpy(packet, boost::asio::buffer_cast<char const *>(buf.data()), sizeof(packet));
+                    buf.consume(sizeof(packet));
+                    if (TsSource::random_access(packet))
+                        return (boost::uint32_t)(now() - start).total_microseconds();
+                }
+            }
+
+            static void bench_gop(
+                char const * title,
+                bool shared,
+                Options const & options)
+            {
+                size_t clients = options.get<size_t>("clients", 20);
+                Upstream upstream(options.get<boost::uint32_t>("bitrate", 2000));
+                RelayHub hub(4 << 20, 256 << 20, 0);
+                Server server(upstream, shared ? &hub : NULL);
+                boost::asio::io_service io_svc;
+                // the channel is working
+                boost::shared_ptr<Request> request(new Request(io_svc, server.endpoint(),
+                    "/c", false, Request::done_func()));
+                request->start();
+                boost::thread thread(boost::bind(run_io, boost::ref(io_svc)));
+                boost::this_thread::sleep(boost::posix_time::seconds(3));
+                boost::minstd_rand rand(1);
+                std::vector<boost::uint32_t> ttff;
+                for (size_t i = 0; i < clients; ++i) {
+                    boost::this_thread::sleep(boost::posix_time::milliseconds(200 + rand() % 1000));
+                    ttff.push_back(first_frame(server.endpoint()));
+                }
+                std::sort(ttff.begin(), ttff.end());
+                printf("%-8s clients: %u  ttff p50: %.1fms  p99: %.1fms\n",
+                    title, (unsigned int)clients, percentile(ttff, 50) / 1000.0, percentile(ttff, 99) / 1000.0);
+                stop_io(io_svc, thread);
+            }
+
+            // hls
+
+            static void bench_hls(
+                char const * title,
+                bool hls,
+                Options const & options)
+            {
+                size_t clients = options.get<size_t>("clients", 100);
+                size_t duration = options.get<size_t>("duration", 30);
+                boost::uint32_t segment = options.get<boost::uint32_t>("hls_segment", 2000);
+                Upstream upstream(options.get<boost::uint32_t>("bitrate", 2000));
+                RelayHub hub(4 << 20, 256 << 20, 30000);
+                hub.set_hls(segment, options.get<size_t>("hls_window", 6));
+                Server server(upstream, &hub);
+                boost::asio::io_service io_svc;
+                std::vector<Viewer *> viewers;
+                if (hls) {
+                    // the first playlist asks for segments, wait them out
+                    boost::shared_ptr<Request> request(new Request(io_svc, server.endpoint(),
+                        "/c?hls", false, Request::done_func()));
+                    request->start();
+                    io_svc.run();
+                    io_svc.reset();
+                    boost::this_thread::sleep(boost::posix_time::milliseconds(segment * 2 + 1000));
+                    for (size_t i = 0; i < clients; ++i) {
+                        viewers.push_back(new Viewer(io_svc, server.endpoint(), segment / 2));
+                        viewers.back()->start();
+                    }
+                } else {
+                    for (size_t i = 0; i < clients; ++i) {
+                        boost::shared_ptr<Request> request(new Request(io_svc, server.endpoint(),
+                            "/c", false, Request::done_func()));
+                        request->start();
+                    }
+                }
+                boost::thread thread(boost::bind(run_io, boost::ref(io_svc)));
+                boost::this_thread::sleep(boost::posix_time::milliseconds(segment + 1000));
+                boost::uint64_t bytes = received;
+                boost::uint32_t errors0 = errors;
+                double cpu = cpu_seconds();
+                ptime start = now();
+                ptime end = start + boost::posix_time::seconds(duration);
+                size_t samples = 0;
+                size_t connections = 0;
+                while (now() < end) {
+                    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+                    connections += server.connections();
+                    ++samples;
+                }
+                bytes = received - bytes;
+                cpu = cpu_seconds() - cpu;
+                double seconds = (now() - start).total_microseconds() / 1000000.0;
+                printf("%-8s viewers: %u  connections: %.1f  mbps: %.1f  cpu: %.1f%%  cpu sec per viewer minute: %.5f  err: %u\n",
+                    title, (unsigned int)clients, samples ? (double)connections / samples : 0.0,
+                    bytes * 8 / 1000000.0 / seconds, cpu * 100 / seconds,
+                    cpu * 60 / seconds / clients, (unsigned int)(errors - errors0));
+                stop_io(io_svc, thread);
+                for (size_t i = 0; i < viewers.size(); ++i)
+                    delete viewers[i];
+            }
+
+            // runs func in a child process, waits for it
+            static void run(
+                boost::function<void ()> const & func)
+            {
+                fflush(stdout);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    func();
+                    fflush(stdout);
+                    _exit(0);
+                }
+                int status = 0;
+                waitpid(pid, &status, 0);
+            }
+
+        } // namespace bench
+    } // namespace live_worker
+} // namespace just
+
+int main(int argc, char * argv[])
+{
+    using namespace just::live_worker::bench;
+    Options options;
+    std::string name = argc > 1 ? argv[1] : "";
+    if (!options.parse(argc - 2, argv + 2) || (name != "index" && name != "ipc"
+        && name != "relay" && name != "gop" && name != "hls")) {
+        fprintf(stderr,
+            "usage: %s <index|ipc|relay|gop|hls> [--name=value ...]\n",
+            argv[0]);
+        return 1;
+    }
+    if (name == "index") {
+        run(boost::bind(bench_index<VectorIndex>, "before", boost::cref(options)));
+        run(boost::bind(bench_index<RidIndex>, "now", boost::cref(options)));
+    } else if (name == "ipc") {
+        run(boost::bind(bench_ipc_text, boost::cref(options)));
+        run(boost::bind(bench_ipc_framed, "framed", 1, boost::cref(options)));
+        run(boost::bind(bench_ipc_framed, "window", options.get<size_t>("window", 16), boost::cref(options)));
+    } else if (name == "relay") {
+        run(boost::bind(bench_relay, "before", false, boost::cref(options)));
+        run(boost::bind(bench_relay, "now", true, boost::cref(options)));
+    } else if (name == "gop") {
+        run(boost::bind(bench_gop, "before", false, boost::cref(options)));
+        run(boost::bind(bench_gop, "now", true, boost::cref(options)));
+    } else {
+        run(boost::bind(bench_hls, "before", false, boost::cref(options)));
+        run(boost::bind(bench_hls, "now", true, boost::cref(options)));
+    }
+    return 0;
+}
@@ -0,0 +1,7 @@
+// ManagerUnits.cpp
+
+// The keep policy of LiveManager and the messages of LiveModuleProxy, built
+// into live_bench from the worker sources, see RelayUnits.cpp
+
+#include "../../KeepPolicy.cpp"
+#include "../../ChildMessage.cpp"
@@ -0,0 +1,8 @@
+// RelayUnits.cpp
+
+// Relay and what it writes to, built into live_bench from the worker
+// sources; live_worker is a program, there is no library of it to link
+
+#include "../../Relay.cpp"
+#include "../../TimeShift.cpp"
+#include "../../HlsSegmenter.cpp"
@@ -0,0 +1,134 @@
+#!/bin/sh
+# bench.sh
+#
+# End to end runs of live_worker on live_mock under live_loadgen, for what
+# live_bench cannot show without the kernel, the daemon and child
+# processes. A case runs the worker twice, before and now, differing in
+# one config value or in the worker build, and prints the loadgen total
+# of each run:
+#   hot       all clients on one url, LiveManager.url_cache_size=0 and the
+#             default; rps, ttfb
+#   lag       channels starting slowly while warm ones are requested, the
+#             worker built BEFORE the kernel executor and WORKER; ttfb p99
+#             of warm requests is the loop lag clients see
+#   pool      cold starts, LiveModuleProxy.pool_min=0 and 8; ttfb
+#   place     LiveModuleProxy.cpu_policy=none and load; ttfb p99, mbps
+#   snapshot  a restart, LiveShards.snapshot_path unset and set; warm of
+#             each interval after the restart, "[check_steady]" of the log
+#   relay     LiveProxy.relay=0 and 1; mbps, err
+#   hls       LiveProxy.relay=1 with hls=0 and 1, loadgen hls=0 and 1, at
+#             rising clients; err, mbps
+# pool and place need a worker built with JUST_LIVE_WORKER_MULTI_PROCESS.
+#
+# Usage: bench.sh <case> [live_loadgen options]
+# Environment:
+#   WORKER   live_worker, default ./live_worker
+#   BEFORE   live_worker built before the change, for lag
+#   MOCK     live_mock library, default ./liblive_mock.so
+#   LOADGEN  live_loadgen, default ./live_loadgen
+#   PORT     default 9001
+#   OUT      logs and snapshot, default /tmp/live_bench
+
+WORKER=${WORKER:-./live_worker}
+MOCK=${MOCK:-./liblive_mock.so}
+LOADGEN=${LOADGEN:-./live_loadgen}
+PORT=${PORT:-9001}
+OUT=${OUT:-/tmp/live_bench}
+
+CASE=$1
+[ -n "$CASE" ] && shift
+mkdir -p "$OUT"
+
+# worker title [config ...], from binary in WORKER
+start_worker()
+{
+    title=$1
+    shift
+    "$WORKER" ++LiveProxy.addr=0.0.0.0:$PORT ++LiveModule.lib_path="$MOCK" \
+        ++framework.logger.Stream.0.file="$OUT/$title.log" "$@" > /dev/null 2>&1 &
+    WORKER_PID=$!
+    sleep 2
+}
+
+stop_worker()
+{
+    kill -INT $WORKER_PID
+    wait $WORKER_PID
+}
+
+# load title [loadgen options ...], total line only
+load()
+{
+    title=$1
+    shift
+    "$LOADGEN" --port=$PORT "$@" $LOADGEN_ARGS | grep '^total' | sed "s/^total/$title/"
+}
+
+# run title [config ...] -- [loadgen options ...]
+run()
+{
+    title=$1
+    shift
+    config=
+    while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+        config="$config $1"
+        shift
+    done
+    [ "$1" = "--" ] && shift
+    start_worker $title $config
+    load $title "$@"
+    stop_worker
+}
+
+LOADGEN_ARGS="$*"
+
+case "$CASE" in
+hot)
+    run before ++LiveManager.url_cache_size=0 -- --channels=1 --clients=200 --hold=0 --duration=30
+    run now -- --channels=1 --clients=200 --hold=0 --duration=30
+    ;;
+lag)
+    # a few hot channels stay warm, the long tail starts slowly
+    export LIVE_MOCK_START_DELAY=800
+    [ -z "$BEFORE" ] && { echo "BEFORE is not set" >&2; exit 1; }
+    (WORKER=$BEFORE; run before -- --channels=2000 --zipf=1.2 --duration=60 --warm_ms=50)
+    run now -- --channels=2000 --zipf=1.2 --duration=60 --warm_ms=50
+    ;;
+pool)
+    run before ++LiveModuleProxy.pool_min=0 -- --channels=5000 --zipf=0.5 --duration=60
+    run now ++LiveModuleProxy.pool_min=8 ++LiveModuleProxy.pool_max=32 -- --channels=5000 --zipf=0.5 --duration=60
+    ;;
+place)
+    export LIVE_MOCK_BITRATE=4000
+    run before ++LiveModuleProxy.cpu_policy=none -- --channels=200 --clients=1000 --duration=60
+    run now ++LiveModuleProxy.cpu_policy=load -- --channels=200 --clients=1000 --duration=60
+    ;;
+snapshot)
+    for snapshot in unset set; do
+        config=
+        [ $snapshot = set ] && config="++LiveShards.snapshot_path=$OUT/snapshot"
+        rm -f "$OUT/snapshot"
+        start_worker fill_$snapshot $config
+        load fill_$snapshot --duration=60
+        stop_worker
+        start_worker restart_$snapshot $config
+        "$LOADGEN" --port=$PORT --duration=60 --interval=5 $LOADGEN_ARGS | sed "s/^/$snapshot /"
+        stop_worker
+        grep '\[check_steady\]' "$OUT/restart_$snapshot.log" | sed "s/^/$snapshot /"
+    done
+    ;;
+relay)
+    run before ++LiveProxy.relay=0 -- --channels=10 --clients=1000 --duration=60
+    run now ++LiveProxy.relay=1 -- --channels=10 --clients=1000 --duration=60
+    ;;
+hls)
+    for clients in 500 1000 2000 4000; do
+        run before_$clients ++LiveProxy.relay=1 -- --channels=10 --clients=$clients --hold=600000 --duration=60
+        run now_$clients ++LiveProxy.relay=1 ++LiveProxy.hls=1 -- --channels=10 --clients=$clients --hold=600000 --duration=60 --hls=1
+    done
+    ;;
+*)
+    echo "usage: $0 <hot|lag|pool|place|snapshot|relay|hls> [live_loadgen options]" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,630 @@
+// LiveMock.cpp
+
+// A mock of the live kernel, for load testing live_worker without the
+// p2p network. It exports the same functions as the kernel library, so it
+// is loaded by setting LiveModule.lib_path to it, or linked instead of the
+// kernel when built with JUST_STATIC_BIND_LIVE_LIB.
+//
+// A started channel plays (UM_LIVEMSG_PLAY) after a start delay, or fails
+// with some probability, then serves a synthetic ts stream over http on
+// m_uMediaListenPort; a client joins it at the live frame, as with the
+// kernel, and waits for the next random access point. Tuned with
+// environment variables:
+//   LIVE_MOCK_START_DELAY  msec from start to play, default 500
+//   LIVE_MOCK_FAIL_RATE    percent of channels failing to start, default 0
+//   LIVE_MOCK_BITRATE      kbps of the ts stream, default 1000
+
+#include <live/Interface.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/bind.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace just
+{
+    namespace live_worker
+    {
+        namespace mock
+        {
+
+            static boost::uint32_t env_value(
+                char const * name,
+                boost::uint32_t def)
+            {
+                char const * value = getenv(name);
+                return value ? (boost::uint32_t)strtoul(value, NULL, 0) : def;
+            }
+
+            // CRC32 of MPEG-2 PSI sections
+            static boost::uint32_t psi_crc32(
+                boost::uint8_t const * data,
+                size_t size)
+            {
+                boost::uint32_t crc = 0xffffffff;
+                for (size_t i = 0; i < size; ++i) {
+                    crc ^= (boost::uint32_t)data[i] << 24;
+                    for (int k = 0; k < 8; ++k)
+                        crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+                }
+                return crc;
+            }
+
+            // Synthetic ts: PAT, PMT and one h264 video pid at 25 frames per
+            // second, with a random access point (PAT, PMT and IDR) each
+            // second. Payload is filler, only the ts/pes framing is real.
+            class TsSource
+            {
+            public:
+                static size_t const packet_size = 188;
+                static boost::uint16_t const pmt_pid = 0x1000;
+                static boost::uint16_t const video_pid = 0x0100;
+                static boost::uint32_t const frame_rate = 25;
+                static boost::uint32_t const gop_size = 25;
+
+            public:
+                TsSource(
+                    boost::uint32_t bitrate) // kbps
+                    : frame_packets_(bitrate * 1000 / 8 / packet_size / frame_rate)
+                    , frame_(0)
+                    , pat_cc_(0)
+                    , pmt_cc_(0)
+                    , video_cc_(0)
+                {
+                    if (frame_packets_ == 0)
+                        frame_packets_ = 1;
+                }
+
+            public:
+                // next frame is frame, of a stream started at frame 0
+                void seek(
+                    boost::uint64_t frame)
+                {
+                    frame_ = frame;
+                }
+
+                // append packets of next frame to buf
+                void next_frame(
+                    std::vector<boost::uint8_t> & buf)
+                {
+                    bool key = frame_ % gop_size == 0;
+                    if (key) {
+                        put_pat(buf);
+                        put_pmt(buf);
+                    }
+                    boost::uint64_t pts = 90000 + frame_ * 90000 / frame_rate;
+                    for (size_t i = 0; i < frame_packets_; ++i) {
+                        boost::uint8_t * p = put_packet(buf, video_pid, i == 0, video_cc_);
+                        size_t pos = 4;
+                        if (i == 0) {
+                            p[3] |= 0x20; // adaptation field
+                            p[4] = 7;
+                            p[5] = key ? 0x50 : 0x10; // random access, pcr
+                            put_pcr(p + 6, pts);
+                            pos = 12;
+                            static boost::uint8_t const pes[] = {
+                                0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0x80, 0x05};
+                            memcpy(p + pos, pes, sizeof(pes));
+                            pos += sizeof(pes);
+                            put_pts(p + pos, pts);
+                            pos += 5;
+                            // access unit delimiter, then slice nal
+                            static boost::uint8_t const idr[] = {
+                                0x00, 0x00, 0x00, 0x01, 0x09, 0xf0, 0x00, 0x00, 0x00, 0x01, 0x65};
+                            static boost::uint8_t const non_idr[] = {
+                                0x00, 0x00, 0x00, 0x01, 0x09, 0x30, 0x00, 0x00, 0x00, 0x01, 0x41};
+                            memcpy(p + pos, key ? idr : non_idr, sizeof(idr));
+                            pos += sizeof(idr);
+                        }
+                        memset(p + pos, 0xff, packet_size - pos);
+                    }
+                    ++frame_;
+                }
+
+            private:
+                static boost::uint8_t * put_packet(
+                    std::vector<boost::uint8_t> & buf,
+                    boost::uint16_t pid,
+                    bool unit_start,
+                    boost::uint8_t & cc)
+                {
+                    buf.resize(buf.size() + packet_size);
+                    boost::uint8_t * p = &buf[buf.size() - packet_size];
+                    p[0] = 0x47;
+                    p[1] = (unit_start ? 0x40 : 0x00) | ((pid >> 8) & 0x1f);
+                    p[2] = pid & 0xff;
+                    p[3] = 0x10 | (cc++ & 0x0f);
+                    return p;
+                }
+
+                static void put_section(
+                    boost::uint8_t * p,
+                    boost::uint8_t const * section,
+                    size_t size)
+                {
+                    p[4] = 0; // pointer field
+                    memcpy(p + 5, section, size);
+                    boost::uint32_t crc = psi_crc32(section, size);
+                    p[5 + size] = crc >> 24;
+                    p[6 + size] = crc >> 16;
+                    p[7 + size] = crc >> 8;
+                    p[8 + size] = crc;
+                    memset(p + 9 + size, 0xff, packet_size - 9 - size);
+                }
+
+                void put_pat(
+                    std::vector<boost::uint8_t> & buf)
+                {
+                    boost::uint8_t const section[] = {
+                        0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+                        0x00, 0x01, 0xe0 | (pmt_pid >> 8), pmt_pid & 0xff};
+                    put_section(put_packet(buf, 0, true, pat_cc_), section, sizeof(section));
+                }
+
+                void put_pmt(
+                    std::vector<boost::uint8_t> & buf)
+                {
+                    boost::uint8_t const section[] = {
+                        0x02, 0xb0, 0x12, 0x00, 0x01, 0xc1, 0x00, 0x00,
+                        0xe0 | (video_pid >> 8), video_pid & 0xff, 0xf0, 0x00,
+                        0x1b, 0xe0 | (video_pid >> 8), video_pid & 0xff, 0xf0, 0x00};
+                    put_section(put_packet(buf, pmt_pid, true, pmt_cc_), section, sizeof(section));
+                }
+
+                static void put_pcr(
+                    boost::uint8_t * p,
+                    boost::uint64_t base)
+                {
+                    p[0] = (boost::uint8_t)(base >> 25);
+                    p[1] = (boost::uint8_t)(base >> 17);
+                    p[2] = (boost::uint8_t)(base >> 9);
+                    p[3] = (boost::uint8_t)(base >> 1);
+                    p[4] = (boost::uint8_t)(((base & 1) << 7) | 0x7e);
+                    p[5] = 0;
+                }
+
+                static void put_pts(
+                    boost::uint8_t * p,
+                    boost::uint64_t pts)
+                {
+                    p[0] = (boost::uint8_t)(0x21 | ((pts >> 29) & 0x0e));
+                    p[1] = (boost::uint8_t)(pts >> 22);
+                    p[2] = (boost::uint8_t)(((pts >> 14) & 0xfe) | 1);
+                    p[3] = (boost::uint8_t)(pts >> 7);
+                    p[4] = (boost::uint8_t)(((pts << 1) & 0xfe) | 1);
+                }
+
+            private:
+                size_t frame_packets_;
+                boost::uint64_t frame_;
+                boost::uint8_t pat_cc_;
+                boost::uint8_t pmt_cc_;
+                boost::uint8_t video_cc_;
+            };
+
+            // one http client of a channel, sends a frame every 1/frame_rate second
+            class Session
+                : public boost::enable_shared_from_this<Session>
+            {
+            public:
+                Session(
+                    boost::asio::io_service & io_svc,
+                    boost::uint32_t bitrate,
+                    boost::posix_time::ptime const & play_time)
+                    : socket_(io_svc)
+                    , timer_(io_svc)
+                    , source_(bitrate)
+                    , play_time_(play_time)
+                {
+                }
+
+                boost::asio::ip::tcp::socket & socket()
+                {
+                    return socket_;
+                }
+
+                void start()
+                {
+                    boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+                        boost::bind(&Session::handle_request, shared_from_this(), _1));
+                }
+
+                void close()
+                {
+                    boost::system::error_code ec;
+                    socket_.close(ec);
+                    timer_.cancel(ec);
+                }
+
+            private:
+                void handle_request(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    static char const head[] =
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: video/mp2t\r\n"
+                        "Connection: close\r\n"
+                        "\r\n";
+                    buf_.assign(head, head + sizeof(head) - 1);
+                    source_.seek((boost::posix_time::microsec_clock::universal_time() 
+                        - play_time_).total_milliseconds() * TsSource::frame_rate / 1000);
+                    source_.next_frame(buf_);
+                    timer_.expires_from_now(boost::posix_time::milliseconds(0));
+                    boost::asio::async_write(socket_, boost::asio::buffer(buf_),
+                        boost::bind(&Session::handle_write, shared_from_this(), _1));
+                }
+
+                void handle_write(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    // keep the pace from the first frame, not from write completion
+                    timer_.expires_at(timer_.expires_at()
+                        + boost::posix_time::milliseconds(1000 / TsSource::frame_rate));
+                    timer_.async_wait(
+                        boost::bind(&Session::handle_timer, shared_from_this(), _1));
+                }
+
+                void handle_timer(
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    buf_.clear();
+                    source_.next_frame(buf_);
+                    boost::asio::async_write(socket_, boost::asio::buffer(buf_),
+                        boost::bind(&Session::handle_write, shared_from_this(), _1));
+                }
+
+            private:
+                boost::asio::ip::tcp::socket socket_;
+                boost::asio::deadline_timer timer_;
+                boost::asio::streambuf request_;
+                std::vector<boost::uint8_t> buf_;
+                TsSource source_;
+                boost::posix_time::ptime play_time_;
+            };
+
+            class Channel
+                : public boost::enable_shared_from_this<Channel>
+            {
+            public:
+                enum StatusEnum
+                {
+                    starting,
+                    playing,
+                    failed,
+                };
+
+            public:
+                Channel(
+                    boost::asio::io_service & io_svc,
+                    boost::uint32_t bitrate)
+                    : io_svc_(io_svc)
+                    , acceptor_(io_svc, boost::asio::ip::tcp::endpoint(
+                        boost::asio::ip::address_v4::loopback(), 0))
+                    , timer_(io_svc)
+                    , port_(acceptor_.local_endpoint().port())
+                    , bitrate_(bitrate)
+                    , status_(starting)
+                    , call_back_(NULL)
+                    , handle_(0)
+                    , notified_(false)
+                {
+                }
+
+            public:
+                boost::uint16_t port() const
+                {
+                    return port_;
+                }
+
+                boost::uint32_t bitrate() const
+                {
+                    return bitrate_;
+                }
+
+                StatusEnum status() const
+                {
+                    return status_;
+                }
+
+                void start(
+                    boost::uint32_t delay,
+                    bool fail)
+                {
+                    timer_.expires_from_now(boost::posix_time::milliseconds(delay));
+                    timer_.async_wait(
+                        boost::bind(&Channel::handle_start, shared_from_this(), fail, _1));
+                }
+
+                void set_call_back(
+                    FUNC_CallBack call_back,
+                    unsigned int handle)
+                {
+                    call_back_ = call_back;
+                    handle_ = handle;
+                    notify();
+                }
+
+                void close()
+                {
+                    boost::system::error_code ec;
+                    timer_.cancel(ec);
+                    acceptor_.close(ec);
+                    for (std::list<boost::weak_ptr<Session> >::iterator iter = sessions_.begin();
+                        iter != sessions_.end(); ++iter) {
+                        boost::shared_ptr<Session> session = iter->lock();
+                        if (session)
+                            session->close();
+                    }
+                    sessions_.clear();
+                    call_back_ = NULL;
+                }
+
+            private:
+                void handle_start(
+                    bool fail,
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    if (fail) {
+                        status_ = failed;
+                        boost::system::error_code ec1;
+                        acceptor_.close(ec1);
+                    } else {
+                        status_ = playing;
+                        play_time_ = boost::posix_time::microsec_clock::universal_time();
+                        accept();
+                    }
+                    notify();
+                }
+
+                // call back may be set before or after the start delay
+                void notify()
+                {
+                    if (notified_ || status_ == starting || call_back_ == NULL)
+                        return;
+                    notified_ = true;
+                    // LiveModule takes any message other than play as failure
+                    call_back_(handle_, status_ == playing ? UM_LIVEMSG_PLAY : UM_LIVEMSG_PLAY + 1, 0, 0);
+                }
+
+                void accept()
+                {
+                    boost::shared_ptr<Session> session(new Session(io_svc_, bitrate_, play_time_));
+                    acceptor_.async_accept(session->socket(),
+                        boost::bind(&Channel::handle_accept, shared_from_this(), session, _1));
+                }
+
+                void handle_accept(
+                    boost::shared_ptr<Session> session,
+                    boost::system::error_code const & ec)
+                {
+                    if (ec)
+                        return;
+                    std::list<boost::weak_ptr<Session> >::iterator iter = sessions_.begin();
+                    while (iter != sessions_.end()) {
+                        if (iter->expired())
+                            iter = sessions_.erase(iter);
+                        else
+                            ++iter;
+                    }
+                    sessions_.push_back(session);
+                    session->start();
+                    accept();
+                }
+
+            private:
+                boost::asio::io_service & io_svc_;
+                boost::asio::ip::tcp::acceptor acceptor_;
+                boost::asio::deadline_timer timer_;
+                boost::uint16_t const port_;
+                boost::uint32_t const bitrate_;
+                StatusEnum volatile status_; // written in mock thread, read by get status
+                FUNC_CallBack call_back_;
+                unsigned int handle_;
+                bool notified_;
+                boost::posix_time::ptime play_time_;
+                std::list<boost::weak_ptr<Session> > sessions_;
+            };
+
+            // all channel work runs in one mock thread
+            class Kernel
+            {
+            public:
+                Kernel()
+                    : work_(new boost::asio::io_service::work(io_svc_))
+                    , start_delay_(env_value("LIVE_MOCK_START_DELAY", 500))
+                    , fail_rate_(env_value("LIVE_MOCK_FAIL_RATE", 0))
+                    , bitrate_(env_value("LIVE_MOCK_BITRATE", 1000))
+                {
+                    thread_ = new boost::thread(
+                        boost::bind(&boost::asio::io_service::run, &io_svc_));
+                }
+
+                ~Kernel()
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    for (channels_t::iterator iter = channels_.begin(); iter != channels_.end(); ++iter)
+                        io_svc_.post(boost::bind(&Channel::close, iter->second));
+                    channels_.clear();
+                    lock.unlock();
+                    delete work_;
+                    thread_->join();
+                    delete thread_;
+                }
+
+            public:
+                Channel * start_channel()
+                {
+                    boost::shared_ptr<Channel> channel;
+                    try {
+                        channel.reset(new Channel(io_svc_, bitrate_));
+                    } catch (boost::system::system_error const &) {
+                        return NULL;
+                    }
+                    bool fail = (boost::uint32_t)(rand() % 100) < fail_rate_;
+                    io_svc_.post(boost::bind(&Channel::start, channel, start_delay_, fail));
+                    boost::mutex::scoped_lock lock(mutex_);
+                    channels_[channel.get()] = channel;
+                    return channel.get();
+                }
+
+                void stop_channel(
+                    void * handle)
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    channels_t::iterator iter = channels_.find(handle);
+                    if (iter == channels_.end())
+                        return;
+                    io_svc_.post(boost::bind(&Channel::close, iter->second));
+                    channels_.erase(iter);
+                }
+
+                boost::shared_ptr<Channel> find(
+                    void * handle)
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    channels_t::iterator iter = channels_.find(handle);
+                    return iter == channels_.end() ? boost::shared_ptr<Channel>() : iter->second;
+                }
+
+                void post_call_back(
+                    boost::shared_ptr<Channel> const & channel,
+                    FUNC_CallBack call_back,
+                    unsigned int handle)
+                {
+                    io_svc_.post(boost::bind(&Channel::set_call_back, channel, call_back, handle));
+                }
+
+            private:
+                typedef std::map<void *, boost::shared_ptr<Channel> > channels_t;
+
+                boost::asio::io_service io_svc_;
+                boost::asio::io_service::work * work_;
+                boost::thread * thread_;
+                boost::uint32_t start_delay_;
+                boost::uint32_t fail_rate_;
+                boost::uint32_t bitrate_;
+                boost::mutex mutex_;
+                channels_t channels_;
+            };
+
+            static Kernel * kernel = NULL;
+
+        } // namespace mock
+    } // namespace live_worker
+} // namespace just
+
+using just::live_worker::mock::kernel;
+using just::live_worker::mock::Kernel;
+using just::live_worker::mock::Channel;
+
+extern "C"
+{
+
+    bool LiveStartup(
+        int type)
+    {
+        if (kernel == NULL)
+            kernel = new Kernel;
+        return true;
+    }
+
+    void LiveCleanup()
+    {
+        delete kernel;
+        kernel = NULL;
+    }
+
+    void * LiveStartChannel(
+        const char * url,
+        int tcpPort,
+        int udpPort)
+    {
+        return kernel ? kernel->start_channel() : NULL;
+    }
+
+    void LiveStopChannel(
+        void * channel)
+    {
+        if (kernel)
+            kernel->stop_channel(channel);
+    }
+
+    bool LiveGetChannelStatus(
+        void * channel,
+        CCoreStatus * status)
+    {
+        boost::shared_ptr<Channel> ch = kernel ? kernel->find(channel) : boost::shared_ptr<Channel>();
+        if (!ch)
+            return false;
+        memset(status, 0, sizeof(*status));
+        status->m_uMediaListenPort = ch->port();
+        if (ch->status() == Channel::playing) {
+            status->m_BufferPercent = 100;
+            status->m_DownloadSpeed = ch->bitrate() * 1000 / 8;
+        }
+        return true;
+    }
+
+    bool LiveGetChannelParameter(
+        void * channel,
+        CCoreParameter * param)
+    {
+        return channel != NULL;
+    }
+
+    bool LiveSetChannelParameter(
+        void * channel,
+        const CCoreParameter * param)
+    {
+        return channel != NULL;
+    }
+
+    bool LiveSetChannelPlayerStatus(
+        void * channel,
+        int pstatus)
+    {
+        return channel != NULL;
+    }
+
+    bool LiveSetChannelCallback(
+        void * channel,
+        FUNC_CallBack callback,
+        unsigned int handle)
+    {
+        boost::shared_ptr<Channel> ch = kernel ? kernel->find(channel) : boost::shared_ptr<Channel>();
+        if (!ch)
+            return false;
+        kernel->post_call_back(ch, callback, handle);
+        return true;
+    }
+
+    bool LiveSetChannelUPNP(
+        void * channel,
+        const CCoreUPNP * param)
+    {
+        return channel != NULL;
+    }
+
+} // extern "C"